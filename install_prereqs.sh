@@ -27,7 +27,7 @@ case $DISTRO in
 		echo | add-apt-repository ppa:ubuntu-toolchain-r/test
 		apt-get update
 		apt-get install -y build-essential g++-4.8 libxml++2.6-dev libssl-dev \
-		libboost-all-dev libpng-dev libdwarf-dev subversion subversion-tools \
+		libboost-all-dev libpng-dev libopus-dev libdwarf-dev subversion subversion-tools \
 		autotools-dev autoconf libtool cmake
 		# replace old gcc/g++ with new one
 		rm /usr/bin/g++
@@ -50,11 +50,11 @@ case $DISTRO in
 	Fedora*)
 		echo 'Fedora detected.Installing required packages...'
 		yum install -y gcc-c++ autoconf automake libtool cmake svn svn2cl \
-		openssl-devel boost-devel libpng-devel elfutils-devel
+		openssl-devel boost-devel libpng-devel opus-devel elfutils-devel
 		;;
 	*SUSE*)
 		echo 'SUSE detected.Installing required packages...'
-		zypper --non-interactive install gcc-c++ make cmake openssl-devel zlib-devel boost-devel libpng-devel
+		zypper --non-interactive install gcc-c++ make cmake openssl-devel zlib-devel boost-devel libpng-devel libopus-devel
 		;;
 	Red\sHat\sEnterprise\sLinux\sServer*7*|CentOS*7*)
 		echo 'CentOS detected. Installing required packages...'
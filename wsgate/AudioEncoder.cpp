@@ -0,0 +1,230 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_OPUS
+
+#include <algorithm>
+#include <cstring>
+#include <opus.h>
+
+#include "AudioEncoder.hpp"
+#include "OpStream.hpp"
+
+namespace wsgate {
+
+    using namespace std;
+
+    // Maximum size of a single Opus packet
+    static const opus_int32 MAX_PACKET = 1276;
+
+    AudioEncoder::AudioEncoder(OpStream *ops)
+        : m_pOps(ops)
+          , m_lock()
+          , m_cond()
+          , m_pcm()
+          , m_nDropped(0)
+          , m_bThreadLoop(false)
+          , m_bStarted(false)
+          , m_worker()
+          , m_tmp()
+          , m_srcChannels(CHANNELS)
+          , m_step(1.0)
+          , m_phase(0.0)
+          , m_last()
+          , m_bEnabled(false)
+          , m_bitrate(START_BITRATE)
+          , m_histLock()
+          , m_sent()
+          , m_seq(0)
+          , m_minRtt(-1)
+    { }
+
+    AudioEncoder::~AudioEncoder()
+    {
+        if (m_bStarted) {
+            {
+                boost::mutex::scoped_lock lock(m_lock);
+                m_bThreadLoop = false;
+            }
+            m_cond.notify_one();
+            pthread_join(m_worker, NULL);
+            log::debug << "Audio encoder terminated, " << m_nDropped
+                << " samples dropped" << endl;
+        }
+    }
+
+    bool AudioEncoder::FormatSupported(uint32_t rate, uint16_t channels, uint16_t bits)
+    {
+        return (16 == bits) && (1 <= channels) && (CHANNELS >= channels) &&
+            (8000 <= rate) && (RATE >= static_cast<int>(rate));
+    }
+
+    void AudioEncoder::SetFormat(uint32_t rate, uint16_t channels)
+    {
+        log::debug << "Audio format " << rate << "Hz, " << channels << " channel(s)" << endl;
+        m_srcChannels = channels;
+        m_step = static_cast<double>(rate) / RATE;
+        m_phase = 0.0;
+        memset(m_last, 0, sizeof(m_last));
+        if (!m_bStarted) {
+            m_bThreadLoop = true;
+            if (0 != pthread_create(&m_worker, NULL, cbThreadFunc, reinterpret_cast<void *>(this))) {
+                m_bThreadLoop = false;
+                log::err << "Could not create audio encoder thread" << endl;
+                return;
+            }
+            m_bStarted = true;
+        }
+    }
+
+    void AudioEncoder::Play(const uint8_t *data, size_t len)
+    {
+        if (!m_bStarted || !m_bEnabled) {
+            return;
+        }
+        // Resample to 48kHz stereo (linear interpolation) without holding the lock.
+        size_t frames = len / (sizeof(int16_t) * m_srcChannels);
+        m_tmp.clear();
+        for (size_t i = 0; i < frames; ++i) {
+            int16_t cur[CHANNELS];
+            memcpy(cur, data + i * sizeof(int16_t) * m_srcChannels, sizeof(int16_t) * m_srcChannels);
+            if (1 == m_srcChannels) {
+                cur[1] = cur[0];
+            }
+            while (m_phase < 1.0) {
+                for (int c = 0; c < CHANNELS; ++c) {
+                    m_tmp.push_back(static_cast<int16_t>(m_last[c] + (cur[c] - m_last[c]) * m_phase));
+                }
+                m_phase += m_step;
+            }
+            m_phase -= 1.0;
+            memcpy(m_last, cur, sizeof(m_last));
+        }
+        {
+            boost::mutex::scoped_lock lock(m_lock);
+            m_pcm.insert(m_pcm.end(), m_tmp.begin(), m_tmp.end());
+            // Better skip some audio than lag behind the picture.
+            size_t max = RATE / 1000 * MAX_QUEUED * CHANNELS;
+            if (m_pcm.size() > max) {
+                size_t n = m_pcm.size() - max;
+                m_pcm.erase(m_pcm.begin(), m_pcm.begin() + n);
+                m_nDropped += n / CHANNELS;
+            }
+        }
+        m_cond.notify_one();
+    }
+
+    void AudioEncoder::OnFeedback(uint32_t seq, uint32_t age, uint32_t lost, uint32_t late)
+    {
+        if (!m_bEnabled.exchange(true)) {
+            log::debug << "Client accepts Opus audio" << endl;
+            return;
+        }
+        int64_t rtt = -1;
+        {
+            boost::mutex::scoped_lock lock(m_histLock);
+            if ((m_seq - seq - 1) < HISTORY) {
+                rtt = chrono::duration_cast<chrono::milliseconds>(
+                        clock::now() - m_sent[seq % HISTORY]).count() - age;
+            }
+        }
+        bool congested = (0 < lost) || (0 < late);
+        if (0 <= rtt) {
+            if ((0 > m_minRtt) || (rtt < m_minRtt)) {
+                m_minRtt = rtt;
+            }
+            // A growing round trip time means, that data is queueing up
+            // somewhere between us and the client.
+            congested = congested || (rtt > m_minRtt + QUEUE_DELAY);
+        }
+        int bitrate = m_bitrate;
+        if (congested) {
+            bitrate = max(MIN_BITRATE, bitrate * 3 / 4);
+        } else {
+            bitrate = min(MAX_BITRATE, bitrate + 8000);
+        }
+        if (bitrate != m_bitrate) {
+            log::debug << "Audio bitrate " << bitrate << " (rtt " << rtt << "ms, lost "
+                << lost << ", late " << late << ")" << endl;
+            m_bitrate = bitrate;
+        }
+    }
+
+    void AudioEncoder::ThreadFunc()
+    {
+        int err = OPUS_OK;
+        OpusEncoder *enc = opus_encoder_create(RATE, CHANNELS, OPUS_APPLICATION_AUDIO, &err);
+        if (OPUS_OK != err) {
+            log::err << "Could not create Opus encoder: " << opus_strerror(err) << endl;
+            return;
+        }
+        int bitrate = m_bitrate;
+        opus_encoder_ctl(enc, OPUS_SET_BITRATE(bitrate));
+        vector<int16_t> frame(FRAME * CHANNELS);
+        unsigned char pkt[MAX_PACKET];
+        uint32_t ts = 0;
+        for (;;) {
+            {
+                boost::mutex::scoped_lock lock(m_lock);
+                while (m_bThreadLoop && (m_pcm.size() < frame.size())) {
+                    m_cond.wait(lock);
+                }
+                if (!m_bThreadLoop) {
+                    break;
+                }
+                copy(m_pcm.begin(), m_pcm.begin() + frame.size(), frame.begin());
+                m_pcm.erase(m_pcm.begin(), m_pcm.begin() + frame.size());
+            }
+            if (bitrate != m_bitrate) {
+                bitrate = m_bitrate;
+                opus_encoder_ctl(enc, OPUS_SET_BITRATE(bitrate));
+            }
+            opus_int32 len = opus_encode(enc, &frame[0], FRAME, pkt, MAX_PACKET);
+            if (0 > len) {
+                log::warn << "Opus encoding failed: " << opus_strerror(len) << endl;
+                continue;
+            }
+            uint32_t seq;
+            {
+                boost::mutex::scoped_lock lock(m_histLock);
+                seq = m_seq++;
+                m_sent[seq % HISTORY] = clock::now();
+            }
+            m_pOps->Audio(seq, ts, pkt, len);
+            ts += FRAME;
+        }
+        opus_encoder_destroy(enc);
+    }
+
+    void *AudioEncoder::cbThreadFunc(void *ctx)
+    {
+        AudioEncoder *self = reinterpret_cast<AudioEncoder *>(ctx);
+        if (self) {
+            self->ThreadFunc();
+        }
+        return NULL;
+    }
+
+}
+
+#endif
@@ -0,0 +1,148 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_AUDIOENCODER_H_
+#define _WSGATE_AUDIOENCODER_H_
+
+#include <pthread.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "rdpcommon.hpp"
+
+namespace wsgate {
+
+    /**
+     * Transcodes the PCM audio of the rdpsnd channel into Opus packets
+     * and streams them to the client (op WSOP_SC_AUDIO).
+     * PCM is resampled to 48kHz stereo and queued by Play(), which
+     * never waits for the encoder. A dedicated thread encodes frames
+     * of FRAME samples and sends each packet with a sequence number
+     * and a timestamp, so that the client can run a jitter buffer.
+     * Nothing is sent, until the client announces its ability to
+     * decode Opus with its first feedback report. Subsequent reports
+     * drive the bitrate: It is reduced on loss, late packets or
+     * growing round trip times and slowly increased otherwise.
+     */
+    class AudioEncoder {
+
+        public:
+            /// Sample rate of the encoded stream.
+            static const int RATE = 48000;
+            /// Number of channels of the encoded stream.
+            static const int CHANNELS = 2;
+            /// Samples per channel and packet (20ms).
+            static const int FRAME = 960;
+            /// Maximum amount of queued PCM in milliseconds.
+            static const int MAX_QUEUED = 200;
+            /// Bitrate limits and start value in bits/s.
+            static const int MIN_BITRATE = 12000;
+            static const int MAX_BITRATE = 96000;
+            static const int START_BITRATE = 64000;
+
+            /**
+             * Constructs a new instance.
+             * The encoder thread is not started before the first SetFormat().
+             * @param ops The serializer for the audio packets.
+             */
+            AudioEncoder(OpStream *ops);
+
+            /// Destructor. Stops the encoder thread.
+            ~AudioEncoder();
+
+            /**
+             * Checks, whether a PCM format can be transcoded.
+             * @param rate The sample rate.
+             * @param channels The number of channels.
+             * @param bits The number of bits per sample.
+             * @return true, if the format is supported.
+             */
+            static bool FormatSupported(uint32_t rate, uint16_t channels, uint16_t bits);
+
+            /**
+             * Selects the format of subsequent PCM data.
+             * Must be invoked from the rdpsnd channel's thread only.
+             * @param rate The sample rate.
+             * @param channels The number of channels.
+             */
+            void SetFormat(uint32_t rate, uint16_t channels);
+
+            /**
+             * Queues PCM data for encoding.
+             * If the encoder falls behind, the oldest data is discarded.
+             * Must be invoked from the rdpsnd channel's thread only.
+             * @param data Interleaved 16bit samples.
+             * @param len The length of data in bytes.
+             */
+            void Play(const uint8_t *data, size_t len);
+
+            /**
+             * Handles a feedback report of the client.
+             * Must be invoked from the thread, delivering the WebSockets messages.
+             * @param seq The highest sequence number, received by the client.
+             * @param age The time in ms between receiving seq and sending the report.
+             * @param lost The number of packets lost since the last report.
+             * @param late The number of packets, which arrived too late for playback.
+             */
+            void OnFeedback(uint32_t seq, uint32_t age, uint32_t lost, uint32_t late);
+
+        private:
+            // Non-copyable
+            AudioEncoder(const AudioEncoder &);
+            AudioEncoder & operator=(const AudioEncoder &);
+
+            void ThreadFunc();
+            static void *cbThreadFunc(void *ctx);
+
+            typedef std::chrono::steady_clock clock;
+
+            OpStream *m_pOps;
+            boost::mutex m_lock;
+            boost::condition_variable m_cond;
+            // Resampled PCM, waiting for the encoder (guarded by m_lock)
+            std::vector<int16_t> m_pcm;
+            uint64_t m_nDropped;
+            bool m_bThreadLoop;
+            bool m_bStarted;
+            pthread_t m_worker;
+            // Resampler state (rdpsnd thread only)
+            std::vector<int16_t> m_tmp;
+            uint16_t m_srcChannels;
+            double m_step;
+            double m_phase;
+            int16_t m_last[CHANNELS];
+            // Set by the client's first feedback report
+            std::atomic<bool> m_bEnabled;
+            std::atomic<int> m_bitrate;
+            // Send times of recent packets, indexed by sequence number
+            static const uint32_t HISTORY = 256;
+            boost::mutex m_histLock;
+            clock::time_point m_sent[HISTORY];
+            uint32_t m_seq;
+            // Smallest round trip time seen so far
+            int64_t m_minRtt;
+            /// Round trip time increase in ms, which is considered congestion.
+            static const int QUEUE_DELAY = 100;
+    };
+}
+
+#endif
@@ -0,0 +1,238 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <cstring>
+#include <sstream>
+
+#include "ChannelRelay.hpp"
+#include "OpStream.hpp"
+
+#include <freerdp/svc.h>
+
+namespace wsgate {
+
+    using namespace std;
+
+    ChannelRelay::ChannelRelay(wspp::wshandler *h, OpStream *ops)
+        : m_wshandler(h)
+          , m_pOps(ops)
+          , m_names()
+          , m_window(0)
+          , m_maxPending(0)
+          , m_lock()
+          , m_channels()
+    { }
+
+    ChannelRelay::~ChannelRelay()
+    { }
+
+    void ChannelRelay::Configure(const WsChannelParams &params)
+    {
+        m_names = params.names;
+        m_window = params.window;
+        m_maxPending = params.maxpending;
+    }
+
+    void ChannelRelay::Register(rdpSettings *settings)
+    {
+        // The WebSocket thread may look up channels concurrently.
+        boost::mutex::scoped_lock lock(m_lock);
+        // After a failed attempt, the session connects a new instance.
+        m_channels.clear();
+        for (vector<string>::const_iterator it = m_names.begin(); it != m_names.end(); ++it) {
+            bool dup = false;
+            for (UINT32 i = 0; i < settings->ChannelCount; ++i) {
+                if (0 == strncmp(settings->ChannelDefArray[i].Name, it->c_str(), 8)) {
+                    dup = true;
+                    break;
+                }
+            }
+            if (dup) {
+                log::warn << "Channel " << *it << " is handled by FreeRDP, not relayed" << endl;
+                continue;
+            }
+            if (settings->ChannelCount >= settings->ChannelDefArraySize) {
+                log::warn << "Too many channels, " << *it << " not relayed" << endl;
+                continue;
+            }
+            rdpChannel *def = &settings->ChannelDefArray[settings->ChannelCount++];
+            memset(def, 0, sizeof(rdpChannel));
+            strncpy(def->Name, it->c_str(), 7);
+            def->options = CHANNEL_OPTION_INITIALIZED | CHANNEL_OPTION_ENCRYPT_RDP;
+            Channel c;
+            c.name = *it;
+            c.id = -1;
+            c.inflight = 0;
+            c.heldBytes = 0;
+            c.dropping = false;
+            c.outBytes = 0;
+            m_channels.push_back(c);
+        }
+    }
+
+    void ChannelRelay::Connected(rdpSettings *settings)
+    {
+        if (m_channels.empty()) {
+            return;
+        }
+        ostringstream oss;
+        oss << "V:" << m_window << ":" << m_maxPending << ":";
+        for (size_t n = 0; n < m_channels.size(); ++n) {
+            Channel &c = m_channels[n];
+            for (UINT32 i = 0; i < settings->ChannelCount; ++i) {
+                if (0 == strncmp(settings->ChannelDefArray[i].Name, c.name.c_str(), 8)) {
+                    c.id = settings->ChannelDefArray[i].ChannelId;
+                    break;
+                }
+            }
+            log::debug << "Relaying channel " << c.name << " (" << c.id << ")" << endl;
+            oss << (n ? "," : "") << c.name;
+        }
+        m_wshandler->send_text(oss.str());
+    }
+
+    bool ChannelRelay::OnServerData(int chId, const uint8_t *data, int size, int flags, int total)
+    {
+        size_t n;
+        for (n = 0; n < m_channels.size(); ++n) {
+            if (chId == m_channels[n].id) {
+                break;
+            }
+        }
+        if (n == m_channels.size()) {
+            return false;
+        }
+        Channel &c = m_channels[n];
+        if (flags & CHANNEL_FLAG_FIRST) {
+            c.dropping = (static_cast<size_t>(total) > m_maxPending);
+            if (c.dropping) {
+                log::warn << "Channel " << c.name << ": dropping message of "
+                    << total << " bytes" << endl;
+            }
+        }
+        if (c.dropping) {
+            return true;
+        }
+        boost::mutex::scoped_lock lock(m_lock);
+        if (c.held.empty() && (c.inflight + size <= m_window)) {
+            // The usual case: Forward the chunk without copying it.
+            c.inflight += size;
+            lock.unlock();
+            m_pOps->ChannelData(n, flags, total, data, size);
+        } else if (c.heldBytes + size <= m_maxPending) {
+            Chunk ch;
+            ch.flags = flags;
+            ch.total = total;
+            ch.data.assign(reinterpret_cast<const char *>(data), size);
+            c.held.push_back(ch);
+            c.heldBytes += size;
+        } else {
+            // The client does not keep up. It discards the partial
+            // message, when the next one starts.
+            log::warn << "Channel " << c.name << ": client too slow, dropping message" << endl;
+            c.dropping = true;
+        }
+        return true;
+    }
+
+    void ChannelRelay::OnClientData(const string &data)
+    {
+        // op, channel index, payload
+        if (data.length() < 8) {
+            return;
+        }
+        uint32_t chan;
+        memcpy(&chan, data.data() + 4, sizeof(chan));
+        boost::mutex::scoped_lock lock(m_lock);
+        if (chan >= m_channels.size()) {
+            return;
+        }
+        Channel &c = m_channels[chan];
+        size_t len = data.length() - 8;
+        if (len > m_maxPending) {
+            log::warn << "Channel " << c.name << ": message too large (" << len << " bytes)" << endl;
+            return;
+        }
+        if (c.outBytes + len > m_maxPending) {
+            log::warn << "Channel " << c.name << ": too much pending data, dropping "
+                << len << " bytes" << endl;
+            return;
+        }
+        c.out.push_back(data.substr(8));
+        c.outBytes += len;
+    }
+
+    void ChannelRelay::OnClientAck(uint32_t chan, uint32_t bytes)
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        if (chan >= m_channels.size()) {
+            return;
+        }
+        Channel &c = m_channels[chan];
+        c.inflight -= min(static_cast<size_t>(bytes), c.inflight);
+    }
+
+    void ChannelRelay::Process(freerdp *inst)
+    {
+        for (size_t n = 0; n < m_channels.size(); ++n) {
+            Channel &c = m_channels[n];
+            Chunk ch;
+            for (;;) {
+                {
+                    boost::mutex::scoped_lock lock(m_lock);
+                    if (c.held.empty() || (c.inflight + c.held.front().data.size() > m_window)) {
+                        break;
+                    }
+                    ch.flags = c.held.front().flags;
+                    ch.total = c.held.front().total;
+                    ch.data.swap(c.held.front().data);
+                    c.held.pop_front();
+                    c.heldBytes -= ch.data.size();
+                    c.inflight += ch.data.size();
+                }
+                m_pOps->ChannelData(n, ch.flags, ch.total,
+                        reinterpret_cast<const uint8_t *>(ch.data.data()), ch.data.size());
+            }
+            // Large uploads must not stall the session thread for too long.
+            size_t sent = 0;
+            string msg;
+            while (sent < BUDGET) {
+                {
+                    boost::mutex::scoped_lock lock(m_lock);
+                    if (c.out.empty()) {
+                        break;
+                    }
+                    msg.swap(c.out.front());
+                    c.out.pop_front();
+                    c.outBytes -= msg.size();
+                }
+                if ((0 < c.id) && !msg.empty()) {
+                    inst->SendChannelData(inst, c.id, reinterpret_cast<BYTE *>(&msg[0]), msg.size());
+                }
+                m_pOps->ChannelAck(n, msg.size());
+                sent += msg.size();
+            }
+        }
+    }
+
+}
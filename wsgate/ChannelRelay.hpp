@@ -0,0 +1,154 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_CHANNELRELAY_H_
+#define _WSGATE_CHANNELRELAY_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+#include "rdpcommon.hpp"
+
+namespace wsgate {
+
+    /**
+     * Relays static virtual channels between the RDP server and the client.
+     * The channels to relay are taken from the configuration and announced
+     * to the client as text message "V:<window>:<maxpending>:<name>,...".
+     * Afterwards, channels are referred to by their index in this list.
+     *
+     * Server to client: Each chunk, received from the RDP server, is
+     * forwarded as op WSOP_SC_VC_DATA, along with its first/last flags and
+     * the length of the whole message, leaving the reassembly to the client.
+     * At most window bytes per channel may be unacknowledged (WSOP_CS_VC_ACK).
+     * Beyond that, chunks are held back, until they exceed maxpending bytes.
+     * Then, the rest of the current message is discarded.
+     *
+     * Client to server: Each WSOP_CS_VC_DATA message carries a complete
+     * channel message, which is queued (up to maxpending bytes) and sent by
+     * the session thread. Once sent, it is acknowledged via WSOP_SC_VC_ACK.
+     */
+    class ChannelRelay {
+
+        public:
+            /// Maximum number of bytes, sent to the RDP server per invocation of Process().
+            static const size_t BUDGET = 65536;
+
+            /**
+             * Constructs a new instance.
+             * @param h A pointer to the corresponding wshandler object.
+             * @param ops The serializer for the channel ops.
+             */
+            ChannelRelay(wspp::wshandler *h, OpStream *ops);
+
+            /// Destructor.
+            ~ChannelRelay();
+
+            /**
+             * Selects the channels to relay.
+             * Must be invoked before the RDP session is started.
+             * @param params The channel parameters from the config file.
+             */
+            void Configure(const WsChannelParams &params);
+
+            /**
+             * Adds the channel definitions to the RDP settings.
+             * Channels, which are already handled by a FreeRDP plugin,
+             * are skipped. Must be invoked from PreConnect, after the
+             * plugins have been loaded.
+             * @param settings The RDP settings.
+             */
+            void Register(rdpSettings *settings);
+
+            /**
+             * Retrieves the channel IDs, assigned by the server and
+             * announces the channels to the client.
+             * Must be invoked from PostConnect.
+             * @param settings The RDP settings.
+             */
+            void Connected(rdpSettings *settings);
+
+            /**
+             * Handles a chunk, received from the RDP server.
+             * Must be invoked from the RDP session thread only.
+             * @return false, if the channel is not relayed.
+             */
+            bool OnServerData(int chId, const uint8_t *data, int size, int flags, int total);
+
+            /**
+             * Handles a WSOP_CS_VC_DATA message of the client.
+             * @param data The complete message, including the op header.
+             */
+            void OnClientData(const std::string &data);
+
+            /**
+             * Handles a WSOP_CS_VC_ACK message of the client.
+             * @param chan The index of the channel.
+             * @param bytes The number of bytes, consumed by the client.
+             */
+            void OnClientAck(uint32_t chan, uint32_t bytes);
+
+            /**
+             * Sends held back chunks to the client and queued messages
+             * to the RDP server.
+             * Must be invoked from the RDP session thread only.
+             * @param inst The FreeRDP instance.
+             */
+            void Process(freerdp *inst);
+
+        private:
+            // Non-copyable
+            ChannelRelay(const ChannelRelay &);
+            ChannelRelay & operator=(const ChannelRelay &);
+
+            typedef struct {
+                uint32_t flags;
+                uint32_t total;
+                std::string data;
+            } Chunk;
+
+            typedef struct {
+                std::string name;
+                int id;
+                // Server to client
+                size_t inflight;
+                std::deque<Chunk> held;
+                size_t heldBytes;
+                bool dropping;
+                // Client to server
+                std::deque<std::string> out;
+                size_t outBytes;
+            } Channel;
+
+            wspp::wshandler *m_wshandler;
+            OpStream *m_pOps;
+            std::vector<std::string> m_names;
+            size_t m_window;
+            size_t m_maxPending;
+            // Guards inflight, held and out of all channels, as well as
+            // the WebSocket thread's access to m_channels
+            boost::mutex m_lock;
+            // Changed by Register() only (session thread, under m_lock)
+            std::vector<Channel> m_channels;
+    };
+}
+
+#endif
@@ -0,0 +1,90 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "CursorCache.hpp"
+#include "wsgate.hpp"
+
+namespace wsgate {
+
+    using namespace std;
+
+    CursorCache::CursorCache(size_t capacity)
+        : m_capacity(capacity)
+          , m_sRoute()
+          , m_lock()
+          , m_lru()
+          , m_entries()
+          , m_nHits(0)
+          , m_nMisses(0)
+    { }
+
+    CursorCache::~CursorCache()
+    {
+        log::debug << "Cursor cache: " << m_entries.size() << " images, "
+            << m_nHits << " hits, " << m_nMisses << " misses" << endl;
+    }
+
+    CursorCache::image_ptr CursorCache::Find(const string &key)
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        EntryMap::iterator it = m_entries.find(key);
+        if (m_entries.end() == it) {
+            ++m_nMisses;
+            return image_ptr();
+        }
+        ++m_nHits;
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+        return it->second.image;
+    }
+
+    CursorCache::image_ptr CursorCache::Insert(const string &key, const string &image)
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        EntryMap::iterator it = m_entries.find(key);
+        if (m_entries.end() != it) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+            return it->second.image;
+        }
+        Entry e;
+        e.image.reset(new string(image));
+        e.lru = m_lru.insert(m_lru.begin(), key);
+        m_entries[key] = e;
+        Evict();
+        return e.image;
+    }
+
+    // private, m_lock must be held
+    void CursorCache::Evict()
+    {
+        LruList::iterator it = m_lru.end();
+        while ((m_entries.size() > m_capacity) && (m_lru.begin() != it)) {
+            --it;
+            EntryMap::iterator ei = m_entries.find(*it);
+            if (ei->second.image.unique()) {
+                m_entries.erase(ei);
+                it = m_lru.erase(it);
+            }
+        }
+    }
+
+}
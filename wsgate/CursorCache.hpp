@@ -0,0 +1,114 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_CURSORCACHE_H_
+#define _WSGATE_CURSORCACHE_H_
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace wsgate {
+
+    /**
+     * A process-wide cache of encoded cursor images, shared by all sessions.
+     * Images are addressed by a hash of the pointer's source data, so the
+     * few cursors, every Windows session uses, are encoded only once and
+     * can be served from immutable URLs (/cur/<key>).
+     * Images, which are still referenced by a session, are never evicted.
+     * Beyond that, the cache keeps at most capacity images, dropping the
+     * least recently used ones first.
+     * All methods are thread-safe.
+     */
+    class CursorCache {
+
+        public:
+            /// A shared, immutable cursor image (.cur format).
+            typedef boost::shared_ptr<const std::string> image_ptr;
+
+            /// Default number of cached images.
+            static const size_t DEFAULT_CAPACITY = 256;
+
+            /**
+             * Constructs a new instance.
+             * @param capacity The maximum number of unreferenced images.
+             */
+            CursorCache(size_t capacity = DEFAULT_CAPACITY);
+
+            /// Destructor.
+            ~CursorCache();
+
+            /**
+             * Looks up an image and marks it as recently used.
+             * @param key The content key of the image.
+             * @return The image or an empty pointer, if it is not cached.
+             */
+            image_ptr Find(const std::string &key);
+
+            /**
+             * Adds an image to the cache.
+             * If another session added the same key in the meantime,
+             * its image is kept.
+             * @param key The content key of the image.
+             * @param image The encoded image.
+             * @return The cached image.
+             */
+            image_ptr Insert(const std::string &key, const std::string &image);
+
+            /**
+             * Sets the prefix of the cursor URLs, sent to the clients.
+             * In a worker process (see Prefork), this tells the main
+             * process, which worker owns an image.
+             * Must be invoked before any session starts.
+             * @param route The prefix, e.g. "1234/2/" (pid of the main
+             *   process and worker number).
+             */
+            void SetRoute(const std::string &route) { m_sRoute = route; }
+
+            /// @return The prefix of the cursor URLs.
+            const std::string & GetRoute() const { return m_sRoute; }
+
+        private:
+            // Non-copyable
+            CursorCache(const CursorCache &);
+            CursorCache & operator=(const CursorCache &);
+
+            void Evict();
+
+            typedef std::list<std::string> LruList;
+            typedef struct {
+                image_ptr image;
+                LruList::iterator lru;
+            } Entry;
+            typedef std::map<std::string, Entry> EntryMap;
+
+            size_t m_capacity;
+            std::string m_sRoute;
+            boost::mutex m_lock;
+            // Most recently used first
+            LruList m_lru;
+            EntryMap m_entries;
+            uint64_t m_nHits;
+            uint64_t m_nMisses;
+    };
+}
+
+#endif
@@ -0,0 +1,767 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+#include "HostAcl.hpp"
+#include "btexception.hpp"
+#include "wsgate.hpp"
+
+namespace wsgate {
+
+    using namespace std;
+
+    enum {
+        MATCH_ALLOW = 1,
+        MATCH_DENY = 2
+    };
+
+    static int hexValue(char c)
+    {
+        if (isdigit(static_cast<unsigned char>(c))) {
+            return c - '0';
+        }
+        return tolower(static_cast<unsigned char>(c)) - 'a' + 10;
+    }
+
+    static int digitValue(char c, unsigned int base)
+    {
+        int val = isxdigit(static_cast<unsigned char>(c)) ? hexValue(c) : 99;
+        return (val < static_cast<int>(base)) ? val : -1;
+    }
+
+    /**
+     * Parses an IPv4 address.
+     * Unless strict, every form inet_aton() accepts (and so does the
+     * resolver, FreeRDP connects through) is recognized: One to four
+     * parts, each of them decimal, octal (leading 0) or hex (leading 0x),
+     * the last part filling the remaining bytes (e.g. 10.1 is 10.0.0.1).
+     * Otherwise, dotted decimal notation (as in IPv6 addresses) only.
+     */
+    static bool parseIPv4(const string &s, unsigned char *addr, bool strict)
+    {
+        unsigned long parts[4];
+        int n = 0;
+        size_t i = 0;
+        for (;;) {
+            if ((4 == n) || (i >= s.length())) {
+                return false;
+            }
+            unsigned int base = 10;
+            size_t start = i;
+            if (('0' == s[i]) && (i + 1 < s.length()) && ('.' != s[i + 1])) {
+                if (strict) {
+                    return false;
+                }
+                base = 8;
+                ++i;
+                if (('x' == s[i]) || ('X' == s[i])) {
+                    base = 16;
+                    ++i;
+                }
+                // 0 and 0x alone are valid as well.
+                start = string::npos;
+            }
+            unsigned long val = 0;
+            int d;
+            while ((i < s.length()) && (0 <= (d = digitValue(s[i], base)))) {
+                val = val * base + d;
+                if ((0xffffffffUL < val) || (strict && (3 == i - start))) {
+                    return false;
+                }
+                ++i;
+            }
+            if (start == i) {
+                return false;
+            }
+            parts[n++] = val;
+            if (i == s.length()) {
+                break;
+            }
+            if ('.' != s[i++]) {
+                return false;
+            }
+        }
+        if (strict && (4 != n)) {
+            return false;
+        }
+        unsigned long ip = 0;
+        for (int k = 0; k < n - 1; ++k) {
+            if (255 < parts[k]) {
+                return false;
+            }
+            ip |= parts[k] << (24 - 8 * k);
+        }
+        if ((0xffffffffUL >> (8 * (n - 1))) < parts[n - 1]) {
+            return false;
+        }
+        ip |= parts[n - 1];
+        for (int k = 0; k < 4; ++k) {
+            addr[k] = static_cast<unsigned char>(ip >> (24 - 8 * k));
+        }
+        return true;
+    }
+
+    static bool parseIPv6(const string &s, unsigned char *addr)
+    {
+        vector<unsigned int> head;
+        vector<unsigned int> tail;
+        vector<unsigned int> *groups = &head;
+        bool gap = false;
+        bool embedded = false;
+        unsigned char v4[4];
+        size_t i = 0;
+        if (0 == s.compare(0, 2, "::")) {
+            gap = true;
+            groups = &tail;
+            i = 2;
+        }
+        while (i < s.length()) {
+            size_t end = s.find(':', i);
+            string group(s.substr(i, (string::npos == end) ? string::npos : end - i));
+            if ((string::npos == end) && (string::npos != group.find('.'))) {
+                // Trailing IPv4 notation, e.g. ::ffff:10.0.0.1
+                if (!parseIPv4(group, v4, true)) {
+                    return false;
+                }
+                embedded = true;
+                break;
+            }
+            if (group.empty() || (4 < group.length())) {
+                return false;
+            }
+            unsigned int val = 0;
+            for (size_t j = 0; j < group.length(); ++j) {
+                if (!isxdigit(static_cast<unsigned char>(group[j]))) {
+                    return false;
+                }
+                val = (val << 4) | hexValue(group[j]);
+            }
+            groups->push_back(val);
+            if (string::npos == end) {
+                break;
+            }
+            i = end + 1;
+            if ((i < s.length()) && (':' == s[i])) {
+                if (gap) {
+                    return false;
+                }
+                gap = true;
+                groups = &tail;
+                ++i;
+            } else if (i == s.length()) {
+                return false;
+            }
+        }
+        size_t n = head.size() + tail.size() + (embedded ? 2 : 0);
+        if (gap ? (7 < n) : (8 != n)) {
+            return false;
+        }
+        memset(addr, 0, 16);
+        size_t pos = 0;
+        for (size_t j = 0; j < head.size(); ++j, pos += 2) {
+            addr[pos] = static_cast<unsigned char>(head[j] >> 8);
+            addr[pos + 1] = static_cast<unsigned char>(head[j]);
+        }
+        pos = 16 - 2 * tail.size() - (embedded ? 4 : 0);
+        for (size_t j = 0; j < tail.size(); ++j, pos += 2) {
+            addr[pos] = static_cast<unsigned char>(tail[j] >> 8);
+            addr[pos + 1] = static_cast<unsigned char>(tail[j]);
+        }
+        if (embedded) {
+            memcpy(addr + 12, v4, 4);
+        }
+        return true;
+    }
+
+    /**
+     * Parses a numeric IPv4 or IPv6 address (optionally in brackets).
+     * IPv4-mapped IPv6 addresses are returned as IPv4 address,
+     * the zone of a scoped IPv6 address is ignored.
+     * @return The number of address bits (32 or 128) or 0,
+     *   if s is not an IP address.
+     */
+    static int parseAddress(const string &s, unsigned char *addr)
+    {
+        if ((2 < s.length()) && ('[' == s[0]) && (']' == s[s.length() - 1])) {
+            return parseAddress(s.substr(1, s.length() - 2), addr);
+        }
+        // Host names are far more common, reject them cheaply.
+        if (s.empty() || (!isdigit(static_cast<unsigned char>(s[0])) && (string::npos == s.find(':')))) {
+            return 0;
+        }
+        if (parseIPv4(s, addr, false)) {
+            return 32;
+        }
+        if ((string::npos != s.find(':')) && parseIPv6(s.substr(0, s.find('%')), addr)) {
+            static const unsigned char mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+            if (0 == memcmp(addr, mapped, sizeof(mapped))) {
+                memmove(addr, addr + 12, 4);
+                return 32;
+            }
+            return 128;
+        }
+        return 0;
+    }
+
+    /**
+     * A binary trie of address prefixes. Every node, a prefix ends in,
+     * carries the MATCH_* flags of its rules.
+     */
+    class PrefixTrie {
+
+        public:
+            PrefixTrie()
+                : m_nodes(1)
+                  , m_nRules(0)
+            { }
+
+            void Insert(const unsigned char *addr, int bits, int flags)
+            {
+                size_t node = 0;
+                for (int i = 0; i < bits; ++i) {
+                    int bit = (addr[i / 8] >> (7 - i % 8)) & 1;
+                    if (0 == m_nodes[node].child[bit]) {
+                        m_nodes[node].child[bit] = m_nodes.size();
+                        m_nodes.push_back(Node());
+                    }
+                    node = m_nodes[node].child[bit];
+                }
+                m_nodes[node].flags |= flags;
+                ++m_nRules;
+            }
+
+            int Match(const unsigned char *addr, int bits) const
+            {
+                size_t node = 0;
+                int flags = m_nodes[0].flags;
+                for (int i = 0; i < bits; ++i) {
+                    node = m_nodes[node].child[(addr[i / 8] >> (7 - i % 8)) & 1];
+                    if (0 == node) {
+                        break;
+                    }
+                    flags |= m_nodes[node].flags;
+                }
+                return flags;
+            }
+
+            size_t Size() const
+            {
+                return m_nRules;
+            }
+
+        private:
+            struct Node {
+                // 0: No child (the root is nobody's child)
+                size_t child[2];
+                int flags;
+                Node() : flags(0) { child[0] = child[1] = 0; }
+            };
+
+            vector<Node> m_nodes;
+            size_t m_nRules;
+    };
+
+    /**
+     * All wildcard rules, merged into one automaton.
+     * Rules and host names are processed from right to left, because
+     * most rules share their domain and differ in the leading labels
+     * only (*.tenant.example.com).
+     * The rules form a trie (the NFA), in which a * becomes a node,
+     * which loops on any character. A DFA state is the set of NFA nodes,
+     * the input so far leads to. DFA states and their transitions are
+     * created on demand, so only the states, real host names run
+     * through, ever exist. Characters, which do not occur in any rule,
+     * share one column of the transition table.
+     */
+    class WildcardAutomaton {
+
+        public:
+            WildcardAutomaton()
+                : m_nfa(1)
+                  , m_repr(1, 0)
+                  , m_ids()
+                  , m_states()
+                  , m_flags()
+                  , m_trans()
+                  , m_entry()
+                  , m_start(0)
+                  , m_bDirty(true)
+                  , m_nRules(0)
+            {
+                memset(m_class, 0, sizeof(m_class));
+            }
+
+            void Insert(const string &pattern, int flags)
+            {
+                size_t node = 0;
+                for (size_t i = pattern.length(); 0 < i--; ) {
+                    unsigned char c = static_cast<unsigned char>(tolower(static_cast<unsigned char>(pattern[i])));
+                    size_t next;
+                    if ('*' == c) {
+                        if (m_nfa[node].loop) {
+                            // ** is the same as *
+                            continue;
+                        }
+                        next = m_nfa[node].star;
+                    } else if ('?' == c) {
+                        next = m_nfa[node].any;
+                    } else {
+                        if (0 == m_class[c]) {
+                            m_class[c] = static_cast<unsigned short>(m_repr.size());
+                            m_repr.push_back(c);
+                        }
+                        next = m_nfa[node].Next(c);
+                    }
+                    if (0 == next) {
+                        next = m_nfa.size();
+                        m_nfa.push_back(Node());
+                        if ('*' == c) {
+                            m_nfa[next].loop = true;
+                            m_nfa[node].star = next;
+                        } else if ('?' == c) {
+                            m_nfa[node].any = next;
+                        } else {
+                            m_nfa[node].SetNext(c, next);
+                        }
+                    }
+                    node = next;
+                }
+                m_nfa[node].flags |= flags;
+                ++m_nRules;
+                m_bDirty = true;
+            }
+
+            /**
+             * @param host The destination in lower case.
+             * @return The MATCH_* flags of the matching rules.
+             */
+            int Match(const string &host)
+            {
+                if (m_bDirty) {
+                    Reset();
+                }
+                int cur = m_start;
+                for (size_t i = host.length(); 0 < i--; ) {
+                    unsigned char c = static_cast<unsigned char>(host[i]);
+                    if (0 > cur) {
+                        // A plain trie node: Just follow the edge.
+                        size_t next = m_nfa[-cur - 2].Next(c);
+                        if (0 == next) {
+                            return 0;
+                        }
+                        if (Plain(next)) {
+                            cur = -static_cast<int>(next) - 2;
+                        } else {
+                            if (-1 == m_entry[next]) {
+                                StateSet set(1, next);
+                                Close(set);
+                                int state = Encode(set);
+                                m_entry[next] = state;
+                            }
+                            cur = m_entry[next];
+                        }
+                        continue;
+                    }
+                    if (DEAD == cur) {
+                        // Nothing can match anymore
+                        return 0;
+                    }
+                    size_t cls = m_class[c];
+                    int next = m_trans[cur * m_repr.size() + cls];
+                    if (-1 == next) {
+                        StateSet set(Step(m_states[cur], m_repr[cls]));
+                        size_t states = m_states.size();
+                        next = Encode(set);
+                        // Unless the DFA has been reset meanwhile
+                        if (states <= m_states.size()) {
+                            m_trans[cur * m_repr.size() + cls] = next;
+                        }
+                    }
+                    cur = next;
+                }
+                return (0 > cur) ? m_nfa[-cur - 2].flags : m_flags[cur];
+            }
+
+            size_t Size() const
+            {
+                return m_nRules;
+            }
+
+        private:
+            typedef vector<size_t> StateSet;
+
+            // The empty set, always the first DFA state
+            static const int DEAD = 0;
+
+            struct Node {
+                // Sorted by character, most nodes have a single edge
+                vector<pair<unsigned char, size_t> > edges;
+                size_t any;
+                size_t star;
+                bool loop;
+                int flags;
+                Node() : edges(), any(0), star(0), loop(false), flags(0) { }
+
+                size_t Next(unsigned char c) const
+                {
+                    vector<pair<unsigned char, size_t> >::const_iterator it =
+                        lower_bound(edges.begin(), edges.end(), make_pair(c, static_cast<size_t>(0)));
+                    return ((edges.end() != it) && (c == it->first)) ? it->second : 0;
+                }
+
+                void SetNext(unsigned char c, size_t node)
+                {
+                    edges.insert(lower_bound(edges.begin(), edges.end(), make_pair(c, static_cast<size_t>(0))),
+                            make_pair(c, node));
+                }
+            };
+
+            void Close(StateSet &set) const
+            {
+                // A * matches the empty string as well.
+                for (size_t i = 0; i < set.size(); ++i) {
+                    if (0 != m_nfa[set[i]].star) {
+                        set.push_back(m_nfa[set[i]].star);
+                    }
+                }
+                sort(set.begin(), set.end());
+                set.erase(unique(set.begin(), set.end()), set.end());
+            }
+
+            StateSet Step(const StateSet &from, unsigned char c) const
+            {
+                StateSet to;
+                for (StateSet::const_iterator it = from.begin(); it != from.end(); ++it) {
+                    const Node &n = m_nfa[*it];
+                    size_t next = n.Next(c);
+                    if (0 != next) {
+                        to.push_back(next);
+                    }
+                    if (0 != n.any) {
+                        to.push_back(n.any);
+                    }
+                    if (n.loop) {
+                        to.push_back(*it);
+                    }
+                }
+                Close(to);
+                return to;
+            }
+
+            bool Plain(size_t node) const
+            {
+                return !m_nfa[node].loop && (0 == m_nfa[node].any) && (0 == m_nfa[node].star);
+            }
+
+            /**
+             * @return The DFA state of set or -(node + 2), if set is
+             *   a single plain trie node. Those need no DFA state, so the
+             *   DFA does not duplicate the (large) deterministic parts
+             *   of the trie.
+             */
+            int Encode(const StateSet &set)
+            {
+                if ((1 == set.size()) && Plain(set[0])) {
+                    return -static_cast<int>(set[0]) - 2;
+                }
+                if (HostAcl::MAX_STATES <= m_states.size()) {
+                    Reset();
+                }
+                return static_cast<int>(Add(set));
+            }
+
+            size_t Add(const StateSet &set)
+            {
+                map<StateSet, size_t>::const_iterator it = m_ids.find(set);
+                if (m_ids.end() != it) {
+                    return it->second;
+                }
+                size_t id = m_states.size();
+                int flags = 0;
+                for (StateSet::const_iterator sit = set.begin(); sit != set.end(); ++sit) {
+                    flags |= m_nfa[*sit].flags;
+                }
+                m_ids[set] = id;
+                m_states.push_back(set);
+                m_flags.push_back(flags);
+                m_trans.resize(m_trans.size() + m_repr.size(), -1);
+                return id;
+            }
+
+            void Reset()
+            {
+                m_ids.clear();
+                m_states.clear();
+                m_flags.clear();
+                m_trans.clear();
+                m_entry.assign(m_nfa.size(), -1);
+                m_bDirty = false;
+                Add(StateSet());
+                StateSet start(1, 0);
+                Close(start);
+                m_start = Encode(start);
+            }
+
+            vector<Node> m_nfa;
+            // Column of each character, 0: Not used by any rule
+            unsigned short m_class[256];
+            // A character of each column
+            vector<unsigned char> m_repr;
+            map<StateSet, size_t> m_ids;
+            vector<StateSet> m_states;
+            vector<int> m_flags;
+            // One row per DFA state, -1: Not computed yet
+            vector<int> m_trans;
+            // DFA state of each trie node, entered from a plain node
+            vector<int> m_entry;
+            int m_start;
+            bool m_bDirty;
+            size_t m_nRules;
+    };
+
+    class HostAcl::Rules {
+
+        public:
+            Rules(bool denyAllow)
+                : m_bDenyAllow(denyAllow)
+                  , m_v4()
+                  , m_v6()
+                  , m_names()
+                  , m_decisions()
+                  , m_nDenyNetworks(0)
+            { }
+
+            void Add(const string &rule, int flags)
+            {
+                string r(boost::trim_copy(rule));
+                if (r.empty()) {
+                    return;
+                }
+                unsigned char addr[16];
+                size_t slash = r.find('/');
+                if (string::npos != slash) {
+                    int bits = parseAddress(r.substr(0, slash), addr);
+                    int len = -1;
+                    try {
+                        len = boost::lexical_cast<int>(r.substr(slash + 1));
+                    } catch (const boost::bad_lexical_cast &) {
+                    }
+                    if ((0 == bits) || (0 > len) || (bits < len)) {
+                        throw tracing::invalid_argument("Invalid acl entry " + r);
+                    }
+                    ((32 == bits) ? m_v4 : m_v6).Insert(addr, len, flags);
+                    m_nDenyNetworks += (MATCH_DENY == flags) ? 1 : 0;
+                    return;
+                }
+                if (string::npos == r.find_first_of("*?")) {
+                    int bits = parseAddress(r, addr);
+                    if (0 != bits) {
+                        ((32 == bits) ? m_v4 : m_v6).Insert(addr, bits, flags);
+                        m_nDenyNetworks += (MATCH_DENY == flags) ? 1 : 0;
+                        return;
+                    }
+                }
+                m_names.Insert(r, flags);
+            }
+
+            bool IsAllowed(const string &host)
+            {
+                unordered_map<string, bool>::const_iterator it = m_decisions.find(host);
+                if (m_decisions.end() != it) {
+                    return it->second;
+                }
+                int flags = m_names.Match(host);
+                unsigned char addr[16];
+                int bits = parseAddress(host, addr);
+                if (0 != bits) {
+                    flags |= MatchAddress(addr, bits);
+                }
+                bool allowed = Decide(flags);
+                if (MAX_DECISIONS <= m_decisions.size()) {
+                    m_decisions.clear();
+                }
+                m_decisions[host] = allowed;
+                return allowed;
+            }
+
+            /**
+             * @return true, if host is a name, whose addresses matter.
+             */
+            bool Resolves(const string &host) const
+            {
+                unsigned char addr[16];
+                return (0 < Networks()) && (0 == parseAddress(host, addr));
+            }
+
+            int MatchNames(const string &host)
+            {
+                return m_names.Match(host);
+            }
+
+            // The tries are not modified after compiling,
+            // so no lock is needed for the following.
+
+            int MatchAddress(const unsigned char *addr, int bits) const
+            {
+                return (32 == bits) ? m_v4.Match(addr, 32) : m_v6.Match(addr, 128);
+            }
+
+            bool Decide(int flags) const
+            {
+                return m_bDenyAllow ?
+                    (!(flags & MATCH_DENY) || (flags & MATCH_ALLOW)) :
+                    ((flags & MATCH_ALLOW) && !(flags & MATCH_DENY));
+            }
+
+            /**
+             * Decides on a name, which could not be resolved: It might
+             * resolve to a denied address later on.
+             */
+            bool DecideUnresolved(int flags) const
+            {
+                return (0 == m_nDenyNetworks) && Decide(flags);
+            }
+
+            size_t Networks() const
+            {
+                return m_v4.Size() + m_v6.Size();
+            }
+
+            size_t Wildcards() const
+            {
+                return m_names.Size();
+            }
+
+        private:
+            bool m_bDenyAllow;
+            PrefixTrie m_v4;
+            PrefixTrie m_v6;
+            WildcardAutomaton m_names;
+            unordered_map<string, bool> m_decisions;
+            size_t m_nDenyNetworks;
+    };
+
+    HostAcl::HostAcl()
+        : m_lock()
+          , m_rules(new Rules(true))
+    { }
+
+    HostAcl::~HostAcl()
+    { }
+
+    void HostAcl::Compile(bool denyAllow, const vector<string> &allow, const vector<string> &deny)
+    {
+        boost::shared_ptr<Rules> rules(new Rules(denyAllow));
+        for (vector<string>::const_iterator it = allow.begin(); it != allow.end(); ++it) {
+            rules->Add(*it, MATCH_ALLOW);
+        }
+        for (vector<string>::const_iterator it = deny.begin(); it != deny.end(); ++it) {
+            rules->Add(*it, MATCH_DENY);
+        }
+        log::debug << "ACL: " << allow.size() + deny.size() << " rule(s), "
+            << rules->Networks() << " network(s), " << rules->Wildcards() << " wildcard(s)" << endl;
+        boost::mutex::scoped_lock lock(m_lock);
+        m_rules.swap(rules);
+    }
+
+    bool HostAcl::IsAllowed(const string &host)
+    {
+        string address;
+        return IsAllowed(host, address);
+    }
+
+    bool HostAcl::IsAllowed(const string &host, string &address)
+    {
+        address = host;
+        // Not boost::to_lower_copy, its locale lookups dominate a cache hit.
+        string h(host);
+        for (string::iterator it = h.begin(); it != h.end(); ++it) {
+            unsigned char c = static_cast<unsigned char>(*it);
+            // Nothing else occurs in host names or addresses. The resolver
+            // might ignore anything after e.g. a blank.
+            if (!isalnum(c) && (0 == c || !strchr(".-_:[]%", c))) {
+                return false;
+            }
+            *it = static_cast<char>(tolower(c));
+        }
+        // host.example.com. is the same as host.example.com
+        if ((1 < h.length()) && ('.' == h[h.length() - 1])) {
+            h.erase(h.length() - 1);
+        }
+        boost::shared_ptr<Rules> rules;
+        int flags;
+        {
+            boost::mutex::scoped_lock lock(m_lock);
+            if (!m_rules->Resolves(h)) {
+                return m_rules->IsAllowed(h);
+            }
+            rules = m_rules;
+            flags = rules->MatchNames(h);
+        }
+        // Resolve without holding the lock, it may take a while.
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *res = NULL;
+        int err = getaddrinfo(h.c_str(), NULL, &hints, &res);
+        if (0 != err) {
+            log::debug << "ACL: Could not resolve " << h << ": " << gai_strerror(err) << endl;
+            return rules->DecideUnresolved(flags);
+        }
+        bool allowed = true;
+        bool resolved = false;
+        for (struct addrinfo *ai = res; allowed && ai; ai = ai->ai_next) {
+            char numeric[NI_MAXHOST];
+            unsigned char addr[16];
+            if (0 != getnameinfo(ai->ai_addr, ai->ai_addrlen, numeric, sizeof(numeric),
+                        NULL, 0, NI_NUMERICHOST)) {
+                continue;
+            }
+            int bits = parseAddress(numeric, addr);
+            if (0 == bits) {
+                continue;
+            }
+            allowed = rules->Decide(flags | rules->MatchAddress(addr, bits));
+            if (!resolved) {
+                address = numeric;
+                resolved = true;
+            }
+        }
+        freeaddrinfo(res);
+        if (!resolved) {
+            address = host;
+            return rules->DecideUnresolved(flags);
+        }
+        return allowed;
+    }
+
+}
@@ -0,0 +1,108 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_HOSTACL_H_
+#define _WSGATE_HOSTACL_H_
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace wsgate {
+
+    /**
+     * The compiled destination ACL (section [acl]).
+     * A rule is either an IP address or network in CIDR notation, or
+     * a host name wildcard (* and ?, case-insensitive). Addresses are
+     * kept in a binary prefix trie per address family, all wildcards
+     * are merged into a single automaton, which is turned into a DFA
+     * lazily while matching. So a check costs one trie walk and one
+     * table lookup per character, no matter how many rules there are.
+     * On top of that, decisions are cached per destination.
+     * IP addresses may be given in any notation the resolver accepts
+     * (e.g. 10.1 or 0x0a000001). If there are address rules, host names
+     * are resolved and every address of a name must be allowed, along
+     * with the name itself. Names, which can't be resolved, are denied
+     * then, if there are address deny rules. Decisions on names, which involve
+     * the resolver, are not cached.
+     * All methods are thread-safe.
+     */
+    class HostAcl {
+
+        public:
+            /// Maximum number of cached decisions.
+            static const size_t MAX_DECISIONS = 4096;
+            /// Maximum number of DFA states, before the DFA is rebuilt.
+            static const size_t MAX_STATES = 16384;
+
+            /**
+             * Constructs a new instance, which allows everything.
+             */
+            HostAcl();
+
+            /// Destructor.
+            ~HostAcl();
+
+            /**
+             * Replaces the rules.
+             * Throws tracing::invalid_argument on an invalid rule. In this
+             * case, the previous rules stay in effect.
+             * @param denyAllow true for the order deny,allow,
+             *   false for allow,deny.
+             * @param allow The allow rules.
+             * @param deny The deny rules.
+             */
+            void Compile(bool denyAllow, const std::vector<std::string> &allow,
+                    const std::vector<std::string> &deny);
+
+            /**
+             * Checks a destination.
+             * Destinations with characters, which can't occur in a host
+             * name or IP address, are denied.
+             * @param host The host name or IP address of the destination.
+             * @param address Receives the address to connect to: The first
+             *   address of a resolved name, host otherwise. Connecting
+             *   there instead of resolving host again ensures, that the
+             *   checked address is used.
+             * @return true, if connecting to host is allowed.
+             */
+            bool IsAllowed(const std::string &host, std::string &address);
+
+            /**
+             * Checks a destination.
+             * @param host The host name or IP address of the destination.
+             * @return true, if connecting to host is allowed.
+             */
+            bool IsAllowed(const std::string &host);
+
+        private:
+            // Non-copyable
+            HostAcl(const HostAcl &);
+            HostAcl & operator=(const HostAcl &);
+
+            class Rules;
+
+            boost::mutex m_lock;
+            boost::shared_ptr<Rules> m_rules;
+    };
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_INPUTQUEUE_H_
+#define _WSGATE_INPUTQUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+namespace wsgate {
+
+    /**
+     * A single input event, to be injected into the RDP session.
+     */
+    typedef struct {
+        /// One of InputQueue::Type
+        uint16_t type;
+        /// Keyboard or pointer flags as defined by the FreeRDP API.
+        uint16_t flags;
+        /// The x coordinate or the key code.
+        uint16_t x;
+        /// The y coordinate (pointer events only).
+        uint16_t y;
+    } InputEvent;
+
+    /**
+     * A lock-free single producer, single consumer ring buffer
+     * for input events.
+     * The producer is the thread, delivering the WebSockets messages
+     * of a session, the consumer is the RDP session thread, which is
+     * the only thread allowed to call into the FreeRDP input API.
+     */
+    class InputQueue {
+
+        public:
+            /// Event types.
+            typedef enum {
+                INPUT_MOUSE,
+                INPUT_KEYBOARD,
+                INPUT_UNICODE,
+                /// Marker for the next text of the TextInjector.
+                INPUT_TEXT,
+                /// The client's page became hidden (flags 0) or visible (flags 1).
+                INPUT_VISIBILITY,
+                /// The client requests a new desktop size (x, y).
+                INPUT_RESIZE
+            } Type;
+
+            /// Number of slots, must be a power of 2.
+            static const size_t CAPACITY = 4096;
+
+            InputQueue()
+                : m_head(0)
+                  , m_tail(0)
+            { }
+
+            /**
+             * Appends an event (producer side).
+             * @param ev The event to append.
+             * @return false, if the queue is full.
+             */
+            bool Push(const InputEvent &ev) {
+                size_t tail = m_tail.load(std::memory_order_relaxed);
+                if (tail - m_head.load(std::memory_order_acquire) >= CAPACITY) {
+                    return false;
+                }
+                m_ring[tail & (CAPACITY - 1)] = ev;
+                m_tail.store(tail + 1, std::memory_order_release);
+                return true;
+            }
+
+            /**
+             * Removes up to max events (consumer side).
+             * @param out The destination array.
+             * @param max The size of the destination array.
+             * @return The number of events removed.
+             */
+            size_t Pop(InputEvent *out, size_t max) {
+                size_t head = m_head.load(std::memory_order_relaxed);
+                size_t n = m_tail.load(std::memory_order_acquire) - head;
+                if (n > max) {
+                    n = max;
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    out[i] = m_ring[(head + i) & (CAPACITY - 1)];
+                }
+                m_head.store(head + n, std::memory_order_release);
+                return n;
+            }
+
+        private:
+            // Non-copyable
+            InputQueue(const InputQueue &);
+            InputQueue & operator=(const InputQueue &);
+
+            // Producer and consumer indices live on separate cache lines.
+            alignas(64) std::atomic<size_t> m_head;
+            alignas(64) std::atomic<size_t> m_tail;
+            InputEvent m_ring[CAPACITY];
+    };
+}
+
+#endif
@@ -0,0 +1,269 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+#include "ListenSockets.hpp"
+#include "wsgate.hpp"
+
+extern char **environ;
+
+namespace wsgate {
+
+    using namespace std;
+
+    static boost::mutex g_lock;
+    static vector<int> g_inherited;
+    static vector<int> g_exported;
+    static string g_exe;
+    // Read end of the successor's readiness pipe (old process)
+    static int g_successorFd = -1;
+    // Write end of the predecessor's readiness pipe (new process)
+    static int g_readyFd = -1;
+
+    /// Environment variable, carrying the write end of the readiness pipe.
+    static const char READY_ENV[] = "WSGATE_READY_FD";
+
+    static bool isListenEnv(const char *var)
+    {
+        return (0 == strncmp(var, "LISTEN_PID=", 11)) ||
+            (0 == strncmp(var, "LISTEN_FDS=", 11)) ||
+            (0 == strncmp(var, "LISTEN_FDNAMES=", 15)) ||
+            ((0 == strncmp(var, READY_ENV, sizeof(READY_ENV) - 1)) && ('=' == var[sizeof(READY_ENV) - 1]));
+    }
+
+    void ListenSockets::Init()
+    {
+        // Later on, /proc/self/exe would refer to the replaced binary.
+        char exe[PATH_MAX];
+        ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (0 < len) {
+            g_exe.assign(exe, len);
+        }
+        const char *pid = getenv("LISTEN_PID");
+        const char *fds = getenv("LISTEN_FDS");
+        if (pid && fds && (atol(pid) == getpid())) {
+            int n = atoi(fds);
+            for (int fd = FIRST_FD; fd < FIRST_FD + n; ++fd) {
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                g_inherited.push_back(fd);
+            }
+            const char *ready = getenv(READY_ENV);
+            if (ready) {
+                g_readyFd = atoi(ready);
+                fcntl(g_readyFd, F_SETFD, FD_CLOEXEC);
+            }
+        }
+        unsetenv("LISTEN_PID");
+        unsetenv("LISTEN_FDS");
+        unsetenv("LISTEN_FDNAMES");
+        unsetenv(READY_ENV);
+    }
+
+    bool ListenSockets::Inherited()
+    {
+        boost::mutex::scoped_lock lock(g_lock);
+        return !g_inherited.empty();
+    }
+
+    int ListenSockets::Take(const string &addr, uint16_t port)
+    {
+        boost::mutex::scoped_lock lock(g_lock);
+        for (vector<int>::iterator it = g_inherited.begin(); it != g_inherited.end(); ++it) {
+            struct sockaddr_storage sa;
+            socklen_t salen = sizeof(sa);
+            int listening = 0;
+            socklen_t optlen = sizeof(listening);
+            char host[NI_MAXHOST];
+            char serv[NI_MAXSERV];
+            if ((0 != getsockname(*it, reinterpret_cast<struct sockaddr *>(&sa), &salen)) ||
+                    (0 != getsockopt(*it, SOL_SOCKET, SO_ACCEPTCONN, &listening, &optlen)) || !listening ||
+                    (0 != getnameinfo(reinterpret_cast<struct sockaddr *>(&sa), salen,
+                                      host, sizeof(host), serv, sizeof(serv), NI_NUMERICHOST | NI_NUMERICSERV))) {
+                continue;
+            }
+            if ((addr == host) && (port == atoi(serv))) {
+                int fd = *it;
+                g_inherited.erase(it);
+                log::info << "Using inherited socket for " << addr << ":" << port << endl;
+                return fd;
+            }
+        }
+        return -1;
+    }
+
+    void ListenSockets::CloseUnused()
+    {
+        boost::mutex::scoped_lock lock(g_lock);
+        for (vector<int>::iterator it = g_inherited.begin(); it != g_inherited.end(); ++it) {
+            log::info << "Closing unused inherited socket " << *it << endl;
+            close(*it);
+        }
+        g_inherited.clear();
+    }
+
+    void ListenSockets::Export(int fd)
+    {
+        boost::mutex::scoped_lock lock(g_lock);
+        if (g_exported.end() == find(g_exported.begin(), g_exported.end(), fd)) {
+            g_exported.push_back(fd);
+        }
+    }
+
+    void ListenSockets::Unexport(int fd)
+    {
+        boost::mutex::scoped_lock lock(g_lock);
+        g_exported.erase(remove(g_exported.begin(), g_exported.end(), fd), g_exported.end());
+    }
+
+    pid_t ListenSockets::Handover(char * const *argv)
+    {
+        boost::mutex::scoped_lock lock(g_lock);
+        if (g_exe.empty()) {
+            log::err << "Could not determine the path of the binary" << endl;
+            return -1;
+        }
+        // Prepare everything before forking: The child of a multithreaded
+        // process may only use async-signal-safe functions until exec.
+        int n = static_cast<int>(g_exported.size());
+        vector<string> env;
+        for (char **e = environ; *e; ++e) {
+            if (!isListenEnv(*e)) {
+                env.push_back(*e);
+            }
+        }
+        env.push_back("LISTEN_FDS=" + boost::lexical_cast<string>(n));
+        // The readiness pipe follows the sockets.
+        env.push_back(string(READY_ENV) + "=" + boost::lexical_cast<string>(FIRST_FD + n));
+        vector<char *> envp;
+        for (vector<string>::iterator it = env.begin(); it != env.end(); ++it) {
+            envp.push_back(const_cast<char *>(it->c_str()));
+        }
+        // The pid is filled in by the child.
+        char pidvar[32] = "LISTEN_PID=";
+        envp.push_back(pidvar);
+        envp.push_back(NULL);
+        int maxfd = static_cast<int>(sysconf(_SC_OPEN_MAX));
+        int pfd[2];
+        if (0 != pipe2(pfd, O_CLOEXEC)) {
+            log::err << "Could not create pipe: " << strerror(errno) << endl;
+            return -1;
+        }
+        vector<int> tmp(g_exported);
+        tmp.push_back(pfd[1]);
+
+        pid_t pid = fork();
+        switch (pid) {
+            case 0:
+                {
+                    // Move the sockets and the pipe out of the way
+                    // first, they might occupy the target descriptors.
+                    for (int i = 0; i <= n; ++i) {
+                        tmp[i] = fcntl(tmp[i], F_DUPFD, FIRST_FD + n + 1);
+                    }
+                    for (int i = 0; i <= n; ++i) {
+                        dup2(tmp[i], FIRST_FD + i);
+                    }
+                    for (int fd = FIRST_FD + n + 1; fd < maxfd; ++fd) {
+                        close(fd);
+                    }
+                    char digits[16];
+                    int nd = 0;
+                    for (pid_t p = getpid(); 0 < p; p /= 10) {
+                        digits[nd++] = '0' + (p % 10);
+                    }
+                    char *dst = pidvar + strlen(pidvar);
+                    while (0 < nd) {
+                        *dst++ = digits[--nd];
+                    }
+                    *dst = '\0';
+                    execve(g_exe.c_str(), argv, &envp[0]);
+                    _exit(127);
+                }
+            case -1:
+                log::err << "Could not start new process: " << strerror(errno) << endl;
+                close(pfd[0]);
+                break;
+            default:
+                log::info << "Handed " << n << " listening socket(s) over to pid " << pid << endl;
+                fcntl(pfd[0], F_SETFL, O_NONBLOCK);
+                if (-1 != g_successorFd) {
+                    close(g_successorFd);
+                }
+                g_successorFd = pfd[0];
+                break;
+        }
+        close(pfd[1]);
+        return pid;
+    }
+
+    int ListenSockets::SuccessorState()
+    {
+        boost::mutex::scoped_lock lock(g_lock);
+        if (-1 == g_successorFd) {
+            return 1;
+        }
+        char c;
+        ssize_t r = read(g_successorFd, &c, 1);
+        if ((-1 == r) && ((EAGAIN == errno) || (EINTR == errno))) {
+            return 0;
+        }
+        // EOF: The new process (and its daemonized child) is gone.
+        close(g_successorFd);
+        g_successorFd = -1;
+        if (1 == r) {
+            return 1;
+        }
+        log::err << "New process terminated before taking over" << endl;
+        return -1;
+    }
+
+    void ListenSockets::Ready()
+    {
+        boost::mutex::scoped_lock lock(g_lock);
+        if (-1 == g_readyFd) {
+            return;
+        }
+        char c = 1;
+        if (1 != write(g_readyFd, &c, 1)) {
+            log::warn << "Could not notify the previous process: " << strerror(errno) << endl;
+        }
+        close(g_readyFd);
+        g_readyFd = -1;
+    }
+
+}
+
+#endif
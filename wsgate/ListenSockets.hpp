@@ -0,0 +1,114 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_LISTENSOCKETS_H_
+#define _WSGATE_LISTENSOCKETS_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string>
+
+namespace wsgate {
+
+    /**
+     * Listening sockets, which survive a restart.
+     * On startup, wsgate adopts sockets passed by the systemd socket
+     * activation protocol (LISTEN_FDS, LISTEN_PID). On SIGUSR2, the
+     * running process starts the (possibly updated) binary the same way,
+     * passing its own listening sockets. The old process keeps accepting
+     * until the new one reports, that it is listening on all ports.
+     * Then the old process stops accepting and drains its sessions.
+     * So no connection is refused during the restart, except on ports,
+     * which EHS binds without the bind helper: These can't be passed,
+     * so the new process asks the old one to release them early.
+     * Only available on Linux.
+     */
+    class ListenSockets {
+
+        public:
+            /// The first inherited file descriptor.
+            static const int FIRST_FD = 3;
+
+            /**
+             * Adopts the inherited sockets and remembers the path of
+             * the binary. Must be invoked at the start of main().
+             */
+            static void Init();
+
+            /**
+             * @return true, if this process has inherited sockets.
+             */
+            static bool Inherited();
+
+            /**
+             * Retrieves an inherited socket.
+             * @param addr The numeric bind address.
+             * @param port The port.
+             * @return The listening socket (owned by the caller)
+             *   or -1, if no socket is bound to addr:port.
+             */
+            static int Take(const std::string &addr, uint16_t port);
+
+            /**
+             * Closes the inherited sockets, which have not been taken.
+             * Otherwise, the kernel would keep queueing connections
+             * on them, which nobody accepts.
+             */
+            static void CloseUnused();
+
+            /**
+             * Registers a listening socket for passing it to the next process.
+             * @param fd The socket.
+             */
+            static void Export(int fd);
+
+            /**
+             * Removes a socket from the list of exported sockets.
+             * @param fd The socket.
+             */
+            static void Unexport(int fd);
+
+            /**
+             * Starts the binary again, passing the exported sockets.
+             * @param argv The command line of the new process.
+             * @return The pid of the new process or -1 on error.
+             */
+            static pid_t Handover(char * const *argv);
+
+            /**
+             * Checks the state of the process, started by Handover().
+             * @return 1, if it is ready to take over, -1, if it terminated
+             *   without becoming ready, 0 if it is still starting up.
+             */
+            static int SuccessorState();
+
+            /**
+             * Tells the process, which started this one via Handover(),
+             * that it may stop accepting now. Subsequent calls are ignored.
+             */
+            static void Ready();
+
+        private:
+            // Not instantiable
+            ListenSockets();
+    };
+
+}
+
+#endif
@@ -0,0 +1,343 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef _WIN32
+#include <stdint.h>
+#endif
+#include <cstring>
+
+#include "OpStream.hpp"
+
+namespace wsgate {
+
+    using namespace std;
+
+    const char * const OpStream::V2_PROTOCOL = "wsgate-v2";
+
+    // Maximum length of a LEB128 encoded 32bit value
+    static const size_t MAX_VARINT = 5;
+
+    /**
+     * Writes a single version 2 op into arena memory.
+     */
+    class V2Writer {
+        public:
+            V2Writer(wspp::arena &a, size_t maxlen, uint32_t op)
+                : m_buf(a.allocate(maxlen))
+                  , m_pos(0)
+            {
+                m_buf[m_pos++] = static_cast<char>(op);
+            }
+
+            /// Writes into a caller supplied buffer instead.
+            V2Writer(char *buf, uint32_t op)
+                : m_buf(buf)
+                  , m_pos(0)
+            {
+                m_buf[m_pos++] = static_cast<char>(op);
+            }
+
+            /// Appends an unsigned varint.
+            V2Writer & U(uint32_t v) {
+                while (v >= 0x80) {
+                    m_buf[m_pos++] = static_cast<char>((v & 0x7F) | 0x80);
+                    v >>= 7;
+                }
+                m_buf[m_pos++] = static_cast<char>(v);
+                return *this;
+            }
+
+            /// Appends a zigzag encoded signed varint.
+            V2Writer & S(int32_t v) {
+                uint32_t u = static_cast<uint32_t>(v);
+                return U((u << 1) ^ (0 - (u >> 31)));
+            }
+
+            /// Appends the difference of two coordinates.
+            V2Writer & D(int32_t v, int32_t base) {
+                return S(static_cast<int32_t>(static_cast<uint32_t>(v) - static_cast<uint32_t>(base)));
+            }
+
+            /// Appends a color as 4 raw bytes.
+            V2Writer & C(uint32_t color) {
+                memcpy(m_buf + m_pos, &color, sizeof(color));
+                m_pos += sizeof(color);
+                return *this;
+            }
+
+            wspp::buffer_slice Slice() const {
+                return wspp::buffer_slice(m_buf, m_pos);
+            }
+
+        private:
+            char *m_buf;
+            size_t m_pos;
+    };
+
+    OpStream::OpStream(wspp::wshandler *h)
+        : m_wshandler(h)
+          , m_version(VERSION_1)
+          , m_lastX(0)
+          , m_lastY(0)
+    { }
+
+    OpStream::~OpStream()
+    { }
+
+    void OpStream::SetVersion(Version v) {
+        m_version = v;
+        m_lastX = 0;
+        m_lastY = 0;
+    }
+
+    void OpStream::Flush(const wspp::buffer_slice &slice, bool compressible) {
+        Flush(&slice, 1, compressible);
+    }
+
+    void OpStream::Flush(const wspp::buffer_slice *slices, size_t count, bool compressible) {
+        m_wshandler->send_binary(slices, count, compressible);
+        // The endpoint has copied the message, so the arena can be reused
+        // right away. This keeps it small, even while no paint batch ends
+        // (e.g. output suppressed, but pointer and channel ops going on).
+        m_wshandler->get_arena().reset();
+    }
+
+    void OpStream::SendOp(uint32_t op) {
+        if (VERSION_2 == m_version) {
+            V2Writer w(m_wshandler->get_arena(), 1, op);
+            Flush(w.Slice());
+        } else {
+            wspp::op_writer w(m_wshandler->get_arena(), sizeof(op));
+            Flush(w.put(op).slice());
+        }
+    }
+
+    void OpStream::SendOp(uint32_t op, uint32_t arg) {
+        if (VERSION_2 == m_version) {
+            V2Writer w(m_wshandler->get_arena(), 1 + MAX_VARINT, op);
+            Flush(w.U(arg).Slice());
+        } else {
+            wspp::op_writer w(m_wshandler->get_arena(), sizeof(op) + sizeof(arg));
+            Flush(w.put(op).put(arg).slice());
+        }
+    }
+
+    void OpStream::BeginPaint() {
+        SendOp(WSOP_SC_BEGINPAINT);
+    }
+
+    void OpStream::EndPaint() {
+        SendOp(WSOP_SC_ENDPAINT);
+    }
+
+    void OpStream::SetBounds(int32_t left, int32_t top, int32_t right, int32_t bottom) {
+        if (VERSION_2 == m_version) {
+            V2Writer w(m_wshandler->get_arena(), 1 + 4 * MAX_VARINT, WSOP_SC_SETBOUNDS);
+            w.D(left, m_lastX).D(top, m_lastY).D(right, left).D(bottom, top);
+            m_lastX = left;
+            m_lastY = top;
+            Flush(w.Slice());
+        } else {
+            int32_t tmp[5] = { WSOP_SC_SETBOUNDS, left, top, right, bottom };
+            wspp::op_writer w(m_wshandler->get_arena(), sizeof(tmp));
+            Flush(w.put(tmp).slice());
+        }
+    }
+
+    void OpStream::Bitmap(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+            uint32_t dw, uint32_t dh, uint32_t bpp, bool compressed,
+            const uint8_t *data, uint32_t len) {
+        // Interleaved/planar encoded tiles don't benefit from permessage-deflate
+        if (VERSION_2 == m_version) {
+            V2Writer v2(m_wshandler->get_arena(), 1 + 9 * MAX_VARINT, WSOP_SC_BITMAP);
+            v2.D(x, m_lastX).D(y, m_lastY).U(w).U(h).U(dw).U(dh);
+            v2.U(bpp).U(compressed ? 1 : 0).U(len);
+            m_lastX = x;
+            m_lastY = y;
+            wspp::buffer_slice buf[2] = { v2.Slice(), wspp::buffer_slice(data, len) };
+            Flush(buf, 2, !compressed);
+        } else {
+            uint32_t hdr[10] = {
+                WSOP_SC_BITMAP, x, y, w, h, dw, dh, bpp,
+                static_cast<uint32_t>(compressed), len
+            };
+            wspp::buffer_slice buf[2] = {
+                wspp::buffer_slice(hdr, sizeof(hdr)),
+                wspp::buffer_slice(data, len)
+            };
+            Flush(buf, 2, !compressed);
+        }
+    }
+
+    void OpStream::OpaqueRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color) {
+        if (VERSION_2 == m_version) {
+            V2Writer v2(m_wshandler->get_arena(), 5 + 4 * MAX_VARINT, WSOP_SC_OPAQUERECT);
+            v2.D(x, m_lastX).D(y, m_lastY).S(w).S(h).C(color);
+            m_lastX = x;
+            m_lastY = y;
+            Flush(v2.Slice());
+        } else {
+            int32_t tmp[5] = { WSOP_SC_OPAQUERECT, x, y, w, h };
+            wspp::op_writer v1(m_wshandler->get_arena(), sizeof(tmp) + sizeof(color));
+            Flush(v1.put(tmp).put(color).slice());
+        }
+    }
+
+    void OpStream::PatBlt(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color, uint32_t rop) {
+        if (VERSION_2 == m_version) {
+            V2Writer v2(m_wshandler->get_arena(), 5 + 5 * MAX_VARINT, WSOP_SC_PATBLT);
+            v2.D(x, m_lastX).D(y, m_lastY).S(w).S(h).C(color).U(rop);
+            m_lastX = x;
+            m_lastY = y;
+            Flush(v2.Slice());
+        } else {
+            int32_t tmp[5] = { WSOP_SC_PATBLT, x, y, w, h };
+            wspp::op_writer v1(m_wshandler->get_arena(), sizeof(tmp) + sizeof(color) + sizeof(rop));
+            Flush(v1.put(tmp).put(color).put(rop).slice());
+        }
+    }
+
+    void OpStream::MultiOpaqueRect(uint32_t color, const DELTA_RECT *rects, uint32_t count) {
+        if (VERSION_2 == m_version) {
+            V2Writer v2(m_wshandler->get_arena(), 5 + MAX_VARINT + 4 * MAX_VARINT * count,
+                    WSOP_SC_MULTI_OPAQUERECT);
+            v2.C(color).U(count);
+            // Each rectangle is relative to its predecessor
+            for (uint32_t i = 0; i < count; ++i) {
+                v2.D(rects[i].left, m_lastX).D(rects[i].top, m_lastY);
+                v2.S(rects[i].width).S(rects[i].height);
+                m_lastX = rects[i].left;
+                m_lastY = rects[i].top;
+            }
+            Flush(v2.Slice());
+        } else {
+            uint32_t op = WSOP_SC_MULTI_OPAQUERECT;
+            wspp::op_writer v1(m_wshandler->get_arena(),
+                    sizeof(op) + sizeof(color) + sizeof(count) + sizeof(DELTA_RECT) * count);
+            v1.put(op).put(color).put(count);
+            v1.put(rects, sizeof(DELTA_RECT) * count);
+            Flush(v1.slice());
+        }
+    }
+
+    void OpStream::ScrBlt(uint32_t rop, int32_t x, int32_t y, int32_t w, int32_t h,
+            int32_t sx, int32_t sy) {
+        if (VERSION_2 == m_version) {
+            V2Writer v2(m_wshandler->get_arena(), 1 + 7 * MAX_VARINT, WSOP_SC_SCRBLT);
+            v2.U(rop).D(x, m_lastX).D(y, m_lastY).S(w).S(h).D(sx, x).D(sy, y);
+            m_lastX = x;
+            m_lastY = y;
+            Flush(v2.Slice());
+        } else {
+            struct {
+                uint32_t op;
+                uint32_t rop;
+                int32_t x;
+                int32_t y;
+                int32_t w;
+                int32_t h;
+                int32_t sx;
+                int32_t sy;
+            } tmp = { WSOP_SC_SCRBLT, rop, x, y, w, h, sx, sy };
+            wspp::op_writer v1(m_wshandler->get_arena(), sizeof(tmp));
+            Flush(v1.put(tmp).slice());
+        }
+    }
+
+    void OpStream::PointerNew(uint32_t id, uint32_t hx, uint32_t hy, const std::string &key) {
+        if (VERSION_2 == m_version) {
+            V2Writer v2(m_wshandler->get_arena(), 1 + 3 * MAX_VARINT, WSOP_SC_PTR_NEW);
+            wspp::buffer_slice buf[2] = { v2.U(id).U(hx).U(hy).Slice(), wspp::buffer_slice(key) };
+            Flush(buf, 2);
+        } else {
+            uint32_t tmp[4] = { WSOP_SC_PTR_NEW, id, hx, hy };
+            wspp::op_writer v1(m_wshandler->get_arena(), sizeof(tmp) + key.length());
+            Flush(v1.put(tmp).put(key.data(), key.length()).slice());
+        }
+    }
+
+    void OpStream::PointerFree(uint32_t id) {
+        SendOp(WSOP_SC_PTR_FREE, id);
+    }
+
+    void OpStream::PointerSet(uint32_t id) {
+        SendOp(WSOP_SC_PTR_SET, id);
+    }
+
+    void OpStream::PointerSetNull() {
+        SendOp(WSOP_SC_PTR_SETNULL);
+    }
+
+    void OpStream::PointerSetDefault() {
+        SendOp(WSOP_SC_PTR_SETDEFAULT);
+    }
+
+    void OpStream::Audio(uint32_t seq, uint32_t ts, const uint8_t *data, uint32_t len) {
+        // Opus packets don't benefit from permessage-deflate
+        if (VERSION_2 == m_version) {
+            char tmp[1 + 2 * MAX_VARINT];
+            V2Writer v2(tmp, WSOP_SC_AUDIO);
+            v2.U(seq).U(ts);
+            wspp::buffer_slice buf[2] = { v2.Slice(), wspp::buffer_slice(data, len) };
+            m_wshandler->send_binary(buf, 2, false);
+        } else {
+            uint32_t hdr[4] = { WSOP_SC_AUDIO, seq, ts, len };
+            wspp::buffer_slice buf[2] = {
+                wspp::buffer_slice(hdr, sizeof(hdr)),
+                wspp::buffer_slice(data, len)
+            };
+            m_wshandler->send_binary(buf, 2, false);
+        }
+    }
+
+    void OpStream::ChannelData(uint32_t chan, uint32_t flags, uint32_t total,
+            const uint8_t *data, uint32_t len) {
+        // The payload is forwarded as is, without assembling the message.
+        if (VERSION_2 == m_version) {
+            char tmp[1 + 3 * MAX_VARINT];
+            V2Writer v2(tmp, WSOP_SC_VC_DATA);
+            v2.U(chan).U(flags).U(total);
+            wspp::buffer_slice buf[2] = { v2.Slice(), wspp::buffer_slice(data, len) };
+            m_wshandler->send_binary(buf, 2);
+        } else {
+            uint32_t hdr[4] = { WSOP_SC_VC_DATA, chan, flags, total };
+            wspp::buffer_slice buf[2] = {
+                wspp::buffer_slice(hdr, sizeof(hdr)),
+                wspp::buffer_slice(data, len)
+            };
+            m_wshandler->send_binary(buf, 2);
+        }
+    }
+
+    void OpStream::ChannelAck(uint32_t chan, uint32_t bytes) {
+        if (VERSION_2 == m_version) {
+            V2Writer v2(m_wshandler->get_arena(), 1 + 2 * MAX_VARINT, WSOP_SC_VC_ACK);
+            Flush(v2.U(chan).U(bytes).Slice());
+        } else {
+            uint32_t tmp[3] = { WSOP_SC_VC_ACK, chan, bytes };
+            wspp::op_writer v1(m_wshandler->get_arena(), sizeof(tmp));
+            Flush(v1.put(tmp).slice());
+        }
+    }
+
+}
@@ -0,0 +1,151 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_OPSTREAM_H_
+#define _WSGATE_OPSTREAM_H_
+
+#include "rdpcommon.hpp"
+
+namespace wsgate {
+
+    /**
+     * Serializer for the ops, sent to the (JavaScript) client.
+     * Two wire formats are supported:
+     * - Version 1: Each op is a sequence of 32bit values in host
+     *   byte order, starting with the opcode.
+     * - Version 2 (subprotocol "wsgate-v2"): A single byte opcode,
+     *   followed by LEB128 varints. Coordinates are zigzag encoded
+     *   deltas against the position of the previous op, colors are
+     *   sent as 4 raw bytes.
+     * All methods except Audio() must be invoked from the RDP session thread.
+     */
+    class OpStream {
+
+        public:
+            /// Wire format versions.
+            typedef enum {
+                VERSION_1 = 1,
+                VERSION_2 = 2
+            } Version;
+
+            /// The Sec-WebSocket-Protocol token, selecting version 2.
+            static const char * const V2_PROTOCOL;
+
+            /**
+             * Constructs a new instance.
+             * @param h A pointer to the corresponding wshandler object.
+             */
+            OpStream(wspp::wshandler *h);
+
+            /// Destructor.
+            ~OpStream();
+
+            /**
+             * Selects the wire format.
+             * Must be invoked before the first op is sent.
+             * @param v The negotiated version.
+             */
+            void SetVersion(Version v);
+
+            /**
+             * Retrieves the wire format.
+             * @return The negotiated version.
+             */
+            Version GetVersion() const { return m_version; }
+
+            void BeginPaint();
+            void EndPaint();
+            void SetBounds(int32_t left, int32_t top, int32_t right, int32_t bottom);
+            void Bitmap(uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+                    uint32_t dw, uint32_t dh, uint32_t bpp, bool compressed,
+                    const uint8_t *data, uint32_t len);
+            void OpaqueRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+            void PatBlt(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color, uint32_t rop);
+            /**
+             * Sends a multi opaque rect op.
+             * @param color The fill color.
+             * @param rects The rectangles (absolute coordinates).
+             * @param count The number of rectangles.
+             */
+            void MultiOpaqueRect(uint32_t color, const DELTA_RECT *rects, uint32_t count);
+            void ScrBlt(uint32_t rop, int32_t x, int32_t y, int32_t w, int32_t h,
+                    int32_t sx, int32_t sy);
+            /**
+             * Sends a new pointer.
+             * @param id The ID of the pointer within this session.
+             * @param hx The x coordinate of the hotspot.
+             * @param hy The y coordinate of the hotspot.
+             * @param key The content key of the image (see CursorCache),
+             *   appended as ASCII. The client fetches it from /cur/<key>.
+             */
+            void PointerNew(uint32_t id, uint32_t hx, uint32_t hy, const std::string &key);
+            void PointerFree(uint32_t id);
+            void PointerSet(uint32_t id);
+            void PointerSetNull();
+            void PointerSetDefault();
+            /**
+             * Sends an Opus packet.
+             * May be invoked from any thread, because neither the arena
+             * nor the position of the previous op is used.
+             * @param seq The sequence number of the packet.
+             * @param ts The timestamp of the packet's first sample in 1/48000s.
+             * @param data The Opus packet.
+             * @param len The length of the packet.
+             */
+            void Audio(uint32_t seq, uint32_t ts, const uint8_t *data, uint32_t len);
+            /**
+             * Sends a chunk of a static virtual channel.
+             * @param chan The index of the channel, as announced to the client.
+             * @param flags The chunk's CHANNEL_FLAG_FIRST/CHANNEL_FLAG_LAST flags.
+             * @param total The length of the complete message.
+             * @param data The chunk's payload.
+             * @param len The length of the chunk.
+             */
+            void ChannelData(uint32_t chan, uint32_t flags, uint32_t total,
+                    const uint8_t *data, uint32_t len);
+            /**
+             * Acknowledges channel data, sent by the client.
+             * @param chan The index of the channel.
+             * @param bytes The number of bytes, forwarded to the RDP server.
+             */
+            void ChannelAck(uint32_t chan, uint32_t bytes);
+
+        private:
+            // Non-copyable
+            OpStream(const OpStream &);
+            OpStream & operator=(const OpStream &);
+
+            /**
+             * Sends an op and releases its arena memory.
+             * Must only be invoked from the RDP session thread.
+             */
+            void Flush(const wspp::buffer_slice &slice, bool compressible = true);
+            void Flush(const wspp::buffer_slice *slices, size_t count, bool compressible = true);
+            void SendOp(uint32_t op);
+            void SendOp(uint32_t op, uint32_t arg);
+
+            wspp::wshandler *m_wshandler;
+            Version m_version;
+            // Position of the previous op (version 2 only)
+            int32_t m_lastX;
+            int32_t m_lastY;
+    };
+}
+
+#endif
@@ -0,0 +1,398 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <openssl/rand.h>
+
+#include "Prefork.hpp"
+#include "wsgateEHS.hpp"
+
+extern char **environ;
+
+namespace wsgate {
+
+    using namespace std;
+
+    /// Environment variable, carrying the read end of the ticket secret pipe.
+    static const char TICKET_ENV[] = "WSGATE_TICKET_FD";
+    /// The descriptor of that pipe in the worker.
+    static const int TICKET_FD = 3;
+
+    static socklen_t channelAddress(pid_t master, int worker, struct sockaddr_un &sa)
+    {
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        // Abstract namespace: Leading NUL, nothing to clean up.
+        int len = snprintf(sa.sun_path + 1, sizeof(sa.sun_path) - 1, "wsgate-%d-%d",
+                static_cast<int>(master), worker);
+        return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + 1 + len);
+    }
+
+    static void setTimeouts(int fd, int seconds)
+    {
+        struct timeval tv;
+        tv.tv_sec = seconds;
+        tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    static bool readAll(int fd, char *buf, size_t len)
+    {
+        while (0 < len) {
+            ssize_t n = read(fd, buf, len);
+            if (0 >= n) {
+                if ((0 > n) && (EINTR == errno)) {
+                    continue;
+                }
+                return false;
+            }
+            buf += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    static bool writeAll(int fd, const char *buf, size_t len)
+    {
+        while (0 < len) {
+            ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+            if (0 > n) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                return false;
+            }
+            buf += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    Prefork::Prefork(const string &config, int workers)
+        : m_sConfig(config)
+          , m_sTicketSecret(TICKET_SECRET, '\0')
+          , m_pids(workers, -1)
+          , m_started(workers, 0)
+          , m_bDraining(false)
+    {
+        if (1 != RAND_bytes(reinterpret_cast<unsigned char *>(&m_sTicketSecret[0]), TICKET_SECRET)) {
+            throw tracing::runtime_error("Could not create session ticket secret");
+        }
+    }
+
+    Prefork::~Prefork()
+    {
+        Stop();
+    }
+
+    void Prefork::Spawn(int n)
+    {
+        // Prepare everything before forking: The child of a multithreaded
+        // process may only use async-signal-safe functions until exec.
+        char num[16];
+        snprintf(num, sizeof(num), "%d", n);
+        const char *argv[] = { "wsgate", "-c", m_sConfig.c_str(), "--worker", num, NULL };
+        int maxfd = static_cast<int>(sysconf(_SC_OPEN_MAX));
+        // The secret fits into the pipe buffer, so it is written up front.
+        int pfd[2] = { -1, -1 };
+        if ((0 != pipe2(pfd, O_CLOEXEC)) ||
+                !writeAll(pfd[1], m_sTicketSecret.data(), m_sTicketSecret.length())) {
+            log::warn << "Could not pass session ticket secret to worker " << n << ": "
+                << strerror(errno) << endl;
+            if (-1 != pfd[0]) {
+                close(pfd[0]);
+                pfd[0] = -1;
+            }
+        }
+        if (-1 != pfd[1]) {
+            close(pfd[1]);
+        }
+        vector<string> env;
+        for (char **e = environ; *e; ++e) {
+            env.push_back(*e);
+        }
+        if (-1 != pfd[0]) {
+            env.push_back(string(TICKET_ENV) + "=" + boost::lexical_cast<string>(TICKET_FD));
+        }
+        vector<char *> envp;
+        for (vector<string>::iterator it = env.begin(); it != env.end(); ++it) {
+            envp.push_back(const_cast<char *>(it->c_str()));
+        }
+        envp.push_back(NULL);
+        pid_t pid = fork();
+        switch (pid) {
+            case 0:
+                if (-1 != pfd[0]) {
+                    if (TICKET_FD == pfd[0]) {
+                        fcntl(TICKET_FD, F_SETFD, 0);
+                    } else {
+                        dup2(pfd[0], TICKET_FD);
+                    }
+                }
+                // Do not inherit the listening sockets of EHS.
+                for (int fd = (-1 != pfd[0]) ? TICKET_FD + 1 : 3; fd < maxfd; ++fd) {
+                    close(fd);
+                }
+                execve("/proc/self/exe", const_cast<char * const *>(argv), &envp[0]);
+                _exit(127);
+            case -1:
+                log::err << "Could not start worker " << n << ": " << strerror(errno) << endl;
+                break;
+            default:
+                log::info << "Started worker " << n << " (pid " << pid << ")" << endl;
+                break;
+        }
+        if (-1 != pfd[0]) {
+            close(pfd[0]);
+        }
+        m_pids[n] = pid;
+        m_started[n] = time(NULL);
+    }
+
+    void Prefork::Start()
+    {
+        for (size_t n = 0; n < m_pids.size(); ++n) {
+            Spawn(n);
+        }
+    }
+
+    void Prefork::Check()
+    {
+        if (m_bDraining) {
+            return;
+        }
+        time_t now = time(NULL);
+        for (size_t n = 0; n < m_pids.size(); ++n) {
+            if (0 < m_pids[n]) {
+                int status;
+                if (m_pids[n] != waitpid(m_pids[n], &status, WNOHANG)) {
+                    continue;
+                }
+                if (WIFSIGNALED(status)) {
+                    log::err << "Worker " << n << " (pid " << m_pids[n] << ") killed by signal "
+                        << WTERMSIG(status) << endl;
+                } else {
+                    log::err << "Worker " << n << " (pid " << m_pids[n] << ") exited with status "
+                        << WEXITSTATUS(status) << endl;
+                }
+                m_pids[n] = -1;
+            }
+            // Do not spin, if the worker dies right after its start.
+            if (now - m_started[n] >= RESTART_DELAY) {
+                Spawn(n);
+            }
+        }
+    }
+
+    void Prefork::Stop()
+    {
+        for (size_t n = 0; n < m_pids.size(); ++n) {
+            if (0 < m_pids[n]) {
+                kill(m_pids[n], SIGTERM);
+            }
+        }
+        for (int i = 0; i < STOP_TIMEOUT * 10; ++i) {
+            if (!Running()) {
+                return;
+            }
+            usleep(100000);
+        }
+        for (size_t n = 0; n < m_pids.size(); ++n) {
+            if (0 < m_pids[n]) {
+                log::warn << "Killing worker " << n << " (pid " << m_pids[n] << ")" << endl;
+                kill(m_pids[n], SIGKILL);
+                waitpid(m_pids[n], NULL, 0);
+                m_pids[n] = -1;
+            }
+        }
+    }
+
+    void Prefork::Drain()
+    {
+        m_bDraining = true;
+        for (size_t n = 0; n < m_pids.size(); ++n) {
+            if (0 < m_pids[n]) {
+                kill(m_pids[n], SIGUSR2);
+            }
+        }
+    }
+
+    bool Prefork::Running()
+    {
+        bool running = false;
+        for (size_t n = 0; n < m_pids.size(); ++n) {
+            if (0 < m_pids[n]) {
+                if (m_pids[n] == waitpid(m_pids[n], NULL, WNOHANG)) {
+                    m_pids[n] = -1;
+                } else {
+                    running = true;
+                }
+            }
+        }
+        return running;
+    }
+
+    void Prefork::Reload()
+    {
+        for (size_t n = 0; n < m_pids.size(); ++n) {
+            if (0 < m_pids[n]) {
+                kill(m_pids[n], SIGHUP);
+            }
+        }
+    }
+
+    string Prefork::TicketSecret()
+    {
+        const char *var = getenv(TICKET_ENV);
+        if (!var) {
+            return string();
+        }
+        int fd = atoi(var);
+        unsetenv(TICKET_ENV);
+        string secret(TICKET_SECRET, '\0');
+        if (!readAll(fd, &secret[0], secret.length())) {
+            log::warn << "Could not read session ticket secret" << endl;
+            secret.clear();
+        }
+        close(fd);
+        return secret;
+    }
+
+    PreforkChannel::PreforkChannel(WsGate *gate, pid_t master, int worker)
+        : m_gate(gate)
+          , m_master(master)
+          , m_worker(worker)
+          , m_fd(-1)
+          , m_thread()
+          , m_bStarted(false)
+    { }
+
+    PreforkChannel::~PreforkChannel()
+    {
+        if (m_bStarted) {
+            // Makes accept() fail, so the thread terminates.
+            shutdown(m_fd, SHUT_RDWR);
+            pthread_join(m_thread, NULL);
+        }
+        if (-1 != m_fd) {
+            close(m_fd);
+        }
+    }
+
+    void PreforkChannel::Start()
+    {
+        struct sockaddr_un sa;
+        socklen_t salen = channelAddress(m_master, m_worker, sa);
+        m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if ((-1 == m_fd) ||
+                (0 != ::bind(m_fd, reinterpret_cast<struct sockaddr *>(&sa), salen)) ||
+                (0 != listen(m_fd, SOMAXCONN))) {
+            throw tracing::runtime_error(string("Could not create worker channel: ") + strerror(errno));
+        }
+        if (0 != pthread_create(&m_thread, NULL, cbThreadFunc, reinterpret_cast<void *>(this))) {
+            throw tracing::runtime_error("Could not create worker channel thread");
+        }
+        m_bStarted = true;
+    }
+
+    void PreforkChannel::ThreadFunc()
+    {
+        for (;;) {
+            int fd = accept4(m_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (-1 == fd) {
+                if ((EINTR == errno) || (ECONNABORTED == errno)) {
+                    continue;
+                }
+                break;
+            }
+            setTimeouts(fd, TIMEOUT);
+            Serve(fd);
+            close(fd);
+        }
+    }
+
+    void PreforkChannel::Serve(int fd)
+    {
+        string key;
+        char c;
+        while (readAll(fd, &c, 1) && ('\n' != c)) {
+            if (MAX_REQUEST < key.length()) {
+                return;
+            }
+            key.push_back(c);
+        }
+        CursorCache::image_ptr img = m_gate->GetCursorCache()->Find(key);
+        uint32_t len = img ? img->length() : 0;
+        if (writeAll(fd, reinterpret_cast<const char *>(&len), sizeof(len)) && img) {
+            writeAll(fd, img->data(), len);
+        }
+    }
+
+    bool PreforkChannel::FetchCursor(pid_t master, int worker, const string &key, string &image)
+    {
+        struct sockaddr_un sa;
+        socklen_t salen = channelAddress(master, worker, sa);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (-1 == fd) {
+            return false;
+        }
+        setTimeouts(fd, TIMEOUT);
+        string req(key + "\n");
+        uint32_t len = 0;
+        bool ret = (0 == connect(fd, reinterpret_cast<struct sockaddr *>(&sa), salen)) &&
+            writeAll(fd, req.data(), req.length()) &&
+            readAll(fd, reinterpret_cast<char *>(&len), sizeof(len)) && (0 < len);
+        if (ret) {
+            image.resize(len);
+            ret = readAll(fd, &image[0], len);
+        }
+        close(fd);
+        return ret;
+    }
+
+    void *PreforkChannel::cbThreadFunc(void *ctx)
+    {
+        PreforkChannel *self = reinterpret_cast<PreforkChannel *>(ctx);
+        if (self) {
+            self->ThreadFunc();
+        }
+        return NULL;
+    }
+
+}
+
+#endif
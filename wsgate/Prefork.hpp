@@ -0,0 +1,191 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_PREFORK_H_
+#define _WSGATE_PREFORK_H_
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <ctime>
+#include <string>
+#include <vector>
+
+namespace wsgate {
+
+    class WsGate;
+
+    /**
+     * Runs the WebSocket engine in several worker processes (engine.workers).
+     * The main process keeps serving HTTP via EHS and starts the workers by
+     * executing itself with the option --worker. Each worker runs its own
+     * WsEngine on the engine port (SO_REUSEPORT), so the kernel spreads the
+     * connections over the workers. Crashed workers are restarted.
+     * On a restart (see ListenSockets), the workers of the new main
+     * process join the same port, while the old ones drain.
+     * Requests, which refer to the state of a worker (cursor images), are
+     * forwarded by the main process to the owning worker via a Unix socket
+     * (see PreforkChannel).
+     * The main process creates a secret for the TLS session ticket keys
+     * once and passes it to each worker through a pipe, so that a ticket,
+     * issued by one worker, is accepted by the others.
+     * Only available on Linux.
+     */
+    class Prefork {
+
+        public:
+            /// Minimum number of seconds between two starts of the same worker.
+            static const time_t RESTART_DELAY = 5;
+            /// Seconds to wait for the workers on shutdown, before killing them.
+            static const int STOP_TIMEOUT = 10;
+            /// Length of the session ticket secret in bytes.
+            static const size_t TICKET_SECRET = 32;
+
+            /**
+             * Constructs a new instance.
+             * @param config The path of the config file, passed to the workers.
+             * @param workers The number of worker processes.
+             * Throws tracing::runtime_error, if the ticket secret can't be created.
+             */
+            Prefork(const std::string &config, int workers);
+
+            /// Destructor. Stops the workers.
+            ~Prefork();
+
+            /**
+             * Starts the worker processes.
+             */
+            void Start();
+
+            /**
+             * Restarts workers, which have terminated.
+             * Must be invoked periodically from the main loop.
+             */
+            void Check();
+
+            /**
+             * Terminates the worker processes and waits for them.
+             */
+            void Stop();
+
+            /**
+             * Asks the workers to stop accepting connections and to
+             * terminate, once their connections are closed.
+             * Workers are not restarted anymore.
+             */
+            void Drain();
+
+            /**
+             * Reaps terminated workers.
+             * @return true, if any worker is still running.
+             */
+            bool Running();
+
+            /**
+             * Asks the workers to reload the config file.
+             * Safe to be invoked from a signal handler.
+             */
+            void Reload();
+
+            /**
+             * Retrieves the session ticket secret, passed by the main process.
+             * Invoked once at the start of a worker process.
+             * @return The secret or an empty string, if there is none.
+             */
+            static std::string TicketSecret();
+
+        private:
+            // Non-copyable
+            Prefork(const Prefork &);
+            Prefork & operator=(const Prefork &);
+
+            void Spawn(int n);
+
+            std::string m_sConfig;
+            std::string m_sTicketSecret;
+            std::vector<pid_t> m_pids;
+            std::vector<time_t> m_started;
+            bool m_bDraining;
+    };
+
+    /**
+     * The Unix socket, on which a worker process answers the requests of
+     * the main process. The socket lives in the abstract namespace and is
+     * named after the main process, which started the worker, and the
+     * worker number. So after a restart, the new main process still
+     * reaches the draining workers of the previous one.
+     * Request: The cursor key, terminated by a newline.
+     * Response: The length of the image (4 bytes, host byte order, 0 if not
+     * found), followed by the image.
+     */
+    class PreforkChannel {
+
+        public:
+            /// Maximum length of a request.
+            static const size_t MAX_REQUEST = 256;
+            /// Timeout for socket operations in seconds.
+            static const int TIMEOUT = 2;
+
+            /**
+             * Constructs a new instance.
+             * @param gate The WsGate instance of the worker.
+             * @param master The pid of the main process, which started the worker.
+             * @param worker The number of the worker.
+             */
+            PreforkChannel(WsGate *gate, pid_t master, int worker);
+
+            /// Destructor. Stops the listener thread.
+            ~PreforkChannel();
+
+            /**
+             * Creates the socket and starts the listener thread.
+             * Throws tracing::runtime_error on failure.
+             */
+            void Start();
+
+            /**
+             * Fetches a cursor image from a worker.
+             * Invoked in the main process.
+             * @param master The pid of the main process, which started the worker.
+             * @param worker The number of the worker.
+             * @param key The content key of the image.
+             * @param image Receives the image.
+             * @return true, if the worker has the image.
+             */
+            static bool FetchCursor(pid_t master, int worker, const std::string &key, std::string &image);
+
+        private:
+            // Non-copyable
+            PreforkChannel(const PreforkChannel &);
+            PreforkChannel & operator=(const PreforkChannel &);
+
+            void ThreadFunc();
+            void Serve(int fd);
+            static void *cbThreadFunc(void *ctx);
+
+            WsGate *m_gate;
+            pid_t m_master;
+            int m_worker;
+            int m_fd;
+            pthread_t m_thread;
+            bool m_bStarted;
+    };
+
+}
+
+#endif
@@ -26,13 +26,14 @@
 
 #include "rdpcommon.hpp"
 #include "Primary.hpp"
+#include "OpStream.hpp"
 
 namespace wsgate {
 
     using namespace std;
 
-    Primary::Primary(wspp::wshandler *h)
-        : m_wshandler(h)
+    Primary::Primary(OpStream *ops)
+        : m_ops(ops)
     { }
 
     Primary::~Primary()
@@ -76,25 +77,8 @@ namespace wsgate {
 #ifdef DBGLOG_PATBLT
             log::debug << "PB S " << hex << rop3 << dec << endl;
 #endif
-            struct {
-                uint32_t op;
-                int32_t x;
-                int32_t y;
-                int32_t w;
-                int32_t h;
-                uint32_t fg;
-                uint32_t rop;
-            } tmp = {
-                WSOP_SC_PATBLT,
-                po->nLeftRect,
-                po->nTopRect,
-                po->nWidth,
-                po->nHeight,
-                freerdp_color_convert_var(po->foreColor, 16, 32, hclrconv),
-                rop3
-            };
-            string buf(reinterpret_cast<const char *>(&tmp), sizeof(tmp));
-            m_wshandler->send_binary(buf);
+            m_ops->PatBlt(po->nLeftRect, po->nTopRect, po->nWidth, po->nHeight,
+                    freerdp_color_convert_var(po->foreColor, 16, 32, hclrconv), rop3);
         } else if (GDI_BS_PATTERN ==  po->brush.style) {
 #ifdef DBGLOG_PATBLT
             log::debug << "PB P " << hex << rop3 << dec << endl;
@@ -119,43 +103,19 @@ namespace wsgate {
             << " h=" << sbo->nHeight
             << endl;
 #endif
-        struct {
-            uint32_t op;
-            uint32_t rop;
-            int32_t x;
-            int32_t y;
-            int32_t w;
-            int32_t h;
-            int32_t sx;
-            int32_t sy;
-        } tmp = {
-            WSOP_SC_SCRBLT,
-            rop3,
-            sbo->nLeftRect,
-            sbo->nTopRect,
-            sbo->nWidth,
-            sbo->nHeight,
-            sbo->nXSrc,
-            sbo->nYSrc
-        };
-        string buf(reinterpret_cast<const char *>(&tmp), sizeof(tmp));
-        m_wshandler->send_binary(buf);
+        m_ops->ScrBlt(rop3, sbo->nLeftRect, sbo->nTopRect, sbo->nWidth, sbo->nHeight,
+                sbo->nXSrc, sbo->nYSrc);
     }
 
     void Primary::OpaqueRect(rdpContext* context, OPAQUE_RECT_ORDER* oro) {
         // log::debug << __PRETTY_FUNCTION__ << endl;
         HCLRCONV hclrconv = reinterpret_cast<wsgContext *>(context)->clrconv;
-        uint32_t svcolor = oro->color;
-        oro->color = freerdp_color_convert_var(oro->color, 16, 32, hclrconv);
-        uint32_t op = WSOP_SC_OPAQUERECT;
+        uint32_t color = freerdp_color_convert_var(oro->color, 16, 32, hclrconv);
 #ifdef DBGLOG_OPAQUERECT
         log::debug << "OR" << " x=" << oro->nLeftRect << " y=" << oro->nTopRect
-            << " w=" << oro->nWidth << " h=" << oro->nHeight << " col=0x" << hex << oro->color << dec << endl;
+            << " w=" << oro->nWidth << " h=" << oro->nHeight << " col=0x" << hex << color << dec << endl;
 #endif
-        string buf(reinterpret_cast<const char *>(&op), sizeof(op));
-        buf.append(reinterpret_cast<const char *>(oro), sizeof(OPAQUE_RECT_ORDER));
-        m_wshandler->send_binary(buf);
-        oro->color = svcolor;
+        m_ops->OpaqueRect(oro->nLeftRect, oro->nTopRect, oro->nWidth, oro->nHeight, color);
     }
 
     void Primary::DrawNineGrid(rdpContext*, DRAW_NINE_GRID_ORDER*) {
@@ -187,15 +147,8 @@ namespace wsgate {
                 << " w=" << r->width << " h=" << r->height << endl;
         }
 #endif
-        uint32_t nr = moro->numRectangles;
-        uint32_t op = WSOP_SC_MULTI_OPAQUERECT;
-        string buf(reinterpret_cast<const char *>(&op), sizeof(op));
-        buf.append(reinterpret_cast<const char *>(&color), sizeof(color));
-        buf.append(reinterpret_cast<const char *>(&nr), sizeof(nr));
         // Rectangles start at index 1 and rect at index 0 is always 0,0,0,0
-        buf.append(reinterpret_cast<const char *>(&moro->rectangles[1]),
-                sizeof(DELTA_RECT) * nr);
-        m_wshandler->send_binary(buf);
+        m_ops->MultiOpaqueRect(color, &moro->rectangles[1], moro->numRectangles);
     }
 
     void Primary::MultiDrawNineGrid(rdpContext*, MULTI_DRAW_NINE_GRID_ORDER*) {
@@ -31,9 +31,9 @@ namespace wsgate {
         public:
             /**
              * Constructs a new instance.
-             * @param h A pointer to the corresponding wshandler object.
+             * @param ops A pointer to the session's op stream.
              */
-            Primary(wspp::wshandler *h);
+            Primary(OpStream *ops);
 
             /// Destructor
             virtual ~Primary();
@@ -45,7 +45,7 @@ namespace wsgate {
             void Register(freerdp *rdp);
 
         private:
-            wspp::wshandler *m_wshandler;
+            OpStream *m_ops;
 
             // Non-copyable
             Primary(const Primary &);
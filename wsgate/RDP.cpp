@@ -21,6 +21,10 @@
 # include "config.h"
 #endif
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
 #include <iomanip>
 
@@ -29,7 +33,13 @@
 #include "RDP.hpp"
 #include "Update.hpp"
 #include "Primary.hpp"
+#include "OpStream.hpp"
+#include "TextInjector.hpp"
+#include "AudioEncoder.hpp"
+#include "ChannelRelay.hpp"
+#include "CursorCache.hpp"
 #include "Png.hpp"
+#include "sha1.hpp"
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
@@ -41,6 +51,13 @@
 extern "C" {
 #include <freerdp/locale/keyboard.h>
 }
+#include <freerdp/channels/channels.h>
+#include <freerdp/client/channels.h>
+#include <freerdp/client/cmdline.h>
+#ifdef HAVE_OPUS
+#include <freerdp/addin.h>
+#include <freerdp/client/rdpsnd.h>
+#endif
 
 
 #ifdef HAVE_UNISTD_H
@@ -314,29 +331,177 @@ namespace wsgate {
 
     map<freerdp *, RDP *> RDP::m_instances;
 
+#ifdef HAVE_OPUS
+    /**
+     * Our rdpsnd output device "wsgate", which hands the PCM data
+     * over to the AudioEncoder of its session.
+     */
+    typedef struct {
+        rdpsndDevicePlugin device;
+        AudioEncoder *encoder;
+    } WsSndDevice;
+
+    // private C callback
+    static BOOL cbSndFormatSupported(rdpsndDevicePlugin *, AUDIO_FORMAT *format)
+    {
+        return (WAVE_FORMAT_PCM == format->wFormatTag) &&
+            AudioEncoder::FormatSupported(format->nSamplesPerSec,
+                    format->nChannels, format->wBitsPerSample);
+    }
+
+    // private C callback
+    static void cbSndSetFormat(rdpsndDevicePlugin *device, AUDIO_FORMAT *format, int)
+    {
+        if (format) {
+            reinterpret_cast<WsSndDevice *>(device)->encoder->SetFormat(
+                    format->nSamplesPerSec, format->nChannels);
+        }
+    }
+
+    // private C callback
+    static void cbSndPlay(rdpsndDevicePlugin *device, BYTE *data, int size)
+    {
+        reinterpret_cast<WsSndDevice *>(device)->encoder->Play(data, size);
+    }
+
+    // private C callback
+    static void cbSndFree(rdpsndDevicePlugin *device)
+    {
+        free(device);
+    }
+
+    // private C callback
+    static int cbSndDeviceEntry(PFREERDP_RDPSND_DEVICE_ENTRY_POINTS pEntryPoints)
+    {
+        AudioEncoder *enc = 0;
+        ADDIN_ARGV *args = pEntryPoints->args;
+        for (int i = 0; args && (i < args->argc); ++i) {
+            void *p;
+            if (1 == sscanf(args->argv[i], "dev:%p", &p)) {
+                enc = reinterpret_cast<AudioEncoder *>(p);
+            }
+        }
+        if (!enc) {
+            log::err << "rdpsnd: no audio encoder" << endl;
+            return -1;
+        }
+        WsSndDevice *dev = reinterpret_cast<WsSndDevice *>(calloc(1, sizeof(WsSndDevice)));
+        if (!dev) {
+            return -1;
+        }
+        dev->device.FormatSupported = cbSndFormatSupported;
+        dev->device.Open = cbSndSetFormat;
+        dev->device.SetFormat = cbSndSetFormat;
+        dev->device.Play = cbSndPlay;
+        dev->device.Free = cbSndFree;
+        dev->encoder = enc;
+        pEntryPoints->pRegisterRdpsndDevice(pEntryPoints->rdpsnd, &dev->device);
+        return 0;
+    }
+
+    // private C callback
+    static void *cbLoadAddinEntry(LPCSTR name, LPSTR subsystem, LPSTR type, DWORD flags)
+    {
+        if (name && subsystem && (0 == strcmp(name, "rdpsnd")) && (0 == strcmp(subsystem, "wsgate"))) {
+            return reinterpret_cast<void *>(cbSndDeviceEntry);
+        }
+        return freerdp_channels_load_static_addin_entry(name, subsystem, type, flags);
+    }
+#endif
+
+    void RDP::GlobalInit()
+    {
+        freerdp_channels_global_init();
+#ifdef HAVE_OPUS
+        // Provides our own rdpsnd device to all sessions.
+        freerdp_register_addin_provider(cbLoadAddinEntry, 0);
+#endif
+    }
+
+    void RDP::GlobalUninit()
+    {
+        freerdp_channels_global_uninit();
+    }
+
     typedef struct {
         rdpPointer pointer;
         uint32_t id;
     } MyPointer;
 
-    RDP::RDP(wspp::wshandler *h, MyRawSocketHandler *rsh, EmbeddedContext embeddedContext)
-        : m_freerdp(freerdp_new())
+    RDP::RDP(wspp::wshandler *h, RdpLauncher *launcher, EmbeddedContext embeddedContext)
+        : m_freerdp(0)
           , m_rdpContext(0)
           , m_rdpInput(0)
           , m_rdpSettings(0)
           , m_bThreadLoop(false)
           , m_worker()
           , m_wshandler(h)
-          , m_rsh(rsh)
+          , m_launcher(launcher)
           , m_errMsg()
           , m_State(STATE_INITIAL)
-          , m_pUpdate(new Update(h))
-          , m_pPrimary(new Primary(h))
+          , m_pOps(new OpStream(h))
+          , m_pUpdate(new Update(h, m_pOps))
+          , m_pPrimary(new Primary(m_pOps))
           , m_lastError(0)
           , m_ptrId(1)
+          , m_pCursorCache(0)
           , m_cursorMap()
           , m_embeddedContext(embeddedContext)
+          , m_input()
+          , m_held()
+          , m_parkedMove(0)
+          , m_bInputOverflow(false)
+          , m_pText(new TextInjector(h))
+          , m_nCoalesced(0)
+          , m_bVisible(true)
+          , m_pDisp(0)
+          , m_bResizePending(false)
+          , m_resizeW(0)
+          , m_resizeH(0)
+          , m_resizeDue()
+#ifdef HAVE_OPUS
+          , m_pAudio(new AudioEncoder(m_pOps))
+#else
+          , m_pAudio(0)
+#endif
+          , m_pRelay(new ChannelRelay(h, m_pOps))
+    {
+        // The FreeRDP instance and the worker thread are created by
+        // Connect(), once the credentials are known.
+    }
+
+    RDP::~RDP()
+    {
+        log::debug << __PRETTY_FUNCTION__ << endl;
+        Disconnect();
+        ReleaseInstance();
+        // The rdpsnd channel has been closed along with the context.
+        delete m_pAudio;
+        delete m_pRelay;
+        delete m_pUpdate;
+        delete m_pPrimary;
+        delete m_pOps;
+        delete m_pText;
+    }
+
+    void RDP::SetProtocolVersion(int v)
+    {
+        m_pOps->SetVersion((OpStream::VERSION_2 == v) ? OpStream::VERSION_2 : OpStream::VERSION_1);
+    }
+
+    void RDP::SetChannelParams(const WsChannelParams &params)
+    {
+        m_pRelay->Configure(params);
+    }
+
+    void RDP::SetCursorCache(CursorCache *cache)
     {
+        m_pCursorCache = cache;
+    }
+
+    void RDP::CreateInstance()
+    {
+        m_freerdp = freerdp_new();
         if (!m_freerdp) {
             throw tracing::runtime_error("Could not create freerep instance");
         }
@@ -346,41 +511,43 @@ namespace wsgate {
         m_freerdp->ContextFree = cbContextFree;
         m_freerdp->Authenticate = cbAuthenticate;
         m_freerdp->VerifyCertificate = reinterpret_cast<pVerifyCertificate>(cbVerifyCertificate);
+        m_freerdp->ReceiveChannelData = cbReceiveChannelData;
 
         freerdp_context_new(m_freerdp);
         reinterpret_cast<wsgContext *>(m_freerdp->context)->pRDP = this;
         reinterpret_cast<wsgContext *>(m_freerdp->context)->pUpdate = m_pUpdate;
         reinterpret_cast<wsgContext *>(m_freerdp->context)->pPrimary = m_pPrimary;
-        // create worker thread
-        m_bThreadLoop = true;
-        if (0 != pthread_create(&m_worker, NULL, cbThreadFunc, reinterpret_cast<void *>(this))) {
-            m_bThreadLoop = false;
-            log::err << "Could not create RDP client thread" << endl;
-        } else {
-            log::debug << "Created RDP client thread" << endl;
-        }
     }
 
-    RDP::~RDP()
+    void RDP::ReleaseInstance()
     {
-        log::debug << __PRETTY_FUNCTION__ << endl;
-        Disconnect();
-        freerdp_context_free(m_freerdp);
-        freerdp_free(m_freerdp);
-        m_instances.erase(m_freerdp);
-        delete m_pUpdate;
-        delete m_pPrimary;
+        if (m_freerdp) {
+            freerdp_context_free(m_freerdp);
+            freerdp_free(m_freerdp);
+            m_instances.erase(m_freerdp);
+            m_freerdp = 0;
+            m_rdpContext = 0;
+            m_rdpInput = 0;
+            m_rdpSettings = 0;
+            m_pDisp = 0;
+        }
     }
 
     bool RDP::Connect(string host, string pcb, string user, string domain, string pass,
             const WsRdpParams &params)
     {
+        if (m_freerdp) {
+            if (STATE_INITIAL != m_State) {
+                throw tracing::runtime_error("RDP session already started");
+            }
+            // The previous attempt failed (e.g. bad credentials), start over.
+            Disconnect();
+            ReleaseInstance();
+        }
+        CreateInstance();
         if (!m_rdpSettings) {
             throw tracing::runtime_error("m_rdpSettings is NULL");
         }
-        if (!m_bThreadLoop) {
-            throw tracing::runtime_error("worker thread has terminated");
-        }
 
         m_rdpSettings->ServerPort = params.port;
 
@@ -452,6 +619,15 @@ namespace wsgate {
 
         m_State = STATE_CONNECT;
 
+        // create worker thread
+        m_bThreadLoop = true;
+        if (0 != pthread_create(&m_worker, NULL, cbThreadFunc, reinterpret_cast<void *>(this))) {
+            m_bThreadLoop = false;
+            m_State = STATE_INITIAL;
+            throw tracing::runtime_error("Could not create RDP client thread");
+        }
+        log::debug << "Created RDP client thread" << endl;
+
         return true;
     }
 
@@ -503,7 +679,7 @@ namespace wsgate {
                         }
 
                         for(unsigned int i=0;i<actionList.size();i++){
-                            freerdp_input_send_keyboard_event(m_rdpInput, actionList[i].first, actionList[i].second);
+                            QueueKeyboard(actionList[i].first, actionList[i].second);
                         }
                     }
                     break;
@@ -516,7 +692,7 @@ namespace wsgate {
                             uint32_t y;
                         } wsmsg;
                         const wsmsg *m = reinterpret_cast<const wsmsg *>(data.data());
-                        m_freerdp->input->MouseEvent(m_freerdp->input, m->flags, m->x, m->y);
+                        QueueMouse(m->flags, m->x, m->y);
                     }
                     break;
                 case WSOP_CS_KUPDOWN:                    
@@ -527,19 +703,7 @@ namespace wsgate {
                             uint32_t code;
                         } wsmsg;
                         const wsmsg *m = reinterpret_cast<const wsmsg *>(data.data());
-                        log::info << "K" << ((m->down) ? "down" : "up") << ": c=" << m->code << endl;
-                        uint32_t tcode = m->code;
-                        if (0 < tcode) {
-                            log::info << "257 >> tcode: " << tcode << "\n";
-                            //make byte
-                            tcode = RDP_SCANCODE_CODE(tcode);
-                            //apply extended 
-                            tcode = ASCII_TO_SCANCODE[tcode];
-                            //extract extended sepparatelly in tflag
-                            uint32_t tflag = RDP_SCANCODE_EXTENDED(tcode) ? KBD_FLAGS_EXTENDED : 0;
-                            //now make the call
-                            freerdp_input_send_keyboard_event(m_rdpInput, (m->down ? KBD_FLAGS_DOWN : KBD_FLAGS_RELEASE)|tflag, tcode);
-                        }
+                        QueueKeyUpDown(m->down, m->code);
                     }
                     break;
                 //Normally this branch is not reached. Will be removed on refactoring. 
@@ -566,8 +730,8 @@ namespace wsgate {
                                     log::info << "Kpress oc=" << tcode << endl;
                                     if (0 < tcode) {
                                     	log::info << "282\n";
-                                    	SendInputUnicodeKeyboardEvent(KBD_FLAGS_DOWN, ASCII_TO_SCANCODE[tcode]);
-                                    	SendInputUnicodeKeyboardEvent(KBD_FLAGS_RELEASE, ASCII_TO_SCANCODE[tcode]);
+                                    	QueueUnicode(KBD_FLAGS_DOWN, ASCII_TO_SCANCODE[tcode]);
+                                    	QueueUnicode(KBD_FLAGS_RELEASE, ASCII_TO_SCANCODE[tcode]);
                                     }
                                 }
                             } else {
@@ -577,18 +741,18 @@ namespace wsgate {
                                     if(tcode == 96)
                                     {
                                         log::info << "JACKPOT2!" << endl;
-                                        freerdp_input_send_keyboard_event(m_rdpInput, KBD_FLAGS_DOWN, RDP_SCANCODE_LCONTROL);
-                                        freerdp_input_send_keyboard_event(m_rdpInput, KBD_FLAGS_DOWN, RDP_SCANCODE_LMENU);
-                                        freerdp_input_send_keyboard_event(m_rdpInput, KBD_FLAGS_DOWN, RDP_SCANCODE_DELETE);
+                                        QueueKeyboard(KBD_FLAGS_DOWN, RDP_SCANCODE_LCONTROL);
+                                        QueueKeyboard(KBD_FLAGS_DOWN, RDP_SCANCODE_LMENU);
+                                        QueueKeyboard(KBD_FLAGS_DOWN, RDP_SCANCODE_DELETE);
 
-                                        freerdp_input_send_keyboard_event(m_rdpInput, KBD_FLAGS_RELEASE, RDP_SCANCODE_LCONTROL);
-                                        freerdp_input_send_keyboard_event(m_rdpInput, KBD_FLAGS_RELEASE, RDP_SCANCODE_LMENU);
-                                        freerdp_input_send_keyboard_event(m_rdpInput, KBD_FLAGS_RELEASE, RDP_SCANCODE_DELETE);
+                                        QueueKeyboard(KBD_FLAGS_RELEASE, RDP_SCANCODE_LCONTROL);
+                                        QueueKeyboard(KBD_FLAGS_RELEASE, RDP_SCANCODE_LMENU);
+                                        QueueKeyboard(KBD_FLAGS_RELEASE, RDP_SCANCODE_DELETE);
                                     }
                                     
                                     log::info << "tcode: " << tcode << " m->code: " << m->code << endl;
-                                    freerdp_input_send_keyboard_event(m_rdpInput, KBD_FLAGS_DOWN, ASCII_TO_SCANCODE[tcode]);
-                                    freerdp_input_send_keyboard_event(m_rdpInput, KBD_FLAGS_RELEASE, ASCII_TO_SCANCODE[tcode]);
+                                    QueueKeyboard(KBD_FLAGS_DOWN, ASCII_TO_SCANCODE[tcode]);
+                                    QueueKeyboard(KBD_FLAGS_RELEASE, ASCII_TO_SCANCODE[tcode]);
 
                                 }
                             }
@@ -602,21 +766,129 @@ namespace wsgate {
 
                                 log::info << "353 tcode: " << tcode <<" & tflag: " << tflag << "\n";
 
-                                freerdp_input_send_keyboard_event(m_rdpInput, KBD_FLAGS_DOWN, ASCII_TO_SCANCODE[tcode]);
-                                freerdp_input_send_keyboard_event(m_rdpInput, KBD_FLAGS_RELEASE, ASCII_TO_SCANCODE[tcode]);
+                                QueueKeyboard(KBD_FLAGS_DOWN, ASCII_TO_SCANCODE[tcode]);
+                                QueueKeyboard(KBD_FLAGS_RELEASE, ASCII_TO_SCANCODE[tcode]);
 
                             }
                         }
                     }
                     break;
                 case WSOP_CS_UNICODE:
-                    const uint32_t* unicodeString = reinterpret_cast<const uint32_t*>(data.data());
-                    //skip the header // WSOP_CS_UNICODE
-                    unicodeString++;
-                    unsigned int len = data.length() / 4 - 1;
-                    for(int i=0; i < len; i++){
-                        freerdp_input_send_unicode_keyboard_event(m_rdpInput, KBD_FLAGS_DOWN, (UINT16) unicodeString[i]);
-                        freerdp_input_send_unicode_keyboard_event(m_rdpInput, KBD_FLAGS_RELEASE, (UINT16) unicodeString[i]);
+                    {
+                        const uint32_t* unicodeString = reinterpret_cast<const uint32_t*>(data.data());
+                        //skip the header // WSOP_CS_UNICODE
+                        unicodeString++;
+                        unsigned int len = data.length() / 4 - 1;
+                        // Typed by the session thread in paced chunks.
+                        if (m_pText->Append(unicodeString, len)) {
+                            InputEvent ev = { InputQueue::INPUT_TEXT, 0, 0, 0 };
+                            if (!QueueInput(ev)) {
+                                // Each marker must have its text and vice versa.
+                                m_pText->Revoke();
+                            }
+                        }
+                    }
+                    break;
+                case WSOP_CS_VISIBILITY:
+                    {
+                        typedef struct {
+                            uint32_t op;
+                            uint32_t visible;
+                        } wsmsg;
+                        if (data.length() < sizeof(wsmsg)) {
+                            break;
+                        }
+                        const wsmsg *m = reinterpret_cast<const wsmsg *>(data.data());
+                        InputEvent ev = {
+                            InputQueue::INPUT_VISIBILITY, static_cast<uint16_t>(m->visible ? 1 : 0), 0, 0
+                        };
+                        QueueInput(ev);
+                    }
+                    break;
+                case WSOP_CS_RESIZE:
+                    {
+                        typedef struct {
+                            uint32_t op;
+                            uint32_t width;
+                            uint32_t height;
+                        } wsmsg;
+                        if (data.length() < sizeof(wsmsg)) {
+                            break;
+                        }
+                        const wsmsg *m = reinterpret_cast<const wsmsg *>(data.data());
+                        InputEvent ev = {
+                            InputQueue::INPUT_RESIZE, 0,
+                            static_cast<uint16_t>(min(m->width, 65535U)),
+                            static_cast<uint16_t>(min(m->height, 65535U))
+                        };
+                        QueueInput(ev);
+                    }
+                    break;
+                case WSOP_CS_AUDIO_FEEDBACK:
+                    {
+                        typedef struct {
+                            uint32_t op;
+                            uint32_t seq;
+                            uint32_t age;
+                            uint32_t lost;
+                            uint32_t late;
+                        } wsmsg;
+                        if ((data.length() < sizeof(wsmsg)) || !m_pAudio) {
+                            break;
+                        }
+                        const wsmsg *m = reinterpret_cast<const wsmsg *>(data.data());
+                        m_pAudio->OnFeedback(m->seq, m->age, m->lost, m->late);
+                    }
+                    break;
+                case WSOP_CS_VC_DATA:
+                    m_pRelay->OnClientData(data);
+                    break;
+                case WSOP_CS_VC_ACK:
+                    {
+                        typedef struct {
+                            uint32_t op;
+                            uint32_t chan;
+                            uint32_t bytes;
+                        } wsmsg;
+                        if (data.length() < sizeof(wsmsg)) {
+                            break;
+                        }
+                        const wsmsg *m = reinterpret_cast<const wsmsg *>(data.data());
+                        m_pRelay->OnClientAck(m->chan, m->bytes);
+                    }
+                    break;
+                case WSOP_CS_INPUT_BATCH:
+                    {
+                        // Header: op, count; followed by count records of 4 words,
+                        // each carrying a WSOP_CS_MOUSE or WSOP_CS_KUPDOWN message.
+                        typedef struct {
+                            uint32_t op;
+                            uint32_t p1;
+                            uint32_t p2;
+                            uint32_t p3;
+                        } wsrec;
+                        if (data.length() < 8) {
+                            break;
+                        }
+                        const uint32_t count = op[1];
+                        if ((data.length() - 8) / sizeof(wsrec) < count) {
+                            log::warn << "Truncated input batch" << endl;
+                            break;
+                        }
+                        const wsrec *r = reinterpret_cast<const wsrec *>(data.data() + 8);
+                        for (uint32_t i = 0; i < count; ++i) {
+                            switch (r[i].op) {
+                                case WSOP_CS_MOUSE:
+                                    QueueMouse(r[i].p1, r[i].p2, r[i].p3);
+                                    break;
+                                case WSOP_CS_KUPDOWN:
+                                    QueueKeyUpDown(r[i].p1, r[i].p2);
+                                    break;
+                                default:
+                                    log::warn << "Unsupported op " << r[i].op << " in input batch" << endl;
+                                    break;
+                            }
+                        }
                     }
                     break;
             }
@@ -663,16 +935,232 @@ namespace wsgate {
                             params.height = 768;
                         }
                     }
-                    this->m_rsh->PrepareRDP(host, pcb, user, pass, params);
+                    this->m_launcher->PrepareRDP(this, host, pcb, user, pass, params);
                 }
                 catch (exception &e){
                     log::err << "Error starting RDP session:" << e.what() << std::endl;
+                    m_wshandler->send_text(string("E:") + e.what());
                 }
                 break;
             }
         }
     }
 
+    void RDP::QueueKeyUpDown(uint32_t down, uint32_t code)
+    {
+        log::info << "K" << (down ? "down" : "up") << ": c=" << code << endl;
+        uint32_t tcode = code;
+        if (0 < tcode) {
+            log::info << "257 >> tcode: " << tcode << "\n";
+            //make byte
+            tcode = RDP_SCANCODE_CODE(tcode);
+            //apply extended 
+            tcode = ASCII_TO_SCANCODE[tcode];
+            //extract extended sepparatelly in tflag
+            uint32_t tflag = RDP_SCANCODE_EXTENDED(tcode) ? KBD_FLAGS_EXTENDED : 0;
+            QueueKeyboard((down ? KBD_FLAGS_DOWN : KBD_FLAGS_RELEASE)|tflag, tcode);
+        }
+    }
+
+    void RDP::QueueMouse(uint32_t flags, uint32_t x, uint32_t y)
+    {
+        InputEvent ev = {
+            InputQueue::INPUT_MOUSE, static_cast<uint16_t>(flags),
+            static_cast<uint16_t>(x), static_cast<uint16_t>(y)
+        };
+        QueueInput(ev);
+    }
+
+    void RDP::QueueKeyboard(uint32_t flags, uint32_t code)
+    {
+        InputEvent ev = {
+            InputQueue::INPUT_KEYBOARD, static_cast<uint16_t>(flags),
+            static_cast<uint16_t>(code), 0
+        };
+        QueueInput(ev);
+    }
+
+    void RDP::QueueUnicode(uint32_t flags, uint32_t code)
+    {
+        InputEvent ev = {
+            InputQueue::INPUT_UNICODE, static_cast<uint16_t>(flags),
+            static_cast<uint16_t>(code), 0
+        };
+        QueueInput(ev);
+    }
+
+    bool RDP::QueueInput(const InputEvent &ev)
+    {
+        if (m_bInputOverflow) {
+            return false;
+        }
+        if (IsMouseMove(ev)) {
+            // Consecutive moves collapse into the latest one, which is
+            // queued ahead of the next other event or picked up by the
+            // session thread, once it has drained the queue.
+            if (0 != m_parkedMove.exchange(ParkMove(ev))) {
+                m_nCoalesced++;
+            }
+            return true;
+        }
+        // A parked move has to be queued before anything that follows it.
+        uint64_t parked = m_parkedMove.exchange(0);
+        if (((0 == parked) || m_input.Push(UnparkMove(parked))) && m_input.Push(ev)) {
+            return true;
+        }
+        // Never block the I/O thread and never lose a key up or down
+        // (which would leave a key stuck on the server).
+        log::warn << "Input queue overflow, closing session" << endl;
+        m_bInputOverflow = true;
+        return false;
+    }
+
+    uint64_t RDP::ParkMove(const InputEvent &ev)
+    {
+        return (uint64_t(1) << 32) | (uint64_t(ev.x) << 16) | ev.y;
+    }
+
+    InputEvent RDP::UnparkMove(uint64_t parked)
+    {
+        InputEvent ev = {
+            InputQueue::INPUT_MOUSE, PTR_FLAGS_MOVE,
+            static_cast<uint16_t>(parked >> 16), static_cast<uint16_t>(parked)
+        };
+        return ev;
+    }
+
+    bool RDP::IsMouseMove(const InputEvent &ev)
+    {
+        return (InputQueue::INPUT_MOUSE == ev.type) && (PTR_FLAGS_MOVE == ev.flags);
+    }
+
+    void RDP::DispatchInput(const InputEvent &ev)
+    {
+        switch (ev.type) {
+            case InputQueue::INPUT_MOUSE:
+                freerdp_input_send_mouse_event(m_rdpInput, ev.flags, ev.x, ev.y);
+                break;
+            case InputQueue::INPUT_KEYBOARD:
+                freerdp_input_send_keyboard_event(m_rdpInput, ev.flags, ev.x);
+                break;
+            case InputQueue::INPUT_UNICODE:
+                freerdp_input_send_unicode_keyboard_event(m_rdpInput, ev.flags, ev.x);
+                break;
+            case InputQueue::INPUT_VISIBILITY:
+                SetVisible(0 != ev.flags);
+                break;
+            case InputQueue::INPUT_RESIZE:
+                // Only the last size of a burst of resize events is applied.
+                m_resizeW = ev.x;
+                m_resizeH = ev.y;
+                m_resizeDue = chrono::steady_clock::now() + chrono::milliseconds(RESIZE_DELAY);
+                m_bResizePending = true;
+                break;
+        }
+    }
+
+    void RDP::ProcessResize()
+    {
+        if (!m_bResizePending || !m_pDisp || (chrono::steady_clock::now() < m_resizeDue)) {
+            return;
+        }
+        m_bResizePending = false;
+        // MS-RDPEDISP: 200 - 8192 pixels, the width must be even.
+        uint32_t w = min(max(m_resizeW, 200U), 8192U) & ~1U;
+        uint32_t h = min(max(m_resizeH, 200U), 8192U);
+        if ((w == m_rdpSettings->DesktopWidth) && (h == m_rdpSettings->DesktopHeight)) {
+            return;
+        }
+        log::debug << "Requesting desktop size " << w << "x" << h << endl;
+        DISPLAY_CONTROL_MONITOR_LAYOUT layout;
+        memset(&layout, 0, sizeof(layout));
+        layout.Flags = DISPLAY_CONTROL_MONITOR_PRIMARY;
+        layout.Width = w;
+        layout.Height = h;
+        layout.DesktopScaleFactor = 100;
+        layout.DeviceScaleFactor = 100;
+        m_pDisp->SendMonitorLayout(m_pDisp, 1, &layout);
+    }
+
+    void RDP::SetVisible(bool visible)
+    {
+        if (visible == m_bVisible) {
+            return;
+        }
+        m_bVisible = visible;
+        log::debug << "Client " << (visible ? "visible" : "hidden") << endl;
+        rdpUpdate *update = m_freerdp->update;
+        RECTANGLE_16 r;
+        r.left = 0;
+        r.top = 0;
+        r.right = m_rdpSettings->DesktopWidth - 1;
+        r.bottom = m_rdpSettings->DesktopHeight - 1;
+        if (update->SuppressOutput) {
+            update->SuppressOutput(m_rdpContext, visible ? 1 : 0, visible ? &r : NULL);
+        }
+        // Whatever changed while hidden has to be repainted.
+        if (visible && update->RefreshRect) {
+            update->RefreshRect(m_rdpContext, 1, &r);
+        }
+    }
+
+    void RDP::ProcessInput()
+    {
+        // Drain the queue even while a text is being typed, so that the
+        // events, held back behind it, don't make the queue overflow.
+        InputEvent batch[256];
+        bool drained = false;
+        while (!drained && (m_held.size() < MAX_HELD)) {
+            size_t n = m_input.Pop(batch, min(sizeof(batch) / sizeof(batch[0]), MAX_HELD - m_held.size()));
+            m_held.insert(m_held.end(), batch, batch + n);
+            drained = (0 == n);
+        }
+        uint64_t parked = drained ? m_parkedMove.exchange(0) : 0;
+        if (0 != parked) {
+            // The queue is empty, so the parked move is the latest event.
+            if (!m_held.empty() && IsMouseMove(m_held.back())) {
+                m_held.back() = UnparkMove(parked);
+                m_nCoalesced++;
+            } else {
+                m_held.push_back(UnparkMove(parked));
+            }
+        }
+        // Events behind a text are held back until it has been typed completely.
+        if (m_pText->Pump(m_rdpInput)) {
+            return;
+        }
+        InputEvent move;
+        bool haveMove = false;
+        while (!m_held.empty()) {
+            InputEvent ev = m_held.front();
+            m_held.pop_front();
+            if (IsMouseMove(ev)) {
+                // Consecutive moves collapse into the latest position.
+                if (haveMove) {
+                    m_nCoalesced++;
+                }
+                move = ev;
+                haveMove = true;
+                continue;
+            }
+            if (haveMove) {
+                DispatchInput(move);
+                haveMove = false;
+            }
+            if (InputQueue::INPUT_TEXT == ev.type) {
+                m_pText->Start();
+                if (m_pText->Pump(m_rdpInput)) {
+                    return;
+                }
+                continue;
+            }
+            DispatchInput(ev);
+        }
+        if (haveMove) {
+            DispatchInput(move);
+        }
+    }
+
     bool RDP::CheckFileDescriptor()
     {
         return ((freerdp_check_fds(m_freerdp) == 0) ? false : true);
@@ -729,15 +1217,6 @@ namespace wsgate {
         freerdp_input_send_extended_mouse_event(m_rdpInput, flags, x, y);
     }
 
-    RDP::cursor RDP::GetCursor(uint32_t cid)
-    {
-        CursorMap::iterator it = m_cursorMap.find(cid);
-        if (it != m_cursorMap.end()) {
-            return it->second;
-        }
-        return cursor(0, string());
-    }
-
     // private
     int RDP::ContextNew(freerdp *inst, rdpContext *ctx)
     {
@@ -747,15 +1226,21 @@ namespace wsgate {
         m_rdpContext = ctx;
         m_rdpInput = inst->input;
         m_rdpSettings = inst->settings;
+        ctx->channels = freerdp_channels_new();
 
         //mrd: return value not used. just set it to 0
         return 0;
     }
 
     // private
-    void RDP::ContextFree(freerdp *, rdpContext *ctx)
+    void RDP::ContextFree(freerdp *inst, rdpContext *ctx)
     {
         log::debug << "RDP::ContextFree" << endl;
+        if (NULL != ctx->channels) {
+            freerdp_channels_close(ctx->channels, inst);
+            freerdp_channels_free(ctx->channels);
+            ctx->channels = NULL;
+        }
         if (NULL != ctx->cache) {
             cache_free(ctx->cache);
             ctx->cache = NULL;
@@ -827,6 +1312,33 @@ namespace wsgate {
 
         m_freerdp->context->cache = cache_new(m_freerdp->settings);
 
+        // Display Control, for resizing the desktop without reconnecting
+        m_rdpSettings->SupportDynamicChannels = TRUE;
+        m_rdpSettings->SupportDisplayControl = TRUE;
+        char *disp[] = { const_cast<char *>("disp") };
+        freerdp_client_add_dynamic_channel(m_rdpSettings, 1, disp);
+        PubSub_SubscribeChannelConnected(rdp->context->pubSub,
+                reinterpret_cast<pChannelConnectedEventHandler>(cbChannelConnected));
+        PubSub_SubscribeChannelDisconnected(rdp->context->pubSub,
+                reinterpret_cast<pChannelDisconnectedEventHandler>(cbChannelDisconnected));
+#ifdef HAVE_OPUS
+        // Audio output via our own rdpsnd device, which finds the
+        // session's encoder by the address, passed in its arguments.
+        m_rdpSettings->AudioPlayback = TRUE;
+        ostringstream devarg;
+        devarg << "dev:" << static_cast<void *>(m_pAudio);
+        string dev = devarg.str();
+        char *snd[] = {
+            const_cast<char *>("rdpsnd"),
+            const_cast<char *>("sys:wsgate"),
+            const_cast<char *>(dev.c_str())
+        };
+        freerdp_client_add_static_channel(m_rdpSettings, 3, snd);
+#endif
+        freerdp_client_load_addins(rdp->context->channels, m_rdpSettings);
+        freerdp_channels_pre_connect(rdp->context->channels, rdp);
+        m_pRelay->Register(m_rdpSettings);
+
         return TRUE;
 
     }
@@ -834,6 +1346,7 @@ namespace wsgate {
     // private
     BOOL RDP::PostConnect(freerdp *rdp)
     {
+        freerdp_channels_post_connect(rdp->context->channels, rdp);
 
         ostringstream oss;
         oss << "S:" << hex << this;
@@ -856,6 +1369,7 @@ namespace wsgate {
         }
         msg.append("RDP session connection started.");
         m_wshandler->send_text(msg);
+        m_pRelay->Connected(m_rdpSettings);
         //make sure that the client gets the resize event
         m_freerdp->update->DesktopResize(m_freerdp->context);
 
@@ -876,19 +1390,37 @@ namespace wsgate {
         return true;
     }
 
-    // private
-    void RDP::Pointer_New(rdpContext* context, rdpPointer* pointer)
+    // Content key of a pointer: SHA1 over everything, which determines its image.
+    static std::string cursorKey(const rdpPointer *pointer, HCLRCONV hclrconv)
     {
-#ifdef DBGLOG_POINTER_NEW
-        log::debug << "PN id=" << m_ptrId
-            << " w=" << pointer->width << " h=" << pointer->height
-            << " hx=" << pointer->xPos << " hy=" << pointer->yPos << endl;
-#endif
-        HCLRCONV hclrconv = reinterpret_cast<wsgContext *>(context)->clrconv;
-        size_t psize = pointer->width * pointer->height * 4;
+        SHA1 sha1;
+        uint32_t hdr[7] = {
+            pointer->width, pointer->height, pointer->xPos, pointer->yPos,
+            pointer->xorBpp, pointer->lengthXorMask, pointer->lengthAndMask
+        };
+        sha1.Input(reinterpret_cast<const unsigned char *>(hdr), sizeof(hdr));
+        if (pointer->xorMaskData && pointer->andMaskData) {
+            sha1.Input(pointer->xorMaskData, pointer->lengthXorMask);
+            sha1.Input(pointer->andMaskData, pointer->lengthAndMask);
+            if ((8 >= pointer->xorBpp) && hclrconv->palette) {
+                sha1.Input(reinterpret_cast<const unsigned char *>(hclrconv->palette->entries),
+                        sizeof(hclrconv->palette->entries));
+            }
+        }
+        unsigned digest[5];
+        sha1.Result(digest);
+        std::ostringstream oss;
+        oss << std::hex << std::setfill('0');
+        for (int i = 0; i < 5; ++i) {
+            oss << std::setw(8) << digest[i];
+        }
+        return oss.str();
+    }
 
-        MyPointer *p = reinterpret_cast<MyPointer *>(pointer);
-        p->id = m_ptrId++;
+    // Converts a pointer into a .cur file with an embedded PNG image.
+    static std::string cursorImage(const rdpPointer *pointer, HCLRCONV hclrconv)
+    {
+        size_t psize = pointer->width * pointer->height * 4;
         uint8_t *pixels = new uint8_t[psize];
         memset(pixels, 0, psize);
         if ((pointer->andMaskData != 0) && (pointer->xorMaskData != 0)) {
@@ -964,23 +1496,30 @@ namespace wsgate {
         //add the image as a PNG format
         curImage.append(png_string.c_str(), png_string.length());
 
-        m_cursorMap[p->id] =
-            cursor(time(NULL), curImage);
-
         delete []pixels;
-        struct {
-            uint32_t op;
-            uint32_t id;
-            uint32_t hx;
-            uint32_t hy;
-        } tmp = {
-            WSOP_SC_PTR_NEW,
-            p->id,
-            pointer->xPos,
-            pointer->yPos
-        };
-        string buf(reinterpret_cast<const char *>(&tmp), sizeof(tmp));
-        m_wshandler->send_binary(buf);
+        return curImage;
+    }
+
+    // private
+    void RDP::Pointer_New(rdpContext* context, rdpPointer* pointer)
+    {
+#ifdef DBGLOG_POINTER_NEW
+        log::debug << "PN id=" << m_ptrId
+            << " w=" << pointer->width << " h=" << pointer->height
+            << " hx=" << pointer->xPos << " hy=" << pointer->yPos << endl;
+#endif
+        HCLRCONV hclrconv = reinterpret_cast<wsgContext *>(context)->clrconv;
+        MyPointer *p = reinterpret_cast<MyPointer *>(pointer);
+        p->id = m_ptrId++;
+
+        // Most cursors have already been encoded for another session.
+        std::string key = cursorKey(pointer, hclrconv);
+        CursorCache::image_ptr img = m_pCursorCache->Find(key);
+        if (!img) {
+            img = m_pCursorCache->Insert(key, cursorImage(pointer, hclrconv));
+        }
+        m_cursorMap[p->id] = img;
+        m_pOps->PointerNew(p->id, pointer->xPos, pointer->yPos, m_pCursorCache->GetRoute() + key);
     }
 
     // private
@@ -995,17 +1534,9 @@ namespace wsgate {
         }
 #endif
         if (p->id) {
-            struct {
-                uint32_t op;
-                uint32_t id;
-            } tmp = {
-                WSOP_SC_PTR_FREE,
-                p->id
-            };
             m_cursorMap.erase(p->id);
+            m_pOps->PointerFree(p->id);
             p->id = 0;
-            string buf(reinterpret_cast<const char *>(&tmp), sizeof(tmp));
-            m_wshandler->send_binary(buf);
         }
     }
 
@@ -1016,15 +1547,7 @@ namespace wsgate {
 #ifdef DBGLOG_POINTER_SET
         log::debug << "PS " << p->id << endl;
 #endif
-        struct {
-            uint32_t op;
-            uint32_t id;
-        } tmp = {
-            WSOP_SC_PTR_SET,
-            p->id
-        };
-        string buf(reinterpret_cast<const char *>(&tmp), sizeof(tmp));
-        m_wshandler->send_binary(buf);
+        m_pOps->PointerSet(p->id);
     }
 
     // private
@@ -1033,9 +1556,7 @@ namespace wsgate {
 #ifdef DBGLOG_POINTER_SETNULL
         log::debug << "PN" << endl;
 #endif
-        uint32_t op = WSOP_SC_PTR_SETNULL;
-        string buf(reinterpret_cast<const char *>(&op), sizeof(op));
-        m_wshandler->send_binary(buf);
+        m_pOps->PointerSetNull();
     }
 
     // private
@@ -1044,9 +1565,7 @@ namespace wsgate {
 #ifdef DBGLOG_POINTER_SETDEFAULT
         log::debug << "PD" << endl;
 #endif
-        uint32_t op = WSOP_SC_PTR_SETDEFAULT;
-        string buf(reinterpret_cast<const char *>(&op), sizeof(op));
-        m_wshandler->send_binary(buf);
+        m_pOps->PointerSetDefault();
     }
 
     // private
@@ -1088,6 +1607,10 @@ namespace wsgate {
                     }
                 }
             }
+            if (m_bInputOverflow) {
+                addError("Too much input, session closed.");
+                m_bThreadLoop = false;
+            }
             if (!m_errMsg.empty()) {
                 log::debug << m_errMsg << endl;
                 std::string errorMsg = "";
@@ -1103,7 +1626,11 @@ namespace wsgate {
             }
             switch (m_State) {
                 case STATE_CONNECTED:
+                    ProcessInput();
+                    ProcessResize();
+                    m_pRelay->Process(m_freerdp);
                     CheckFileDescriptor();
+                    freerdp_channels_check_fds(m_freerdp->context->channels, m_freerdp);
                     break;
                 case STATE_CONNECT:
                 	if(freerdp_connect(m_freerdp)) {
@@ -1119,7 +1646,8 @@ namespace wsgate {
             }
             usleep(1000);
         }
-        log::debug << "RDP client thread terminated" << endl;
+        log::debug << "RDP client thread terminated, " << m_nCoalesced.load()
+            << " mouse moves coalesced" << endl;
         if (STATE_CONNECTED == m_State) {
             m_wshandler->send_text("T:");
         }
@@ -1172,6 +1700,63 @@ namespace wsgate {
         return false;
     }
 
+    // private
+    int RDP::ReceiveChannelData(freerdp* inst, int chId, uint8_t* data, int size,
+            int flags, int total_size)
+    {
+        if (m_pRelay->OnServerData(chId, data, size, flags, total_size)) {
+            return 0;
+        }
+        return freerdp_channels_data(inst, chId, data, size, flags, total_size);
+    }
+
+    // private
+    void RDP::ChannelConnected(ChannelConnectedEventArgs *e)
+    {
+        log::debug << "Channel " << e->name << " connected" << endl;
+        if (0 == strcmp(e->name, DISP_DVC_CHANNEL_NAME)) {
+            m_pDisp = reinterpret_cast<DispClientContext *>(e->pInterface);
+        }
+    }
+
+    // private
+    void RDP::ChannelDisconnected(ChannelDisconnectedEventArgs *e)
+    {
+        log::debug << "Channel " << e->name << " disconnected" << endl;
+        if (0 == strcmp(e->name, DISP_DVC_CHANNEL_NAME)) {
+            m_pDisp = 0;
+        }
+    }
+
+    // private C callback
+    int RDP::cbReceiveChannelData(freerdp* inst, int chId, uint8_t* data, int size,
+            int flags, int total_size)
+    {
+        RDP *self = reinterpret_cast<wsgContext *>(inst->context)->pRDP;
+        if (self) {
+            return self->ReceiveChannelData(inst, chId, data, size, flags, total_size);
+        }
+        return 0;
+    }
+
+    // private C callback
+    void RDP::cbChannelConnected(void *context, ChannelConnectedEventArgs *e)
+    {
+        RDP *self = reinterpret_cast<wsgContext *>(context)->pRDP;
+        if (self) {
+            self->ChannelConnected(e);
+        }
+    }
+
+    // private C callback
+    void RDP::cbChannelDisconnected(void *context, ChannelDisconnectedEventArgs *e)
+    {
+        RDP *self = reinterpret_cast<wsgContext *>(context)->pRDP;
+        if (self) {
+            self->ChannelDisconnected(e);
+        }
+    }
+
     // private C callback
     BOOL RDP::cbAuthenticate(freerdp *inst, char** user, char** pass, char** domain)
     {
@@ -21,12 +21,18 @@
 #define _WSGATE_RDP_H_
 
 #include <pthread.h>
+#include <deque>
 #include <map>
 #include <string>
 #include <boost/shared_ptr.hpp>
+#include <atomic>
+#include <chrono>
 #include <boost/tuple/tuple.hpp>
 
 #include "rdpcommon.hpp"
+#include <freerdp/event.h>
+#include <freerdp/client/disp.h>
+#include "InputQueue.hpp"
 
 namespace wsgate {
 
@@ -38,7 +44,30 @@ namespace wsgate {
        ,CONTEXT_EMBEDDED
     } EmbeddedContext;
 
-    class MyRawSocketHandler;
+    class RDP;
+
+    /**
+     * Interface for starting an RDP session, once the client has sent
+     * its credentials (WSOP_CS_CREDENTIAL_JSON).
+     * Implemented by the owner of the WebSocket connection.
+     */
+    class RdpLauncher {
+        public:
+            virtual ~RdpLauncher() { }
+
+            /**
+             * Connects an RDP session, created by this launcher.
+             * @param rdp The RDP instance, which received the credentials.
+             * @param host The RDP host to connect to.
+             * @param pcb The preconnection blob.
+             * @param user The user name to be used for the RDP session.
+             * @param pass The password to be used for the RDP session.
+             * @param params Additional RDP parameters.
+             */
+            virtual void PrepareRDP(RDP *rdp, const std::string host, const std::string pcb,
+                    const std::string user, const std::string pass, const WsRdpParams &params) = 0;
+    };
+
     /**
      * This class serves as a wrapper around the
      * main FreeRDP API.
@@ -57,19 +86,29 @@ namespace wsgate {
             } State;
             
 
-            /// Map for storing cursor images of this session
-            typedef boost::tuple<time_t, std::string> cursor;
-            typedef std::map<uint32_t, cursor> CursorMap;
+            /// Map for keeping the cursor images of this session in the cache
+            typedef std::map<uint32_t, boost::shared_ptr<const std::string> > CursorMap;
 
             /**
              * Constructor
              * @param h The WebSockets handler to be used for communication with the client.
-             * @param rsh The Raw Socket handler that is used for starting the RDP session
+             * @param launcher The launcher that is used for starting the RDP session
              */
-            RDP(wspp::wshandler *h, MyRawSocketHandler *rsh, EmbeddedContext embeddedContext = CONTEXT_PLAIN);
+            RDP(wspp::wshandler *h, RdpLauncher *launcher, EmbeddedContext embeddedContext = CONTEXT_PLAIN);
             /// Destructor
             virtual ~RDP();
 
+            /**
+             * Initializes FreeRDP's process-wide state.
+             * Must be invoked once at startup, before any session is created.
+             */
+            static void GlobalInit();
+            /**
+             * Releases FreeRDP's process-wide state.
+             * Must be invoked once at shutdown, after all sessions are gone.
+             */
+            static void GlobalUninit();
+
             /**
              * Sets the error message for the last error.
              * @param msg The message.
@@ -77,6 +116,8 @@ namespace wsgate {
             void SetError(std::string msg);
             /**
              * Initiates the actual RDP session.
+             * Creates the FreeRDP instance and the session thread.
+             * If a previous attempt has failed, its instance is replaced.
              * @param host The RDP host to connect to.
              * @param user The user name to be used for the RDP session.
              * @param domain The domain name to be used for the RDP session.
@@ -99,15 +140,10 @@ namespace wsgate {
             /**
              * Handler for incoming WebSockets messages.
              * Called from the WebSockets codec, whenever the client sent a message.
+             * Input events are not sent directly, but queued for the session thread.
              * @param data The binary payload of the incoming message.
              */
             void OnWsMessage(const std::string & data);
-            /**
-             * Retrieves a custom cursor tuple by ID.
-             * @param cid Unique cursor ID (valid for current session).
-             * @return A tuple, containing the creation time and PNG-encoded RGBA image or a tuple containing 0 and an empty String, if no cursor image is defined for the given Id.
-             */
-            cursor GetCursor(uint32_t cid);
             /**
              * Sets the context of the web-connect app
              * @param kind of ebdedded context
@@ -118,6 +154,23 @@ namespace wsgate {
              * @return the context
              */
             EmbeddedContext getEmbeddedContext(){return this->m_embeddedContext;}
+            /**
+             * Selects the wire format of the ops, sent to the client.
+             * @param v The version, negotiated via Sec-WebSocket-Protocol.
+             */
+            void SetProtocolVersion(int v);
+            /**
+             * Selects the static virtual channels, relayed to the client.
+             * Must be invoked before Connect().
+             * @param params The channel parameters from the config file.
+             */
+            void SetChannelParams(const WsChannelParams &params);
+            /**
+             * Selects the process-wide cache for cursor images.
+             * Must be invoked before Connect().
+             * @param cache The cache, which must outlive this instance.
+             */
+            void SetCursorCache(CursorCache *cache);
 
         private:
             /**
@@ -150,11 +203,67 @@ namespace wsgate {
              */
             void SendInputExtendedMouseEvent(uint16_t flags, uint16_t x, uint16_t y);
 
+            /**
+             * Translates a key up/down message and queues the resulting event.
+             * @param down Nonzero, if the key was pressed.
+             * @param code The key code, sent by the client.
+             */
+            void QueueKeyUpDown(uint32_t down, uint32_t code);
+            void QueueMouse(uint32_t flags, uint32_t x, uint32_t y);
+            void QueueKeyboard(uint32_t flags, uint32_t code);
+            void QueueUnicode(uint32_t flags, uint32_t code);
+            /**
+             * Hands an event over to the session thread.
+             * Never blocks. Mouse moves are parked outside of the queue,
+             * so consecutive moves collapse into the latest one. If the
+             * queue is full, any other event closes the session, because
+             * losing it could leave a key stuck.
+             * @param ev The event to queue.
+             * @return false, if the event was not queued.
+             */
+            bool QueueInput(const InputEvent &ev);
+            /**
+             * Sends all queued input events to the RDP server.
+             * Consecutive mouse moves without button changes are merged.
+             * While a text is being typed, subsequent events are held back
+             * (but still taken from the queue, up to MAX_HELD events).
+             * Must be invoked from the session thread only.
+             */
+            void ProcessInput();
+            void DispatchInput(const InputEvent &ev);
+            /**
+             * Suppresses or resumes the server's graphics output.
+             * On resume, a refresh of the whole desktop is requested.
+             * Must be invoked from the session thread only.
+             * @param visible true, if the client's page is visible.
+             */
+            void SetVisible(bool visible);
+            /**
+             * Sends a pending desktop resize via Display Control, once
+             * no further resize request arrived for RESIZE_DELAY ms.
+             * Must be invoked from the session thread only.
+             */
+            void ProcessResize();
+            static bool IsMouseMove(const InputEvent &ev);
+            static uint64_t ParkMove(const InputEvent &ev);
+            static InputEvent UnparkMove(uint64_t parked);
+
             // Non-copyable
             RDP(const RDP &);
             RDP & operator=(const RDP &);
 
             void ThreadFunc();
+            /**
+             * Creates the FreeRDP instance and its context.
+             * Deferred until Connect(), so that connections, which never
+             * send any credentials, don't allocate any FreeRDP resources.
+             */
+            void CreateInstance();
+            /**
+             * Frees the FreeRDP instance and its context, if any.
+             * The session thread must have been terminated.
+             */
+            void ReleaseInstance();
             void addError(const std::string &msg);
 
             int ContextNew(freerdp *inst, rdpContext *ctx);
@@ -163,9 +272,10 @@ namespace wsgate {
             BOOL PostConnect(freerdp *inst);
             BOOL Authenticate(freerdp *inst, char** user, char** pass, char** domain);
             BOOL VerifyCertificate(freerdp *inst, char* subject, char* issuer, char* fprint);
-            int SendChannelData(freerdp *inst, int chId, uint8_t* data, int size);
             int ReceiveChannelData(freerdp* inst, int chId, uint8_t* data, int size,
                     int flags, int total_size);
+            void ChannelConnected(ChannelConnectedEventArgs *e);
+            void ChannelDisconnected(ChannelDisconnectedEventArgs *e);
 
             void Pointer_New(rdpContext* context, rdpPointer* pointer);
             void Pointer_Free(rdpContext* context, rdpPointer* pointer);
@@ -181,15 +291,41 @@ namespace wsgate {
             bool m_bThreadLoop;
             pthread_t m_worker;
             wspp::wshandler *m_wshandler;
-            MyRawSocketHandler *m_rsh;
+            RdpLauncher *m_launcher;
             std::string m_errMsg;
             State m_State;
+            OpStream *m_pOps;
             Update *m_pUpdate;
             Primary *m_pPrimary;
             uint32_t m_lastError;
             uint32_t m_ptrId;
+            CursorCache *m_pCursorCache;
             CursorMap m_cursorMap;
             EmbeddedContext m_embeddedContext;
+            InputQueue m_input;
+            // Events, taken from m_input but not yet processed
+            // (session thread only)
+            std::deque<InputEvent> m_held;
+            /// Maximum number of events in m_held.
+            static const size_t MAX_HELD = 65536;
+            // Latest mouse move, not queued yet (0 if none)
+            std::atomic<uint64_t> m_parkedMove;
+            // Set by the producer, if a non-move event did not fit into m_input
+            std::atomic<bool> m_bInputOverflow;
+            TextInjector *m_pText;
+            std::atomic<uint64_t> m_nCoalesced;
+            bool m_bVisible;
+            // Display Control channel, set from the channel's thread
+            std::atomic<DispClientContext *> m_pDisp;
+            bool m_bResizePending;
+            uint32_t m_resizeW;
+            uint32_t m_resizeH;
+            std::chrono::steady_clock::time_point m_resizeDue;
+            /// Debounce interval for resize requests in milliseconds.
+            static const int RESIZE_DELAY = 300;
+            // Opus transcoder for the rdpsnd channel, NULL if built without Opus
+            AudioEncoder *m_pAudio;
+            ChannelRelay *m_pRelay;
 
             // Callbacks from C pthreads - Must be static in order t be assigned to C fnPtrs.
             static void *cbThreadFunc(void *ctx);
@@ -201,9 +337,10 @@ namespace wsgate {
             static BOOL cbAuthenticate(freerdp *inst, char** user, char** pass, char** domain);
             static BOOL cbVerifyCertificate(freerdp *inst, char* subject, char* issuer,
                     char* fprint);
-            static int cbSendChannelData(freerdp *inst, int chId, uint8_t* data, int size);
             static int cbReceiveChannelData(freerdp* inst, int chId, uint8_t* data, int size,
                     int flags, int total_size);
+            static void cbChannelConnected(void *context, ChannelConnectedEventArgs *e);
+            static void cbChannelDisconnected(void *context, ChannelDisconnectedEventArgs *e);
 
             static void cbPointer_New(rdpContext* context, rdpPointer* pointer);
             static void cbPointer_Free(rdpContext* context, rdpPointer* pointer);
@@ -0,0 +1,120 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_SNAPSHOT_H_
+#define _WSGATE_SNAPSHOT_H_
+
+#include <atomic>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace wsgate {
+
+    /**
+     * Publishes immutable snapshots of an object to concurrent readers,
+     * in the manner of RCU. A writer builds the next snapshot aside and
+     * publishes it by exchanging a single pointer. Readers never block:
+     * They pin the current snapshot by copying its shared pointer, while
+     * being counted in the reader counter of the current period (a reader,
+     * which is counted only after the period has ended, retries).
+     * After the exchange, the writer starts a new period and waits for the
+     * readers of the previous one, before it drops the previous pointer.
+     * Readers, which hold the previous snapshot, keep it alive until
+     * they are done with it.
+     */
+    template <typename T> class SnapshotHolder {
+
+        public:
+            typedef boost::shared_ptr<const T> ptr;
+
+            /**
+             * Constructs a new instance.
+             * @param initial The initial snapshot.
+             */
+            explicit SnapshotHolder(const ptr &initial)
+                : m_current(new ptr(initial))
+                  , m_nPeriod(0)
+                  , m_lock()
+            {
+                m_nReaders[0] = 0;
+                m_nReaders[1] = 0;
+            }
+
+            /// Destructor.
+            ~SnapshotHolder()
+            {
+                delete m_current.load();
+            }
+
+            /**
+             * Retrieves the current snapshot, without taking any lock.
+             * @return The snapshot. It does not change, even if a new
+             *   one is published meanwhile.
+             */
+            ptr Get() const
+            {
+                for (;;) {
+                    unsigned long period = m_nPeriod.load();
+                    std::atomic<unsigned long> &readers = m_nReaders[period & 1];
+                    ++readers;
+                    // Unless a writer has ended this period meanwhile.
+                    // Then the next writer would not wait for us.
+                    if (period == m_nPeriod.load()) {
+                        ptr ret(*m_current.load());
+                        --readers;
+                        return ret;
+                    }
+                    --readers;
+                }
+            }
+
+            /**
+             * Publishes a new snapshot.
+             * Waits for the readers, which are copying the previous one.
+             * @param snapshot The new snapshot.
+             */
+            void Publish(const ptr &snapshot)
+            {
+                ptr *next = new ptr(snapshot);
+                boost::mutex::scoped_lock lock(m_lock);
+                ptr *prev = m_current.exchange(next);
+                // Readers, arriving from now on, count in the other period
+                // and see next. Only the ones counted so far may see prev.
+                std::atomic<unsigned long> &readers = m_nReaders[m_nPeriod++ & 1];
+                while (0 != readers.load()) {
+                    boost::this_thread::yield();
+                }
+                delete prev;
+            }
+
+        private:
+            // Non-copyable
+            SnapshotHolder(const SnapshotHolder &);
+            SnapshotHolder & operator=(const SnapshotHolder &);
+
+            std::atomic<ptr *> m_current;
+            std::atomic<unsigned long> m_nPeriod;
+            mutable std::atomic<unsigned long> m_nReaders[2];
+            boost::mutex m_lock;
+    };
+
+}
+
+#endif
@@ -0,0 +1,121 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sstream>
+
+#include "TextInjector.hpp"
+
+namespace wsgate {
+
+    using namespace std;
+
+    TextInjector::TextInjector(wspp::wshandler *h)
+        : m_wshandler(h)
+          , m_lock()
+          , m_pending()
+          , m_nPending(0)
+          , m_current()
+          , m_pos(0)
+          , m_next()
+          , m_nextProgress()
+    { }
+
+    TextInjector::~TextInjector()
+    { }
+
+    bool TextInjector::Append(const uint32_t *chars, size_t len)
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        if (m_nPending + len > MAX_PENDING) {
+            log::warn << "Too much pending text, dropping " << len << " characters" << endl;
+            return false;
+        }
+        m_pending.push_back(Text(chars, chars + len));
+        m_nPending += len;
+        return true;
+    }
+
+    void TextInjector::Revoke()
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        if (m_pending.empty()) {
+            return;
+        }
+        m_nPending -= m_pending.back().size();
+        m_pending.pop_back();
+    }
+
+    void TextInjector::Start()
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        if (m_pending.empty()) {
+            return;
+        }
+        m_current.swap(m_pending.front());
+        m_pending.pop_front();
+        m_nPending -= m_current.size();
+        m_pos = 0;
+        m_next = clock::now();
+        m_nextProgress = m_next;
+    }
+
+    bool TextInjector::Pump(rdpInput *input)
+    {
+        if (m_pos >= m_current.size()) {
+            return false;
+        }
+        clock::time_point now = clock::now();
+        if (now < m_next) {
+            return true;
+        }
+        size_t end = m_pos + CHUNK;
+        if (end > m_current.size()) {
+            end = m_current.size();
+        }
+        for (; m_pos < end; ++m_pos) {
+            freerdp_input_send_unicode_keyboard_event(input, KBD_FLAGS_DOWN, m_current[m_pos]);
+            freerdp_input_send_unicode_keyboard_event(input, KBD_FLAGS_RELEASE, m_current[m_pos]);
+        }
+        m_next = now + chrono::milliseconds(INTERVAL);
+        // Short texts (a single chunk) are not worth reporting.
+        if ((m_current.size() > CHUNK) &&
+                ((now >= m_nextProgress) || (m_pos == m_current.size()))) {
+            Progress();
+            m_nextProgress = now + chrono::milliseconds(250);
+        }
+        if (m_pos < m_current.size()) {
+            return true;
+        }
+        Text().swap(m_current);
+        m_pos = 0;
+        return false;
+    }
+
+    void TextInjector::Progress()
+    {
+        ostringstream oss;
+        oss << "P:" << m_pos << "/" << m_current.size();
+        m_wshandler->send_text(oss.str());
+    }
+
+}
@@ -0,0 +1,111 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_TEXTINJECTOR_H_
+#define _WSGATE_TEXTINJECTOR_H_
+
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+#include "rdpcommon.hpp"
+
+namespace wsgate {
+
+    /**
+     * Injects longer texts (e.g. pastes from the browser) as a paced
+     * sequence of unicode keyboard events.
+     * Instead of typing everything at once, at most CHUNK characters
+     * are sent every INTERVAL milliseconds, so that the session thread
+     * keeps processing the server's output in between and slow servers
+     * are not flooded. For longer texts, the progress is reported to
+     * the client as text message "P:<done>/<total>".
+     */
+    class TextInjector {
+
+        public:
+            /// Number of characters, sent per step.
+            static const size_t CHUNK = 32;
+            /// Minimum delay between two steps in milliseconds.
+            static const int INTERVAL = 10;
+            /// Maximum number of pending characters (about 20 seconds of typing).
+            static const size_t MAX_PENDING = 1 << 16;
+
+            /**
+             * Constructs a new instance.
+             * @param h A pointer to the corresponding wshandler object.
+             */
+            TextInjector(wspp::wshandler *h);
+
+            /// Destructor.
+            ~TextInjector();
+
+            /**
+             * Appends a text to the list of pending texts.
+             * May be invoked from any thread.
+             * @param chars The UTF-16 code units of the text, one per 32bit word.
+             * @param len The number of code units.
+             * @return false, if the text was dropped, because too much text is pending.
+             */
+            bool Append(const uint32_t *chars, size_t len);
+
+            /**
+             * Removes the text, appended last, if its marker could not be queued.
+             * Must be invoked from the thread, which invoked Append().
+             */
+            void Revoke();
+
+            /**
+             * Starts injecting the next pending text.
+             * Must be invoked from the RDP session thread only.
+             */
+            void Start();
+
+            /**
+             * Sends the next chunk of the current text, if it is due.
+             * Must be invoked from the RDP session thread only.
+             * @param input The FreeRDP input interface.
+             * @return true, if some of the current text still has to be sent.
+             */
+            bool Pump(rdpInput *input);
+
+        private:
+            // Non-copyable
+            TextInjector(const TextInjector &);
+            TextInjector & operator=(const TextInjector &);
+
+            void Progress();
+
+            typedef std::chrono::steady_clock clock;
+            typedef std::vector<uint16_t> Text;
+
+            wspp::wshandler *m_wshandler;
+            boost::mutex m_lock;
+            std::deque<Text> m_pending;
+            size_t m_nPending;
+            // The text currently being sent (session thread only)
+            Text m_current;
+            size_t m_pos;
+            clock::time_point m_next;
+            clock::time_point m_nextProgress;
+    };
+}
+
+#endif
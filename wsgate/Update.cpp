@@ -27,13 +27,15 @@
 
 #include "rdpcommon.hpp"
 #include "Update.hpp"
+#include "OpStream.hpp"
 
 namespace wsgate {
 
     using namespace std;
 
-    Update::Update(wspp::wshandler *h)
+    Update::Update(wspp::wshandler *h, OpStream *ops)
         : m_wshandler(h)
+          , m_ops(ops)
     { }
 
     Update::~Update()
@@ -50,32 +52,26 @@ namespace wsgate {
         rdp->update->Palette = reinterpret_cast<pPalette>(cbPalette);
         rdp->update->PlaySound = reinterpret_cast<pPlaySound>(cbPlaySound);
         rdp->update->SurfaceBits = reinterpret_cast<pSurfaceBits>(cbSurfaceBits);
-
-        rdp->update->RefreshRect = reinterpret_cast<pRefreshRect>(cbRefreshRect);
-        rdp->update->SuppressOutput = reinterpret_cast<pSuppressOutput>(cbSuppressOutput);
+        // RefreshRect and SuppressOutput are left alone: On the client side,
+        // these send the corresponding PDUs (see RDP::SetVisible).
     }
 
     void Update::BeginPaint(rdpContext*) {
 #ifdef DBGLOG_BEGINPAINT
         log::debug << "BP" << endl;
 #endif
-        uint32_t op = WSOP_SC_BEGINPAINT;
-        string buf(reinterpret_cast<const char *>(&op), sizeof(op));
-        m_wshandler->send_binary(buf);
+        m_ops->BeginPaint();
     }
 
     void Update::EndPaint(rdpContext*) {
 #ifdef DBGLOG_ENDPAINT
         log::debug << "EP" << endl;
 #endif
-        uint32_t op = WSOP_SC_ENDPAINT;
-        string buf(reinterpret_cast<const char *>(&op), sizeof(op));
-        m_wshandler->send_binary(buf);
+        m_ops->EndPaint();
     }
 
     void Update::SetBounds(rdpContext*, rdpBounds* bounds) {
         rdpBounds lB;
-        uint32_t op = WSOP_SC_SETBOUNDS;
         if (bounds) {
             memcpy(&lB, bounds, sizeof(rdpBounds));
             lB.right++;
@@ -87,9 +83,7 @@ namespace wsgate {
         log::debug << "CL l: " << lB.left << " t: " << lB.top
             << " r: " << lB.right << " b: " << lB.bottom << endl;
 #endif
-        string buf(reinterpret_cast<const char *>(&op), sizeof(op));
-        buf.append(reinterpret_cast<const char *>(&lB), sizeof(lB));
-        m_wshandler->send_binary(buf);
+        m_ops->SetBounds(lB.left, lB.top, lB.right, lB.bottom);
     }
 
     void Update::Synchronize(rdpContext*) {
@@ -112,39 +106,19 @@ namespace wsgate {
         BITMAP_DATA* bmd;
         for (i = 0; i < (int) bitmap->number; i++) {
             bmd = &bitmap->rectangles[i];
-            struct {
-                uint32_t op;
-                uint32_t x;
-                uint32_t y;
-                uint32_t w;
-                uint32_t h;
-                uint32_t dw;
-                uint32_t dh;
-                uint32_t bpp;
-                uint32_t cf;
-                uint32_t sz;
-            } wxbm = {
-                WSOP_SC_BITMAP,
-                bmd->destLeft, bmd->destTop,
-                bmd->width, bmd->height,
-                bmd->destRight - bmd->destLeft + 1,
-                bmd->destBottom - bmd->destTop + 1,
-                bmd->bitsPerPixel,
-                static_cast<uint32_t>(bmd->compressed), bmd->bitmapLength
-            };
+            uint32_t dw = bmd->destRight - bmd->destLeft + 1;
+            uint32_t dh = bmd->destBottom - bmd->destTop + 1;
             if (!bmd->compressed) {
                 freerdp_image_flip(bmd->bitmapDataStream, bmd->bitmapDataStream,
                         bmd->width, bmd->height, bmd->bitsPerPixel);
             }
-            string buf(reinterpret_cast<const char *>(&wxbm), sizeof(wxbm));
-            buf.append(reinterpret_cast<const char *>(bmd->bitmapDataStream),
-                    bmd->bitmapLength);
 #ifdef DBGLOG_BITMAP
-            log::debug << "BM" << (wxbm.cf ? " C " : " U ") << "x="
-                << wxbm.x << " y=" << wxbm.y << " w=" << wxbm.w << " h=" << wxbm.h
-                << " bpp=" << wxbm.bpp << " dw=" << wxbm.dw << " dh=" << wxbm.dh << endl;
+            log::debug << "BM" << (bmd->compressed ? " C " : " U ") << "x="
+                << bmd->destLeft << " y=" << bmd->destTop << " w=" << bmd->width << " h=" << bmd->height
+                << " bpp=" << bmd->bitsPerPixel << " dw=" << dw << " dh=" << dh << endl;
 #endif
-            m_wshandler->send_binary(buf);
+            m_ops->Bitmap(bmd->destLeft, bmd->destTop, bmd->width, bmd->height, dw, dh,
+                    bmd->bitsPerPixel, bmd->compressed, bmd->bitmapDataStream, bmd->bitmapLength);
         }
     }
 
@@ -156,14 +130,6 @@ namespace wsgate {
         log::debug << __PRETTY_FUNCTION__ << endl;
     }
 
-    void Update::RefreshRect(rdpContext*, UINT8, RECTANGLE_16*) {
-        log::debug << __PRETTY_FUNCTION__ << endl;
-    }
-
-    void Update::SuppressOutput(rdpContext*, UINT8, RECTANGLE_16*) {
-        log::debug << __PRETTY_FUNCTION__ << endl;
-    }
-
     void Update::SurfaceCommand(rdpContext*, wStream*) {
         log::debug << __PRETTY_FUNCTION__ << endl;
     }
@@ -233,20 +199,6 @@ namespace wsgate {
         }
     }
 
-    void Update::cbRefreshRect(rdpContext* context, UINT8 count, RECTANGLE_16* areas) {
-        Update *self = reinterpret_cast<wsgContext *>(context)->pUpdate;
-        if (self) {
-            self->RefreshRect(context, count, areas);
-        }
-    }
-
-    void Update::cbSuppressOutput(rdpContext* context, UINT8 allow, RECTANGLE_16* area) {
-        Update *self = reinterpret_cast<wsgContext *>(context)->pUpdate;
-        if (self) {
-            self->SuppressOutput(context, allow, area);
-        }
-    }
-
     void Update::cbSurfaceCommand(rdpContext* context, wStream* s) {
         Update *self = reinterpret_cast<wsgContext *>(context)->pUpdate;
         if (self) {
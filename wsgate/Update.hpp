@@ -39,8 +39,9 @@ namespace wsgate {
             /**
              * Constructs a new instance.
              * @param h A pointer to the corresponding wshandler object.
+             * @param ops A pointer to the session's op stream.
              */
-            Update(wspp::wshandler *h);
+            Update(wspp::wshandler *h, OpStream *ops);
 
             /// Destructor.
             virtual ~Update();
@@ -53,6 +54,7 @@ namespace wsgate {
 
         private:
             wspp::wshandler *m_wshandler;
+            OpStream *m_ops;
 
             // Non-copyable
             Update(const Update &);
@@ -66,8 +68,6 @@ namespace wsgate {
             void BitmapUpdate(rdpContext* context, BITMAP_UPDATE* bitmap);
             void Palette(rdpContext* context, PALETTE_UPDATE* palette);
             void PlaySound(rdpContext* context, PLAY_SOUND_UPDATE* play_sound);
-            void RefreshRect(rdpContext* context, UINT8 count, RECTANGLE_16* areas);
-            void SuppressOutput(rdpContext* context, UINT8 allow, RECTANGLE_16* area);
             void SurfaceCommand(rdpContext* context, wStream* s);
             void SurfaceBits(rdpContext* context, SURFACE_BITS_COMMAND* surface_bits_command);
             void SurfaceFrameMarker(rdpContext* context, SURFACE_FRAME_MARKER* surface_frame_marker);
@@ -81,8 +81,6 @@ namespace wsgate {
             static void cbBitmapUpdate(rdpContext* context, BITMAP_UPDATE* bitmap);
             static void cbPalette(rdpContext* context, PALETTE_UPDATE* palette);
             static void cbPlaySound(rdpContext* context, PLAY_SOUND_UPDATE* play_sound);
-            static void cbRefreshRect(rdpContext* context, UINT8 count, RECTANGLE_16* areas);
-            static void cbSuppressOutput(rdpContext* context, UINT8 allow, RECTANGLE_16* area);
             static void cbSurfaceCommand(rdpContext* context, wStream* s);
             static void cbSurfaceBits(rdpContext* context, SURFACE_BITS_COMMAND* surface_bits_command);
             static void cbSurfaceFrameMarker(rdpContext* context, SURFACE_FRAME_MARKER* surface_frame_marker);
@@ -0,0 +1,1503 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+# include <openssl/core_names.h>
+#endif
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+# define HAVE_KTLS 1
+#endif
+
+#include "WsEngine.hpp"
+#include "ListenSockets.hpp"
+#include "wsgateEHS.hpp"
+#include "wshandler.hpp"
+
+namespace wsgate {
+
+    using namespace std;
+
+    static const int MAX_EVENTS = 256;
+
+    // Dynamic TLS record sizing: A record, which fits into a single TCP
+    // segment, can be decrypted as soon as it arrives. That is what an
+    // interactive session wants. During bulk transfers, the per-record
+    // overhead matters more, so the records grow after BULK_BYTES,
+    // sent without a pause of IDLE_MS.
+    static const size_t SMALL_RECORD = 1360;
+    static const size_t LARGE_RECORD = 16384;
+    static const size_t BULK_BYTES = 1048576;
+    static const int64_t IDLE_MS = 1000;
+
+    static string sslError()
+    {
+        char buf[256];
+        ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+        return buf;
+    }
+
+    static string urlDecode(const string &s)
+    {
+        string ret;
+        for (size_t i = 0; i < s.length(); ++i) {
+            if (('%' == s[i]) && (i + 2 < s.length()) &&
+                    isxdigit(s[i + 1]) && isxdigit(s[i + 2])) {
+                ret.push_back(static_cast<char>(strtol(s.substr(i + 1, 2).c_str(), NULL, 16)));
+                i += 2;
+            } else if ('+' == s[i]) {
+                ret.push_back(' ');
+            } else {
+                ret.push_back(s[i]);
+            }
+        }
+        return ret;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static int ticketKeyCallback(SSL *ssl, unsigned char *name, unsigned char *iv,
+            EVP_CIPHER_CTX *cctx, EVP_MAC_CTX *hctx, int enc)
+#else
+    static int ticketKeyCallback(SSL *ssl, unsigned char *name, unsigned char *iv,
+            EVP_CIPHER_CTX *cctx, HMAC_CTX *hctx, int enc)
+#endif
+    {
+        return WsEngine::cbTicketKey(ssl, name, iv, cctx, hctx, enc);
+    }
+
+    static const char *reasonPhrase(int code)
+    {
+        switch (code) {
+            case 101: return "Switching Protocols";
+            case 400: return "Bad Request";
+            case 403: return "Forbidden";
+            case 404: return "Not Found";
+            case 426: return "Upgrade Required";
+            case 500: return "Internal Server Error";
+            case 503: return "Service Unavailable";
+        }
+        return "Error";
+    }
+
+    /**
+     * A client connection of the engine.
+     * Reads and the connection state machine are driven by the I/O thread,
+     * the connection is assigned to. Writes may happen from any thread.
+     */
+    class WsEngine::Conn : public WsUpgrade, public RdpLauncher {
+
+        public:
+            typedef enum {
+                STATE_TLS,
+                STATE_HTTP,
+                STATE_UPGRADE,
+                STATE_OPEN
+            } State;
+
+            typedef enum {
+                TOKEN_NONE,
+                TOKEN_RESOLVED,
+                TOKEN_FAILED
+            } TokenState;
+
+            Conn(WsEngine *engine, int fd, int epfd, const string &remote, SSL *ssl)
+                : m_engine(engine)
+                  , m_fd(fd)
+                  , m_epfd(epfd)
+                  , m_remote(remote)
+                  , m_ssl(ssl)
+                  , m_tAccept(time(NULL))
+                  , m_lock()
+                  , m_state(ssl ? STATE_TLS : STATE_HTTP)
+                  , m_out()
+                  , m_outPos(0)
+                  , m_bClosed(false)
+                  , m_bFailed(false)
+                  , m_bCloseAfterFlush(false)
+                  , m_fragment(0)
+                  , m_burst(0)
+                  , m_lastWrite()
+                  , m_in()
+                  , m_uri()
+                  , m_version()
+                  , m_headers()
+                  , m_form()
+                  , m_response()
+                  , m_tokenState(TOKEN_NONE)
+                  , m_console()
+                  , m_bPreAuth(false)
+                  , m_handler()
+                  , m_endpoint()
+                  , m_rdp()
+            { }
+
+            ~Conn()
+            {
+                if (m_rdp) {
+                    m_engine->m_gate->UnregisterRdpSession(m_rdp);
+                }
+                // The RDP session must go first, it uses the handler.
+                m_rdp.reset();
+                m_endpoint.reset();
+                m_handler.reset();
+                if (m_ssl) {
+                    SSL_free(m_ssl);
+                }
+                if (-1 != m_fd) {
+                    ::close(m_fd);
+                }
+            }
+
+            // WsUpgrade
+            string RemoteAddress() { return m_remote; }
+            string HttpVersion() { return m_version; }
+
+            string Header(const string &name)
+            {
+                map<string, string>::const_iterator it = m_headers.find(to_lower_copy(name));
+                return (m_headers.end() == it) ? string() : it->second;
+            }
+
+            string FormValue(const string &name)
+            {
+                map<string, string>::const_iterator it = m_form.find(name);
+                return (m_form.end() == it) ? string() : it->second;
+            }
+
+            void SetHeader(const string &name, const string &value)
+            {
+                RemoveHeader(name);
+                m_response.push_back(make_pair(name, value));
+            }
+
+            void RemoveHeader(const string &name)
+            {
+                for (vector<pair<string, string> >::iterator it = m_response.begin(); it != m_response.end(); ) {
+                    it = iequals(it->first, name) ? m_response.erase(it) : it + 1;
+                }
+            }
+
+            bool Prepare(const string host, const string pcb, const string user, const string pass,
+                    const WsRdpParams &params, EmbeddedContext embeddedContext,
+                    const wspp::deflate_params &deflate, int protocol);
+
+            // RdpLauncher
+            void PrepareRDP(RDP *rdp, const string host, const string pcb,
+                    const string user, const string pass, const WsRdpParams &params);
+
+            bool Handle();
+            void Upgrade();
+            void Write(const char *data, size_t len);
+            void CloseAfterFlush();
+            void OnMessage(const string &data);
+            void Shutdown();
+            time_t HandshakeAge(time_t now);
+
+        private:
+            // Non-copyable
+            Conn(const Conn &);
+            Conn & operator=(const Conn &);
+
+            bool TlsAccept();
+            bool Flush();
+            bool Read();
+            bool Input(const char *data, size_t len);
+            bool ParseRequest(size_t hdrlen);
+            void Respond(int code);
+            void Kick();
+            ssize_t RawWrite(const char *data, size_t len);
+            void SizeRecords(size_t len);
+            void Fail();
+
+            WsEngine *m_engine;
+            int m_fd;
+            int m_epfd;
+            string m_remote;
+            SSL *m_ssl;
+            time_t m_tAccept;
+            // Guards the SSL object and everything up to m_bCloseAfterFlush
+            boost::mutex m_lock;
+            State m_state;
+            string m_out;
+            size_t m_outPos;
+            bool m_bClosed;
+            bool m_bFailed;
+            bool m_bCloseAfterFlush;
+            size_t m_fragment;
+            size_t m_burst;
+            chrono::steady_clock::time_point m_lastWrite;
+            // Received data, not yet processed (I/O thread only)
+            string m_in;
+            // The upgrade request, written by the I/O thread before
+            // the handshake thread takes over.
+            string m_uri;
+            string m_version;
+            map<string, string> m_headers;
+            map<string, string> m_form;
+            vector<pair<string, string> > m_response;
+            // The OpenStack console, resolved before the handshake is resumed
+            TokenState m_tokenState;
+            nova_console_info m_console;
+
+        public:
+            // Guarded by the engine's lock
+            bool m_bPreAuth;
+            // Set during the handshake, constant afterwards
+            handler_ptr m_handler;
+            conn_ptr m_endpoint;
+            rdp_ptr m_rdp;
+
+            friend class WsEngine;
+    };
+
+    /**
+     * Our wshandler, which routes the WebSocket events
+     * to the corresponding engine connection.
+     */
+    class WsEngine::Handler : public wspp::wshandler {
+
+        public:
+            Handler(Conn *conn) : m_conn(conn) { }
+
+        private:
+            // Non-copyable
+            Handler(const Handler &);
+            Handler & operator=(const Handler &);
+
+            void on_message(string hdr, string data)
+            {
+                if (1 == (hdr[0] & 0x0F)) {
+                    // A text message
+                    if (':' == data[1]) {
+                        switch (data[0]) {
+                            case 'D':
+                                log::debug << "JS: " << data.substr(2) << endl;
+                                break;
+                            case 'I':
+                                log::info << "JS: " << data.substr(2) << endl;
+                                break;
+                            case 'W':
+                                log::warn << "JS: " << data.substr(2) << endl;
+                                break;
+                            case 'E':
+                                log::err << "JS: " << data.substr(2) << endl;
+                                break;
+                        }
+                    }
+                    return;
+                }
+                // binary message;
+                m_conn->OnMessage(data);
+            }
+
+            void on_close()
+            {
+                log::debug << "GOT Close" << endl;
+                m_conn->CloseAfterFlush();
+            }
+
+            bool on_ping(const string & data)
+            {
+                log::debug << "GOT Ping: '" << data << "'" << endl;
+                return true;
+            }
+
+            void on_pong(const string & data)
+            {
+                log::debug << "GOT Pong: '" << data << "'" << endl;
+            }
+
+            void do_response(const string & data)
+            {
+                m_conn->Write(data.data(), data.length());
+            }
+
+            Conn *m_conn;
+    };
+
+    bool WsEngine::Conn::Prepare(const string host, const string pcb, const string user, const string pass,
+            const WsRdpParams &params, EmbeddedContext embeddedContext,
+            const wspp::deflate_params &deflate, int protocol)
+    {
+        if ((embeddedContext != CONTEXT_EMBEDDED) && !m_engine->BeginPreAuth(this)) {
+            return false;
+        }
+        try
+        {
+            handler_ptr h(new Handler(this));
+            conn_ptr c(new wspp::wsendpoint(h.get()));
+            c->set_max_message(m_engine->m_gate->GetMaxMessage());
+            if (deflate.enabled) {
+                c->enable_deflate(deflate);
+            }
+            rdp_ptr r(new RDP(h.get(), this));
+            r->setEmbeddedContext(embeddedContext);
+            r->SetProtocolVersion(protocol);
+            r->SetChannelParams(m_engine->m_gate->GetChannelParams());
+            r->SetCursorCache(m_engine->m_gate->GetCursorCache());
+            {
+                boost::mutex::scoped_lock lock(m_lock);
+                if (m_bClosed) {
+                    m_engine->EndPreAuth(this);
+                    return false;
+                }
+                m_handler = h;
+                m_endpoint = c;
+                m_rdp = r;
+            }
+            if (embeddedContext == CONTEXT_EMBEDDED) {
+                PrepareRDP(r.get(), host, pcb, user, pass, params);
+            }
+        }
+        catch (...)
+        {
+            log::info << "Could not prepare RDP session for " << m_remote << endl;
+            m_engine->EndPreAuth(this);
+            return false;
+        }
+        return true;
+    }
+
+    void WsEngine::Conn::PrepareRDP(RDP *, const string host, const string pcb,
+            const string user, const string pass, const WsRdpParams &params)
+    {
+        m_engine->EndPreAuth(this);
+        m_engine->m_gate->StartRdpSession(m_rdp, host, pcb, user, pass, params);
+    }
+
+    void WsEngine::Conn::OnMessage(const string &data)
+    {
+        m_rdp->OnWsMessage(data);
+    }
+
+    time_t WsEngine::Conn::HandshakeAge(time_t now)
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        if ((STATE_TLS == m_state) || (STATE_HTTP == m_state)) {
+            return now - m_tAccept;
+        }
+        return -1;
+    }
+
+    bool WsEngine::Conn::Handle()
+    {
+        if (!TlsAccept() || !Flush()) {
+            return false;
+        }
+        State st;
+        {
+            boost::mutex::scoped_lock lock(m_lock);
+            st = m_state;
+        }
+        if ((STATE_OPEN == st) && !m_in.empty()) {
+            // Received while the handshake was in progress
+            string pending;
+            pending.swap(m_in);
+            m_endpoint->AddRxData(pending);
+        }
+        if (!Read()) {
+            return false;
+        }
+        boost::mutex::scoped_lock lock(m_lock);
+        return !(m_bFailed || (m_bCloseAfterFlush && m_out.empty()));
+    }
+
+    bool WsEngine::Conn::TlsAccept()
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        if (STATE_TLS != m_state) {
+            return true;
+        }
+        ERR_clear_error();
+        int r = SSL_accept(m_ssl);
+        if (1 == r) {
+            m_state = STATE_HTTP;
+            if (SSL_session_reused(m_ssl)) {
+                ++m_engine->m_nResumedHandshakes;
+            } else {
+                ++m_engine->m_nFullHandshakes;
+            }
+#ifdef HAVE_KTLS
+            if (BIO_get_ktls_send(SSL_get_wbio(m_ssl))) {
+                ++m_engine->m_nKtls;
+                log::debug << "TLS connection from " << m_remote << " offloaded to the kernel ("
+                    << (BIO_get_ktls_recv(SSL_get_rbio(m_ssl)) ? "send and receive" : "send") << ")" << endl;
+            }
+#endif
+            return true;
+        }
+        switch (SSL_get_error(m_ssl, r)) {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                return true;
+        }
+        log::debug << "TLS handshake with " << m_remote << " failed: " << sslError() << endl;
+        return false;
+    }
+
+    ssize_t WsEngine::Conn::RawWrite(const char *data, size_t len)
+    {
+        if (m_ssl) {
+            ERR_clear_error();
+            int r = SSL_write(m_ssl, data, static_cast<int>(min(len, static_cast<size_t>(INT_MAX))));
+            if (0 < r) {
+                return r;
+            }
+            switch (SSL_get_error(m_ssl, r)) {
+                case SSL_ERROR_WANT_READ:
+                case SSL_ERROR_WANT_WRITE:
+                    return 0;
+            }
+            return -1;
+        }
+        ssize_t r = ::send(m_fd, data, len, MSG_NOSIGNAL);
+        if (0 <= r) {
+            return r;
+        }
+        if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno)) {
+            return 0;
+        }
+        return -1;
+    }
+
+    void WsEngine::Conn::SizeRecords(size_t len)
+    {
+        // Lock held, no write pending (a retry must not see another record size).
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (chrono::duration_cast<chrono::milliseconds>(now - m_lastWrite).count() > IDLE_MS) {
+            m_burst = 0;
+        }
+        m_lastWrite = now;
+        m_burst += len;
+        size_t fragment = (BULK_BYTES < m_burst) ? LARGE_RECORD : SMALL_RECORD;
+        if (fragment != m_fragment) {
+            SSL_set_max_send_fragment(m_ssl, fragment);
+            m_fragment = fragment;
+        }
+    }
+
+    void WsEngine::Conn::Fail()
+    {
+        // Lock held. The I/O thread notices the shutdown and closes the connection.
+        m_bFailed = true;
+        m_out.clear();
+        m_outPos = 0;
+        ::shutdown(m_fd, SHUT_RDWR);
+    }
+
+    void WsEngine::Conn::Write(const char *data, size_t len)
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        if (m_bClosed || m_bFailed || (0 == len)) {
+            return;
+        }
+        if (m_out.empty() && (STATE_OPEN == m_state)) {
+            if (m_ssl) {
+                SizeRecords(len);
+            }
+            // The usual case: The socket accepts all of it.
+            ssize_t n = RawWrite(data, len);
+            if (0 > n) {
+                Fail();
+                return;
+            }
+            data += n;
+            len -= n;
+            if (0 == len) {
+                return;
+            }
+        }
+        if (m_out.size() - m_outPos + len > m_engine->m_params.maxqueue) {
+            log::warn << "Client " << m_remote << " does not keep up, dropping connection" << endl;
+            Fail();
+            return;
+        }
+        m_out.append(data, len);
+    }
+
+    bool WsEngine::Conn::Flush()
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        if ((STATE_OPEN != m_state) && !m_bCloseAfterFlush) {
+            // Nothing must precede the response to the upgrade request.
+            return true;
+        }
+        while (m_outPos < m_out.size()) {
+            ssize_t n = RawWrite(m_out.data() + m_outPos, m_out.size() - m_outPos);
+            if (0 > n) {
+                Fail();
+                return false;
+            }
+            if (0 == n) {
+                return true;
+            }
+            m_outPos += n;
+        }
+        if (m_out.capacity() > 1048576) {
+            // Release the memory of a large burst
+            string().swap(m_out);
+        } else {
+            m_out.clear();
+        }
+        m_outPos = 0;
+        return true;
+    }
+
+    bool WsEngine::Conn::Read()
+    {
+        char buf[16384];
+        for (;;) {
+            ssize_t n;
+            if (m_ssl) {
+                boost::mutex::scoped_lock lock(m_lock);
+                if (STATE_TLS == m_state) {
+                    return true;
+                }
+                ERR_clear_error();
+                int r = SSL_read(m_ssl, buf, sizeof(buf));
+                if (0 >= r) {
+                    switch (SSL_get_error(m_ssl, r)) {
+                        case SSL_ERROR_WANT_READ:
+                        case SSL_ERROR_WANT_WRITE:
+                            return true;
+                    }
+                    return false;
+                }
+                n = r;
+            } else {
+                n = ::recv(m_fd, buf, sizeof(buf), 0);
+                if (0 > n) {
+                    if (EINTR == errno) {
+                        continue;
+                    }
+                    return ((EAGAIN == errno) || (EWOULDBLOCK == errno));
+                }
+                if (0 == n) {
+                    return false;
+                }
+            }
+            if (!Input(buf, n)) {
+                return false;
+            }
+        }
+    }
+
+    bool WsEngine::Conn::Input(const char *data, size_t len)
+    {
+        State st;
+        {
+            boost::mutex::scoped_lock lock(m_lock);
+            if (m_bCloseAfterFlush || m_bFailed) {
+                return true;
+            }
+            st = m_state;
+        }
+        if (STATE_OPEN == st) {
+            m_endpoint->AddRxData(string(data, len));
+            return true;
+        }
+        m_in.append(data, len);
+        if (MAX_REQUEST < m_in.length()) {
+            log::warn << "Request from " << m_remote << " too large" << endl;
+            return false;
+        }
+        if (STATE_HTTP == st) {
+            size_t end = m_in.find("\r\n\r\n");
+            if (string::npos != end) {
+                if (!ParseRequest(end)) {
+                    Respond(400);
+                    return true;
+                }
+                m_in.erase(0, end + 4);
+                {
+                    boost::mutex::scoped_lock lock(m_lock);
+                    m_state = STATE_UPGRADE;
+                }
+                m_engine->QueueHandshake(m_engine->Find(this));
+            }
+        }
+        return true;
+    }
+
+    bool WsEngine::Conn::ParseRequest(size_t hdrlen)
+    {
+        vector<string> lines;
+        string hdr(m_in.substr(0, hdrlen));
+        split(lines, hdr, is_any_of("\n"));
+        vector<string> rl;
+        string reqline(trim_right_copy_if(lines[0], is_any_of("\r")));
+        split(rl, reqline, is_any_of(" "), boost::token_compress_on);
+        if ((3 != rl.size()) || (0 != rl[0].compare("GET")) || !boost::starts_with(rl[2], "HTTP/")) {
+            log::warn << "Invalid request from " << m_remote << endl;
+            return false;
+        }
+        m_uri = rl[1];
+        m_version = rl[2].substr(5);
+        for (size_t i = 1; i < lines.size(); ++i) {
+            string line(trim_right_copy_if(lines[i], is_any_of("\r")));
+            size_t colon = line.find(':');
+            if (string::npos == colon) {
+                continue;
+            }
+            string name(to_lower_copy(line.substr(0, colon)));
+            string value(line.substr(colon + 1));
+            trim(name);
+            trim(value);
+            map<string, string>::iterator it = m_headers.find(name);
+            if (m_headers.end() == it) {
+                m_headers[name] = value;
+            } else {
+                it->second.append(", ").append(value);
+            }
+        }
+        size_t q = m_uri.find('?');
+        if (string::npos != q) {
+            vector<string> args;
+            split(args, m_uri.substr(q + 1), is_any_of("&"));
+            for (vector<string>::const_iterator it = args.begin(); it != args.end(); ++it) {
+                size_t eq = it->find('=');
+                if (string::npos == eq) {
+                    m_form[urlDecode(*it)] = "";
+                } else {
+                    m_form[urlDecode(it->substr(0, eq))] = urlDecode(it->substr(eq + 1));
+                }
+            }
+        }
+        return true;
+    }
+
+    void WsEngine::Conn::Upgrade()
+    {
+        if (m_bClosed) {
+            return;
+        }
+        int rc;
+        string path(m_uri.substr(0, m_uri.find('?')));
+        if (0 == path.compare("/wsgate")) {
+            WsGate *gate = m_engine->m_gate;
+            if (boost::starts_with(m_uri, "/wsgate?token=")) {
+                switch (m_tokenState) {
+                    case TOKEN_NONE:
+                        {
+                            // Resolve without blocking the handshake thread,
+                            // the callback queues the handshake again.
+                            WsEngine *engine = m_engine;
+                            conn_sp self(engine->Find(this));
+                            if (!self) {
+                                return;
+                            }
+                            ++engine->m_nResolving;
+                            if (gate->ResolveConsoleToken(FormValue("token"),
+                                        [engine, self](bool ok, const nova_console_info &info) {
+                                            self->m_console = info;
+                                            self->m_tokenState = ok ? TOKEN_RESOLVED : TOKEN_FAILED;
+                                            engine->QueueHandshake(self);
+                                            --engine->m_nResolving;
+                                        })) {
+                                return;
+                            }
+                            --engine->m_nResolving;
+                            Respond(503);
+                            return;
+                        }
+                    case TOKEN_FAILED:
+                        Respond(400);
+                        return;
+                    case TOKEN_RESOLVED:
+                        break;
+                }
+            }
+            const string hostname(gate->GetHostname());
+            string thisHost(hostname.empty() ?
+                    to_lower_copy(Header("Host")) : gate->GetEngineHost(hostname));
+            rc = gate->HandleUpgrade(*this, m_uri, thisHost,
+                    (TOKEN_RESOLVED == m_tokenState) ? &m_console : NULL);
+        } else {
+            log::info << "Request from " << m_remote << ": " << m_uri << " => 404 Not found" << endl;
+            rc = 404;
+        }
+        Respond(rc);
+    }
+
+    void WsEngine::Conn::Respond(int code)
+    {
+        ostringstream oss;
+        oss << "HTTP/1.1 " << code << " " << reasonPhrase(code) << "\r\n";
+        for (vector<pair<string, string> >::const_iterator it = m_response.begin(); it != m_response.end(); ++it) {
+            oss << it->first << ": " << it->second << "\r\n";
+        }
+        if (101 != code) {
+            oss << "Content-Length: 0\r\nConnection: close\r\n";
+        }
+        oss << "\r\n";
+        string resp(oss.str());
+        {
+            boost::mutex::scoped_lock lock(m_lock);
+            if (m_bClosed) {
+                return;
+            }
+            // Anything, the RDP session has sent already, has been queued.
+            m_out.insert(m_outPos, resp);
+            if (101 == code) {
+                m_state = STATE_OPEN;
+            } else {
+                m_bCloseAfterFlush = true;
+            }
+        }
+        Kick();
+    }
+
+    void WsEngine::Conn::Kick()
+    {
+        // Re-arming an edge-triggered socket reports its current state,
+        // so the I/O thread flushes the queue and processes pending input.
+        boost::mutex::scoped_lock lock(m_lock);
+        if (m_bClosed) {
+            return;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = this;
+        epoll_ctl(m_epfd, EPOLL_CTL_MOD, m_fd, &ev);
+    }
+
+    void WsEngine::Conn::CloseAfterFlush()
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        m_bCloseAfterFlush = true;
+        if (m_out.empty() && !m_bClosed) {
+            // Let the I/O thread notice
+            ::shutdown(m_fd, SHUT_RDWR);
+        }
+    }
+
+    void WsEngine::Conn::Shutdown()
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        if (m_bClosed) {
+            return;
+        }
+        m_bClosed = true;
+        m_out.clear();
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, m_fd, NULL);
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+    WsEngine::WsEngine(WsGate *gate, const WsEngineParams &params)
+        : m_gate(gate)
+          , m_params(params)
+          , m_ctx(NULL)
+          , m_listenFd(-1)
+          , m_workers()
+          , m_nextWorker(0)
+          , m_bRunning(false)
+          , m_bDraining(false)
+          , m_nFullHandshakes(0)
+          , m_nResumedHandshakes(0)
+          , m_nKtls(0)
+          , m_tStats(time(NULL))
+          , m_ticketLock()
+          , m_ticketKeys()
+          , m_sTicketSecret()
+          , m_lock()
+          , m_conns()
+          , m_nPreAuth(0)
+          , m_bThreadLoop(false)
+          , m_nResolving(0)
+          , m_handshakes()
+          , m_handshakeCond()
+          , m_handshakeThread()
+          , m_reap()
+          , m_reapCond()
+          , m_reaperThread()
+    { }
+
+    WsEngine::~WsEngine()
+    {
+        Stop();
+    }
+
+    static int passwordCallback(char *buf, int size, int, void *userdata)
+    {
+        const string *pass = reinterpret_cast<const string *>(userdata);
+        int len = min(size - 1, static_cast<int>(pass->length()));
+        memcpy(buf, pass->data(), len);
+        buf[len] = '\0';
+        return len;
+    }
+
+    void WsEngine::InitTls()
+    {
+        SSL_library_init();
+        SSL_load_error_strings();
+        m_ctx = SSL_CTX_new(SSLv23_server_method());
+        if (!m_ctx) {
+            throw tracing::runtime_error("Could not create TLS context: " + sslError());
+        }
+        SSL_CTX_set_options(m_ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
+        // Writes are retried from the queue, which may have moved or grown meanwhile.
+        SSL_CTX_set_mode(m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        SSL_CTX_set_default_passwd_cb(m_ctx, passwordCallback);
+        SSL_CTX_set_default_passwd_cb_userdata(m_ctx, &m_params.certpass);
+        if ((1 != SSL_CTX_use_certificate_chain_file(m_ctx, m_params.certfile.c_str())) ||
+                (1 != SSL_CTX_use_PrivateKey_file(m_ctx, m_params.certfile.c_str(), SSL_FILETYPE_PEM)) ||
+                (1 != SSL_CTX_check_private_key(m_ctx))) {
+            throw tracing::runtime_error("Could not load certificate " + m_params.certfile + ": " + sslError());
+        }
+        SSL_CTX_set_app_data(m_ctx, this);
+        if (m_params.ktls) {
+#ifdef HAVE_KTLS
+            // OpenSSL falls back to user space encryption per connection,
+            // if the kernel lacks TLS support or the cipher is not offloadable.
+            SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS);
+#else
+            log::info << "Kernel TLS is not supported by this OpenSSL build" << endl;
+#endif
+        }
+        // Resumption from the server-side cache
+        static const unsigned char sid_ctx[] = "wsgate";
+        SSL_CTX_set_session_id_context(m_ctx, sid_ctx, sizeof(sid_ctx) - 1);
+        SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(m_ctx, m_params.sessioncache);
+        SSL_CTX_set_timeout(m_ctx, m_params.sessiontimeout);
+        // Resumption from session tickets
+        if (0 < m_params.ticketlifetime) {
+            if (m_sTicketSecret.empty()) {
+                NewTicketKey(m_ticketKeys[0]);
+                NewTicketKey(m_ticketKeys[1]);
+            } else {
+                time_t period = time(NULL) / m_params.ticketlifetime;
+                DeriveTicketKey(period, m_ticketKeys[0]);
+                DeriveTicketKey(period - 1, m_ticketKeys[1]);
+            }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            SSL_CTX_set_tlsext_ticket_key_evp_cb(m_ctx, ticketKeyCallback);
+#else
+            SSL_CTX_set_tlsext_ticket_key_cb(m_ctx, ticketKeyCallback);
+#endif
+        } else {
+            SSL_CTX_set_options(m_ctx, SSL_OP_NO_TICKET);
+        }
+    }
+
+    void WsEngine::NewTicketKey(TicketKey &key)
+    {
+        if ((1 != RAND_bytes(key.name, sizeof(key.name))) ||
+                (1 != RAND_bytes(key.aes, sizeof(key.aes))) ||
+                (1 != RAND_bytes(key.hmac, sizeof(key.hmac)))) {
+            throw tracing::runtime_error("Could not create session ticket key: " + sslError());
+        }
+        key.created = time(NULL);
+    }
+
+    void WsEngine::DeriveTicketKey(time_t period, TicketKey &key)
+    {
+        // Each part is the SHA-256 hash of the secret, its label and the period.
+        static const char *labels[] = { "name", "aes", "hmac" };
+        unsigned char *parts[] = { key.name, key.aes, key.hmac };
+        const size_t lengths[] = { sizeof(key.name), sizeof(key.aes), sizeof(key.hmac) };
+        for (int i = 0; i < 3; ++i) {
+            ostringstream oss;
+            oss << labels[i] << ':' << period << ':';
+            string data(oss.str() + m_sTicketSecret);
+            unsigned char md[EVP_MAX_MD_SIZE];
+            if (1 != EVP_Digest(data.data(), data.length(), md, NULL, EVP_sha256(), NULL)) {
+                throw tracing::runtime_error("Could not derive session ticket key: " + sslError());
+            }
+            memcpy(parts[i], md, lengths[i]);
+        }
+        key.created = period * m_params.ticketlifetime;
+    }
+
+    bool WsEngine::GetTicketKey(const unsigned char *name, TicketKey &key, bool &renew)
+    {
+        boost::mutex::scoped_lock lock(m_ticketLock);
+        if (!m_sTicketSecret.empty()) {
+            // All engines switch to the key of a new period at the same time.
+            time_t period = time(NULL) / m_params.ticketlifetime;
+            if (period * m_params.ticketlifetime != m_ticketKeys[0].created) {
+                try {
+                    DeriveTicketKey(period, m_ticketKeys[0]);
+                    DeriveTicketKey(period - 1, m_ticketKeys[1]);
+                } catch (const tracing::runtime_error &e) {
+                    log::err << e.what() << endl;
+                    return false;
+                }
+                log::debug << "Rotated session ticket key" << endl;
+            }
+        }
+        if (!name) {
+            // Encrypting a new ticket, rotate the keys if due.
+            if (m_sTicketSecret.empty() &&
+                    (time(NULL) - m_ticketKeys[0].created >= m_params.ticketlifetime)) {
+                TicketKey next;
+                try {
+                    NewTicketKey(next);
+                } catch (const tracing::runtime_error &e) {
+                    log::err << e.what() << endl;
+                    return false;
+                }
+                m_ticketKeys[1] = m_ticketKeys[0];
+                m_ticketKeys[0] = next;
+                log::debug << "Rotated session ticket key" << endl;
+            }
+            key = m_ticketKeys[0];
+            return true;
+        }
+        // Tickets of the previous key are accepted, but replaced.
+        for (int i = 0; i < 2; ++i) {
+            if ((0 == memcmp(name, m_ticketKeys[i].name, sizeof(key.name))) &&
+                    (time(NULL) - m_ticketKeys[i].created < 2 * m_params.ticketlifetime)) {
+                key = m_ticketKeys[i];
+                renew = (0 != i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int WsEngine::cbTicketKey(SSL *ssl, unsigned char *name, unsigned char *iv,
+            EVP_CIPHER_CTX *cctx, void *hctx, int enc)
+    {
+        WsEngine *self = reinterpret_cast<WsEngine *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+        TicketKey key;
+        bool renew = false;
+        if (enc) {
+            if (!self->GetTicketKey(NULL, key, renew) ||
+                    (1 != RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())))) {
+                return -1;
+            }
+            memcpy(name, key.name, sizeof(key.name));
+            if (1 != EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key.aes, iv)) {
+                return -1;
+            }
+        } else {
+            if (!self->GetTicketKey(name, key, renew)) {
+                // Unknown or expired: Fall back to a full handshake.
+                return 0;
+            }
+            if (1 != EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key.aes, iv)) {
+                return -1;
+            }
+        }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        OSSL_PARAM params[3];
+        params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac, sizeof(key.hmac));
+        params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char *>("SHA256"), 0);
+        params[2] = OSSL_PARAM_construct_end();
+        if (1 != EVP_MAC_CTX_set_params(reinterpret_cast<EVP_MAC_CTX *>(hctx), params)) {
+            return -1;
+        }
+#else
+        if (1 != HMAC_Init_ex(reinterpret_cast<HMAC_CTX *>(hctx), key.hmac, sizeof(key.hmac), EVP_sha256(), NULL)) {
+            return -1;
+        }
+#endif
+        return renew ? 2 : 1;
+    }
+
+    void WsEngine::LogStats()
+    {
+        time_t now = time(NULL);
+        time_t last = m_tStats;
+        if ((now - last < STATS_INTERVAL) || !m_tStats.compare_exchange_strong(last, now)) {
+            return;
+        }
+        if (m_ctx) {
+            log::info << "TLS handshakes: " << m_nFullHandshakes << " full, "
+                << m_nResumedHandshakes << " resumed, " << m_nKtls << " kernel offloaded" << endl;
+        }
+    }
+
+    void WsEngine::Start()
+    {
+        if (m_params.tls) {
+            InitTls();
+        }
+        struct addrinfo hints;
+        struct addrinfo *ai = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+        ostringstream port;
+        port << m_params.port;
+        if (0 != getaddrinfo(m_params.bindaddr.c_str(), port.str().c_str(), &hints, &ai)) {
+            throw tracing::runtime_error("Invalid engine bind address " + m_params.bindaddr);
+        }
+        // After a restart, the previous process has passed its socket.
+        m_listenFd = ListenSockets::Take(m_params.bindaddr, m_params.port);
+        if (-1 != m_listenFd) {
+            fcntl(m_listenFd, F_SETFL, fcntl(m_listenFd, F_GETFL) | O_NONBLOCK);
+        } else {
+            m_listenFd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int on = 1;
+            if ((-1 == m_listenFd) ||
+                    (0 != setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))) ||
+                    // Worker processes share the port, the kernel balances between them.
+                    ((0 < m_params.workers) &&
+                     (0 != setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)))) ||
+                    (0 != ::bind(m_listenFd, ai->ai_addr, ai->ai_addrlen)) ||
+                    (0 != listen(m_listenFd, SOMAXCONN))) {
+                string err(strerror(errno));
+                freeaddrinfo(ai);
+                throw tracing::runtime_error("Could not listen on " + m_params.bindaddr + ":" + port.str() + ": " + err);
+            }
+        }
+        freeaddrinfo(ai);
+        if (0 == m_params.workers) {
+            ListenSockets::Export(m_listenFd);
+        }
+
+        int n = m_params.threads;
+        if (0 >= n) {
+            n = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+        }
+        m_bThreadLoop = true;
+        if (0 != pthread_create(&m_handshakeThread, NULL, cbHandshakeFunc, reinterpret_cast<void *>(this))) {
+            close(m_listenFd);
+            m_listenFd = -1;
+            throw tracing::runtime_error("Could not create engine thread");
+        }
+        if (0 != pthread_create(&m_reaperThread, NULL, cbReaperFunc, reinterpret_cast<void *>(this))) {
+            {
+                boost::mutex::scoped_lock lock(m_lock);
+                m_bThreadLoop = false;
+            }
+            m_handshakeCond.notify_one();
+            pthread_join(m_handshakeThread, NULL);
+            close(m_listenFd);
+            m_listenFd = -1;
+            throw tracing::runtime_error("Could not create engine thread");
+        }
+        m_bRunning = true;
+        // Set up every worker before any thread runs: Accept() picks
+        // from m_workers on the listener thread.
+        m_workers.reserve(n);
+        for (int i = 0; i < n; ++i) {
+            Worker *w = new Worker();
+            w->engine = this;
+            w->listener = (0 == i);
+            w->running = false;
+            w->epfd = epoll_create1(EPOLL_CLOEXEC);
+            w->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.ptr = w;
+            epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->evfd, &ev);
+            m_workers.push_back(w);
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = NULL;
+        epoll_ctl(m_workers.front()->epfd, EPOLL_CTL_ADD, m_listenFd, &ev);
+        for (vector<Worker *>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+            if (0 != pthread_create(&(*it)->thread, NULL, cbWorkerFunc, reinterpret_cast<void *>(*it))) {
+                Stop();
+                throw tracing::runtime_error("Could not create engine thread");
+            }
+            (*it)->running = true;
+        }
+        log::info << "WebSocket engine listening on " << m_params.bindaddr << ":" << m_params.port
+            << (m_params.tls ? " (TLS)" : "") << ", " << n << " I/O thread(s)" << endl;
+    }
+
+    void WsEngine::Drain()
+    {
+        if (m_bRunning && !m_bDraining.exchange(true)) {
+            uint64_t one = 1;
+            if (sizeof(one) != write(m_workers.front()->evfd, &one, sizeof(one))) {
+                log::warn << "Could not wake engine thread" << endl;
+            }
+        }
+    }
+
+    size_t WsEngine::Connections()
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        return m_conns.size();
+    }
+
+    void WsEngine::Stop()
+    {
+        if (!m_bRunning.exchange(false)) {
+            return;
+        }
+        for (vector<Worker *>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+            if (!(*it)->running) {
+                continue;
+            }
+            uint64_t one = 1;
+            if (sizeof(one) != write((*it)->evfd, &one, sizeof(one))) {
+                log::warn << "Could not wake engine thread" << endl;
+            }
+            pthread_join((*it)->thread, NULL);
+        }
+        if (-1 != m_listenFd) {
+            ListenSockets::Unexport(m_listenFd);
+            close(m_listenFd);
+            m_listenFd = -1;
+        }
+        {
+            boost::mutex::scoped_lock lock(m_lock);
+            m_bThreadLoop = false;
+        }
+        m_handshakeCond.notify_one();
+        m_reapCond.notify_one();
+        pthread_join(m_handshakeThread, NULL);
+        pthread_join(m_reaperThread, NULL);
+        // Pending token lookups refer to this instance.
+        while (0 < m_nResolving) {
+            usleep(100000);
+        }
+        map<Conn *, conn_sp> conns;
+        {
+            boost::mutex::scoped_lock lock(m_lock);
+            conns.swap(m_conns);
+            m_handshakes.clear();
+        }
+        for (map<Conn *, conn_sp>::iterator it = conns.begin(); it != conns.end(); ++it) {
+            it->second->Shutdown();
+        }
+        conns.clear();
+        for (vector<Worker *>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+            close((*it)->epfd);
+            close((*it)->evfd);
+            delete *it;
+        }
+        m_workers.clear();
+        if (m_ctx) {
+            log::info << "TLS handshakes: " << m_nFullHandshakes << " full, "
+                << m_nResumedHandshakes << " resumed, " << m_nKtls << " kernel offloaded" << endl;
+            SSL_CTX_free(m_ctx);
+            m_ctx = NULL;
+        }
+        log::info << "WebSocket engine stopped" << endl;
+    }
+
+    void WsEngine::Accept()
+    {
+        for (;;) {
+            struct sockaddr_storage sa;
+            socklen_t salen = sizeof(sa);
+            int fd = accept4(m_listenFd, reinterpret_cast<struct sockaddr *>(&sa), &salen,
+                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (-1 == fd) {
+                if ((EAGAIN == errno) || (EWOULDBLOCK == errno)) {
+                    return;
+                }
+                if ((EINTR == errno) || (ECONNABORTED == errno)) {
+                    continue;
+                }
+                log::err << "Could not accept connection: " << strerror(errno) << endl;
+                return;
+            }
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            char host[NI_MAXHOST];
+            if (0 != getnameinfo(reinterpret_cast<struct sockaddr *>(&sa), salen,
+                        host, sizeof(host), NULL, 0, NI_NUMERICHOST)) {
+                strcpy(host, "?");
+            }
+            SSL *ssl = NULL;
+            if (m_ctx) {
+                ssl = SSL_new(m_ctx);
+                if (!ssl || (1 != SSL_set_fd(ssl, fd))) {
+                    log::err << "Could not create TLS session: " << sslError() << endl;
+                    SSL_free(ssl);
+                    close(fd);
+                    continue;
+                }
+                SSL_set_accept_state(ssl);
+            }
+            Worker *w = m_workers[m_nextWorker++ % m_workers.size()];
+            conn_sp c(new Conn(this, fd, w->epfd, host, ssl));
+            {
+                boost::mutex::scoped_lock lock(m_lock);
+                m_conns[c.get()] = c;
+            }
+            {
+                boost::mutex::scoped_lock lock(w->lock);
+                w->pending.insert(c.get());
+            }
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = c.get();
+            if (0 != epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+                log::err << "Could not register connection: " << strerror(errno) << endl;
+                {
+                    boost::mutex::scoped_lock lock(w->lock);
+                    w->pending.erase(c.get());
+                }
+                boost::mutex::scoped_lock lock(m_lock);
+                m_conns.erase(c.get());
+            }
+        }
+    }
+
+    void WsEngine::Close(Worker *w, Conn *c, conn_list &closed)
+    {
+        c->Shutdown();
+        {
+            boost::mutex::scoped_lock lock(w->lock);
+            w->pending.erase(c);
+        }
+        boost::mutex::scoped_lock lock(m_lock);
+        map<Conn *, conn_sp>::iterator it = m_conns.find(c);
+        if (m_conns.end() != it) {
+            closed.push_back(it->second);
+            m_conns.erase(it);
+        }
+        if (c->m_bPreAuth) {
+            c->m_bPreAuth = false;
+            --m_nPreAuth;
+        }
+    }
+
+    void WsEngine::Sweep(Worker *w, conn_list &closed)
+    {
+        time_t now = time(NULL);
+        vector<Conn *> expired;
+        {
+            boost::mutex::scoped_lock lock(w->lock);
+            for (set<Conn *>::iterator it = w->pending.begin(); it != w->pending.end(); ) {
+                time_t age = (*it)->HandshakeAge(now);
+                if (0 > age) {
+                    // Request complete
+                    w->pending.erase(it++);
+                } else {
+                    if (HANDSHAKE_TIMEOUT < age) {
+                        expired.push_back(*it);
+                    }
+                    ++it;
+                }
+            }
+        }
+        for (vector<Conn *>::iterator it = expired.begin(); it != expired.end(); ++it) {
+            log::debug << "Handshake timeout for " << (*it)->m_remote << endl;
+            Close(w, *it, closed);
+        }
+    }
+
+    bool WsEngine::BeginPreAuth(Conn *c)
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        unsigned long max = m_gate->GetMaxPreAuth();
+        if ((0 < max) && (m_nPreAuth >= max)) {
+            log::warn << "Too many connections without credentials (" << max << ")" << endl;
+            return false;
+        }
+        c->m_bPreAuth = true;
+        ++m_nPreAuth;
+        return true;
+    }
+
+    void WsEngine::EndPreAuth(Conn *c)
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        if (c->m_bPreAuth) {
+            c->m_bPreAuth = false;
+            --m_nPreAuth;
+        }
+    }
+
+    WsEngine::conn_sp WsEngine::Find(Conn *c)
+    {
+        boost::mutex::scoped_lock lock(m_lock);
+        map<Conn *, conn_sp>::iterator it = m_conns.find(c);
+        return (m_conns.end() == it) ? conn_sp() : it->second;
+    }
+
+    void WsEngine::QueueHandshake(conn_sp c)
+    {
+        if (!c) {
+            return;
+        }
+        {
+            boost::mutex::scoped_lock lock(m_lock);
+            if (!m_bThreadLoop) {
+                return;
+            }
+            m_handshakes.push_back(c);
+        }
+        m_handshakeCond.notify_one();
+    }
+
+    void WsEngine::WorkerFunc(Worker *w)
+    {
+        struct epoll_event evs[MAX_EVENTS];
+        conn_list closed;
+        time_t lastSweep = time(NULL);
+        while (m_bRunning) {
+            int n = epoll_wait(w->epfd, evs, MAX_EVENTS, 1000);
+            if (0 > n) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                log::err << "epoll_wait failed: " << strerror(errno) << endl;
+                break;
+            }
+            for (int i = 0; i < n; ++i) {
+                void *ptr = evs[i].data.ptr;
+                if (NULL == ptr) {
+                    Accept();
+                } else if (w == ptr) {
+                    uint64_t val;
+                    if (0 > read(w->evfd, &val, sizeof(val))) {
+                        // Nothing to do, just woken up
+                    }
+                } else {
+                    Conn *c = reinterpret_cast<Conn *>(ptr);
+                    // Might have been closed by a previous event of this batch
+                    if (c->m_bClosed) {
+                        continue;
+                    }
+                    if ((evs[i].events & EPOLLERR) || !c->Handle()) {
+                        Close(w, c, closed);
+                    }
+                }
+            }
+            if (w->listener && m_bDraining) {
+                // The listening socket lives on in the new process.
+                epoll_ctl(w->epfd, EPOLL_CTL_DEL, m_listenFd, NULL);
+                ListenSockets::Unexport(m_listenFd);
+                close(m_listenFd);
+                m_listenFd = -1;
+                w->listener = false;
+                log::info << "WebSocket engine stopped accepting, draining "
+                    << Connections() << " connection(s)" << endl;
+            }
+            time_t now = time(NULL);
+            if (now != lastSweep) {
+                lastSweep = now;
+                Sweep(w, closed);
+                LogStats();
+            }
+            if (!closed.empty()) {
+                // Destroying a session waits for its RDP thread, so do it elsewhere.
+                {
+                    boost::mutex::scoped_lock lock(m_lock);
+                    m_reap.insert(m_reap.end(), closed.begin(), closed.end());
+                }
+                closed.clear();
+                m_reapCond.notify_one();
+            }
+        }
+    }
+
+    void WsEngine::HandshakeFunc()
+    {
+        for (;;) {
+            conn_sp c;
+            {
+                boost::mutex::scoped_lock lock(m_lock);
+                while (m_bThreadLoop && m_handshakes.empty()) {
+                    m_handshakeCond.wait(lock);
+                }
+                if (!m_bThreadLoop) {
+                    break;
+                }
+                c = m_handshakes.front();
+                m_handshakes.pop_front();
+            }
+            try {
+                c->Upgrade();
+            } catch (const exception &e) {
+                log::err << "WebSocket handshake with " << c->m_remote << " failed: " << e.what() << endl;
+                c->Respond(500);
+            }
+        }
+    }
+
+    void WsEngine::ReaperFunc()
+    {
+        for (;;) {
+            conn_list reap;
+            {
+                boost::mutex::scoped_lock lock(m_lock);
+                while (m_bThreadLoop && m_reap.empty()) {
+                    m_reapCond.wait(lock);
+                }
+                reap.swap(m_reap);
+                if (reap.empty() && !m_bThreadLoop) {
+                    break;
+                }
+            }
+            log::debug << "Closing " << reap.size() << " engine connection(s)" << endl;
+            reap.clear();
+        }
+    }
+
+    void *WsEngine::cbWorkerFunc(void *ctx)
+    {
+        Worker *w = reinterpret_cast<Worker *>(ctx);
+        if (w) {
+            w->engine->WorkerFunc(w);
+        }
+        return NULL;
+    }
+
+    void *WsEngine::cbHandshakeFunc(void *ctx)
+    {
+        WsEngine *self = reinterpret_cast<WsEngine *>(ctx);
+        if (self) {
+            self->HandshakeFunc();
+        }
+        return NULL;
+    }
+
+    void *WsEngine::cbReaperFunc(void *ctx)
+    {
+        WsEngine *self = reinterpret_cast<WsEngine *>(ctx);
+        if (self) {
+            self->ReaperFunc();
+        }
+        return NULL;
+    }
+
+}
+
+#endif
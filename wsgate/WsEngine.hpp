@@ -0,0 +1,233 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_WSENGINE_H_
+#define _WSGATE_WSENGINE_H_
+
+#include <pthread.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// Avoid <openssl/ssl.h>, its SHA1() collides with our SHA1 class.
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
+
+namespace wsgate {
+
+    class WsGate;
+
+    /**
+     * Parameters of the WebSocket engine (config section [engine]).
+     */
+    typedef struct {
+        bool enabled;
+        std::string bindaddr;
+        uint16_t port;
+        bool tls;
+        std::string certfile;
+        std::string certpass;
+        int threads;
+        size_t maxqueue;
+        long sessioncache;
+        long sessiontimeout;
+        long ticketlifetime;
+        bool ktls;
+        int workers;
+        long draintimeout;
+    } WsEngineParams;
+
+    /**
+     * Serves WebSocket connections from a few event driven threads
+     * instead of dedicating an EHS thread to each of them.
+     * The engine has its own listening socket. Each accepted socket is
+     * assigned to one of the I/O threads, which waits for it with an
+     * edge-triggered epoll set and performs all reads non-blocking.
+     * Outgoing messages are written directly by the sending thread if
+     * the socket accepts them and queued otherwise, to be flushed by the
+     * I/O thread, once the socket becomes writable again.
+     * The WebSocket handshake (which may involve OpenStack token
+     * authentication) runs on a separate thread, connection teardown
+     * (which waits for the RDP session thread) on another one, so that
+     * neither of them stalls the I/O threads.
+     * TLS sessions are resumable from a server-side cache and from session
+     * tickets, whose keys are rotated every ticketlifetime seconds.
+     * Worker processes derive these keys from a common secret, so that
+     * a client may resume its session on any of them.
+     * Where the kernel and OpenSSL support it, established TLS connections
+     * are handed over to kernel TLS, so that records are encrypted by the
+     * kernel (or the NIC) instead of OpenSSL.
+     * The listening socket may be inherited from a previous process
+     * and is passed on to the next one (see ListenSockets).
+     * Only available on Linux.
+     */
+    class WsEngine {
+
+        public:
+            /// Maximum size of the HTTP request header.
+            static const size_t MAX_REQUEST = 8192;
+            /// Seconds, a client may take for sending its upgrade request.
+            static const time_t HANDSHAKE_TIMEOUT = 10;
+            /// Seconds between two log messages with handshake counts.
+            static const time_t STATS_INTERVAL = 300;
+
+            /**
+             * Constructs a new instance.
+             * @param gate The WsGate instance, which performs the handshake
+             *   and keeps track of the RDP sessions.
+             * @param params The engine parameters from the config file.
+             */
+            WsEngine(WsGate *gate, const WsEngineParams &params);
+
+            /// Destructor. Stops the engine.
+            ~WsEngine();
+
+            /**
+             * Derives the session ticket keys of each period from a
+             * secret instead of creating random ones. So all engines
+             * with the same secret accept the tickets of each other.
+             * Must be invoked before Start().
+             * @param secret The secret (binary), empty for random keys.
+             */
+            void SetTicketSecret(const std::string &secret) { m_sTicketSecret = secret; }
+
+            /**
+             * Creates the listening socket and starts the threads.
+             * Throws tracing::runtime_error on failure.
+             */
+            void Start();
+
+            /**
+             * Stops all threads and closes all connections.
+             */
+            void Stop();
+
+            /**
+             * Stops accepting connections, after the listening socket
+             * has been handed over to a new process. Established
+             * connections continue to be served.
+             */
+            void Drain();
+
+            /**
+             * @return The number of open connections.
+             */
+            size_t Connections();
+
+            /**
+             * Session ticket key callback for OpenSSL.
+             * @param hctx The HMAC_CTX (EVP_MAC_CTX for OpenSSL 3).
+             * @see SSL_CTX_set_tlsext_ticket_key_cb
+             */
+            static int cbTicketKey(SSL *ssl, unsigned char *name, unsigned char *iv,
+                    EVP_CIPHER_CTX *cctx, void *hctx, int enc);
+
+        private:
+            // Non-copyable
+            WsEngine(const WsEngine &);
+            WsEngine & operator=(const WsEngine &);
+
+            class Conn;
+            class Handler;
+            typedef boost::shared_ptr<Conn> conn_sp;
+            typedef std::vector<conn_sp> conn_list;
+
+            typedef struct {
+                unsigned char name[16];
+                unsigned char aes[32];
+                unsigned char hmac[32];
+                time_t created;
+            } TicketKey;
+
+            typedef struct {
+                WsEngine *engine;
+                // Owns the listening socket
+                bool listener;
+                int epfd;
+                int evfd;
+                pthread_t thread;
+                // The thread has been started
+                bool running;
+                // Connections, which have not sent their request yet
+                boost::mutex lock;
+                std::set<Conn *> pending;
+            } Worker;
+
+            void InitTls();
+            void NewTicketKey(TicketKey &key);
+            void DeriveTicketKey(time_t period, TicketKey &key);
+            bool GetTicketKey(const unsigned char *name, TicketKey &key, bool &renew);
+            void LogStats();
+            void Accept();
+            void Close(Worker *w, Conn *c, conn_list &closed);
+            void Sweep(Worker *w, conn_list &closed);
+            bool BeginPreAuth(Conn *c);
+            void EndPreAuth(Conn *c);
+            void QueueHandshake(conn_sp c);
+            conn_sp Find(Conn *c);
+
+            void WorkerFunc(Worker *w);
+            void HandshakeFunc();
+            void ReaperFunc();
+            static void *cbWorkerFunc(void *ctx);
+            static void *cbHandshakeFunc(void *ctx);
+            static void *cbReaperFunc(void *ctx);
+
+            WsGate *m_gate;
+            WsEngineParams m_params;
+            SSL_CTX *m_ctx;
+            int m_listenFd;
+            std::vector<Worker *> m_workers;
+            size_t m_nextWorker;
+            std::atomic<bool> m_bRunning;
+            std::atomic<bool> m_bDraining;
+            std::atomic<uint64_t> m_nFullHandshakes;
+            std::atomic<uint64_t> m_nResumedHandshakes;
+            std::atomic<uint64_t> m_nKtls;
+            std::atomic<time_t> m_tStats;
+            // Current and previous session ticket key
+            boost::mutex m_ticketLock;
+            TicketKey m_ticketKeys[2];
+            std::string m_sTicketSecret;
+            // Guards everything below
+            boost::mutex m_lock;
+            std::map<Conn *, conn_sp> m_conns;
+            unsigned long m_nPreAuth;
+            bool m_bThreadLoop;
+            // Number of OpenStack token lookups in flight
+            std::atomic<unsigned long> m_nResolving;
+            std::deque<conn_sp> m_handshakes;
+            boost::condition_variable m_handshakeCond;
+            pthread_t m_handshakeThread;
+            conn_list m_reap;
+            boost::condition_variable m_reapCond;
+            pthread_t m_reaperThread;
+    };
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _WSGATE_WSUPGRADE_H_
+#define _WSGATE_WSUPGRADE_H_
+
+#include <string>
+#include <boost/lexical_cast.hpp>
+
+#include "RDP.hpp"
+#include "wsdeflate.hpp"
+
+namespace wsgate {
+
+    /**
+     * A WebSocket upgrade request along with its response.
+     * Decouples the handshake in WsGate::HandleUpgrade from the
+     * server, which received the request (EHS or WsEngine).
+     */
+    class WsUpgrade {
+
+        public:
+            virtual ~WsUpgrade() { }
+
+            /// @return The address of the client.
+            virtual std::string RemoteAddress() = 0;
+
+            /// @return The HTTP version of the request, e.g. "1.1".
+            virtual std::string HttpVersion() = 0;
+
+            /**
+             * Retrieves a request header.
+             * @param name The name of the header (case insensitive).
+             * @return The value or an empty string.
+             */
+            virtual std::string Header(const std::string &name) = 0;
+
+            /**
+             * Retrieves a query parameter of the request URI.
+             * @param name The name of the parameter.
+             * @return The decoded value or an empty string.
+             */
+            virtual std::string FormValue(const std::string &name) = 0;
+
+            /**
+             * Sets a header of the response.
+             * @param name The name of the header.
+             * @param value The value of the header.
+             */
+            virtual void SetHeader(const std::string &name, const std::string &value) = 0;
+
+            /**
+             * Removes a header from the response.
+             * @param name The name of the header.
+             */
+            virtual void RemoveHeader(const std::string &name) = 0;
+
+            /**
+             * Creates the session objects for the upgraded connection.
+             * @see MyRawSocketHandler::Prepare
+             * @return true on success.
+             */
+            virtual bool Prepare(const std::string host, const std::string pcb,
+                    const std::string user, const std::string pass,
+                    const WsRdpParams &params, EmbeddedContext embeddedContext,
+                    const wspp::deflate_params &deflate, int protocol) = 0;
+
+            /**
+             * Retrieves a numeric query parameter of the request URI.
+             * @param name The name of the parameter.
+             * @param defval The value to return, if the parameter is
+             *   missing or not a number.
+             * @return The value of the parameter.
+             */
+            int IntValue(const std::string &name, int defval) {
+                std::string tmp(FormValue(name));
+                int ret = defval;
+                if (!tmp.empty()) {
+                    try {
+                        ret = boost::lexical_cast<int>(tmp);
+                    } catch (const boost::bad_lexical_cast &) { ret = defval; }
+                }
+                return ret;
+            }
+    };
+
+}
+
+#endif
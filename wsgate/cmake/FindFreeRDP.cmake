@@ -8,6 +8,7 @@
 # It searches for freerdp-codec.lib freerdp-codec.so freerdp-codec.a and will add one of them to the link list.
 # It searches for freerdp-gdi.lib freerdp-gdi.so freerdp-gdi.a and will add one of them to the link list.
 # It searches for freerdp-cache.lib freerdp-cache.so freerdp-cache.a and will add one of them to the link list.
+# It searches for freerdp-client.lib freerdp-client.so freerdp-client.a and will add one of them to the link list.
 
 
 if(UNIX)
@@ -155,6 +156,18 @@ elseif(UNIX)
     endif(NOT LIB_FREERDP)
 endif(WIN32 AND NOT CYGWIN)
 
+# The client library (channel addins, command line helpers) is never part of the monolithic one
+find_library(LIB_FREERDP_CLIENT
+             NAMES
+             freerdp-client
+             HINTS
+             ${_FREERDP_LIBDIR}
+             ${_FREERDP_ROOT_HINTS_AND_PATHS}
+             PATH_SUFFIXES
+             lib
+             "lib/freerdp"
+)
+
 if(LIB_FREERDP)
     mark_as_advanced(LIB_FREERDP)
     set(FREERDP_LIBRARIES ${LIB_FREERDP})
@@ -162,6 +175,10 @@ else(NOT LIB_FREERDP)
     mark_as_advanced(LIB_FREERDP_CORE LIB_FREERDP_CODEC LIB_FREERDP_GDI LIB_FREERDP_CACHE)
     set(FREERDP_LIBRARIES ${LIB_FREERDP_CORE} ${LIB_FREERDP_CODEC} ${LIB_FREERDP_GDI} ${LIB_FREERDP_CACHE})
 endif(LIB_FREERDP)
+if(LIB_FREERDP_CLIENT)
+    mark_as_advanced(LIB_FREERDP_CLIENT)
+    set(FREERDP_LIBRARIES ${LIB_FREERDP_CLIENT} ${FREERDP_LIBRARIES})
+endif(LIB_FREERDP_CLIENT)
 
 
 if (FREERDP_INCLUDE_DIR)
@@ -0,0 +1,48 @@
+# FindOpus package
+#
+# Set OPUS_ROOT_DIR to guide the package to the opus installation.
+# The script will set OPUS_INCLUDE_DIR pointing to the location of opus.h
+# and OPUS_LIBRARIES will be a list that can be passed to taget_link_libraries.
+# OPUS_FOUND is set, if both have been found.
+
+if(UNIX)
+	find_package(PkgConfig)
+	pkg_check_modules(_OPUS QUIET opus)
+endif()
+
+set(_OPUS_ROOT_HINTS
+	${OPUS_ROOT_DIR}
+	ENV OPUS_ROOT_DIR
+)
+
+find_path(OPUS_INCLUDE_DIR
+	NAMES
+	 opus.h
+	HINTS
+	 ${_OPUS_INCLUDE_DIRS}
+	 ${_OPUS_ROOT_HINTS}
+	PATH_SUFFIXES
+	 include/opus
+	 opus
+)
+
+find_library(LIB_OPUS
+	NAMES
+	 opus
+	 libopus
+	HINTS
+	 ${_OPUS_LIBRARY_DIRS}
+	 ${_OPUS_ROOT_HINTS}
+	PATH_SUFFIXES
+	 lib
+)
+
+set(OPUS_LIBRARIES ${LIB_OPUS})
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Opus "Could NOT find Opus, audio redirection is disabled"
+	OPUS_LIBRARIES
+	OPUS_INCLUDE_DIR
+)
+
+mark_as_advanced(OPUS_INCLUDE_DIR OPUS_LIBRARIES)
@@ -96,6 +96,9 @@
 /* Define to 1 if you have the <openssl/ssl.h> header file. */
 #cmakedefine HAVE_OPENSSL_SSL_H 1
 
+/* Define to 1 if libopus is available (audio redirection) */
+#cmakedefine HAVE_OPUS 1
+
 /* Define to 1 if you have the `pthread_getw32threadhandle_np' function. */
 #cmakedefine HAVE_PTHREAD_GETW32THREADHANDLE_NP 1
 
@@ -143,6 +146,9 @@
 /* Define to 1 if you have the <syslog.h> header file. */
 #cmakedefine HAVE_SYSLOG_H 1
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#cmakedefine HAVE_SYS_EPOLL_H 1
+
 /* Define to 1 if you have the <sys/ioctl.h> header file. */
 #cmakedefine HAVE_SYS_IOCTL_H 1
 
@@ -1,7 +1,14 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
 #ifndef _WIN32
 
 #include "myBindHelper.hpp"
 #include "wsgate.hpp"
+#ifdef HAVE_SYS_EPOLL_H
+# include "ListenSockets.hpp"
+#endif
 
 using namespace std;
 
@@ -16,6 +23,18 @@ namespace wsgate {
         pid_t pid;
         int status;
         char buf[32];
+#ifdef HAVE_SYS_EPOLL_H
+        // After a restart, the previous process has passed its socket.
+        int fd = ListenSockets::Take(addr, port);
+        if (-1 != fd) {
+            ret = (-1 != dup2(fd, socket));
+            close(fd);
+            if (ret) {
+                ListenSockets::Export(socket);
+                return true;
+            }
+        }
+#endif
         pthread_mutex_lock(&mutex);
         switch (pid = fork()) {
             case 0:
@@ -28,6 +47,11 @@ namespace wsgate {
             default:
                 if (waitpid(pid, &status, 0) != -1) {
                     ret = (0 == status);
+#ifdef HAVE_SYS_EPOLL_H
+                    if (ret) {
+                        ListenSockets::Export(socket);
+                    }
+#endif
                     if (0 != status) {
                         log::err << BINDHELPER_PATH << " reports: " << strerror(WEXITSTATUS(status)) << endl;
                         errno = WEXITSTATUS(status);
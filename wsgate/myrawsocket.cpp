@@ -6,6 +6,8 @@ namespace wsgate{
     MyRawSocketHandler::MyRawSocketHandler(WsGate *parent)
         : m_parent(parent)
           , m_cmap(conn_map())
+          , m_preAuth()
+          , m_preAuthLock()
     { }
 
     bool MyRawSocketHandler::OnData(EHSConnection *conn, std::string data)
@@ -25,6 +27,7 @@ namespace wsgate{
     void MyRawSocketHandler:: OnDisconnect(EHSConnection *conn)
     {
         log::debug << "GOT WS DISCONNECT" << endl;
+        EndPreAuth(conn);
         m_parent->UnregisterRdpSession(m_cmap[conn].get<2>());
         m_cmap.erase(conn);
     }
@@ -37,74 +40,63 @@ namespace wsgate{
     }
 
     bool MyRawSocketHandler::Prepare(EHSConnection *conn, const string host, const string pcb,
-            const string user, const string pass, const WsRdpParams &params, EmbeddedContext embeddedContext)
+            const string user, const string pass, const WsRdpParams &params, EmbeddedContext embeddedContext,
+            const wspp::deflate_params &deflate, int protocol)
     {
+        if (embeddedContext != CONTEXT_EMBEDDED) {
+            // Credentials arrive later via WSOP_CS_CREDENTIAL_JSON
+            boost::mutex::scoped_lock lock(m_preAuthLock);
+            unsigned long max = m_parent->GetMaxPreAuth();
+            if ((0 < max) && (m_preAuth.size() >= max)) {
+                log::warn << "Too many connections without credentials (" << max << ")" << endl;
+                return false;
+            }
+            m_preAuth.insert(conn);
+        }
         try
         {
             handler_ptr h(new MyWsHandler(conn, m_parent, this));
             conn_ptr c(new wspp::wsendpoint(h.get()));
+            c->set_max_message(m_parent->GetMaxMessage());
+            if (deflate.enabled) {
+                c->enable_deflate(deflate);
+            }
             rdp_ptr r(new RDP(h.get(), this));
             m_cmap[conn] = conn_tuple(c, h, r);
 
             r->setEmbeddedContext(embeddedContext);
+            r->SetProtocolVersion(protocol);
+            r->SetChannelParams(m_parent->GetChannelParams());
+            r->SetCursorCache(m_parent->GetCursorCache());
 
-            this->conn = conn;
             if (embeddedContext == CONTEXT_EMBEDDED){
-                PrepareRDP(host, pcb, user, pass, params);
+                PrepareRDP(r.get(), host, pcb, user, pass, params);
             }
         }
         catch(...)
         {
             log::info << "Attemtped double connection to the same machine" << endl;
+            EndPreAuth(conn);
             return false;
         }
         return true;
     }
 
-    void MyRawSocketHandler::PrepareRDP(const std::string _host, const std::string _pcb, const std::string _user, const std::string _pass, const WsRdpParams &_params){
-        std::string host = _host;
-        std::string pcb = _pcb;
-        std::string user = _user;
-        std::string pass = _pass;
-        WsRdpParams params = _params;
-
-        string username;
-        string domain;
-
-        //do needed overrides
-        WsRdpOverrideParams op = this->m_parent->getOverrideParams();
-        if (op.m_bOverrideRdpFntlm) params.fntlm = op.m_RdpOverrideParams.fntlm;
-        if (op.m_bOverrideRdpNomani) params.nomani = op.m_RdpOverrideParams.nomani;
-        if (op.m_bOverrideRdpNonla) params.nonla = op.m_RdpOverrideParams.nonla;
-        if (op.m_bOverrideRdpNotheme) params.notheme = op.m_RdpOverrideParams.notheme;
-        if (op.m_bOverrideRdpNotls) params.notls = op.m_RdpOverrideParams.notls;
-        if (op.m_bOverrideRdpNowallp) params.nowallp = op.m_RdpOverrideParams.nowallp;
-        if (op.m_bOverrideRdpNowdrag) params.nowdrag = op.m_bOverrideRdpNowdrag;
-        if (op.m_bOverrideRdpPerf) params.perf = op.m_RdpOverrideParams.perf;
-        if (op.m_bOverrideRdpPort) params.port = op.m_RdpOverrideParams.port;
-        if (op.m_bOverrideRdpHost) host = op.m_sRdpOverrideHost;
-        if (op.m_bOverrideRdpPass) pass = op.m_sRdpOverridePass;
-        if (op.m_bOverrideRdpPcb) pcb = op.m_sRdpOverridePcb;
-        if (op.m_bOverrideRdpUser) user = op.m_sRdpOverrideUser;
-
-        SplitUserDomain(user, username, domain);
-
-        rdp_ptr r = this->m_cmap[this->conn].get<2>();
-        r->Connect(host, pcb, username, domain, pass, params);
-        m_parent->RegisterRdpSession(r);
+    void MyRawSocketHandler::PrepareRDP(RDP *rdp, const std::string host, const std::string pcb,
+            const std::string user, const std::string pass, const WsRdpParams &params)
+    {
+        for (conn_map::iterator it = m_cmap.begin(); it != m_cmap.end(); ++it) {
+            if (it->second.get<2>().get() == rdp) {
+                EndPreAuth(it->first);
+                m_parent->StartRdpSession(it->second.get<2>(), host, pcb, user, pass, params);
+                return;
+            }
+        }
+    }
 
-        log::debug << "RDP Host:              '" << host << "'" << endl;
-        log::debug << "RDP Pcb:               '" << pcb << "'" << endl;
-        log::debug << "RDP User:              '" << user << "'" << endl;
-        log::info << "RDP Port:               '" << params.port << "'" << endl;
-        log::debug << "RDP Desktop size:       " << params.width << "x" << params.height << endl;
-        log::debug << "RDP Performance:        " << params.perf << endl;
-        log::debug << "RDP No wallpaper:       " << params.nowallp << endl;
-        log::debug << "RDP No full windowdrag: " << params.nowdrag << endl;
-        log::debug << "RDP No menu animation:  " << params.nomani << endl;
-        log::debug << "RDP No theming:         " << params.notheme << endl;
-        log::debug << "RDP Disable TLS:        " << params.notls << endl;
-        log::debug << "RDP Disable NLA:        " << params.nonla << endl;
-        log::debug << "RDP NTLM auth:          " << params.fntlm << endl;
+    void MyRawSocketHandler::EndPreAuth(EHSConnection *conn)
+    {
+        boost::mutex::scoped_lock lock(m_preAuthLock);
+        m_preAuth.erase(conn);
     }
-}
\ No newline at end of file
+}
@@ -21,6 +21,9 @@
 #define _MYRAWSOCKET_H_
 
 #include "RDP.hpp"
+#include "wsdeflate.hpp"
+#include <set>
+#include <boost/thread/mutex.hpp>
 #include <ehs/ehs.h>
 
 namespace wsgate {
@@ -43,7 +46,7 @@ namespace wsgate {
      * This class is our specialization of RawSocketHandler which
      * handles all WebSocket I/O events.
      */
-    class MyRawSocketHandler : public RawSocketHandler
+    class MyRawSocketHandler : public RawSocketHandler, public RdpLauncher
     {
         public:
             /**
@@ -86,15 +89,20 @@ namespace wsgate {
              * @param pass The password to be used for the RDP session.
              * @param params Additional RDP parameters.
              * @param embeddedContext Tells the purpose of the connection
+             * @param deflate The negotiated permessage-deflate parameters.
+             * @param protocol The negotiated version of the op encoding.
              * @return true on success.
              */
             bool Prepare(EHSConnection *conn, const std::string host, const std::string pcb,
                     const std::string user, const std::string pass,
-                    const WsRdpParams &params, EmbeddedContext embeddedContext);
+                    const WsRdpParams &params, EmbeddedContext embeddedContext,
+                    const wspp::deflate_params &deflate, int protocol);
             /**
              * Creates an RDP session using parameters specified to wsgate::MyRawSocketHandler::Prepare
+             * @see RdpLauncher::PrepareRDP
              */
-            void PrepareRDP(const std::string host, const std::string pcb, const std::string user, const std::string pass, const WsRdpParams &params);
+            virtual void PrepareRDP(RDP *rdp, const std::string host, const std::string pcb,
+                    const std::string user, const std::string pass, const WsRdpParams &params);
 
             /**
              * Event handler for WebSocket message events.
@@ -108,9 +116,18 @@ namespace wsgate {
             MyRawSocketHandler(const MyRawSocketHandler&);
             MyRawSocketHandler& operator=(const MyRawSocketHandler&);
 
+            /**
+             * Removes a connection from the set of connections,
+             * still waiting for their credentials.
+             * @param conn The EHSConnection in question.
+             */
+            void EndPreAuth(EHSConnection *conn);
+
             WsGate *m_parent;
             conn_map m_cmap;
-            EHSConnection *conn;
+            // Connections without credentials, limited by WsGate::GetMaxPreAuth
+            std::set<EHSConnection *> m_preAuth;
+            boost::mutex m_preAuthLock;
     };
 
 }
@@ -16,6 +16,14 @@
  */
 
 #include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
 #include <cpprest/http_client.h>
 #include <cpprest/json.h>
 
@@ -28,37 +36,110 @@ using namespace web;
 using namespace wsgate;
 using namespace utility::conversions;
 
+// Seconds, a service token is renewed before it expires
+#define TOKEN_RENEW_MARGIN 300
+// Seconds, a service token without a known expiry is used
+#define TOKEN_DEFAULT_LIFETIME 300
+// Maximum number of cached console tokens
+#define CONSOLE_CACHE_SIZE 4096
+
+class keystone_session
+{
+public:
+    std::string auth_token;
+    std::string nova_url;
+    std::chrono::steady_clock::time_point renew_at;
+};
+
+// An error response of nova's console token lookup,
+// as opposed to one from Keystone
+class nova_exception : public http_exception
+{
+public:
+    nova_exception(unsigned status_code, const std::string& message) :
+        http_exception(status_code, message)
+    {
+    }
+};
+
+class console_entry
+{
+public:
+    nova_console_info info;
+    // Set, if nova has rejected the token
+    std::exception_ptr error;
+    std::chrono::steady_clock::time_point expires_at;
+};
+
 class nova_console_token_auth_impl : public nova_console_token_auth
 {
 private:
-    web::http::http_response execute_request_and_get_response(
-        web::http::client::http_client& client,
-        web::http::http_request& request);
-
-    web::json::value get_json_from_response(web::http::http_response response);
-
-    std::pair<std::string, std::string> get_auth_token_data_v2(std::string osAuthUrl,
-                                                                           std::string osUserName,
-                                                                           std::string osPassword,
-                                                                           std::string osProjectName,
-                                                                           std::string osRegion);
-
-    std::pair<std::string, std::string> get_auth_token_data_v3(std::string osAuthUrl,
-                                                                           std::string osUserName,
-                                                                           std::string osPassword,
-                                                                           std::string osProjectName,
-                                                                           std::string osProjectId,
-                                                                           std::string osProjectDomainName,
-                                                                           std::string osUserDomainName,
-                                                                           std::string osProjectDomainId,
-                                                                           std::string osUserDomainId,
-                                                                           std::string osRegion);
-
-    web::json::value get_console_token_data(std::string authToken,
-                                            std::string novaUrl,
-                                            std::string consoleToken);
+    // Guards everything below
+    std::mutex session_lock;
+    // Service tokens and nova endpoints by credentials
+    std::map<std::string, keystone_session> sessions;
+    // Authentications in progress by credentials
+    std::map<std::string, pplx::task<keystone_session> > pending_sessions;
+    // Clients by base URL, each keeps its connections open
+    std::map<std::string, std::shared_ptr<web::http::client::http_client> > clients;
+    std::chrono::seconds timeout;
+    // Console lookups by credentials and console token
+    std::map<std::string, console_entry> consoles;
+    // Callbacks of the lookups in progress
+    std::map<std::string, std::vector<console_info_callback> > pending_consoles;
+    std::chrono::seconds console_ttl;
+    std::chrono::seconds negative_ttl;
+
+    std::shared_ptr<web::http::client::http_client> get_client(const std::string& url);
+
+    std::chrono::steady_clock::time_point get_renew_time(web::json::value expires);
+
+    pplx::task<keystone_session> get_keystone_session(
+        const std::string& key,
+        const std::function<pplx::task<keystone_session>()>& authenticate,
+        const std::string& staleToken);
+
+    pplx::task<web::http::http_response> execute_request(
+        const std::string& url,
+        web::http::http_request request);
+
+    pplx::task<keystone_session> get_auth_token_data_v2(std::string osAuthUrl,
+                                                       std::string osUserName,
+                                                       std::string osPassword,
+                                                       std::string osProjectName,
+                                                       std::string osRegion);
+
+    pplx::task<keystone_session> get_auth_token_data_v3(std::string osAuthUrl,
+                                                       std::string osUserName,
+                                                       std::string osPassword,
+                                                       std::string osProjectName,
+                                                       std::string osProjectId,
+                                                       std::string osProjectDomainName,
+                                                       std::string osUserDomainName,
+                                                       std::string osProjectDomainId,
+                                                       std::string osUserDomainId,
+                                                       std::string osRegion);
+
+    pplx::task<web::json::value> get_console_token_data(std::string authToken,
+                                                        std::string novaUrl,
+                                                        std::string consoleToken);
+
+    static nova_console_info parse_console_info(web::json::value consoleTokenData);
+
+    static bool is_invalid_token(std::exception_ptr error);
+
+    void complete_console_lookup(const std::string& key,
+                                 const nova_console_info& info,
+                                 std::exception_ptr error);
 
 public:
+    nova_console_token_auth_impl() :
+        timeout(30),
+        console_ttl(30),
+        negative_ttl(10)
+    {
+    }
+
     virtual nova_console_info get_console_info(std::string osAuthUrl,
                                                std::string osUserName,
                                                std::string osPassword,
@@ -71,36 +152,159 @@ public:
                                                std::string consoleToken,
                                                std::string keystoneVersion,
                                                std::string osRegion);
+
+    virtual void get_console_info_async(std::string osAuthUrl,
+                                        std::string osUserName,
+                                        std::string osPassword,
+                                        std::string osProjectName,
+                                        std::string osProjectId,
+                                        std::string osProjectDomainName,
+                                        std::string osUserDomainName,
+                                        std::string osProjectDomainId,
+                                        std::string osUserDomainId,
+                                        std::string consoleToken,
+                                        std::string keystoneVersion,
+                                        std::string osRegion,
+                                        console_info_callback callback);
+
+    virtual void set_timeout(unsigned seconds);
+
+    virtual void set_cache_ttl(unsigned seconds, unsigned negativeSeconds);
 };
 
 
 
-http::http_response nova_console_token_auth_impl::execute_request_and_get_response(
-    http::client::http_client& client,
-    http::http_request& request)
+pplx::task<http::http_response> nova_console_token_auth_impl::execute_request(
+    const std::string& url,
+    http::http_request request)
 {
-    auto response_task = client.request(request);
-    response_task.wait();
-    auto response = response_task.get();
+    // The client is kept alive by the continuation
+    auto client = get_client(url);
+    return client->request(request).then([client](http::http_response response) -> http::http_response
+    {
+        if(response.status_code() >= 400)
+        {
+            throw http_exception(response.status_code(), to_utf8string(response.reason_phrase()));
+        }
+
+        return response;
+    });
+}
+
+std::shared_ptr<http::client::http_client> nova_console_token_auth_impl::get_client(
+    const std::string& url)
+{
+    std::lock_guard<std::mutex> guard(session_lock);
+    auto& client = clients[url];
+    if (!client)
+    {
+        http::client::http_client_config config;
+        config.set_timeout(timeout);
+        client = std::make_shared<http::client::http_client>(to_string_t(url), config);
+    }
 
-    if(response.status_code() >= 400)
+    return client;
+}
+
+void nova_console_token_auth_impl::set_timeout(unsigned seconds)
+{
+    std::lock_guard<std::mutex> guard(session_lock);
+    if (timeout != std::chrono::seconds(seconds))
     {
-        throw http_exception(response.status_code(), to_utf8string(response.reason_phrase()));
+        timeout = std::chrono::seconds(seconds);
+        // Running requests keep their clients
+        clients.clear();
     }
+}
 
-    return response;
+void nova_console_token_auth_impl::set_cache_ttl(unsigned seconds, unsigned negativeSeconds)
+{
+    std::lock_guard<std::mutex> guard(session_lock);
+    console_ttl = std::chrono::seconds(seconds);
+    negative_ttl = std::chrono::seconds(negativeSeconds);
+    consoles.clear();
 }
 
-json::value nova_console_token_auth_impl::get_json_from_response(
-    http::http_response response)
+std::chrono::steady_clock::time_point nova_console_token_auth_impl::get_renew_time(
+    json::value expires)
 {
-    auto json_task = response.extract_json();
-    json_task.wait();
+    auto now = std::chrono::steady_clock::now();
+    int lifetime = TOKEN_DEFAULT_LIFETIME;
+    if (expires.is_string())
+    {
+        auto expiry = utility::datetime::from_string(expires.as_string(), utility::datetime::ISO_8601);
+        if (expiry.is_initialized())
+            lifetime = expiry - utility::datetime::utc_now();
+    }
+    // Short-lived tokens are renewed after 90% of their lifetime
+    lifetime -= std::min(lifetime / 10, TOKEN_RENEW_MARGIN);
 
-    return json_task.get();
+    return now + std::chrono::seconds(std::max(lifetime, 0));
 }
 
-std::pair<std::string, std::string> nova_console_token_auth_impl::get_auth_token_data_v2(
+pplx::task<keystone_session> nova_console_token_auth_impl::get_keystone_session(
+    const std::string& key,
+    const std::function<pplx::task<keystone_session>()>& authenticate,
+    const std::string& staleToken)
+{
+    pplx::task_completion_event<keystone_session> done;
+    {
+        std::lock_guard<std::mutex> guard(session_lock);
+        auto it = sessions.find(key);
+        if (it != sessions.end() && it->second.auth_token != staleToken &&
+            std::chrono::steady_clock::now() < it->second.renew_at)
+        {
+            return pplx::task_from_result(it->second);
+        }
+
+        // Concurrent requests share a single authentication
+        auto pending = pending_sessions.find(key);
+        if (pending != pending_sessions.end())
+            return pending->second;
+
+        pending_sessions[key] = pplx::create_task(done);
+    }
+
+    auto fail = [this, key, done](std::exception_ptr error)
+    {
+        {
+            std::lock_guard<std::mutex> guard(session_lock);
+            pending_sessions.erase(key);
+        }
+        done.set_exception(error);
+    };
+
+    try
+    {
+        authenticate().then([this, key, done, fail](pplx::task<keystone_session> result)
+        {
+            keystone_session session;
+            try
+            {
+                session = result.get();
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> guard(session_lock);
+                sessions[key] = session;
+                pending_sessions.erase(key);
+            }
+            done.set(session);
+        });
+    }
+    catch (...)
+    {
+        fail(std::current_exception());
+    }
+
+    return pplx::create_task(done);
+}
+
+pplx::task<keystone_session> nova_console_token_auth_impl::get_auth_token_data_v2(
     string osAuthUrl, string osUserName,
     string osPassword, string osProjectName,
     string osRegion)
@@ -119,36 +323,41 @@ std::pair<std::string, std::string> nova_console_token_auth_impl::get_auth_token
     request.headers().set_content_type(U("application/json"));
     request.set_body(jsonRequestBody);
 
-    http::client::http_client client(to_string_t(osAuthUrl));
-    auto response_json = get_json_from_response(execute_request_and_get_response(client, request));
-
-    utility::string_t authToken;
-    utility::string_t novaUrl;
-    //get the authentication token
-    authToken = response_json[U("access")][U("token")][U("id")].as_string();
-
-    //get the nova api endpoint
-    for (auto serviceCatalog : response_json[U("access")][U("serviceCatalog")].as_array())
-        if (serviceCatalog[U("name")].as_string() == U("nova")){
-            if (osRegion.empty()){
-                novaUrl = serviceCatalog[U("endpoints")][0][U("adminURL")].as_string();
-            }
-            else{
-                for (auto endpoint : serviceCatalog[U("endpoints")].as_array()){
-                    if (endpoint[U("region")].as_string() == to_string_t(osRegion)){
-                        novaUrl = endpoint[U("adminURL")].as_string();
+    return execute_request(osAuthUrl, request).then([](http::http_response response)
+    {
+        return response.extract_json();
+    }).then([this, osRegion](json::value response_json) -> keystone_session
+    {
+        utility::string_t authToken;
+        utility::string_t novaUrl;
+        //get the authentication token
+        authToken = response_json[U("access")][U("token")][U("id")].as_string();
+
+        //get the nova api endpoint
+        for (auto serviceCatalog : response_json[U("access")][U("serviceCatalog")].as_array())
+            if (serviceCatalog[U("name")].as_string() == U("nova")){
+                if (osRegion.empty()){
+                    novaUrl = serviceCatalog[U("endpoints")][0][U("adminURL")].as_string();
+                }
+                else{
+                    for (auto endpoint : serviceCatalog[U("endpoints")].as_array()){
+                        if (endpoint[U("region")].as_string() == to_string_t(osRegion)){
+                            novaUrl = endpoint[U("adminURL")].as_string();
+                        }
                     }
                 }
             }
-        }
-            
 
-    return std::pair<std::string, std::string>(
-        to_utf8string(authToken),
-        to_utf8string(novaUrl));
+        keystone_session session;
+        session.auth_token = to_utf8string(authToken);
+        session.nova_url = to_utf8string(novaUrl);
+        session.renew_at = get_renew_time(response_json[U("access")][U("token")][U("expires")]);
+
+        return session;
+    });
 }
 
-std::pair<std::string, std::string> nova_console_token_auth_impl::get_auth_token_data_v3(
+pplx::task<keystone_session> nova_console_token_auth_impl::get_auth_token_data_v3(
     string osAuthUrl, string osUserName,
     string osPassword, string osProjectName,
     string osProjectId,
@@ -210,33 +419,38 @@ std::pair<std::string, std::string> nova_console_token_auth_impl::get_auth_token
     request.headers().set_content_type(U("application/json"));
     request.set_body(jsonRequestBody);
 
-    http::client::http_client client(to_string_t(osAuthUrl));
-    auto response = execute_request_and_get_response(client, request);
-    auto response_json = get_json_from_response(response);
-
-    utility::string_t authToken;
-    utility::string_t novaUrl;
-    //get the authentication token
-    authToken = response.headers()[U("X-Subject-Token")];
-
-    //get the nova api endpoint
-    for (auto serviceCatalog : response_json[U("token")][U("catalog")].as_array())
-        if (serviceCatalog[U("name")].as_string() == U("nova"))
-            for (auto endpoint : serviceCatalog[U("endpoints")].as_array())
-                if (endpoint[U("interface")].as_string() == U("admin") &&
-                    (endpoint[U("region")].as_string() == to_string_t(osRegion) || osRegion.empty())){
-                        novaUrl = endpoint[U("url")].as_string();
-                }
-
-    return std::pair<std::string, std::string>(
-        to_utf8string(authToken),
-        to_utf8string(novaUrl));
+    return execute_request(osAuthUrl, request).then([this, osRegion](http::http_response response) -> pplx::task<keystone_session>
+    {
+        //get the authentication token
+        utility::string_t authToken = response.headers()[U("X-Subject-Token")];
+
+        return response.extract_json().then([this, osRegion, authToken](json::value response_json) -> keystone_session
+        {
+            utility::string_t novaUrl;
+            //get the nova api endpoint
+            for (auto serviceCatalog : response_json[U("token")][U("catalog")].as_array())
+                if (serviceCatalog[U("name")].as_string() == U("nova"))
+                    for (auto endpoint : serviceCatalog[U("endpoints")].as_array())
+                        if (endpoint[U("interface")].as_string() == U("admin") &&
+                            (endpoint[U("region")].as_string() == to_string_t(osRegion) || osRegion.empty())){
+                                novaUrl = endpoint[U("url")].as_string();
+                        }
+
+            keystone_session session;
+            session.auth_token = to_utf8string(authToken);
+            session.nova_url = to_utf8string(novaUrl);
+            session.renew_at = get_renew_time(response_json[U("token")][U("expires_at")]);
+
+            return session;
+        });
+    });
 }
 
-json::value nova_console_token_auth_impl::get_console_token_data(
+
+
+pplx::task<json::value> nova_console_token_auth_impl::get_console_token_data(
     string authToken, string novaUrl, string consoleToken)
 {
-    http::client::http_client client(to_string_t(novaUrl));
     http::uri_builder console_token_uri;
     console_token_uri.append(U("os-console-auth-tokens"));
     console_token_uri.append(to_string_t(consoleToken));
@@ -247,51 +461,25 @@ json::value nova_console_token_auth_impl::get_console_token_data(
     request.headers().add(http::header_names::accept, U("application/json"));
     request.headers().set_content_type(U("application/json"));
 
-    return get_json_from_response(execute_request_and_get_response(client, request));
+    return execute_request(novaUrl, request).then([](pplx::task<http::http_response> result)
+    {
+        try
+        {
+            return result.get().extract_json();
+        }
+        catch (http_exception& e)
+        {
+            throw nova_exception(e.get_status_code(), e.what());
+        }
+    });
 }
 
-nova_console_info nova_console_token_auth_impl::get_console_info(
-    std::string osAuthUrl, std::string osUserName,
-    std::string osPassword,
-    std::string osProjectName, std::string osProjectId,
-    std::string osProjectDomainName, std::string osUserDomainName,
-    std::string osProjectDomainId, std::string osUserDomainId,
-    std::string consoleToken, std::string keystoneVersion,
-    std::string osRegion)
-{
-    std::string authToken;
-    std::string novaUrl;
-
-    if (keystoneVersion == KEYSTONE_V2){
-        std::tie(authToken, novaUrl) = get_auth_token_data_v2(osAuthUrl,
-                                                              osUserName,
-                                                              osPassword,
-                                                              osProjectName,
-                                                              osRegion);
-    }
-    else if (keystoneVersion == KEYSTONE_V3){
-        std::tie(authToken, novaUrl) = get_auth_token_data_v3(osAuthUrl,
-                                                              osUserName,
-                                                              osPassword,
-                                                              osProjectName,
-                                                              osProjectId,
-                                                              osProjectDomainName,
-                                                              osUserDomainName,
-                                                              osProjectDomainId,
-                                                              osUserDomainId,
-                                                              osRegion);
-    }
-    else{
-        throw std::invalid_argument("Unknown Keystone version");
-    }
 
+nova_console_info nova_console_token_auth_impl::parse_console_info(
+    json::value consoleTokenData)
+{
     nova_console_info info;
 
-    auto consoleTokenData = get_console_token_data(
-        authToken,
-        novaUrl,
-        consoleToken);
-
     info.host = to_utf8string(consoleTokenData[U("console")][U("host")].as_string());
 
     auto portValue = consoleTokenData[U("console")][U("port")];
@@ -315,6 +503,195 @@ nova_console_info nova_console_token_auth_impl::get_console_info(
     return info;
 }
 
+bool nova_console_token_auth_impl::is_invalid_token(std::exception_ptr error)
+{
+    // Only nova's verdict on the token is cached, not transient failures
+    // or errors of Keystone
+    try
+    {
+        std::rethrow_exception(error);
+    }
+    catch (nova_exception& e)
+    {
+        return e.get_status_code() == 401 || e.get_status_code() == 404;
+    }
+    catch (...)
+    {
+    }
+
+    return false;
+}
+
+void nova_console_token_auth_impl::complete_console_lookup(
+    const std::string& key, const nova_console_info& info,
+    std::exception_ptr error)
+{
+    std::vector<console_info_callback> callbacks;
+    {
+        std::lock_guard<std::mutex> guard(session_lock);
+        auto pending = pending_consoles.find(key);
+        if (pending != pending_consoles.end())
+        {
+            callbacks.swap(pending->second);
+            pending_consoles.erase(pending);
+        }
+
+        auto ttl = error ? (is_invalid_token(error) ? negative_ttl : std::chrono::seconds(0)) : console_ttl;
+        auto now = std::chrono::steady_clock::now();
+        if (ttl.count() > 0 && consoles.size() >= CONSOLE_CACHE_SIZE)
+        {
+            for (auto it = consoles.begin(); it != consoles.end(); )
+            {
+                if (it->second.expires_at <= now)
+                    it = consoles.erase(it);
+                else
+                    ++it;
+            }
+        }
+        if (ttl.count() > 0 && consoles.size() < CONSOLE_CACHE_SIZE)
+        {
+            console_entry& entry = consoles[key];
+            entry.info = info;
+            entry.error = error;
+            entry.expires_at = now + ttl;
+        }
+    }
+
+    for (auto& callback : callbacks)
+        callback(info, error);
+}
+
+void nova_console_token_auth_impl::get_console_info_async(
+    std::string osAuthUrl, std::string osUserName,
+    std::string osPassword,
+    std::string osProjectName, std::string osProjectId,
+    std::string osProjectDomainName, std::string osUserDomainName,
+    std::string osProjectDomainId, std::string osUserDomainId,
+    std::string consoleToken, std::string keystoneVersion,
+    std::string osRegion, console_info_callback callback)
+{
+    if (keystoneVersion != KEYSTONE_V2 && keystoneVersion != KEYSTONE_V3){
+        throw std::invalid_argument("Unknown Keystone version");
+    }
+
+    std::function<pplx::task<keystone_session>()> authenticate = [=]() -> pplx::task<keystone_session> {
+        if (keystoneVersion == KEYSTONE_V2){
+            return get_auth_token_data_v2(osAuthUrl,
+                                          osUserName,
+                                          osPassword,
+                                          osProjectName,
+                                          osRegion);
+        }
+        return get_auth_token_data_v3(osAuthUrl,
+                                      osUserName,
+                                      osPassword,
+                                      osProjectName,
+                                      osProjectId,
+                                      osProjectDomainName,
+                                      osUserDomainName,
+                                      osProjectDomainId,
+                                      osUserDomainId,
+                                      osRegion);
+    };
+
+    // The service token and the nova endpoint are reused until shortly
+    // before the token expires.
+    std::ostringstream oss;
+    oss << keystoneVersion << '\n' << osAuthUrl << '\n' << osUserName << '\n'
+        << osPassword << '\n' << osProjectName << '\n' << osProjectId << '\n'
+        << osProjectDomainName << '\n' << osUserDomainName << '\n'
+        << osProjectDomainId << '\n' << osUserDomainId << '\n' << osRegion;
+    std::string key = oss.str();
+
+    // Repeated opens of a console share the result of a single lookup,
+    // rejected tokens are remembered as well.
+    std::string consoleKey = key + '\n' + consoleToken;
+    {
+        std::unique_lock<std::mutex> guard(session_lock);
+        auto it = consoles.find(consoleKey);
+        if (it != consoles.end())
+        {
+            if (std::chrono::steady_clock::now() < it->second.expires_at)
+            {
+                console_entry entry = it->second;
+                guard.unlock();
+                callback(entry.info, entry.error);
+                return;
+            }
+            consoles.erase(it);
+        }
+
+        auto& callbacks = pending_consoles[consoleKey];
+        callbacks.push_back(callback);
+        if (callbacks.size() > 1)
+            return;
+    }
+
+    // No thread waits for the responses, each step continues the previous one.
+    get_keystone_session(key, authenticate, std::string()).then(
+        [this, key, authenticate, consoleToken](keystone_session session)
+    {
+        return get_console_token_data(session.auth_token, session.nova_url, consoleToken).then(
+            [this, key, authenticate, consoleToken, session](pplx::task<json::value> result) -> pplx::task<json::value>
+        {
+            try
+            {
+                return pplx::task_from_result(result.get());
+            }
+            catch (http_exception& e)
+            {
+                if (e.get_status_code() != 401)
+                    throw;
+            }
+            // The service token has been revoked before its expiry
+            return get_keystone_session(key, authenticate, session.auth_token).then(
+                [this, consoleToken](keystone_session renewed)
+            {
+                return get_console_token_data(renewed.auth_token, renewed.nova_url, consoleToken);
+            });
+        });
+    }).then([this, consoleKey](pplx::task<json::value> result)
+    {
+        nova_console_info info;
+        try
+        {
+            info = parse_console_info(result.get());
+        }
+        catch (...)
+        {
+            complete_console_lookup(consoleKey, info, std::current_exception());
+            return;
+        }
+        complete_console_lookup(consoleKey, info, std::exception_ptr());
+    });
+}
+
+nova_console_info nova_console_token_auth_impl::get_console_info(
+    std::string osAuthUrl, std::string osUserName,
+    std::string osPassword,
+    std::string osProjectName, std::string osProjectId,
+    std::string osProjectDomainName, std::string osUserDomainName,
+    std::string osProjectDomainId, std::string osUserDomainId,
+    std::string consoleToken, std::string keystoneVersion,
+    std::string osRegion)
+{
+    auto result = std::make_shared<std::promise<nova_console_info> >();
+    get_console_info_async(osAuthUrl, osUserName, osPassword,
+                           osProjectName, osProjectId,
+                           osProjectDomainName, osUserDomainName,
+                           osProjectDomainId, osUserDomainId,
+                           consoleToken, keystoneVersion, osRegion,
+                           [result](const nova_console_info& info, std::exception_ptr error)
+    {
+        if (error)
+            result->set_exception(error);
+        else
+            result->set_value(info);
+    });
+
+    return result->get_future().get();
+}
+
 
 nova_console_token_auth* nova_console_token_auth_factory::instance = NULL;
 
@@ -19,6 +19,7 @@
 #define _NOVA_TOKEN_AUTH_
 
 #include <exception>
+#include <functional>
 #include <string>
 
 #define KEYSTONE_V2 "v2.0"
@@ -62,6 +63,15 @@ namespace wsgate {
     };
 
 
+    /**
+     * Receives the result of get_console_info_async. On failure,
+     * error holds the exception, which would have been thrown by
+     * get_console_info.
+     */
+    typedef std::function<void(const nova_console_info& info,
+                               std::exception_ptr error)> console_info_callback;
+
+
     class nova_console_token_auth
     {
     public:
@@ -77,6 +87,37 @@ namespace wsgate {
                                                    std::string consoleToken,
                                                    std::string keystoneVersion,
                                                    std::string osRegion) = 0;
+
+        /**
+         * Resolves a console token without blocking the caller.
+         * The callback is invoked on a thread of the HTTP client or,
+         * if the result is cached, right away.
+         */
+        virtual void get_console_info_async(std::string osAuthUrl,
+                                            std::string osUserName,
+                                            std::string osPassword,
+                                            std::string osProjectName,
+                                            std::string osProjectId,
+                                            std::string osProjectDomainName,
+                                            std::string osUserDomainName,
+                                            std::string osProjectDomainId,
+                                            std::string osUserDomainId,
+                                            std::string consoleToken,
+                                            std::string keystoneVersion,
+                                            std::string osRegion,
+                                            console_info_callback callback) = 0;
+
+        /**
+         * Sets the timeout of each request to Keystone and nova.
+         */
+        virtual void set_timeout(unsigned seconds) = 0;
+
+        /**
+         * Sets how long console lookups are cached: Successful ones for
+         * seconds, the ones rejected by nova for negativeSeconds.
+         * 0 disables the respective cache.
+         */
+        virtual void set_cache_ttl(unsigned seconds, unsigned negativeSeconds) = 0;
     };
 
 
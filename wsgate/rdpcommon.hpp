@@ -31,6 +31,8 @@ extern "C" {
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/color.h>
 
+#include <vector>
+
 #include "wsgate.hpp"
 #include "wshandler.hpp"
 
@@ -44,6 +46,11 @@ namespace wsgate {
     class RDP;
     class Update;
     class Primary;
+    class OpStream;
+    class TextInjector;
+    class AudioEncoder;
+    class ChannelRelay;
+    class CursorCache;
     struct CLRCONV;
 
     /**
@@ -63,7 +70,10 @@ namespace wsgate {
         WSOP_SC_PTR_FREE,
         WSOP_SC_PTR_SET,
         WSOP_SC_PTR_SETNULL,
-        WSOP_SC_PTR_SETDEFAULT
+        WSOP_SC_PTR_SETDEFAULT,
+        WSOP_SC_AUDIO,
+        WSOP_SC_VC_DATA,
+        WSOP_SC_VC_ACK
     } WsOPsc;
 
     /**
@@ -76,7 +86,13 @@ namespace wsgate {
         WSOP_CS_KPRESS,
         WSOP_CS_SPECIALCOMB,
         WSOP_CS_CREDENTIAL_JSON,
-        WSOP_CS_UNICODE
+        WSOP_CS_UNICODE,
+        WSOP_CS_INPUT_BATCH,
+        WSOP_CS_VISIBILITY,
+        WSOP_CS_RESIZE,
+        WSOP_CS_AUDIO_FEEDBACK,
+        WSOP_CS_VC_DATA,
+        WSOP_CS_VC_ACK
     } WsOPcs;
 
     /**
@@ -108,6 +124,19 @@ namespace wsgate {
         int notheme;
     } WsRdpParams;
 
+    /**
+     * Static virtual channels, relayed between
+     * the RDP server and the client (from config file).
+     */
+    typedef struct {
+        /// The channel names.
+        std::vector<std::string> names;
+        /// Maximum number of unacknowledged bytes per channel and direction.
+        size_t window;
+        /// Maximum number of bytes, buffered per channel and direction.
+        size_t maxpending;
+    } WsChannelParams;
+
     /**
      * Set of override parameters
      */
@@ -0,0 +1,145 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark for the UTF-8 validation of text frames.
+ * Compares the bytewise DFA against utf8_validator::validate() on
+ * payloads resembling the traffic seen by the gateway.
+ *
+ * Not built by default:
+ *   cmake -DWSGATE_BENCHMARKS=ON ... && make utf8bench
+ *   (autotools: make utf8bench)
+ * or standalone:
+ *   g++ -O2 -I.. utf8bench.cpp -o utf8bench
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "wsutf8.hpp"
+
+namespace {
+
+    typedef std::chrono::steady_clock clk;
+
+    struct payload {
+        std::string name;
+        std::string data;
+    };
+
+    // Repeats the given fragments until at least len bytes are collected.
+    std::string build(const char * const *frags, size_t nfrags, size_t len) {
+        std::string ret;
+        size_t i = 0;
+        while (ret.length() < len) {
+            ret.append(frags[i++ % nfrags]);
+        }
+        return ret;
+    }
+
+    bool dfa(const std::string &s) {
+        utf8_validator::validator v;
+        return v.decode(s.begin(), s.end()) && v.complete();
+    }
+
+    template <typename F>
+    double run(F fn, const std::string &s, bool &result) {
+        // Aim for roughly 256MB per measurement.
+        size_t iter = (size_t(256) << 20) / (s.length() + 1) + 1;
+        volatile bool sink = true;
+        clk::time_point t0 = clk::now();
+        for (size_t i = 0; i < iter; ++i) {
+            sink = fn(s) && sink;
+        }
+        clk::time_point t1 = clk::now();
+        result = sink;
+        double secs = std::chrono::duration<double>(t1 - t0).count();
+        return (double(s.length()) * iter) / secs / (1024.0 * 1024.0);
+    }
+
+}
+
+int main(int, char **)
+{
+    // Client log messages, as sent by wsgate-debug.js
+    static const char * const logs[] = {
+        "D:Mouse event: x=512 y=384 flags=0x0800\n",
+        "I:Connected to 10.0.0.15:3389\n",
+        "W:Unhandled key code 229\n",
+        "E:WebSocket error: connection reset\n",
+    };
+    // Credentials JSON with a few non-ASCII user names
+    static const char * const creds[] = {
+        "{\"host\":\"rdp.example.com\",\"user\":\"J\xc3\xbcrgen M\xc3\xbcller\",",
+        "\"pass\":\"s3cr\xc3\xa9t\",\"dtop\":\"\",\"width\":1920,\"height\":1080}",
+    };
+    // Mixed western european text
+    static const char * const latin[] = {
+        "Gr\xc3\xbc\xc3\x9f" "e aus K\xc3\xb6ln, ",
+        "\xc3\xa7" "a co\xc3\xbb" "te 10\xe2\x82\xac, ",
+        "se\xc3\xb1or \xc3\xa1rbol ",
+    };
+    // CJK and emoji (3 and 4 byte sequences only)
+    static const char * const cjk[] = {
+        "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe3\x83\x86\xe3\x82\xad\xe3\x82\xb9\xe3\x83\x88",
+        "\xf0\x9f\x98\x80\xf0\x9f\x9a\x80",
+        "\xe4\xb8\xad\xe6\x96\x87",
+    };
+
+    std::vector<payload> payloads;
+    size_t sizes[] = { 40, 1024, 65536 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        char name[64];
+        payload p;
+        snprintf(name, sizeof(name), "log lines %6lu", (unsigned long)sizes[i]);
+        p.name = name;
+        p.data = build(logs, 4, sizes[i]);
+        payloads.push_back(p);
+        snprintf(name, sizeof(name), "credentials %6lu", (unsigned long)sizes[i]);
+        p.name = name;
+        p.data = build(creds, 2, sizes[i]);
+        payloads.push_back(p);
+        snprintf(name, sizeof(name), "latin-1 text %6lu", (unsigned long)sizes[i]);
+        p.name = name;
+        p.data = build(latin, 3, sizes[i]);
+        payloads.push_back(p);
+        snprintf(name, sizeof(name), "cjk/emoji %6lu", (unsigned long)sizes[i]);
+        p.name = name;
+        p.data = build(cjk, 3, sizes[i]);
+        payloads.push_back(p);
+    }
+
+    printf("%-22s %12s %12s %8s\n", "payload", "dfa MB/s", "fast MB/s", "speedup");
+    int ret = 0;
+    for (std::vector<payload>::iterator i = payloads.begin(); i != payloads.end(); ++i) {
+        bool r1, r2;
+        double slow = run(dfa, i->data, r1);
+        double fast = run(static_cast<bool (*)(const std::string &)>(utf8_validator::validate), i->data, r2);
+        printf("%-22s %12.1f %12.1f %7.1fx%s\n", i->name.c_str(), slow, fast, fast / slow,
+                (r1 && r2) ? "" : "  MISMATCH");
+        if (!(r1 && r2)) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
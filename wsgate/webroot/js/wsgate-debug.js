@@ -128,7 +128,7 @@ wsgate.WSrunner = new Class( {
     },
     Run: function() {
         try {
-            this.sock = new WebSocket(this.url);
+            this.sock = this.proto ? new WebSocket(this.url, this.proto) : new WebSocket(this.url);
         } catch (err) { }
         this.sock.binaryType = 'arraybuffer';
         this.sock.onopen = this.onWSopen.bind(this);
@@ -167,6 +167,17 @@ wsgate.RDP = new Class( {
         this.cursors = new Array();
         this.sid = null;
         this.open = false;
+        // Offer the compact op encoding
+        this.proto = 'wsgate-v2';
+        this.v2 = false;
+        this.v2x = 0;
+        this.v2y = 0;
+        // Pending mouse moves (x, y pairs)
+        this.inQ = [];
+        this.aCtx = null;
+        this.aDec = null;
+        // Relayed virtual channels, announced by the server
+        this.vc = [];
         this.cssC = cssCursor;
         this.uT = useTouch;
         if (!cssCursor) {
@@ -207,6 +218,48 @@ wsgate.RDP = new Class( {
             this.sock.send(buf);
         };
     },
+    /**
+     * Request a new remote desktop size.
+     * The gateway applies the last of a series of requests only,
+     * if the server supports Display Control.
+     */
+    SendResize: function(w, h) {
+        var buf, a;
+        if (this.sock.readyState == this.sock.OPEN) {
+            buf = new ArrayBuffer(12);
+            a = new Uint32Array(buf);
+            a[0] = 8; // WSOP_CS_RESIZE
+            a[1] = w;
+            a[2] = h;
+            this.sock.send(buf);
+        }
+    },
+    /**
+     * Send a message on a relayed virtual channel.
+     * data is an ArrayBuffer or a typed array, holding a complete
+     * channel message. Messages are queued, while more than the
+     * announced window is in flight.
+     * Returns false, if the channel is not relayed or the message is too large.
+     */
+    SendChannel: function(name, data) {
+        var chan, c, buf, msg;
+        for (chan = 0; chan < this.vc.length; ++chan) {
+            if (this.vc[chan].name == name) {
+                break;
+            }
+        }
+        c = this.vc[chan];
+        msg = ArrayBuffer.isView(data) ? new Uint8Array(data.buffer, data.byteOffset, data.byteLength) : new Uint8Array(data);
+        if (!c || (msg.length > this.vcMax)) {
+            return false;
+        }
+        buf = new ArrayBuffer(8 + msg.length);
+        new Uint32Array(buf, 0, 2).set([10, chan]); // WSOP_CS_VC_DATA
+        new Uint8Array(buf, 8).set(msg);
+        c.outQ.push(buf);
+        this._vcFlush(c);
+        return true;
+    },
     SendCredentials: function() {
         var infoJSONstring = JSON.stringify(settingsGetJSON());
         var len = infoJSONstring.length;
@@ -328,6 +381,122 @@ wsgate.RDP = new Class( {
         // No clipping region
         return true;
     },
+    /**
+     * Convert an op in the compact encoding (subprotocol wsgate-v2)
+     * into the layout, processed by _pmsg. A v2 op consists of a single
+     * byte opcode, followed by LEB128 varints. Coordinates are zigzag
+     * encoded deltas against the position of the previous op.
+     */
+    _v2to1: function(data) {
+        var src = new Uint8Array(data), pos = 1, op = src[0], out, i32, hdr, n, i, x, y;
+        var self = this;
+        var u = function() { // unsigned varint
+            var ret = 0, mul = 1, b;
+            do {
+                b = src[pos++];
+                ret += (b & 0x7f) * mul;
+                mul *= 128;
+            } while (b & 0x80);
+            return ret;
+        };
+        var s = function() { // zigzag encoded varint
+            var v = u();
+            return (v % 2) ? -(v + 1) / 2 : v / 2;
+        };
+        var dx = function() {
+            self.v2x = (self.v2x + s()) | 0;
+            return self.v2x;
+        };
+        var dy = function() {
+            self.v2y = (self.v2y + s()) | 0;
+            return self.v2y;
+        };
+        var c = function(buf, offs) { // 4 raw bytes
+            new Uint8Array(buf, offs, 4).set(src.subarray(pos, pos + 4));
+            pos += 4;
+        };
+        switch (op) {
+            case 2:
+                // x, y, w, h, dw, dh, bpp, compressed, len, data
+                hdr = [op, dx(), dy(), u(), u(), u(), u(), u(), u(), u()];
+                out = new ArrayBuffer(40 + hdr[9]);
+                new Uint32Array(out, 0, 10).set(hdr);
+                new Uint8Array(out, 40).set(src.subarray(pos, pos + hdr[9]));
+                return out;
+            case 3:
+                // x, y, w, h, color
+                out = new ArrayBuffer(24);
+                new Int32Array(out, 0, 5).set([op, dx(), dy(), s(), s()]);
+                c(out, 20);
+                return out;
+            case 4:
+                // left, top, width, height
+                x = dx();
+                y = dy();
+                return new Int32Array([op, x, y, (x + s()) | 0, (y + s()) | 0]).buffer;
+            case 5:
+                // x, y, w, h, color, rop3
+                out = new ArrayBuffer(28);
+                new Int32Array(out, 0, 5).set([op, dx(), dy(), s(), s()]);
+                c(out, 20);
+                new Uint32Array(out, 24, 1)[0] = u();
+                return out;
+            case 6:
+                // color, nrects, rects (each relative to its predecessor)
+                hdr = new Uint8Array(src.subarray(1, 5));
+                pos = 5;
+                n = u();
+                out = new ArrayBuffer(12 + 16 * n);
+                new Uint32Array(out, 0, 3).set([op, 0, n]);
+                new Uint8Array(out, 4, 4).set(hdr);
+                i32 = new Int32Array(out, 12, 4 * n);
+                for (i = 0; i < 4 * n; i += 4) {
+                    i32[i] = dx();
+                    i32[i+1] = dy();
+                    i32[i+2] = s();
+                    i32[i+3] = s();
+                }
+                return out;
+            case 7:
+                // rop3, x, y, w, h, sx, sy
+                out = new ArrayBuffer(32);
+                new Uint32Array(out, 0, 2).set([op, u()]);
+                x = dx();
+                y = dy();
+                new Int32Array(out, 8, 6).set([x, y, s(), s(), (x + s()) | 0, (y + s()) | 0]);
+                return out;
+            case 8:
+                // id, xhot, yhot, key (the remainder of the message)
+                hdr = [op, u(), u(), u()];
+                out = new ArrayBuffer(16 + src.length - pos);
+                new Uint32Array(out, 0, 4).set(hdr);
+                new Uint8Array(out, 16).set(src.subarray(pos));
+                return out;
+            case 9:
+            case 10:
+                // id
+                return new Uint32Array([op, u()]).buffer;
+            case 13:
+                // seq, ts, packet (the remainder of the message)
+                hdr = [op, u(), u(), src.length - pos];
+                out = new ArrayBuffer(16 + hdr[3]);
+                new Uint32Array(out, 0, 4).set(hdr);
+                new Uint8Array(out, 16).set(src.subarray(pos));
+                return out;
+            case 14:
+                // chan, flags, total, chunk (the remainder of the message)
+                hdr = [op, u(), u(), u()];
+                out = new ArrayBuffer(16 + src.length - pos);
+                new Uint32Array(out, 0, 4).set(hdr);
+                new Uint8Array(out, 16).set(src.subarray(pos));
+                return out;
+            case 15:
+                // chan, bytes
+                return new Uint32Array([op, u(), u()]).buffer;
+            default:
+                return new Uint32Array([op]).buffer;
+        }
+    },
     /**
      * Main message loop.
      */
@@ -481,14 +650,17 @@ wsgate.RDP = new Class( {
                 break;
             case 8:
                 // PTR_NEW
-                // id, xhot, yhot
+                // id, xhot, yhot, key
+                // The image URL depends on its content only, so the
+                // browser cache serves cursors, known from earlier sessions.
                 hdr = new Uint32Array(data, 4, 3);
+                var curl = '/cur/' + String.fromCharCode.apply(null, new Uint8Array(data, 16));
                 if (this.cssC) {
-                    this.cursors[hdr[0]] = (this.msie > 0 || this.trident > 0) ? 'url(/cur/' + this.sid + '/' + hdr[0] + '), none' : //IE is not suporting given hot spots
-                                            'url(/cur/' + this.sid + '/' + hdr[0] + ') ' + hdr[1] + ' ' + hdr[2] + ',none'; 
+                    this.cursors[hdr[0]] = (this.msie > 0 || this.trident > 0) ? 'url(' + curl + '), none' : //IE is not suporting given hot spots
+                                            'url(' + curl + ') ' + hdr[1] + ' ' + hdr[2] + ',none'; 
                 } else {
-                    this.cursors[hdr[0]] = (this.msie > 0 || this.trident > 0) ? { u: '/cur/' + this.sid + '/' + hdr[0] } :
-                                            { u: '/cur/' + this.sid + '/' + hdr[0], x: hdr[1], y: hdr[2] };
+                    this.cursors[hdr[0]] = (this.msie > 0 || this.trident > 0) ? { u: curl } :
+                                            { u: curl, x: hdr[1], y: hdr[2] };
                 }
                 break;
             case 9:
@@ -530,10 +702,228 @@ wsgate.RDP = new Class( {
                     this.cI.src = '/c_default.png';
                 }
                 break;
+            case 13:
+                // Opus audio packet
+                hdr = new Uint32Array(data, 0, 4);
+                this._aPkt(hdr[1], hdr[2], new Uint8Array(data, 16, hdr[3]));
+                break;
+            case 14:
+                // Virtual channel chunk
+                // chan, flags, total, chunk
+                hdr = new Uint32Array(data, 0, 4);
+                this._vcChunk(hdr[1], hdr[2], hdr[3], new Uint8Array(data, 16));
+                break;
+            case 15:
+                // Virtual channel message, sent by the server
+                // chan, bytes
+                hdr = new Uint32Array(data, 0, 3);
+                if (this.vc[hdr[1]]) {
+                    this.vc[hdr[1]].outB = Math.max(0, this.vc[hdr[1]].outB - hdr[2]);
+                    this._vcFlush(this.vc[hdr[1]]);
+                }
+                break;
             default:
                 this.log.warn('Unknown BINRESP: ', data.byteLength);
         }
     },
+    /**
+     * Set up audio playback, if the browser can decode Opus.
+     * The server does not send any audio, before it received
+     * our first feedback report.
+     */
+    _aInit: function() {
+        var AC = window.AudioContext || window.webkitAudioContext;
+        if (('undefined' == typeof(AudioDecoder)) || !AC) {
+            this.log.info('No Opus decoder, audio disabled');
+            return;
+        }
+        this.aCtx = new AC();
+        this.aDec = new AudioDecoder({
+            'output': this._aOut.bind(this),
+            'error': function(e) { this.log.warn('Audio: ', e.message); }.bind(this)
+        });
+        this.aDec.configure({'codec': 'opus', 'sampleRate': 48000, 'numberOfChannels': 2});
+        this.aNext = -1;    // next expected sequence number
+        this.aHighT = 0;    // arrival time of the last packet
+        this.aRepT = null;  // arrival time of the last reported packet
+        this.aLost = 0;
+        this.aLate = 0;
+        this.aJit = 0;      // interarrival jitter in ms (RFC 3550)
+        this.aTransit = null;
+        this.aBase = null;  // AudioContext time of timestamp 0
+        this.aCont = [];    // per decoded packet: part of a continuous stream?
+        this._aReport();
+        this.aTid = this._aReport.periodical(1000, this);
+    },
+    _aStop: function() {
+        if ('number' == typeof(this.aTid)) {
+            clearInterval(this.aTid);
+        }
+        delete this.aTid;
+        if (this.aDec) {
+            if ('closed' != this.aDec.state) {
+                this.aDec.close();
+            }
+            this.aCtx.close();
+            this.aDec = null;
+            this.aCtx = null;
+        }
+    },
+    /**
+     * Browsers start an AudioContext only in response to a user gesture.
+     */
+    _aResume: function() {
+        if (this.aCtx && ('suspended' == this.aCtx.state)) {
+            this.aCtx.resume();
+        }
+    },
+    /**
+     * Send a WSOP_CS_AUDIO_FEEDBACK message, if any packet
+     * arrived since the previous one.
+     */
+    _aReport: function() {
+        var buf, a;
+        if (this.aRepT === this.aHighT) {
+            return;
+        }
+        if (this.sock.readyState == this.sock.OPEN) {
+            buf = new ArrayBuffer(20);
+            a = new Uint32Array(buf);
+            a[0] = 9; // WSOP_CS_AUDIO_FEEDBACK
+            a[1] = this.aNext - 1;
+            a[2] = this.aHighT ? Math.round(performance.now() - this.aHighT) : 0;
+            a[3] = this.aLost;
+            a[4] = this.aLate;
+            this.sock.send(buf);
+            this.aLost = 0;
+            this.aLate = 0;
+            this.aRepT = this.aHighT;
+        }
+    },
+    /**
+     * Handle an incoming Opus packet.
+     * Packets are decoded immediately and scheduled by their
+     * timestamp, the playout delay follows the measured jitter.
+     */
+    _aPkt: function(seq, ts, pkt) {
+        var now = performance.now(), transit;
+        if (!this.aDec) {
+            return;
+        }
+        if (seq < this.aNext) {
+            // Reordered, the successor has already been decoded
+            this.aLate += 1;
+            return;
+        }
+        if (this.aNext >= 0) {
+            this.aLost += seq - this.aNext;
+        }
+        this.aNext = seq + 1;
+        transit = now - ts / 48;
+        if (null !== this.aTransit) {
+            this.aJit += (Math.abs(transit - this.aTransit) - this.aJit) / 16;
+        }
+        this.aTransit = transit;
+        // After a pause, the stream simply starts over.
+        this.aCont.push((now - this.aHighT) < 100);
+        this.aHighT = now;
+        this.aDec.decode(new EncodedAudioChunk({
+            'type': 'key',
+            'timestamp': ts * 1000 / 48,
+            'data': pkt
+        }));
+    },
+    _aOut: function(ad) {
+        var ctx = this.aCtx, cont = this.aCont.shift(), buf, src, c, t;
+        var delay = Math.min(Math.max((3 * this.aJit + 20) / 1000, 0.04), 0.3);
+        buf = ctx.createBuffer(ad.numberOfChannels, ad.numberOfFrames, ad.sampleRate);
+        for (c = 0; c < ad.numberOfChannels; ++c) {
+            ad.copyTo(buf.getChannelData(c), {'planeIndex': c, 'format': 'f32-planar'});
+        }
+        t = ad.timestamp / 1e6;
+        ad.close();
+        if ((null !== this.aBase) && (this.aBase + t < ctx.currentTime) && cont) {
+            this.aLate += 1;
+        }
+        if ((null === this.aBase) || (this.aBase + t < ctx.currentTime) ||
+                (this.aBase + t > ctx.currentTime + delay + 0.2)) {
+            this.aBase = ctx.currentTime + delay - t;
+        }
+        src = ctx.createBufferSource();
+        src.buffer = buf;
+        src.connect(ctx.destination);
+        src.start(this.aBase + t);
+    },
+    /**
+     * Set up the relayed virtual channels from a 'V:' announcement:
+     * V:<window>:<maxpending>:<name>,...
+     */
+    _vcInit: function(msg) {
+        var p = msg.split(':');
+        this.vcWin = p[0].toInt();
+        this.vcMax = p[1].toInt();
+        this.vc = p[2].split(',').map(function(name, i) {
+            return {
+                'name': name,
+                'idx': i,
+                'msg': null,  // message, being reassembled
+                'len': 0,
+                'ackB': 0,    // received, but not yet acknowledged
+                'outQ': [],   // messages, waiting for credit
+                'outB': 0     // sent, but not yet acknowledged by the server
+            };
+        });
+        this.vc.each(function(c) {
+            this.fireEvent('channelopen', c.name);
+        }, this);
+    },
+    /**
+     * Reassemble a virtual channel message and acknowledge
+     * received chunks, so that the server may send more.
+     */
+    _vcChunk: function(chan, flags, total, chunk) {
+        var c = this.vc[chan], buf;
+        if (!c) {
+            return;
+        }
+        if (flags & 1) { // CHANNEL_FLAG_FIRST
+            c.msg = (total <= this.vcMax) ? new Uint8Array(total) : null;
+            c.len = 0;
+        }
+        if (c.msg && (c.len + chunk.length <= c.msg.length)) {
+            c.msg.set(chunk, c.len);
+            c.len += chunk.length;
+            if (flags & 2) { // CHANNEL_FLAG_LAST
+                this.fireEvent('channeldata', [c.name, c.msg.subarray(0, c.len)]);
+                c.msg = null;
+            }
+        } else {
+            // Incomplete message (the server dropped parts of it)
+            c.msg = null;
+        }
+        c.ackB += chunk.length;
+        if ((c.ackB >= this.vcWin / 4) || (flags & 2)) {
+            if (this.sock.readyState == this.sock.OPEN) {
+                buf = new ArrayBuffer(12);
+                new Uint32Array(buf).set([11, chan, c.ackB]); // WSOP_CS_VC_ACK
+                this.sock.send(buf);
+            }
+            c.ackB = 0;
+        }
+    },
+    _vcFlush: function(c) {
+        var buf;
+        while (c.outQ.length && (this.sock.readyState == this.sock.OPEN)) {
+            buf = c.outQ[0];
+            // A single message may exceed the window, if nothing else is in flight.
+            if (c.outB && (c.outB + buf.byteLength - 8 > this.vcWin)) {
+                break;
+            }
+            c.outQ.shift();
+            c.outB += buf.byteLength - 8;
+            this.sock.send(buf);
+        }
+    },
     _cR: function(x, y, w, h, save) {
         if (save) {
             this.clx = x;
@@ -662,6 +1052,8 @@ wsgate.RDP = new Class( {
      */
     _reset: function() {
         this.log.setWS(null);
+        this._aStop();
+        this.vc = [];
         this.fireEvent('disconnected');
         if (this.sock.readyState == this.sock.OPEN) {
             this.sock.close();
@@ -792,7 +1184,13 @@ wsgate.RDP = new Class( {
             this.cP();
         }
         // this.log.debug('mM x: ', x, ' y: ', y);
-        if (this.sock.readyState == this.sock.OPEN) {
+        if (this.v2) {
+            // Servers speaking wsgate-v2 accept batched input
+            this.inQ.push(x, y);
+            if ('number' != typeof(this.inTid)) {
+                this.inTid = this._flushInput.delay(16, this);
+            }
+        } else if (this.sock.readyState == this.sock.OPEN) {
             buf = new ArrayBuffer(16);
             a = new Uint32Array(buf);
             a[0] = 0; // WSOP_CS_MOUSE
@@ -802,11 +1200,36 @@ wsgate.RDP = new Class( {
             this.sock.send(buf);
         }
     },
+    /**
+     * Send all pending mouse moves as a single WSOP_CS_INPUT_BATCH message.
+     * Must be invoked before sending any other input event, in order
+     * to preserve the event order.
+     */
+    _flushInput: function() {
+        var buf, a, i, n = this.inQ.length / 2;
+        if ('number' == typeof(this.inTid)) {
+            clearTimeout(this.inTid);
+        }
+        delete this.inTid;
+        if (n && (this.sock.readyState == this.sock.OPEN)) {
+            buf = new ArrayBuffer(8 + 16 * n);
+            a = new Uint32Array(buf);
+            a[0] = 6; // WSOP_CS_INPUT_BATCH
+            a[1] = n;
+            for (i = 0; i < n; ++i) {
+                // WSOP_CS_MOUSE, PTR_FLAGS_MOVE, x, y
+                a.set([0, 0x0800, this.inQ[2 * i], this.inQ[2 * i + 1]], 2 + 4 * i);
+            }
+            this.sock.send(buf);
+        }
+        this.inQ = [];
+    },
     /**
      * Event handler for mouse down events
      */
     onMd: function(evt) {
         var buf, a, x, y, which;
+        this._flushInput();
         if (this.Tcool) {
             if(evt.preventDefault) evt.preventDefault();
             if(evt.stopPropagation) evt.stopPropagation();
@@ -835,6 +1258,7 @@ wsgate.RDP = new Class( {
      */
     onMu: function(evt, x, y) {
         var buf, a, x, y, which;
+        this._flushInput();
         if (this.Tcool) {
             evt.preventDefault();
             x = (this.msie > 0 || this.trident > 0) ? evt.event.layerX - evt.event.currentTarget.offsetLeft : evt.event.layerX;
@@ -861,6 +1285,7 @@ wsgate.RDP = new Class( {
      */
     onMw: function(evt) {
         var buf, a, x, y;
+        this._flushInput();
         evt.preventDefault();
         x = (this.msie > 0 || this.trident > 0) ? evt.event.layerX - evt.event.currentTarget.offsetLeft : evt.event.layerX;
         y = (this.msie > 0 || this.trident > 0) ? evt.event.layerY - evt.event.currentTarget.offsetTop : evt.event.layerY;
@@ -875,6 +1300,20 @@ wsgate.RDP = new Class( {
             this.sock.send(buf);
         }
     },
+    /**
+     * Event handler for page visibility changes
+     */
+    onVis: function(evt) {
+        var buf, a;
+        if (this.sock.readyState == this.sock.OPEN) {
+            this.log.debug('visible: ', !document.hidden);
+            buf = new ArrayBuffer(8);
+            a = new Uint32Array(buf);
+            a[0] = 7; // WSOP_CS_VISIBILITY
+            a[1] = document.hidden ? 0 : 1;
+            this.sock.send(buf);
+        }
+    },
     /**
      * Field used to keep the states of the sent mouse events
      */
@@ -884,6 +1323,7 @@ wsgate.RDP = new Class( {
      * used to send mouse release for any unsent mouse releases
      */
     onMouseLeave: function(evt){
+       this._flushInput();
        for(var button in this.mouseDownStatus){
            if(this.mouseDownStatus[button]){
                var x = (this.msie > 0 || this.trident > 0) ? evt.event.layerX - evt.event.currentTarget.offsetLeft : evt.event.layerX;
@@ -940,6 +1380,7 @@ wsgate.RDP = new Class( {
      * up = 0
      */
     SendKeyUpDown: function(key, upDown){
+        this._flushInput();
         if (this.sock.readyState == this.sock.OPEN) {
             buf = new ArrayBuffer(12);
             a = new Uint32Array(buf);
@@ -996,6 +1437,7 @@ wsgate.RDP = new Class( {
      */
     onKd: function(evt) {
         var a, buf;
+        this._flushInput();
         this.log.debug('kD code: ', evt.code, ' ', evt);
         evt.preventDefault();
         // this.log.debug('kD code: ', evt.code, ' ', evt);
@@ -1013,6 +1455,7 @@ wsgate.RDP = new Class( {
      */
     onKu: function(evt) {
         var a, buf;
+        this._flushInput();
         evt.preventDefault();
         this.log.debug('ku code: ', evt.code, ' ', evt);
         if (this.sock.readyState == this.sock.OPEN) {
@@ -1094,6 +1537,15 @@ wsgate.RDP = new Class( {
                     case 'S:':
                             this.sid = evt.data.substring(2);
                             break;
+                    case 'P:':
+                            // Progress of a pasted text: done/total
+                            var p = evt.data.substring(2).split('/');
+                            this.fireEvent('pasteprogress', [p[0].toInt(), p[1].toInt()]);
+                            break;
+                    case 'V:':
+                            // Relayed virtual channels
+                            this._vcInit(evt.data.substring(2));
+                            break;
                     case 'R:':
                             //resolution changed
                             resolution=evt.data.substr(2).split('x');
@@ -1119,7 +1571,7 @@ wsgate.RDP = new Class( {
                 break;
                 // ... and binary messages for the actual RDP stuff.
             case 'object':
-                this._pmsg(evt.data);
+                this._pmsg(this.v2 ? this._v2to1(evt.data) : evt.data);
                 break;
         }
 
@@ -1129,6 +1581,10 @@ wsgate.RDP = new Class( {
      */
     onWSopen: function(evt) {
         this.open = true;
+        this.v2 = (this.sock.protocol == this.proto);
+        this.v2x = 0;
+        this.v2y = 0;
+        this.inQ = [];
         this.log.setWS(this.sock);
         //add the textarea on top of the canvas
         this.SetupCanvas($('screen'));
@@ -1138,6 +1594,9 @@ wsgate.RDP = new Class( {
         this.textAreaInput.addEvent('mouseup', this.onMu.bind(this));
         this.textAreaInput.addEvent('mousewheel', this.onMw.bind(this));
         this.textAreaInput.addEvent('mouseleave', this.onMouseLeave.bind(this));
+        // Let the server pause graphics while this page is hidden
+        Element.NativeEvents.visibilitychange = 2;
+        document.addEvent('visibilitychange', this.onVis.bind(this));
         // Disable the browser's context menu
         this.textAreaInput.addEvent('contextmenu', function(e) {e.stop();});
         // For touch devices
@@ -1161,6 +1620,9 @@ wsgate.RDP = new Class( {
         }
         this.fireEvent('connected');
         this.SendCredentials();
+        this._aInit();
+        this.textAreaInput.addEvent('mousedown', this._aResume.bind(this));
+        this.textAreaInput.addEvent('keydown', this._aResume.bind(this));
     },
     /**
      * Event handler for WebSocket disconnect events
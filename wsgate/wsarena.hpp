@@ -0,0 +1,168 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WSARENA_H
+#define WSARENA_H
+
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include "wsbuffer.hpp"
+
+namespace wspp {
+
+    /**
+     * A monotonic allocator for short-lived message buffers.
+     * Memory is handed out by bumping a pointer within a list of blocks
+     * and is never freed individually. Instead, reset() makes all blocks
+     * available again at once, so once the arena has grown to the
+     * size of a typical paint batch, no further heap allocations happen.
+     * Not thread-safe: An arena must only be used by a single thread.
+     */
+    class arena {
+        public:
+            /**
+             * Constructor
+             * @param blocksize The default size of a single block.
+             */
+            explicit arena(size_t blocksize = 65536)
+                : m_blocks()
+                  , m_blocksize(blocksize)
+                  , m_current(0)
+                  , m_used(0)
+            { }
+
+            /// Destructor
+            ~arena() {
+                for (std::vector<block>::iterator i = m_blocks.begin(); i != m_blocks.end(); ++i) {
+                    free(i->data);
+                }
+            }
+
+            /**
+             * Allocates memory from the arena.
+             * The returned memory is aligned to 8 bytes and stays valid
+             * until the next call to reset().
+             * @param len The number of bytes to allocate.
+             * @return A pointer to the allocated memory.
+             */
+            char *allocate(size_t len) {
+                len = (len + 7) & ~static_cast<size_t>(7);
+                while (m_current < m_blocks.size()) {
+                    block &b = m_blocks[m_current];
+                    if (m_used + len <= b.size) {
+                        char *ret = b.data + m_used;
+                        m_used += len;
+                        return ret;
+                    }
+                    m_current++;
+                    m_used = 0;
+                }
+                block b;
+                b.size = (len > m_blocksize) ? len : m_blocksize;
+                b.data = static_cast<char *>(malloc(b.size));
+                if (!b.data) {
+                    throw std::bad_alloc();
+                }
+                m_blocks.push_back(b);
+                m_current = m_blocks.size() - 1;
+                m_used = len;
+                return b.data;
+            }
+
+            /**
+             * Releases all allocations at once.
+             * The blocks are kept for reuse.
+             */
+            void reset() {
+                m_current = 0;
+                m_used = 0;
+            }
+
+        private:
+            // Non-copyable
+            arena(const arena &);
+            arena & operator=(const arena &);
+
+            struct block {
+                char *data;
+                size_t size;
+            };
+
+            std::vector<block> m_blocks;
+            size_t m_blocksize;
+            size_t m_current;
+            size_t m_used;
+    };
+
+    /**
+     * Serializes a single binary message into an arena.
+     * The total size must be known in advance.
+     */
+    class op_writer {
+        public:
+            /**
+             * Constructor
+             * @param a The arena to allocate from.
+             * @param len The total size of the message.
+             */
+            op_writer(arena &a, size_t len)
+                : m_buf(a.allocate(len))
+                  , m_pos(0)
+            { }
+
+            /**
+             * Appends raw data.
+             * @param data The data to append.
+             * @param len The length of the data.
+             * @return A reference to this writer.
+             */
+            op_writer & put(const void *data, size_t len) {
+                memcpy(m_buf + m_pos, data, len);
+                m_pos += len;
+                return *this;
+            }
+
+            /**
+             * Appends a POD value in host byte order.
+             * @param v The value to append.
+             * @return A reference to this writer.
+             */
+            template <typename T> op_writer & put(const T &v) {
+                return put(&v, sizeof(v));
+            }
+
+            /**
+             * Retrieves the serialized message.
+             * @return A slice, referring to the arena memory.
+             */
+            buffer_slice slice() const {
+                return buffer_slice(m_buf, m_pos);
+            }
+
+        private:
+            char *m_buf;
+            size_t m_pos;
+    };
+
+}
+
+#endif
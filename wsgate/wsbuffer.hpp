@@ -0,0 +1,123 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WSBUFFER_H
+#define WSBUFFER_H
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+namespace wspp {
+
+    /**
+     * A read-only slice of a buffer.
+     * A slice either borrows its memory (the caller guarantees that the
+     * memory stays valid until the send call returns) or holds a reference
+     * to a shared, immutable string, which keeps the data alive for as long
+     * as any slice refers to it. Copying a slice never copies the data.
+     */
+    class buffer_slice {
+        public:
+            /**
+             * Constructs a borrowing slice.
+             * @param data Pointer to the first byte.
+             * @param len Number of bytes.
+             */
+            buffer_slice(const void *data, size_t len)
+                : m_owner()
+                  , m_data(static_cast<const char *>(data))
+                  , m_len(len)
+            { }
+
+            /**
+             * Constructs a borrowing slice of a string.
+             * @param s The string to refer to.
+             */
+            explicit buffer_slice(const std::string &s)
+                : m_owner()
+                  , m_data(s.data())
+                  , m_len(s.length())
+            { }
+
+            /**
+             * Constructs a reference-counted slice.
+             * @param buf The shared buffer to refer to.
+             * @param offset Offset of the first byte within buf.
+             * @param len Number of bytes, npos means "up to the end of buf".
+             */
+            buffer_slice(const boost::shared_ptr<const std::string> &buf,
+                    size_t offset = 0, size_t len = std::string::npos)
+                : m_owner(buf)
+                  , m_data(buf->data() + offset)
+                  , m_len((std::string::npos == len) ? buf->length() - offset : len)
+            { }
+
+            /**
+             * Retrieves the data.
+             * @return A pointer to the first byte of this slice.
+             */
+            const char *data() const { return m_data; }
+
+            /**
+             * Retrieves the length.
+             * @return The number of bytes in this slice.
+             */
+            size_t size() const { return m_len; }
+
+        private:
+            boost::shared_ptr<const std::string> m_owner;
+            const char *m_data;
+            size_t m_len;
+    };
+
+    /// A list of slices, forming a single message.
+    typedef std::vector<buffer_slice> buffer_list;
+
+    /**
+     * Calculates the total length of a list of slices.
+     * @param slices The list of slices.
+     * @return The sum of all slice lengths.
+     */
+    inline size_t buffer_size(const buffer_list &slices) {
+        size_t ret = 0;
+        for (buffer_list::const_iterator i = slices.begin(); i != slices.end(); ++i) {
+            ret += i->size();
+        }
+        return ret;
+    }
+
+    /**
+     * Calculates the total length of an array of slices.
+     * @param slices Pointer to the first slice.
+     * @param count Number of slices.
+     * @return The sum of all slice lengths.
+     */
+    inline size_t buffer_size(const buffer_slice *slices, size_t count) {
+        size_t ret = 0;
+        for (size_t i = 0; i < count; ++i) {
+            ret += slices[i].size();
+        }
+        return ret;
+    }
+
+}
+
+#endif
@@ -150,6 +150,7 @@ namespace wspp {
             static const uint8_t PAYLOAD_SIZE_BASIC = 125;
             static const uint16_t PAYLOAD_SIZE_EXTENDED = 0xFFFF; // 2^16, 65535
             static const uint64_t PAYLOAD_SIZE_JUMBO = 0x7FFFFFFFFFFFFFFFLL;//2^63
+            static const uint64_t PAYLOAD_SIZE_MESSAGE = 1048576; // 1MB, minimum default for incoming messages
         }
     } // namespace frame
 }
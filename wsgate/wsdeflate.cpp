@@ -0,0 +1,290 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <cstring>
+#include <sstream>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "wsdeflate.hpp"
+#include "wsframe.hpp"
+
+namespace wspp {
+
+    using boost::algorithm::trim_copy;
+    using boost::algorithm::trim_copy_if;
+    using boost::algorithm::is_any_of;
+    using boost::algorithm::iequals;
+
+    // The empty, uncompressed block that terminates each message (RFC7692 7.2.1)
+    static const unsigned char deflate_tail[4] = { 0x00, 0x00, 0xff, 0xff };
+    static const size_t chunk_size = 16384;
+    // Number of bytes, sampled by the compressible() heuristic
+    static const size_t sample_size = 256;
+    // More distinct values in a sample than this, means "looks random"
+    static const size_t sample_threshold = 144;
+
+    static bool parse_window_bits(const std::string &val, int &bits) {
+        try {
+            bits = boost::lexical_cast<int>(trim_copy_if(val, is_any_of("\" \t")));
+        } catch (const boost::bad_lexical_cast &) {
+            return false;
+        }
+        return ((8 <= bits) && (15 >= bits));
+    }
+
+    permessage_deflate::permessage_deflate(const deflate_params &params)
+        : m_params(params)
+          , m_deflate()
+          , m_inflate()
+          , m_bDeflateInit(false)
+          , m_bInflateInit(false)
+    {
+        memset(&m_deflate, 0, sizeof(m_deflate));
+        memset(&m_inflate, 0, sizeof(m_inflate));
+        if (Z_OK != deflateInit2(&m_deflate, m_params.level, Z_DEFLATED,
+                    -m_params.server_max_window_bits, 8, Z_DEFAULT_STRATEGY)) {
+            throw tracing::runtime_error("Could not initialize deflate stream");
+        }
+        m_bDeflateInit = true;
+        if (Z_OK != inflateInit2(&m_inflate, -m_params.client_max_window_bits)) {
+            deflateEnd(&m_deflate);
+            throw tracing::runtime_error("Could not initialize inflate stream");
+        }
+        m_bInflateInit = true;
+    }
+
+    permessage_deflate::~permessage_deflate()
+    {
+        if (m_bDeflateInit) {
+            deflateEnd(&m_deflate);
+        }
+        if (m_bInflateInit) {
+            inflateEnd(&m_inflate);
+        }
+    }
+
+    deflate_params permessage_deflate::defaults()
+    {
+        deflate_params ret = {
+            false,  // enabled
+            15,     // server_max_window_bits
+            15,     // client_max_window_bits
+            false,  // server_no_context_takeover
+            false,  // client_no_context_takeover
+            64,     // min_size
+            Z_DEFAULT_COMPRESSION
+        };
+        return ret;
+    }
+
+    bool permessage_deflate::negotiate(const std::string &offer, const deflate_params &cfg,
+            deflate_params &agreed, std::string &response)
+    {
+        if (!cfg.enabled) {
+            return false;
+        }
+        std::vector<std::string> offers;
+        boost::split(offers, offer, is_any_of(","));
+        std::vector<std::string>::iterator oi;
+        for (oi = offers.begin(); oi != offers.end(); ++oi) {
+            std::vector<std::string> parts;
+            boost::split(parts, *oi, is_any_of(";"));
+            if (!iequals(trim_copy(parts[0]), "permessage-deflate")) {
+                continue;
+            }
+            deflate_params p = cfg;
+            bool valid = true;
+            bool clientBits = false;
+            bool seenSnct = false, seenCnct = false, seenSmwb = false;
+            int bits;
+            for (size_t i = 1; valid && (i < parts.size()); ++i) {
+                std::string name(trim_copy(parts[i]));
+                std::string val;
+                size_t eq = name.find('=');
+                if (std::string::npos != eq) {
+                    val = name.substr(eq + 1);
+                    name = trim_copy(name.substr(0, eq));
+                }
+                if (iequals(name, "server_no_context_takeover") && !seenSnct && val.empty()) {
+                    seenSnct = true;
+                    p.server_no_context_takeover = true;
+                } else if (iequals(name, "client_no_context_takeover") && !seenCnct && val.empty()) {
+                    seenCnct = true;
+                    p.client_no_context_takeover = true;
+                } else if (iequals(name, "server_max_window_bits") && !seenSmwb) {
+                    seenSmwb = true;
+                    // zlib silently turns a raw window of 8 into 9, so we
+                    // would violate the client's limit. Decline such an offer.
+                    valid = parse_window_bits(val, bits) && (8 < bits);
+                    if (valid && (bits < p.server_max_window_bits)) {
+                        p.server_max_window_bits = bits;
+                    }
+                } else if (iequals(name, "client_max_window_bits") && !clientBits) {
+                    clientBits = true;
+                    if (!val.empty()) {
+                        valid = parse_window_bits(val, bits);
+                        if (valid && (bits < p.client_max_window_bits)) {
+                            p.client_max_window_bits = bits;
+                        }
+                    }
+                } else {
+                    valid = false;
+                }
+            }
+            if (!valid) {
+                continue;
+            }
+            if (!clientBits) {
+                // Client can't limit its window, so we must be able to inflate anything.
+                p.client_max_window_bits = 15;
+            }
+            std::ostringstream oss;
+            oss << "permessage-deflate";
+            if (p.server_no_context_takeover) {
+                oss << "; server_no_context_takeover";
+            }
+            if (p.client_no_context_takeover) {
+                oss << "; client_no_context_takeover";
+            }
+            if (15 > p.server_max_window_bits) {
+                oss << "; server_max_window_bits=" << p.server_max_window_bits;
+            }
+            if (clientBits && (15 > p.client_max_window_bits)) {
+                oss << "; client_max_window_bits=" << p.client_max_window_bits;
+            }
+            p.enabled = true;
+            agreed = p;
+            response = oss.str();
+            return true;
+        }
+        return false;
+    }
+
+    bool permessage_deflate::compressible(const buffer_slice *payload, size_t count) const
+    {
+        size_t len = buffer_size(payload, count);
+        if (len < m_params.min_size) {
+            return false;
+        }
+        if (len < sample_size) {
+            return true;
+        }
+        // Sample evenly across the payload and count distinct byte values.
+        // Already compressed data (RLE/planar bitmap tiles, PNG) is close
+        // to uniformly distributed, while raw pixels and drawing orders
+        // are highly repetitive.
+        bool seen[256];
+        memset(seen, 0, sizeof(seen));
+        size_t step = len / sample_size;
+        size_t distinct = 0;
+        size_t pos = 0;
+        size_t base = 0;
+        const buffer_slice *si = payload;
+        for (size_t i = 0; i < sample_size; ++i, pos += step) {
+            while (pos >= base + si->size()) {
+                base += si->size();
+                ++si;
+            }
+            unsigned char c = static_cast<unsigned char>(si->data()[pos - base]);
+            if (!seen[c]) {
+                seen[c] = true;
+                distinct++;
+            }
+        }
+        return (distinct <= sample_threshold);
+    }
+
+    void permessage_deflate::compress(const buffer_slice *in, size_t count, std::string &out)
+    {
+        unsigned char buf[chunk_size];
+        out.clear();
+        // Feed all slices with Z_NO_FLUSH, then flush once with Z_SYNC_FLUSH
+        for (size_t i = 0; i <= count; ++i) {
+            int flush = Z_NO_FLUSH;
+            if (i < count) {
+                m_deflate.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in[i].data()));
+                m_deflate.avail_in = static_cast<uInt>(in[i].size());
+            } else {
+                m_deflate.next_in = NULL;
+                m_deflate.avail_in = 0;
+                flush = Z_SYNC_FLUSH;
+            }
+            do {
+                m_deflate.next_out = buf;
+                m_deflate.avail_out = chunk_size;
+                int ret = deflate(&m_deflate, flush);
+                if ((Z_OK != ret) && (Z_BUF_ERROR != ret)) {
+                    throw tracing::wserror("deflate failed", tracing::wserror::INTERNAL_ENDPOINT_ERROR);
+                }
+                out.append(reinterpret_cast<const char *>(buf), chunk_size - m_deflate.avail_out);
+            } while ((0 == m_deflate.avail_out) || (0 != m_deflate.avail_in));
+        }
+        if ((out.length() >= 4) &&
+                (0 == out.compare(out.length() - 4, 4, reinterpret_cast<const char *>(deflate_tail), 4))) {
+            out.resize(out.length() - 4);
+        }
+        if (m_params.server_no_context_takeover) {
+            deflateReset(&m_deflate);
+        }
+    }
+
+    void permessage_deflate::decompress(const std::vector<unsigned char> &in, std::string &out, size_t limit)
+    {
+        unsigned char buf[chunk_size];
+        out.clear();
+        // Feed the payload, followed by the stripped tail, as two separate
+        // inputs in order to avoid copying the payload.
+        const unsigned char *src[2] = { in.empty() ? deflate_tail : &in[0], deflate_tail };
+        size_t srclen[2] = { in.size(), sizeof(deflate_tail) };
+        bool ended = false;
+        for (int part = 0; (part < 2) && !ended; ++part) {
+            m_inflate.next_in = const_cast<Bytef *>(src[part]);
+            m_inflate.avail_in = static_cast<uInt>(srclen[part]);
+            do {
+                m_inflate.next_out = buf;
+                m_inflate.avail_out = chunk_size;
+                int ret = inflate(&m_inflate, Z_SYNC_FLUSH);
+                if ((Z_OK != ret) && (Z_BUF_ERROR != ret) && (Z_STREAM_END != ret)) {
+                    inflateReset(&m_inflate);
+                    throw tracing::wserror("Invalid compressed data", tracing::wserror::PAYLOAD_VIOLATION);
+                }
+                out.append(reinterpret_cast<const char *>(buf), chunk_size - m_inflate.avail_out);
+                if (out.length() > limit) {
+                    inflateReset(&m_inflate);
+                    throw tracing::wserror("decompressed message too big", tracing::wserror::MESSAGE_TOO_BIG);
+                }
+                if (Z_STREAM_END == ret) {
+                    // Client has set BFINAL, so the next message starts a new stream.
+                    ended = true;
+                    break;
+                }
+            } while (0 == m_inflate.avail_out);
+        }
+        if (ended || m_params.client_no_context_takeover) {
+            inflateReset(&m_inflate);
+        }
+    }
+
+}
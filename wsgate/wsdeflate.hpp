@@ -0,0 +1,130 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WSDEFLATE_H
+#define WSDEFLATE_H
+
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "wsbuffer.hpp"
+
+namespace wspp {
+
+    /**
+     * Parameters of the permessage-deflate extension (RFC7692).
+     * An instance of this struct is used for both, the server side
+     * configuration and the result of a successful negotiation.
+     */
+    typedef struct {
+        /// Flag: Extension enabled.
+        bool enabled;
+        /// LZ77 window size (9..15) used for compressing outgoing messages.
+        int server_max_window_bits;
+        /// LZ77 window size (9..15) the client uses for its messages.
+        int client_max_window_bits;
+        /// Flag: Reset our compressor after each message.
+        bool server_no_context_takeover;
+        /// Flag: Client resets its compressor after each message.
+        bool client_no_context_takeover;
+        /// Messages smaller than this are sent uncompressed.
+        size_t min_size;
+        /// zlib compression level (1..9).
+        int level;
+    } deflate_params;
+
+    /**
+     * Per-connection codec for the permessage-deflate extension.
+     * Each instance owns a zlib deflate and inflate stream, so that
+     * the LZ77 window can be shared across messages unless context
+     * takeover has been disabled during negotiation.
+     */
+    class permessage_deflate {
+        public:
+            /**
+             * Constructor
+             * @param params The negotiated parameters for this connection.
+             */
+            permessage_deflate(const deflate_params &params);
+
+            /// Destructor
+            ~permessage_deflate();
+
+            /**
+             * Retrieves the built-in server defaults.
+             * @return A disabled parameter set with sane defaults.
+             */
+            static deflate_params defaults();
+
+            /**
+             * Negotiates the extension with a client offer.
+             * @param offer The value of the Sec-WebSocket-Extensions request header.
+             * @param cfg The server side configuration.
+             * @param agreed Receives the negotiated parameters.
+             * @param response Receives the value for the Sec-WebSocket-Extensions
+             *  response header.
+             * @return true, if an offer was accepted.
+             */
+            static bool negotiate(const std::string &offer, const deflate_params &cfg,
+                    deflate_params &agreed, std::string &response);
+
+            /**
+             * Checks, if a payload is worth compressing.
+             * Small payloads and payloads that already look like compressed
+             * data (e.g. interleaved/planar bitmap tiles or PNG cursors) are
+             * skipped, because deflate would only burn CPU without any gain.
+             * @param payload Pointer to the first payload slice.
+             * @param count Number of slices.
+             * @return true, if the payload should be compressed.
+             */
+            bool compressible(const buffer_slice *payload, size_t count) const;
+
+            /**
+             * Compresses a complete message.
+             * @param in Pointer to the first uncompressed payload slice.
+             * @param count Number of slices.
+             * @param out Receives the compressed payload (without the
+             *  trailing 0x00 0x00 0xff 0xff).
+             */
+            void compress(const buffer_slice *in, size_t count, std::string &out);
+
+            /**
+             * Decompresses a complete message.
+             * @param in The compressed payload as received from the client.
+             * @param out Receives the decompressed payload.
+             * @param limit Maximum size of the decompressed payload.
+             */
+            void decompress(const std::vector<unsigned char> &in, std::string &out, size_t limit);
+
+        private:
+            // Non-copyable
+            permessage_deflate(const permessage_deflate &);
+            permessage_deflate & operator=(const permessage_deflate &);
+
+            deflate_params m_params;
+            z_stream m_deflate;
+            z_stream m_inflate;
+            bool m_bDeflateInit;
+            bool m_bInflateInit;
+    };
+
+}
+
+#endif
@@ -56,6 +56,13 @@ namespace wspp {
                   , m_state(session::state::OPEN)
                   , m_lock()
                   , m_handler(h)
+                  , m_deflate()
+                  , m_nMaxMessage(frame::limits::PAYLOAD_SIZE_MESSAGE)
+                  , m_zmsg()
+                  , m_zmsgHeader()
+                  , m_bZmsg(false)
+                  , m_txbuf()
+                  , m_zbuf()
         {
 #ifndef HAVE_BOOST_LOCK_GUARD
             pthread_mutexattr_t mattr;
@@ -65,18 +72,20 @@ namespace wspp {
             pthread_mutexattr_destroy(&mattr);
 #endif
             m_handler->m_endpoint = this;
+            m_parser.set_max_payload(m_nMaxMessage);
         }
 
 #ifndef HAVE_BOOST_LOCK_GUARD
     wsendpoint::~wsendpoint() { pthread_mutex_destroy(&m_lock); }
 #endif
 
-    void wsendpoint::AddRxData(std::string data)
+    void wsendpoint::AddRxData(const std::string &data)
     {
-        std::istringstream s(data);
-        while (m_state != session::state::CLOSED && s.rdbuf()->in_avail()) {
+        const char *p = data.data();
+        size_t len = data.length();
+        while (m_state != session::state::CLOSED && len > 0) {
             try {
-                m_parser.consume(s);
+                m_parser.consume(p, len);
                 if (m_parser.ready()) {
                     if (m_parser.is_control()) {
                         process_control();
@@ -123,7 +132,41 @@ namespace wspp {
         }
     }
 
-    void wsendpoint::send(const std::string& payload, frame::opcode::value op) {
+    void wsendpoint::enable_deflate(const deflate_params &params) {
+#ifdef HAVE_BOOST_LOCK_GUARD
+        boost::lock_guard<boost::recursive_mutex> lock(m_lock);
+#else
+        MutexHelper((pthread_mutex_t *)&m_lock);
+#endif
+
+        m_deflate.reset(new permessage_deflate(params));
+        m_parser.set_rsv1_allowed(true);
+    }
+
+    void wsendpoint::set_max_message(uint64_t limit) {
+#ifdef HAVE_BOOST_LOCK_GUARD
+        boost::lock_guard<boost::recursive_mutex> lock(m_lock);
+#else
+        MutexHelper((pthread_mutex_t *)&m_lock);
+#endif
+
+        m_nMaxMessage = limit;
+        m_parser.set_max_payload(limit);
+    }
+
+    // Frame buffers, grown beyond this size, are released after sending.
+    static const size_t max_idle_txbuf = 1024 * 1024;
+
+    void wsendpoint::send(const std::string& payload, frame::opcode::value op, bool compressible) {
+        buffer_slice slice(payload);
+        send(&slice, 1, op, compressible);
+    }
+
+    void wsendpoint::send(const buffer_list& slices, frame::opcode::value op, bool compressible) {
+        send(slices.empty() ? NULL : &slices[0], slices.size(), op, compressible);
+    }
+
+    void wsendpoint::send(const buffer_slice *slices, size_t count, frame::opcode::value op, bool compressible) {
 #ifdef HAVE_BOOST_LOCK_GUARD
         boost::lock_guard<boost::recursive_mutex> lock(m_lock);
 #else
@@ -134,21 +177,84 @@ namespace wspp {
             log::err << "send: enpoint-state not OPEN";
             return;
         }
-        frame::parser<simple_rng> control(m_rng);
-        control.set_opcode(op);
-        control.set_fin(true);
-        control.set_masked(false);
-        control.set_payload(payload);
+        if (frame::opcode::is_control(op) || frame::opcode::invalid(op) || frame::opcode::reserved(op)) {
+            throw tracing::wserror("invalid data opcode", tracing::wserror::PROTOCOL_VIOLATION);
+        }
 
-        std::string tmp(control.get_header_str());
-        tmp.append(control.get_payload_str());
-        m_handler->do_response(tmp);
+        char hdr[frame::MAX_SERVER_HEADER_LENGTH];
+        m_txbuf.clear();
+        if (m_deflate && compressible && m_deflate->compressible(slices, count)) {
+            m_deflate->compress(slices, count, m_zbuf);
+            size_t hlen = frame::write_header(hdr, op, true, m_zbuf.length());
+            m_txbuf.reserve(hlen + m_zbuf.length());
+            m_txbuf.append(hdr, hlen);
+            m_txbuf.append(m_zbuf);
+        } else {
+            size_t len = buffer_size(slices, count);
+            size_t hlen = frame::write_header(hdr, op, false, len);
+            m_txbuf.reserve(hlen + len);
+            m_txbuf.append(hdr, hlen);
+            for (size_t i = 0; i < count; ++i) {
+                m_txbuf.append(slices[i].data(), slices[i].size());
+            }
+        }
+        m_handler->do_response(m_txbuf);
+        if (m_txbuf.capacity() > max_idle_txbuf) {
+            std::string().swap(m_txbuf);
+        }
+        if (m_zbuf.capacity() > max_idle_txbuf) {
+            std::string().swap(m_zbuf);
+        }
     }
 
     void wsendpoint::process_data() {
+        if (m_bZmsg && (m_parser.get_opcode() != frame::opcode::CONTINUATION)) {
+            throw tracing::wserror("Expected continuation frame", tracing::wserror::PROTOCOL_VIOLATION);
+        }
+        if (m_parser.get_rsv1() || m_bZmsg) {
+            // RSV1 can only be set, if permessage-deflate was negotiated.
+            // It is set on the first frame only and covers the whole
+            // message (RFC7692, 6.1), so the fragments are inflated at once.
+            const std::vector<unsigned char> &payload = m_parser.get_payload();
+            if (!m_bZmsg) {
+                m_zmsgHeader = m_parser.get_header_str();
+                m_zmsg.clear();
+            }
+            if (!m_bZmsg && m_parser.get_fin()) {
+                deliver_compressed(payload);
+                return;
+            }
+            if (m_zmsg.size() + payload.size() > m_nMaxMessage) {
+                throw tracing::wserror("message too big", tracing::wserror::MESSAGE_TOO_BIG);
+            }
+            m_zmsg.insert(m_zmsg.end(), payload.begin(), payload.end());
+            m_bZmsg = !m_parser.get_fin();
+            if (!m_bZmsg) {
+                deliver_compressed(m_zmsg);
+                std::vector<unsigned char>().swap(m_zmsg);
+            }
+            return;
+        }
+        // Unfragmented text messages must be valid UTF-8 (RFC6455, 8.1)
+        bool text = (m_parser.get_opcode() == frame::opcode::TEXT) && m_parser.get_fin();
+        const std::vector<unsigned char> &payload = m_parser.get_payload();
+        if (text && !payload.empty() &&
+                !utf8_validator::validate(reinterpret_cast<const char *>(&payload[0]), payload.size())) {
+            throw tracing::wserror("Invalid UTF-8 Data", tracing::wserror::PAYLOAD_VIOLATION);
+        }
         m_handler->on_message(m_parser.get_header_str(), m_parser.get_payload_str());
     }
 
+    void wsendpoint::deliver_compressed(const std::vector<unsigned char> &payload) {
+        std::string data;
+        m_deflate->decompress(payload, data, m_nMaxMessage);
+        // The opcode of the first frame
+        if ((frame::opcode::TEXT == (m_zmsgHeader[0] & 0x0F)) && !utf8_validator::validate(data)) {
+            throw tracing::wserror("Invalid UTF-8 Data", tracing::wserror::PAYLOAD_VIOLATION);
+        }
+        m_handler->on_message(m_zmsgHeader, data);
+    }
+
             
     void wsendpoint::shutdown() {
 #ifdef HAVE_BOOST_LOCK_GUARD
@@ -33,6 +33,8 @@
 #include <string>
 #include <boost/thread.hpp>
 #include "wsframe.hpp"
+#include "wsbuffer.hpp"
+#include "wsdeflate.hpp"
 #include "wsgate.hpp"
 #include "wshandler.hpp"
 
@@ -110,7 +112,7 @@ namespace wspp {
              *
              * @param data the raw data, received from the client.
              */
-            void AddRxData(std::string data);
+            void AddRxData(const std::string &data);
 
             /**
              * Send a data message.
@@ -118,11 +120,59 @@ namespace wspp {
              * in order to send TEXT and BINARY payloads.
              * @param payload The payload data.
              * @param op The opcode according to RFC6455
+             * @param compressible false, if the payload is known to be
+             *  incompressible and permessage-deflate should be skipped.
              */
-            void send(const std::string& payload, frame::opcode::value op);
+            void send(const std::string& payload, frame::opcode::value op, bool compressible = true);
+
+            /**
+             * Send a data message, assembled from multiple slices.
+             * The frame header and all slices are written into a single
+             * response buffer in one pass, so the payload is copied exactly
+             * once on its way to the connection.
+             * @param slices The payload slices, forming a single message.
+             * @param op The opcode according to RFC6455
+             * @param compressible false, if the payload is known to be
+             *  incompressible and permessage-deflate should be skipped.
+             */
+            void send(const buffer_list& slices, frame::opcode::value op, bool compressible = true);
+
+            /**
+             * Send a data message, assembled from an array of slices.
+             * All other send methods end up here. The frame is assembled in a
+             * buffer, owned by the endpoint and reused for subsequent messages,
+             * so sending small messages does not allocate.
+             * @param slices Pointer to the first payload slice.
+             * @param count Number of slices.
+             * @param op The opcode according to RFC6455
+             * @param compressible false, if the payload is known to be
+             *  incompressible and permessage-deflate should be skipped.
+             */
+            void send(const buffer_slice *slices, size_t count, frame::opcode::value op,
+                    bool compressible = true);
+
+            /**
+             * Enables the permessage-deflate extension (RFC7692).
+             * Must be invoked before any data is exchanged.
+             * @param params The parameters, negotiated during the handshake.
+             */
+            void enable_deflate(const deflate_params &params);
+
+            /**
+             * Limits the size of incoming messages. Applies to the
+             * payload on the wire as well as after decompression, so
+             * a small compressed message can not inflate to more.
+             * @param limit The maximum message size in bytes.
+             */
+            void set_max_message(uint64_t limit);
 
         private:
             void process_data();
+            /**
+             * Inflates a complete compressed message and hands it over to the handler.
+             * @param payload The payload of all its frames.
+             */
+            void deliver_compressed(const std::vector<unsigned char> &payload);
 
             /// Ends the connection by cleaning up based on current state
             /** Terminate will review the outstanding resources and close each
@@ -184,6 +234,14 @@ namespace wspp {
             mutable pthread_mutex_t m_lock;
 #endif
             wshandler *m_handler;
+            boost::shared_ptr<permessage_deflate> m_deflate;
+            uint64_t m_nMaxMessage;
+            // A fragmented compressed message, collected until its final frame
+            std::vector<unsigned char> m_zmsg;
+            std::string m_zmsgHeader;
+            bool m_bZmsg;
+            std::string m_txbuf;
+            std::string m_zbuf;
     };
 
     
@@ -33,6 +33,7 @@
 
 #include "wscommon.hpp"
 #include "wsutf8.hpp"
+#include "wsmask.hpp"
 #include "btexception.hpp"
 
 #if defined(_WIN32)
@@ -43,6 +44,7 @@
 
 #include <vector>
 #include <cstring>
+#include <sstream>
 #include <iostream>
 #include <algorithm>
 
@@ -185,6 +187,8 @@ namespace wspp {
                         : m_state(STATE_BASIC_HEADER)
                         , m_bytes_needed(BASIC_HEADER_LENGTH)
                         , m_degraded(false)
+                        , m_rsv1_allowed(false)
+                        , m_max_payload(max_payload_size)
                         , m_payload(std::vector<unsigned char>())
                         , m_rng(rng)
                     {
@@ -211,21 +215,25 @@ namespace wspp {
                     }
 
                     /**
-                     * Reads incoming data and decodes it.
+                     * Decodes incoming data directly from the receive buffer.
+                     * Consumed bytes are removed from the front of the given span,
+                     * even if an exception is thrown. Payload bytes are unmasked
+                     * while they are copied into the payload buffer.
                      * Method invariant: One of the following must always be true even in the case 
                      * of exceptions.
                      * - m_bytes_needed > 0
                      * - m-state = STATE_READY
                      *
-                     * @param s The stream of incoming data.
+                     * @param data Pointer to the incoming data, advanced on return.
+                     * @param len Number of available bytes, decremented on return.
                      */
-                    void consume(std::istream &s) {
+                    void consume(const char *&data, size_t &len) {
                         try {
+                            size_t n;
                             switch (m_state) {
                                 case STATE_BASIC_HEADER:
-                                    s.read(&m_header[BASIC_HEADER_LENGTH-m_bytes_needed],m_bytes_needed);
-
-                                    m_bytes_needed -= s.gcount();
+                                    n = take(data, len);
+                                    memcpy(&m_header[BASIC_HEADER_LENGTH-m_bytes_needed-n], data-n, n);
 
                                     if (m_bytes_needed == 0) {
                                         process_basic_header();
@@ -248,9 +256,8 @@ namespace wspp {
                                     }
                                     break;
                                 case STATE_EXTENDED_HEADER:
-                                    s.read(&m_header[get_header_len()-m_bytes_needed],m_bytes_needed);
-
-                                    m_bytes_needed -= s.gcount();
+                                    n = take(data, len);
+                                    memcpy(&m_header[get_header_len()-m_bytes_needed-n], data-n, n);
 
                                     if (m_bytes_needed == 0) {
                                         process_extended_header();
@@ -263,10 +270,17 @@ namespace wspp {
                                     }
                                     break;
                                 case STATE_PAYLOAD:
-                                    s.read(reinterpret_cast<char *>(&m_payload[m_payload.size()-m_bytes_needed]),
-                                            m_bytes_needed);
-
-                                    m_bytes_needed -= s.gcount();
+                                    {
+                                        uint64_t offset = m_payload.size() - m_bytes_needed;
+                                        n = take(data, len);
+                                        if (get_masked()) {
+                                            unmask_copy(&m_payload[offset],
+                                                    reinterpret_cast<const unsigned char *>(data-n),
+                                                    n, get_masking_key(), offset);
+                                        } else {
+                                            memcpy(&m_payload[offset], data-n, n);
+                                        }
+                                    }
 
                                     if (m_bytes_needed == 0) {
                                         m_state = STATE_READY;
@@ -276,15 +290,16 @@ namespace wspp {
                                 case STATE_RECOVERY:
                                     // Recovery state discards all bytes that are not the first byte
                                     // of a close frame.
-                                    do {
-                                        s.read(reinterpret_cast<char *>(&m_header[0]),1);
+                                    while (len > 0) {
+                                        m_header[0] = *data++;
+                                        len--;
                                         if (int(static_cast<unsigned char>(m_header[0])) == 0x88) {
                                             //(BPB0_FIN && CONNECTION_CLOSE)
                                             m_bytes_needed--;
                                             m_state = STATE_BASIC_HEADER;
                                             break;
                                         }
-                                    } while (s.gcount() > 0);
+                                    }
                                     break;
                                 default:
                                     break;
@@ -301,7 +316,7 @@ namespace wspp {
                                 m_state = STATE_RECOVERY;
                                 m_degraded = true;
 
-                                throw e;
+                                throw;
                             }
                         }
                     }
@@ -437,7 +452,64 @@ namespace wspp {
                         }
                     }
 
+                    /**
+                     * Retrieve the RSV1 bit of the current message.
+                     * With permessage-deflate, this flags a compressed message.
+                     * @return The value of the RSV1 bit.
+                     */
+                    bool get_rsv1() const {
+                        return ((m_header[0] & BPB0_RSV1) == BPB0_RSV1);
+                    }
+
+                    /**
+                     * Retrieves the FIN bit of the current frame.
+                     * @return true, if this is the final fragment of a message.
+                     */
+                    bool get_fin() const {
+                        return ((m_header[0] & BPB0_FIN) == BPB0_FIN);
+                    }
+
+                    /**
+                     * Set the RSV1 bit of the current message.
+                     * @param b The value of the RSV1 bit.
+                     */
+                    void set_rsv1(bool b) {
+                        if (b) {
+                            m_header[0] |= BPB0_RSV1;
+                        } else {
+                            m_header[0] &= (0xFF ^ BPB0_RSV1);
+                        }
+                    }
+
+                    /**
+                     * Permit the RSV1 bit on incoming data messages.
+                     * Must be enabled, if an extension using RSV1 (permessage-deflate)
+                     * has been negotiated. The setting survives reset().
+                     * @param allowed true, if RSV1 is permitted.
+                     */
+                    void set_rsv1_allowed(bool allowed) {
+                        m_rsv1_allowed = allowed;
+                    }
+
+                    /**
+                     * Limits the payload of incoming frames.
+                     * The setting survives reset().
+                     * @param limit The maximum payload size in bytes.
+                     */
+                    void set_max_payload(uint64_t limit) {
+                        m_max_payload = (limit < max_payload_size) ? limit : max_payload_size;
+                    }
+
                 private:
+                    // Advances the input span by up to m_bytes_needed bytes.
+                    size_t take(const char *&data, size_t &len) {
+                        size_t n = (m_bytes_needed < len) ? static_cast<size_t>(m_bytes_needed) : len;
+                        data += n;
+                        len -= n;
+                        m_bytes_needed -= n;
+                        return n;
+                    }
+
                     /**
                      * Retrieves the current amount of bytes,
                      * required to complete the next decoding step.
@@ -475,20 +547,6 @@ namespace wspp {
                     }
 
                     // get and set header bits
-                    bool get_fin() const {
-                        return ((m_header[0] & BPB0_FIN) == BPB0_FIN);
-                    }
-                    bool get_rsv1() const {
-                        return ((m_header[0] & BPB0_RSV1) == BPB0_RSV1);
-                    }
-                    void set_rsv1(bool b) {
-                        if (b) {
-                            m_header[0] |= BPB0_RSV1;
-                        } else {
-                            m_header[0] &= (0xFF ^ BPB0_RSV1);
-                        }
-                    }
-
                     bool get_rsv2() const {
                         return ((m_header[0] & BPB0_RSV2) == BPB0_RSV2);
                     }
@@ -543,10 +601,7 @@ namespace wspp {
                     }
                     std::string get_close_msg() const {
                         if (get_payload_size() > 2) {
-                            uint32_t state = utf8_validator::UTF8_ACCEPT;
-                            uint32_t codep = 0;
-                            validate_utf8(&state,&codep,2);
-                            if (state != utf8_validator::UTF8_ACCEPT) {
+                            if (!utf8_validator::validate(reinterpret_cast<const char *>(&m_payload[2]), m_payload.size() - 2)) {
                                 throw tracing::wserror("Invalid UTF-8 Data",tracing::wserror::PAYLOAD_VIOLATION);
                             }
                             return std::string(m_payload.begin()+2,m_payload.end());
@@ -556,7 +611,7 @@ namespace wspp {
                     }
 
                     void set_payload_helper(uint64_t s) {
-                        if (s > max_payload_size) {
+                        if (s > m_max_payload) {
                             throw tracing::wserror("requested payload is over implementation defined limit",tracing::wserror::MESSAGE_TOO_BIG);
                         }
 
@@ -703,62 +758,22 @@ namespace wspp {
                               m_masking_key[3] = m_header[mask_index+3];*/
                         }
 
-                        if (payload_size > max_payload_size) {
-                            // TODO: frame/message size limits
+                        if (payload_size > m_max_payload) {
                             // TODO: find a way to throw a server error without coupling frame
                             //       with server
                             // throw wspp::server_error("got frame with payload greater than maximum frame buffer size.");
-                            throw "Got frame with payload greater than maximum frame buffer size.";
+                            throw tracing::wserror("Got frame with payload greater than maximum frame buffer size.",
+                                    tracing::wserror::MESSAGE_TOO_BIG);
                         }
                         m_payload.resize(payload_size);
                         m_bytes_needed = payload_size;
                     }
 
                     void process_payload() {
-                        if (get_masked()) {
-                            char *masking_key = get_masking_key();
-
-                            for (uint64_t i = 0; i < m_payload.size(); i++) {
-                                m_payload[i] = (m_payload[i] ^ masking_key[i%4]);
-                            }
-                        }
-                    }
-
-                    // experiment with more efficient masking code.
-                    void process_payload2() {
-                        // unmask payload one byte at a time
-
-                        //uint64_t key = (*((uint32_t*)m_masking_key;)) << 32;
-                        //key += *((uint32_t*)m_masking_key);
-
-                        // might need to switch byte order
-                        /*uint32_t key = *((uint32_t*)m_masking_key);
-
-                        // 4
-
-                        uint64_t i = 0;
-                        uint64_t s = (m_payload.size() / 4);
-
-                        // chunks of 4
-                        for (i = 0; i < s; i+=4) {
-                        ((uint32_t*)(&m_payload[0]))[i] = (((uint32_t*)(&m_payload[0]))[i] ^ key);
-                        }
-
-                        // finish the last few
-                        for (i = s; i < m_payload.size(); i++) {
-                        m_payload[i] = (m_payload[i] ^ m_masking_key[i%4]);
-                        }*/
+                        // Nothing to do: The payload has already been unmasked
+                        // while being copied in consume().
                     }
 
-                    void validate_utf8(uint32_t* state,uint32_t* codep,size_t offset = 0) const {
-                        for (size_t i = offset; i < m_payload.size(); i++) {
-                            using utf8_validator::decode;
-
-                            if (decode(state,codep,m_payload[i]) == utf8_validator::UTF8_REJECT) {
-                                throw tracing::wserror("Invalid UTF-8 Data",tracing::wserror::PAYLOAD_VIOLATION);
-                            }
-                        }
-                    }
                     void validate_basic_header() const {
                         // check for control frame size
                         if (is_control() && get_basic_size() > limits::PAYLOAD_SIZE_BASIC) {
@@ -766,7 +781,10 @@ namespace wspp {
                         }
 
                         // check for reserved bits
-                        if (get_rsv1() || get_rsv2() || get_rsv3()) {
+                        // RSV1 flags a compressed message, so it is only valid
+                        // on the first frame of a data message (RFC7692, 6.1).
+                        if ((get_rsv1() && (!m_rsv1_allowed || is_control() ||
+                                        (opcode::CONTINUATION == get_opcode()))) || get_rsv2() || get_rsv3()) {
                             throw tracing::wserror("Reserved bit used",tracing::wserror::PROTOCOL_VIOLATION);
                         }
 
@@ -814,6 +832,8 @@ namespace wspp {
                     uint8_t     m_state;
                     uint64_t    m_bytes_needed;
                     bool        m_degraded;
+                    bool        m_rsv1_allowed;
+                    uint64_t    m_max_payload;
 
                     char m_header[MAX_HEADER_LENGTH];
                     std::vector<unsigned char> m_payload;
@@ -821,6 +841,38 @@ namespace wspp {
                     rng_policy& m_rng;
             };
 
+        /// Maximum length of an unmasked server frame header.
+        static const size_t MAX_SERVER_HEADER_LENGTH = 10;
+
+        /**
+         * Encodes the header of an unfragmented, unmasked (server) frame.
+         * This is used by the gather send path, which writes the header
+         * directly in front of the payload slices instead of going through
+         * a parser instance.
+         * @param buf Receives the header. Must hold MAX_SERVER_HEADER_LENGTH bytes.
+         * @param op The opcode of the frame.
+         * @param rsv1 The value of the RSV1 bit.
+         * @param len The length of the payload.
+         * @return The length of the encoded header.
+         */
+        inline size_t write_header(char *buf, opcode::value op, bool rsv1, uint64_t len) {
+            buf[0] = static_cast<char>(0x80 | (rsv1 ? 0x40 : 0x00) | op);
+            if (len <= limits::PAYLOAD_SIZE_BASIC) {
+                buf[1] = static_cast<char>(len);
+                return 2;
+            }
+            if (len <= limits::PAYLOAD_SIZE_EXTENDED) {
+                uint16_t n = htons(static_cast<uint16_t>(len));
+                buf[1] = 0x7E;
+                memcpy(&buf[2], &n, sizeof(n));
+                return 4;
+            }
+            int64_t n = htonll(len);
+            buf[1] = 0x7F;
+            memcpy(&buf[2], &n, sizeof(n));
+            return 10;
+        }
+
     }
 }
 
@@ -1,5 +1,6 @@
 #include "wsgateEHS.hpp"
 #include "wsgate.hpp"
+#include "Prefork.hpp"
 
 namespace wsgate{
     WsGate::MimeType WsGate::simpleMime(const string & filename)
@@ -25,23 +26,38 @@ namespace wsgate{
         return BINARY;
     }
 
-    WsGate::WsGate(EHS *parent, std::string registerpath)
-        : EHS(parent, registerpath)
+    WsGate::Config::Config()
+        : m_ptIniConfig()
         , m_sHostname()
         , m_sDocumentRoot()
-        , m_sPidFile()
         , m_bDebug(false)
         , m_bEnableCore(false)
-        , m_SessionMap()
-        , m_allowedHosts()
-        , m_deniedHosts()
-        , m_bOrderDenyAllow(true)
-        , m_sConfigFile()
-        , m_ptIniConfig()
         , m_bDaemon(false)
         , m_bRedirect(false)
-        , m_StaticCache()
+        , m_acl()
+        , overrideParams()
+        , m_deflateConfig(wspp::permessage_deflate::defaults())
+        , m_nMaxPreAuth(64)
+        , m_nMaxMessage(wspp::frame::limits::PAYLOAD_SIZE_MESSAGE)
+        , m_nTokenTimeout(10)
+        , m_nMaxPendingTokens(64)
+        , m_bPrefetchTokens(true)
+        , m_channelParams()
+        , m_engineParams()
         {
+            m_channelParams.window = 262144;
+            m_channelParams.maxpending = 4194304;
+            m_engineParams.enabled = false;
+            m_engineParams.port = 0;
+            m_engineParams.tls = false;
+            m_engineParams.threads = 0;
+            m_engineParams.maxqueue = 33554432;
+            m_engineParams.sessioncache = 20480;
+            m_engineParams.sessiontimeout = 300;
+            m_engineParams.ticketlifetime = 3600;
+            m_engineParams.ktls = true;
+            m_engineParams.workers = 0;
+            m_engineParams.draintimeout = 3600;
             overrideParams.m_bOverrideRdpHost = false;
             overrideParams.m_bOverrideRdpPort = false;
             overrideParams.m_bOverrideRdpUser = false;
@@ -57,6 +73,18 @@ namespace wsgate{
             overrideParams.m_bOverrideRdpFntlm = false;
         }
 
+    WsGate::WsGate(EHS *parent, std::string registerpath)
+        : EHS(parent, registerpath)
+        , m_sPidFile()
+        , m_SessionMap()
+        , m_sessionLock()
+        , m_sConfigFile()
+        , m_config(config_ptr(new Config()))
+        , m_StaticCache()
+        , m_nPendingTokens(0)
+        , m_cursorCache()
+        { }
+
     WsGate::~WsGate()
     {
         if (!m_sPidFile.empty()) {
@@ -88,51 +116,21 @@ namespace wsgate{
         return ret;
     }
 
-    void WsGate::CheckForPredefined(string& rdpHost, string& rdpUser, string& rdpPass)
+    void WsGate::CheckForPredefined(const Config &cfg, string& rdpHost, string& rdpUser, string& rdpPass)
     {
-        if (this->overrideParams.m_bOverrideRdpHost)
-            rdpHost.assign(this->overrideParams.m_sRdpOverrideHost);
+        if (cfg.overrideParams.m_bOverrideRdpHost)
+            rdpHost.assign(cfg.overrideParams.m_sRdpOverrideHost);
 
-        if (this->overrideParams.m_bOverrideRdpUser)
-            rdpUser.assign(this->overrideParams.m_sRdpOverrideUser);
+        if (cfg.overrideParams.m_bOverrideRdpUser)
+            rdpUser.assign(cfg.overrideParams.m_sRdpOverrideUser);
 
-        if (this->overrideParams.m_bOverrideRdpPass)
-            rdpPass.assign(this->overrideParams.m_sRdpOverridePass);
+        if (cfg.overrideParams.m_bOverrideRdpPass)
+            rdpPass.assign(cfg.overrideParams.m_sRdpOverridePass);
     }
 
-    bool WsGate::ConnectionIsAllowed(string rdphost)
+    bool WsGate::ConnectionIsAllowed(const Config &cfg, string rdphost, string &address)
     {
-            bool denied = true;
-            vector<boost::regex>::iterator ri;
-            if (m_bOrderDenyAllow) {
-                denied = false;
-                for (ri = m_deniedHosts.begin(); ri != m_deniedHosts.end(); ++ri) {
-                    if (regex_match(rdphost, *ri)) {
-                        denied = true;
-                        break;
-                    }
-                }
-                for (ri = m_allowedHosts.begin(); ri != m_allowedHosts.end(); ++ri) {
-                    if (regex_match(rdphost, *ri)) {
-                        denied = false;
-                        break;
-                    }
-                }
-            } else {
-                for (ri = m_allowedHosts.begin(); ri != m_allowedHosts.end(); ++ri) {
-                    if (regex_match(rdphost, *ri)) {
-                        denied = false;
-                        break;
-                    }
-                }
-                for (ri = m_deniedHosts.begin(); ri != m_deniedHosts.end(); ++ri) {
-                    if (regex_match(rdphost, *ri)) {
-                        denied = true;
-                        break;
-                    }
-                }
-            }
-            return true;
+        return cfg.m_acl.IsAllowed(rdphost, address);
     }
 
     void WsGate::LogInfo(std::basic_string<char> remoteAdress, string uri, const char response[])
@@ -150,32 +148,45 @@ namespace wsgate{
     /* =================================== CURSOR HANDLING =================================== */
     ResponseCode WsGate::HandleCursorRequest(HttpRequest *request, HttpResponse *response, string uri, string thisHost)
     {
-        string idpart(uri.substr(5));
-        vector<string> parts;
-        boost::split(parts, idpart, is_any_of("/"));
-        SessionMap::iterator it = m_SessionMap.find(parts[0]);
-        if (it != m_SessionMap.end()) {
-            uint32_t cid = 0;
+        // The URI is /cur/<key>, where key is the content hash of the image.
+        // So a given URI always refers to the same image and browsers may
+        // keep it forever, even across sessions.
+        string key(uri.substr(5));
+#ifdef HAVE_SYS_EPOLL_H
+        // With worker processes, the URI is /cur/<master>/<worker>/<key>
+        // and the image lives in the cache of that worker. master is the
+        // pid of the main process, which started the worker: After a
+        // restart, it may be the previous one.
+        const int workers = config()->m_engineParams.workers;
+        string::size_type slash = key.find('/');
+        string::size_type slash2 = (string::npos == slash) ? slash : key.find('/', slash + 1);
+        if ((string::npos != slash2) && (0 < workers)) {
+            pid_t master = -1;
+            int worker = -1;
             try {
-                cid = boost::lexical_cast<uint32_t>(parts[1]);
-            } catch (const boost::bad_lexical_cast & e) { cid = 0; }
-            if (cid) {
-                RDP::cursor c = it->second->GetCursor(cid);
-                time_t ct = c.get<0>();
-                if (0 != ct) {
-                    if (notModified(request, response, ct)) {
-                        return HTTPRESPONSECODE_304_NOT_MODIFIED;
-                    }
-                    string png = c.get<1>();
-                    if (!png.empty()) {
-                        response->SetHeader("Content-Type", "image/cur");
-                        response->SetLastModified(ct);
-                        response->SetBody(png.data(), png.length());
-                        LogInfo(request->RemoteAddress(), uri, "200 OK");
-                        return HTTPRESPONSECODE_200_OK;
-                    }
-                }
+                master = boost::lexical_cast<pid_t>(key.substr(0, slash));
+                worker = boost::lexical_cast<int>(key.substr(slash + 1, slash2 - slash - 1));
+            } catch (const boost::bad_lexical_cast &) { worker = -1; }
+            string img;
+            if ((0 < master) && (0 <= worker) && (worker < workers) &&
+                    PreforkChannel::FetchCursor(master, worker, key.substr(slash2 + 1), img)) {
+                response->SetHeader("Content-Type", "image/cur");
+                response->SetHeader("Cache-Control", "public, max-age=31536000, immutable");
+                response->SetBody(img.data(), img.length());
+                LogInfo(request->RemoteAddress(), uri, "200 OK");
+                return HTTPRESPONSECODE_200_OK;
             }
+            LogInfo(request->RemoteAddress(), uri, "404 Not Found");
+            return HTTPRESPONSECODE_404_NOTFOUND;
+        }
+#endif
+        CursorCache::image_ptr c = m_cursorCache.Find(key);
+        if (c) {
+            response->SetHeader("Content-Type", "image/cur");
+            response->SetHeader("Cache-Control", "public, max-age=31536000, immutable");
+            response->SetBody(c->data(), c->length());
+            LogInfo(request->RemoteAddress(), uri, "200 OK");
+            return HTTPRESPONSECODE_200_OK;
         }
         LogInfo(request->RemoteAddress(), uri, "404 Not Found");
         return HTTPRESPONSECODE_404_NOTFOUND;
@@ -186,10 +197,11 @@ namespace wsgate{
     {
         string dest(boost::starts_with(uri, "/wsgate?") ? "wss" : "https");
         //adding the sslPort to the dest Location
-        if (this->m_ptIniConfig.get_optional<uint16_t>("ssl.port"))
+        config_ptr cfg(config());
+        if (cfg->m_ptIniConfig.get_optional<uint16_t>("ssl.port"))
         {
             stringstream sslPort;
-            sslPort << this->m_ptIniConfig.get<uint16_t>("ssl.port");
+            sslPort << cfg->m_ptIniConfig.get<uint16_t>("ssl.port");
 
             //Replace the http port with the ssl one
             string thisSslHost = thisHost.substr(0, thisHost.find(":")) + ":" + sslPort.str();      
@@ -209,58 +221,119 @@ namespace wsgate{
     }
 
     /* =================================== HANDLE WSGATE REQUEST =================================== */
-    int WsGate::CheckIfWSocketRequest(HttpRequest *request, HttpResponse *response, string uri, string thisHost)
+    int WsGate::CheckIfWSocketRequest(const Config &cfg, WsUpgrade &request, string uri, string thisHost, wspp::deflate_params &deflate, int &protocol)
     {
-        if (0 != request->HttpVersion().compare("1.1"))
+        if (0 != request.HttpVersion().compare("1.1"))
         {
-            LogInfo(request->RemoteAddress(), uri, "400 (Not HTTP 1.1)");
+            LogInfo(request.RemoteAddress(), uri, "400 (Not HTTP 1.1)");
             return 400;
         }
 
-        string wshost(to_lower_copy(request->Headers("Host")));
-        string wsconn(to_lower_copy(request->Headers("Connection")));
-        string wsupg(to_lower_copy(request->Headers("Upgrade")));
-        string wsver(request->Headers("Sec-WebSocket-Version"));
-        string wskey(request->Headers("Sec-WebSocket-Key"));
+        string wshost(to_lower_copy(request.Header("Host")));
+        string wsconn(to_lower_copy(request.Header("Connection")));
+        string wsupg(to_lower_copy(request.Header("Upgrade")));
+        string wsver(request.Header("Sec-WebSocket-Version"));
+        string wskey(request.Header("Sec-WebSocket-Key"));
 
-        string wsproto(request->Headers("Sec-WebSocket-Protocol"));
-        string wsext(request->Headers("Sec-WebSocket-Extension"));
+        string wsproto(request.Header("Sec-WebSocket-Protocol"));
+        string wsext(request.Header("Sec-WebSocket-Extensions"));
 
         if (!MultivalHeaderContains(wsconn, "upgrade"))
         {
-            LogInfo(request->RemoteAddress(), uri, "400 (No upgrade header)");
+            LogInfo(request.RemoteAddress(), uri, "400 (No upgrade header)");
 
             return 400;
         }
         if (!MultivalHeaderContains(wsupg, "websocket"))
         {
-            LogInfo(request->RemoteAddress(), uri, "400 (Upgrade header does not contain websocket tag)");
+            LogInfo(request.RemoteAddress(), uri, "400 (Upgrade header does not contain websocket tag)");
             return 400;
         }
         if (0 != wshost.compare(thisHost))
         {
-            LogInfo(request->RemoteAddress(), uri, "400 (Host header does not match)");
+            LogInfo(request.RemoteAddress(), uri, "400 (Host header does not match)");
             return 400;
         }
         string wskey_decoded(base64_decode(wskey));
 
         if (16 != wskey_decoded.length())
         {
-            LogInfo(request->RemoteAddress(), uri, "400 (Invalid WebSocket key)");
+            LogInfo(request.RemoteAddress(), uri, "400 (Invalid WebSocket key)");
             return 400;
         }
 
         if (!MultivalHeaderContains(wsver, "13"))
         {
-            response->SetHeader("Sec-WebSocket-Version", "13");
-            LogInfo(request->RemoteAddress(), uri, "426 (Protocol version not 13)");
+            request.SetHeader("Sec-WebSocket-Version", "13");
+            LogInfo(request.RemoteAddress(), uri, "426 (Protocol version not 13)");
             return 426;
         }
 
+        deflate = cfg.m_deflateConfig;
+        deflate.enabled = false;
+        string wsextResponse;
+        if (!wsext.empty() &&
+                wspp::permessage_deflate::negotiate(wsext, cfg.m_deflateConfig, deflate, wsextResponse))
+        {
+            log::debug << "Negotiated extension: " << wsextResponse << endl;
+            request.SetHeader("Sec-WebSocket-Extensions", wsextResponse);
+        }
+
+        // Clients, capable of the compact op encoding, offer it as subprotocol
+        protocol = OpStream::VERSION_1;
+        if (MultivalHeaderContains(wsproto, OpStream::V2_PROTOCOL))
+        {
+            protocol = OpStream::VERSION_2;
+        }
+
         return 0;
     }
 
-    ResponseCode WsGate::HandleWsgateRequest(HttpRequest *request, HttpResponse *response, std::string uri, std::string thisHost)
+    bool WsGate::ResolveConsoleToken(const string &token, const ConsoleTokenCallback &done)
+    {
+        config_ptr cfg(config());
+        // Bounds the threads and connections, a slow Keystone can tie up.
+        unsigned long pending = ++m_nPendingTokens;
+        if ((0 < cfg->m_nMaxPendingTokens) && (pending > cfg->m_nMaxPendingTokens)) {
+            --m_nPendingTokens;
+            log::warn << "Too many pending OpenStack token lookups (" << cfg->m_nMaxPendingTokens << ")" << endl;
+            return false;
+        }
+        log::info << "Starting OpenStack token authentication" << endl;
+        std::atomic<unsigned long> *counter = &m_nPendingTokens;
+        console_info_callback finish = [done, counter](const nova_console_info &info, std::exception_ptr error) {
+            if (error) {
+                try {
+                    std::rethrow_exception(error);
+                } catch (const exception &ex) {
+                    log::err << "OpenStack token authentication failed: " << ex.what() << endl;
+                } catch (...) {
+                    log::err << "OpenStack token authentication failed" << endl;
+                }
+            } else {
+                log::info << "Host: " << info.host << " Port: " << info.port
+                    << " Internal access path: " << info.internal_access_path
+                    << endl;
+            }
+            --*counter;
+            done(!error, info);
+        };
+        try {
+            nova_console_token_auth* token_auth = nova_console_token_auth_factory::get_instance();
+            token_auth->get_console_info_async(cfg->m_sOpenStackAuthUrl, cfg->m_sOpenStackUsername,
+                    cfg->m_sOpenStackPassword, cfg->m_sOpenStackProjectName,
+                    cfg->m_sOpenStackProjectId,
+                    cfg->m_sOpenStackProjectDomainName, cfg->m_sOpenStackUserDomainName,
+                    cfg->m_sOpenStackProjectDomainId, cfg->m_sOpenStackUserDomainId,
+                    token, cfg->m_sOpenStackKeystoneVersion, cfg->m_sOpenStackRegion, finish);
+        } catch (...) {
+            finish(nova_console_info(), std::current_exception());
+        }
+        return true;
+    }
+
+    ResponseCode WsGate::HandleUpgrade(WsUpgrade &request, std::string uri, std::string thisHost,
+            const nova_console_info *console)
     {
         //FreeRDP Params
         string dtsize;
@@ -272,44 +345,46 @@ namespace wsgate{
         WsRdpParams params;
         bool setCookie = true;
         EmbeddedContext embeddedContext = CONTEXT_PLAIN;
+        // The whole handshake uses the same configuration.
+        config_ptr cfg(config());
 
         if(boost::starts_with(uri, "/wsgate?token="))
         {
             // OpenStack console authentication
             setCookie = false;
-            try
-            {
-                log::info << "Starting OpenStack token authentication" << endl;
-
-                string tokenId = request->FormValues("token").m_sBody;
-
-                nova_console_token_auth* token_auth = nova_console_token_auth_factory::get_instance();
-
-                nova_console_info info = token_auth->get_console_info(m_sOpenStackAuthUrl, m_sOpenStackUsername,
-                                                                        m_sOpenStackPassword, m_sOpenStackProjectName,
-                                                                        m_sOpenStackProjectId,
-                                                                        m_sOpenStackProjectDomainName, m_sOpenStackUserDomainName,
-                                                                        m_sOpenStackProjectDomainId, m_sOpenStackUserDomainId,
-                                                                        tokenId, m_sOpenStackKeystoneVersion, m_sOpenStackRegion);
-
-                log::info << "Host: " << info.host << " Port: " << info.port
-                            << " Internal access path: " << info.internal_access_path
-                            << endl;
+            nova_console_info info;
+            if (console) {
+                info = *console;
+            } else {
+                // EHS cannot suspend a request, so wait here, but not forever.
+                typedef std::pair<bool, nova_console_info> result_type;
+                boost::shared_ptr<std::promise<result_type> > result(new std::promise<result_type>());
+                std::future<result_type> future(result->get_future());
+                if (!ResolveConsoleToken(request.FormValue("token"),
+                            [result](bool ok, const nova_console_info &info) {
+                                result->set_value(result_type(ok, info));
+                            })) {
+                    return HTTPRESPONSECODE_503_SERVICEUNAVAILABLE;
+                }
+                if (std::future_status::ready != future.wait_for(std::chrono::seconds(cfg->m_nTokenTimeout))) {
+                    log::err << "OpenStack token authentication timed out" << endl;
+                    return HTTPRESPONSECODE_503_SERVICEUNAVAILABLE;
+                }
+                result_type res(future.get());
+                if (!res.first) {
+                    return HTTPRESPONSECODE_400_BADREQUEST;
+                }
+                info = res.second;
+            }
 
-                rdphost = info.host;
-                rdpport = info.port;
-                rdppcb = info.internal_access_path;
+            rdphost = info.host;
+            rdpport = info.port;
+            rdppcb = info.internal_access_path;
 
-                rdpuser = m_sHyperVHostUsername;
-                rdppass = m_sHyperVHostPassword;
+            rdpuser = cfg->m_sHyperVHostUsername;
+            rdppass = cfg->m_sHyperVHostPassword;
 
-                embeddedContext = CONTEXT_EMBEDDED;
-            }
-            catch(exception& ex)
-            {
-                log::err << "OpenStack token authentication failed: " << ex.what() << endl;
-                return HTTPRESPONSECODE_400_BADREQUEST;
-            }
+            embeddedContext = CONTEXT_EMBEDDED;
         }
 
         params =
@@ -317,20 +392,23 @@ namespace wsgate{
             rdpport,
             1024,
             768,
-            this->overrideParams.m_bOverrideRdpPerf ? this->overrideParams.m_RdpOverrideParams.perf : nFormValue(request, "perf", 0),
-            this->overrideParams.m_bOverrideRdpFntlm ? this->overrideParams.m_RdpOverrideParams.fntlm : nFormValue(request, "fntlm", 0),
-            this->overrideParams.m_bOverrideRdpNotls ? this->overrideParams.m_RdpOverrideParams.notls : nFormValue(request, "notls", 0),
-            this->overrideParams.m_bOverrideRdpNonla ? this->overrideParams.m_RdpOverrideParams.nonla : nFormValue(request, "nonla", 0),
-            this->overrideParams.m_bOverrideRdpNowallp ? this->overrideParams.m_RdpOverrideParams.nowallp : nFormValue(request, "nowallp", 0),
-            this->overrideParams.m_bOverrideRdpNowdrag ? this->overrideParams.m_RdpOverrideParams.nowdrag : nFormValue(request, "nowdrag", 0),
-            this->overrideParams.m_bOverrideRdpNomani ? this->overrideParams.m_RdpOverrideParams.nomani : nFormValue(request, "nomani", 0),
-            this->overrideParams.m_bOverrideRdpNotheme ? this->overrideParams.m_RdpOverrideParams.notheme : nFormValue(request, "notheme", 0),
+            cfg->overrideParams.m_bOverrideRdpPerf ? cfg->overrideParams.m_RdpOverrideParams.perf : request.IntValue("perf", 0),
+            cfg->overrideParams.m_bOverrideRdpFntlm ? cfg->overrideParams.m_RdpOverrideParams.fntlm : request.IntValue("fntlm", 0),
+            cfg->overrideParams.m_bOverrideRdpNotls ? cfg->overrideParams.m_RdpOverrideParams.notls : request.IntValue("notls", 0),
+            cfg->overrideParams.m_bOverrideRdpNonla ? cfg->overrideParams.m_RdpOverrideParams.nonla : request.IntValue("nonla", 0),
+            cfg->overrideParams.m_bOverrideRdpNowallp ? cfg->overrideParams.m_RdpOverrideParams.nowallp : request.IntValue("nowallp", 0),
+            cfg->overrideParams.m_bOverrideRdpNowdrag ? cfg->overrideParams.m_RdpOverrideParams.nowdrag : request.IntValue("nowdrag", 0),
+            cfg->overrideParams.m_bOverrideRdpNomani ? cfg->overrideParams.m_RdpOverrideParams.nomani : request.IntValue("nomani", 0),
+            cfg->overrideParams.m_bOverrideRdpNotheme ? cfg->overrideParams.m_RdpOverrideParams.notheme : request.IntValue("notheme", 0),
         };
 
-        CheckForPredefined(rdphost, rdpuser, rdppass);
+        CheckForPredefined(*cfg, rdphost, rdpuser, rdppass);
 
-        if( !ConnectionIsAllowed(rdphost) ){
-            LogInfo(request->RemoteAddress(), rdphost, "403 Denied by access rules");
+        // Without a token, the host is only known in StartRdpSession(),
+        // which checks it again after applying the overrides.
+        string rdpaddress;
+        if (!rdphost.empty() && !ConnectionIsAllowed(*cfg, rdphost, rdpaddress)) {
+            LogInfo(request.RemoteAddress(), rdphost, "403 Denied by access rules");
             return HTTPRESPONSECODE_403_FORBIDDEN;
         }
 
@@ -347,9 +425,9 @@ namespace wsgate{
                 params.height = 768;
             }
         }
-        response->SetBody("", 0);
-
-        int wsocketCheck = CheckIfWSocketRequest(request, response, uri, thisHost);
+        wspp::deflate_params deflate;
+        int protocol;
+        int wsocketCheck = CheckIfWSocketRequest(*cfg, request, uri, thisHost, deflate, protocol);
         if(wsocketCheck != 0)
         {
             //using a switch in case of new errors being thrown from the wsocket check
@@ -366,13 +444,13 @@ namespace wsgate{
             }
         }
 
-        string wskey(request->Headers("Sec-WebSocket-Key"));
+        string wskey(request.Header("Sec-WebSocket-Key"));
         SHA1 sha1;
         uint32_t digest[5];
         sha1 << wskey.c_str() << ws_magic;
         if (!sha1.Result(digest))
         {
-            LogInfo(request->RemoteAddress(), uri, "500 (Digest calculation failed)");
+            LogInfo(request.RemoteAddress(), uri, "500 (Digest calculation failed)");
             return HTTPRESPONSECODE_500_INTERNALSERVERERROR;
         }
         // Handle endianess
@@ -380,19 +458,12 @@ namespace wsgate{
         {
             digest[i] = htonl(digest[i]);
         }
-        MyRawSocketHandler *sh = dynamic_cast<MyRawSocketHandler*>(GetRawSocketHandler());
-        if (!sh)
-        {
-            throw tracing::runtime_error("No raw socket handler available");
-        }
-        response->EnableIdleTimeout(false);
-        response->EnableKeepAlive(true);
         try
         {
-            if (!sh->Prepare(request->Connection(), rdphost, rdppcb, rdpuser, rdppass, params, embeddedContext))
+            if (!request.Prepare(rdphost, rdppcb, rdpuser, rdppass, params, embeddedContext, deflate, protocol))
             {
-                LogInfo(request->RemoteAddress(), uri, "503 (RDP backend not available)");
-                response->EnableIdleTimeout(true);
+                LogInfo(request.RemoteAddress(), uri, "503 (RDP backend not available)");
+                request.RemoveHeader("Sec-WebSocket-Extensions");
                 return HTTPRESPONSECODE_503_SERVICEUNAVAILABLE;
             }
         }
@@ -401,30 +472,85 @@ namespace wsgate{
             log::info << "caught exception!" << endl;
         }
 
-        response->RemoveHeader("Content-Type");
-        response->RemoveHeader("Content-Length");
-        response->RemoveHeader("Last-Modified");
-        response->RemoveHeader("Cache-Control");
+        request.RemoveHeader("Content-Type");
+        request.RemoveHeader("Content-Length");
+        request.RemoveHeader("Last-Modified");
+        request.RemoveHeader("Cache-Control");
 
-        string wsproto(request->Headers("Sec-WebSocket-Protocol"));
-        if (0 < wsproto.length())
+        string wsproto(request.Header("Sec-WebSocket-Protocol"));
+        if (OpStream::VERSION_2 == protocol)
         {
-            response->SetHeader("Sec-WebSocket-Protocol", wsproto);
+            request.SetHeader("Sec-WebSocket-Protocol", OpStream::V2_PROTOCOL);
         }
-        response->SetHeader("Upgrade", "websocket");
-        response->SetHeader("Connection", "Upgrade");
-        response->SetHeader("Sec-WebSocket-Accept", base64_encode(reinterpret_cast<const unsigned char *>(digest), 20));
+        else if (0 < wsproto.length())
+        {
+            request.SetHeader("Sec-WebSocket-Protocol", wsproto);
+        }
+        request.SetHeader("Upgrade", "websocket");
+        request.SetHeader("Connection", "Upgrade");
+        request.SetHeader("Sec-WebSocket-Accept", base64_encode(reinterpret_cast<const unsigned char *>(digest), 20));
 
-        LogInfo(request->RemoteAddress(), uri, "101");
+        LogInfo(request.RemoteAddress(), uri, "101");
         return HTTPRESPONSECODE_101_SWITCHING_PROTOCOLS;
     }
 
+    namespace {
+        // Adapts an EHS request/response pair for WsGate::HandleUpgrade
+        class EhsUpgrade : public WsUpgrade {
+            public:
+                EhsUpgrade(HttpRequest *request, HttpResponse *response, MyRawSocketHandler *sh)
+                    : m_request(request)
+                      , m_response(response)
+                      , m_sh(sh)
+                { }
+
+                string RemoteAddress() { return m_request->RemoteAddress(); }
+                string HttpVersion() { return m_request->HttpVersion(); }
+                string Header(const string &name) { return m_request->Headers(name); }
+                string FormValue(const string &name) { return m_request->FormValues(name).m_sBody; }
+                void SetHeader(const string &name, const string &value) { m_response->SetHeader(name, value); }
+                void RemoveHeader(const string &name) { m_response->RemoveHeader(name); }
+
+                bool Prepare(const string host, const string pcb, const string user, const string pass,
+                        const WsRdpParams &params, EmbeddedContext embeddedContext,
+                        const wspp::deflate_params &deflate, int protocol)
+                {
+                    m_response->EnableIdleTimeout(false);
+                    m_response->EnableKeepAlive(true);
+                    if (!m_sh->Prepare(m_request->Connection(), host, pcb, user, pass,
+                                params, embeddedContext, deflate, protocol)) {
+                        m_response->EnableIdleTimeout(true);
+                        return false;
+                    }
+                    return true;
+                }
+
+            private:
+                HttpRequest *m_request;
+                HttpResponse *m_response;
+                MyRawSocketHandler *m_sh;
+        };
+    }
+
+    ResponseCode WsGate::HandleWsgateRequest(HttpRequest *request, HttpResponse *response, std::string uri, std::string thisHost)
+    {
+        MyRawSocketHandler *sh = dynamic_cast<MyRawSocketHandler*>(GetRawSocketHandler());
+        if (!sh)
+        {
+            throw tracing::runtime_error("No raw socket handler available");
+        }
+        response->SetBody("", 0);
+        EhsUpgrade upgrade(request, response, sh);
+        return HandleUpgrade(upgrade, uri, thisHost);
+    }
+
     // generates a page for each http request
     ResponseCode WsGate::HandleRequest(HttpRequest *request, HttpResponse *response)
     {
         //Connection Params
         string uri = request->Uri();
-        string thisHost = m_sHostname.empty() ? request->Headers("Host") : m_sHostname;
+        config_ptr cfg(config());
+        string thisHost = cfg->m_sHostname.empty() ? request->Headers("Host") : cfg->m_sHostname;
 
         //add new behaviour note:
         //those requests that have the same beggining have to be placed with an if else condition
@@ -432,7 +558,7 @@ namespace wsgate{
         if(request->Method() != REQUESTMETHOD_GET)
             return HTTPRESPONSECODE_400_BADREQUEST;
 
-        if (m_bRedirect && (!request->Secure()))
+        if (cfg->m_bRedirect && (!request->Secure()))
         {
             return HandleRedirectRequest(request, response, uri, thisHost);
         }
@@ -462,10 +588,11 @@ namespace wsgate{
     ResponseCode WsGate::HandleHTTPRequest(HttpRequest *request, HttpResponse *response, bool tokenAuth)
     {
         string uri(request->Uri());
-        string thisHost(m_sHostname.empty() ? request->Headers("Host") : m_sHostname);
+        config_ptr cfg(config());
+        string thisHost(cfg->m_sHostname.empty() ? request->Headers("Host") : cfg->m_sHostname);
 
         // Regular (non WebSockets) request
-        bool bDynDebug = m_bDebug;
+        bool bDynDebug = cfg->m_bDebug;
         if (!bDynDebug) {
             // Enable debugging by using a custom UserAgent header
             if (iequals(request->Headers("X-WSGate-Debug"), "true")) {
@@ -477,7 +604,17 @@ namespace wsgate{
             return HTTPRESPONSECODE_404_NOTFOUND;
         }
 
-        path p(m_sDocumentRoot);
+        if (cfg->m_bPrefetchTokens && (0 == cfg->m_engineParams.workers)) {
+            // The embedded page opens its WebSocket right after loading.
+            // Resolve the token meanwhile, the upgrade finds the result
+            // in the lookup cache (or joins the lookup in progress).
+            string token(request->FormValues("token").m_sBody);
+            if (!token.empty()) {
+                ResolveConsoleToken(token, [](bool, const nova_console_info &) { });
+            }
+        }
+
+        path p(cfg->m_sDocumentRoot);
         p /= uri;
         if (ends_with(uri, "/")) {
             p /= (bDynDebug ? "/index-debug.html" : "/index.html");
@@ -486,7 +623,7 @@ namespace wsgate{
         bool externalRequest = false;
 
         if (!exists(p)) {
-            p = m_sDocumentRoot;
+            p = cfg->m_sDocumentRoot;
             p /= "index.html";
         }
 
@@ -495,7 +632,7 @@ namespace wsgate{
             log::warn << "Request from " << request->RemoteAddress()
                 << ": " << uri << " => 403 Forbidden" << endl;
 
-            p = m_sDocumentRoot;
+            p = cfg->m_sDocumentRoot;
             p /= "index.html";
         }
 
@@ -537,7 +674,11 @@ namespace wsgate{
         if (HTML == mt) {
             ostringstream oss;
 
-            oss << (request->Secure() ? "wss://" : "ws://") << thisHost << "/wsgate";
+            if (cfg->m_engineParams.enabled) {
+                oss << (cfg->m_engineParams.tls ? "wss://" : "ws://") << GetEngineHost(*cfg, thisHost) << "/wsgate";
+            } else {
+                oss << (request->Secure() ? "wss://" : "ws://") << thisHost << "/wsgate";
+            }
 
             replace_all(body, "%WSURI%", oss.str());
             replace_all(body, "%JSDEBUG%", (bDynDebug ? "-debug" : ""));
@@ -555,23 +696,23 @@ namespace wsgate{
             }
             else
             {
-                tmp.assign(this->overrideParams.m_bOverrideRdpUser ? "<predefined>" : request->Cookies("lastuser"));
+                tmp.assign(cfg->overrideParams.m_bOverrideRdpUser ? "<predefined>" : request->Cookies("lastuser"));
                 replace_all(body, "%COOKIE_LASTUSER%", tmp);
-                tmp.assign(this->overrideParams.m_bOverrideRdpUser ? "disabled=\"disabled\"" : "");
+                tmp.assign(cfg->overrideParams.m_bOverrideRdpUser ? "disabled=\"disabled\"" : "");
                 replace_all(body, "%DISABLED_USER%", tmp);
-                tmp.assign(this->overrideParams.m_bOverrideRdpPass ? "SomthingUseless" : base64_decode(request->Cookies("lastpass")));
+                tmp.assign(cfg->overrideParams.m_bOverrideRdpPass ? "SomthingUseless" : base64_decode(request->Cookies("lastpass")));
                 replace_all(body, "%COOKIE_LASTPASS%", tmp);
-                tmp.assign(this->overrideParams.m_bOverrideRdpPass ? "disabled=\"disabled\"" : "");
+                tmp.assign(cfg->overrideParams.m_bOverrideRdpPass ? "disabled=\"disabled\"" : "");
                 replace_all(body, "%DISABLED_PASS%", tmp);
 
-                tmp.assign(this->overrideParams.m_bOverrideRdpHost ? "<predefined>" : request->Cookies("lasthost"));
+                tmp.assign(cfg->overrideParams.m_bOverrideRdpHost ? "<predefined>" : request->Cookies("lasthost"));
                 replace_all(body, "%COOKIE_LASTHOST%", tmp);
-                tmp.assign(this->overrideParams.m_bOverrideRdpHost ? "disabled=\"disabled\"" : "");
+                tmp.assign(cfg->overrideParams.m_bOverrideRdpHost ? "disabled=\"disabled\"" : "");
                 replace_all(body, "%DISABLED_HOST%", tmp);
 
-                tmp.assign(this->overrideParams.m_bOverrideRdpPcb ? "<predefined>" : request->Cookies("lastpcb"));
+                tmp.assign(cfg->overrideParams.m_bOverrideRdpPcb ? "<predefined>" : request->Cookies("lastpcb"));
                 replace_all(body, "%COOKIE_LASTPCB%", tmp);
-                tmp.assign(this->overrideParams.m_bOverrideRdpPcb ? "disabled=\"disabled\"" : "");
+                tmp.assign(cfg->overrideParams.m_bOverrideRdpPcb ? "disabled=\"disabled\"" : "");
                 replace_all(body, "%DISABLED_PCB%", tmp);
             }
 
@@ -579,21 +720,21 @@ namespace wsgate{
             replace_all(body, "%VERSION%", tmp);
 
             //The new Port Selector
-            if (this->overrideParams.m_bOverrideRdpPort) {
+            if (cfg->overrideParams.m_bOverrideRdpPort) {
                 replace_all(body, "%DISABLED_PORT%", "disabled=\"disabled\"");
             } else {
                 replace_all(body, "%DISABLED_PORT%", "");
             }
 
-            tmp.assign(this->overrideParams.m_bOverrideRdpPort ? boost::lexical_cast<string>(this->overrideParams.m_RdpOverrideParams.port) : "3389");
+            tmp.assign(cfg->overrideParams.m_bOverrideRdpPort ? boost::lexical_cast<string>(cfg->overrideParams.m_RdpOverrideParams.port) : "3389");
             replace_all(body, "%DEFAULT_PORT%", tmp);
 
             //The Desktop Resolution
-            if (this->overrideParams.m_bOverrideRdpPerf) {
+            if (cfg->overrideParams.m_bOverrideRdpPerf) {
                 replace_all(body, "%DISABLED_PERF%", "disabled=\"disabled\"");
-                replace_all(body, "%SELECTED_PERF0%", (0 == this->overrideParams.m_RdpOverrideParams.perf) ? "selected" : "");
-                replace_all(body, "%SELECTED_PERF1%", (1 == this->overrideParams.m_RdpOverrideParams.perf) ? "selected" : "");
-                replace_all(body, "%SELECTED_PERF2%", (2 == this->overrideParams.m_RdpOverrideParams.perf) ? "selected" : "");
+                replace_all(body, "%SELECTED_PERF0%", (0 == cfg->overrideParams.m_RdpOverrideParams.perf) ? "selected" : "");
+                replace_all(body, "%SELECTED_PERF1%", (1 == cfg->overrideParams.m_RdpOverrideParams.perf) ? "selected" : "");
+                replace_all(body, "%SELECTED_PERF2%", (2 == cfg->overrideParams.m_RdpOverrideParams.perf) ? "selected" : "");
             } else {
                 replace_all(body, "%DISABLED_PERF%", "");
                 replace_all(body, "%SELECTED_PERF0%", "");
@@ -602,49 +743,49 @@ namespace wsgate{
             }
 
 
-            if (this->overrideParams.m_bOverrideRdpFntlm) {
+            if (cfg->overrideParams.m_bOverrideRdpFntlm) {
                 replace_all(body, "%DISABLED_FNTLM%", "disabled=\"disabled\"");
-                replace_all(body, "%SELECTED_FNTLM0%", (0 == this->overrideParams.m_RdpOverrideParams.fntlm) ? "selected" : "");
-                replace_all(body, "%SELECTED_FNTLM1%", (1 == this->overrideParams.m_RdpOverrideParams.fntlm) ? "selected" : "");
-                replace_all(body, "%SELECTED_FNTLM2%", (2 == this->overrideParams.m_RdpOverrideParams.fntlm) ? "selected" : "");
+                replace_all(body, "%SELECTED_FNTLM0%", (0 == cfg->overrideParams.m_RdpOverrideParams.fntlm) ? "selected" : "");
+                replace_all(body, "%SELECTED_FNTLM1%", (1 == cfg->overrideParams.m_RdpOverrideParams.fntlm) ? "selected" : "");
+                replace_all(body, "%SELECTED_FNTLM2%", (2 == cfg->overrideParams.m_RdpOverrideParams.fntlm) ? "selected" : "");
             } else {
                 replace_all(body, "%DISABLED_FNTLM%", "");
                 replace_all(body, "%SELECTED_FNTLM0%", "");
                 replace_all(body, "%SELECTED_FNTLM1%", "");
                 replace_all(body, "%SELECTED_FNTLM2%", "");
             }
-            if (this->overrideParams.m_bOverrideRdpNowallp) {
-                tmp.assign("disabled=\"disabled\"").append((this->overrideParams.m_RdpOverrideParams.nowallp) ? " checked=\"checked\"" : "");
+            if (cfg->overrideParams.m_bOverrideRdpNowallp) {
+                tmp.assign("disabled=\"disabled\"").append((cfg->overrideParams.m_RdpOverrideParams.nowallp) ? " checked=\"checked\"" : "");
             } else {
                 tmp.assign("");
             }
             replace_all(body, "%CHECKED_NOWALLP%", tmp);
-            if (this->overrideParams.m_bOverrideRdpNowdrag) {
-                tmp.assign("disabled=\"disabled\"").append((this->overrideParams.m_RdpOverrideParams.nowdrag) ? " checked=\"checked\"" : "");
+            if (cfg->overrideParams.m_bOverrideRdpNowdrag) {
+                tmp.assign("disabled=\"disabled\"").append((cfg->overrideParams.m_RdpOverrideParams.nowdrag) ? " checked=\"checked\"" : "");
             } else {
                 tmp.assign("");
             }
             replace_all(body, "%CHECKED_NOWDRAG%", tmp);
-            if (this->overrideParams.m_bOverrideRdpNomani) {
-                tmp.assign("disabled=\"disabled\"").append((this->overrideParams.m_RdpOverrideParams.nomani) ? " checked=\"checked\"" : "");
+            if (cfg->overrideParams.m_bOverrideRdpNomani) {
+                tmp.assign("disabled=\"disabled\"").append((cfg->overrideParams.m_RdpOverrideParams.nomani) ? " checked=\"checked\"" : "");
             } else {
                 tmp.assign("");
             }
             replace_all(body, "%CHECKED_NOMANI%", tmp);
-            if (this->overrideParams.m_bOverrideRdpNotheme) {
-                tmp.assign("disabled=\"disabled\"").append((this->overrideParams.m_RdpOverrideParams.notheme) ? " checked=\"checked\"" : "");
+            if (cfg->overrideParams.m_bOverrideRdpNotheme) {
+                tmp.assign("disabled=\"disabled\"").append((cfg->overrideParams.m_RdpOverrideParams.notheme) ? " checked=\"checked\"" : "");
             } else {
                 tmp.assign("");
             }
             replace_all(body, "%CHECKED_NOTHEME%", tmp);
-            if (this->overrideParams.m_bOverrideRdpNotls) {
-                tmp.assign("disabled=\"disabled\"").append((this->overrideParams.m_RdpOverrideParams.notls) ? " checked=\"checked\"" : "");
+            if (cfg->overrideParams.m_bOverrideRdpNotls) {
+                tmp.assign("disabled=\"disabled\"").append((cfg->overrideParams.m_RdpOverrideParams.notls) ? " checked=\"checked\"" : "");
             } else {
                 tmp.assign("");
             }
             replace_all(body, "%CHECKED_NOTLS%", tmp);
-            if (this->overrideParams.m_bOverrideRdpNonla) {
-                tmp.assign("disabled=\"disabled\"").append((this->overrideParams.m_RdpOverrideParams.nonla) ? " checked=\"checked\"" : "");
+            if (cfg->overrideParams.m_bOverrideRdpNonla) {
+                tmp.assign("disabled=\"disabled\"").append((cfg->overrideParams.m_RdpOverrideParams.nonla) ? " checked=\"checked\"" : "");
             } else {
                 tmp.assign("");
             }
@@ -691,7 +832,7 @@ namespace wsgate{
     }
 
     boost::property_tree::ptree WsGate::GetConfig() {
-        return this->m_ptIniConfig;
+        return config()->m_ptIniConfig;
     }
 
     const string & WsGate::GetConfigFile() {
@@ -699,7 +840,7 @@ namespace wsgate{
     }
 
     bool WsGate::GetEnableCore() {
-        return m_bEnableCore;
+        return config()->m_bEnableCore;
     }
 
     bool WsGate::SetConfigFile(const string &name) {
@@ -758,27 +899,46 @@ namespace wsgate{
             ("openstack.tenantname", po::value<string>(), "OpenStack tenant name")
             ("hyperv.hostusername", po::value<string>(), "Hyper-V username")
             ("hyperv.hostpassword", po::value<string>(), "Hyper-V user's password")
+            ("websocket.deflate", po::value<string>(), "enable/disable permessage-deflate")
+            ("websocket.windowbits", po::value<int>(), "specify deflate window bits")
+            ("websocket.contexttakeover", po::value<string>(), "enable/disable deflate context takeover")
+            ("websocket.deflateminsize", po::value<unsigned long>(), "specify minimum message size for deflate")
+            ("websocket.maxpreauth", po::value<unsigned long>(), "specify maximum number of connections without credentials")
+            ("websocket.maxmessage", po::value<unsigned long>(), "specify maximum size of incoming messages")
+            ("openstack.authtimeout", po::value<unsigned long>(), "specify timeout of OpenStack token lookups")
+            ("openstack.maxpending", po::value<unsigned long>(), "specify maximum number of concurrent OpenStack token lookups")
+            ("openstack.cachettl", po::value<unsigned long>(), "specify seconds, a resolved console token is cached")
+            ("openstack.negativettl", po::value<unsigned long>(), "specify seconds, a rejected console token is cached")
+            ("openstack.prefetch", po::value<string>(), "enable/disable resolving console tokens when the page is served")
+            ("channels.relay", po::value<string>(), "specify static virtual channels, relayed to the client")
+            ("channels.window", po::value<unsigned long>(), "specify maximum unacknowledged bytes per channel")
+            ("channels.maxpending", po::value<unsigned long>(), "specify maximum buffered bytes per channel")
+            ("engine.enable", po::value<string>(), "enable/disable the epoll based WebSocket engine")
+            ("engine.port", po::value<uint16_t>(), "specify listening port of the WebSocket engine")
+            ("engine.bindaddr", po::value<string>(), "specify bind address of the WebSocket engine")
+            ("engine.tls", po::value<string>(), "enable/disable TLS for the WebSocket engine")
+            ("engine.threads", po::value<int>(), "specify number of I/O threads of the WebSocket engine")
+            ("engine.maxqueue", po::value<unsigned long>(), "specify maximum queued bytes per WebSocket connection")
+            ("engine.sessioncache", po::value<long>(), "specify number of cached TLS sessions")
+            ("engine.sessiontimeout", po::value<long>(), "specify lifetime of cached TLS sessions")
+            ("engine.ticketlifetime", po::value<long>(), "specify rotation interval of TLS session ticket keys")
+            ("engine.ktls", po::value<string>(), "enable/disable kernel TLS offload")
+            ("engine.workers", po::value<int>(), "specify number of WebSocket engine processes")
+            ("engine.draintimeout", po::value<long>(), "specify maximum time for draining connections after a restart")
             ;
 
+        // Build the new configuration aside. It replaces the current one
+        // only if it is valid, requests in flight keep their snapshot.
+        boost::shared_ptr<Config> conf(new Config());
         try {
-            boost::property_tree::ini_parser::read_ini(m_sConfigFile, this->m_ptIniConfig);
-            boost::property_tree::ptree pt = this->m_ptIniConfig;
+            boost::property_tree::ini_parser::read_ini(m_sConfigFile, conf->m_ptIniConfig);
+            const boost::property_tree::ptree &pt = conf->m_ptIniConfig;
 
             try {
                 // Examine values from config file
-                m_bDaemon = str2bool(pt.get<std::string>("global.daemon","false"));
-                m_bDebug = str2bool(pt.get<std::string>("global.debug","false"));
-                m_bEnableCore = str2bool(pt.get<std::string>("global.enablecore","false"));
-                if (pt.get_optional<std::string>("global.logmask")) {
-                    if (NULL != logger) {
-                        logger->setmaskByName(to_upper_copy(pt.get<std::string>("global.logmask")));
-                    }
-                }
-                if (pt.get_optional<std::string>("global.logfacility")) {
-                    if (NULL != logger) {
-                        logger->setfacilityByName(to_upper_copy(pt.get<std::string>("global.logfacility")));
-                    }
-                }
+                conf->m_bDaemon = str2bool(pt.get<std::string>("global.daemon","false"));
+                conf->m_bDebug = str2bool(pt.get<std::string>("global.debug","false"));
+                conf->m_bEnableCore = str2bool(pt.get<std::string>("global.enablecore","false"));
                 if (!pt.get_optional<std::string>("global.port") && !pt.get_optional<std::string>("ssl.port")) {
                     throw tracing::invalid_argument("No listening ports defined.");
                 }
@@ -786,48 +946,44 @@ namespace wsgate{
                 if (!pt.get_optional<std::string>("http.documentroot")) {
                     throw tracing::invalid_argument("No documentroot defined.");
                 }
-                m_sDocumentRoot.assign(pt.get<std::string>("http.documentroot"));
-                if (m_sDocumentRoot.empty()) {
+                conf->m_sDocumentRoot.assign(pt.get<std::string>("http.documentroot"));
+                if (conf->m_sDocumentRoot.empty()) {
                     throw tracing::invalid_argument("documentroot is empty.");
                 }
 
-                m_bRedirect = str2bool(pt.get<std::string>("global.redirect","false"));
+                conf->m_bRedirect = str2bool(pt.get<std::string>("global.redirect","false"));
                         
+                bool denyAllow = true;
                 if (pt.get_optional<std::string>("acl.order")) {
-                    setAclOrder(pt.get<std::string>("acl.order"));
-                }
-                if (pt.get_child_optional("acl.allow")) {
-                    setHostList(as_vector<std::string>(pt, "acl.allow"), m_allowedHosts);
-                }
-                if (pt.get_child_optional("acl.deny")) {
-                    setHostList(as_vector<std::string>(pt, "acl.deny"), m_deniedHosts);
+                    denyAllow = isOrderDenyAllow(pt.get<std::string>("acl.order"));
                 }
+                conf->m_acl.Compile(denyAllow, aclList(pt, "acl.allow"), aclList(pt, "acl.deny"));
 
                 if (pt.get_optional<std::string>("rdpoverride.host")) {
-                    this->overrideParams.m_sRdpOverrideHost.assign(pt.get<std::string>("rdpoverride.host"));
-                    this->overrideParams.m_bOverrideRdpHost = true;
+                    conf->overrideParams.m_sRdpOverrideHost.assign(pt.get<std::string>("rdpoverride.host"));
+                    conf->overrideParams.m_bOverrideRdpHost = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpHost = false;
+                    conf->overrideParams.m_bOverrideRdpHost = false;
                 }
                 if (pt.get_optional<std::string>("rdpoverride.user")) {
-                    this->overrideParams.m_sRdpOverrideUser.assign(pt.get<std::string>("rdpoverride.user"));
-                    this->overrideParams.m_bOverrideRdpUser = true;
+                    conf->overrideParams.m_sRdpOverrideUser.assign(pt.get<std::string>("rdpoverride.user"));
+                    conf->overrideParams.m_bOverrideRdpUser = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpUser = false;
+                    conf->overrideParams.m_bOverrideRdpUser = false;
                 }
                 if (pt.get_optional<std::string>("rdpoverride.pass")) {
-                    this->overrideParams.m_sRdpOverridePass.assign(pt.get<std::string>("rdpoverride.pass"));
-                    this->overrideParams.m_bOverrideRdpPass = true;
+                    conf->overrideParams.m_sRdpOverridePass.assign(pt.get<std::string>("rdpoverride.pass"));
+                    conf->overrideParams.m_bOverrideRdpPass = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpPass = false;
+                    conf->overrideParams.m_bOverrideRdpPass = false;
                 }
 
                 if (pt.get_optional<std::string>("rdpoverride.pcb")) {
-                    this->overrideParams.m_sRdpOverridePcb.assign(pt.get<std::string>("rdpoverride.pcb"));
-                    this->overrideParams.m_bOverrideRdpPcb = true;
+                    conf->overrideParams.m_sRdpOverridePcb.assign(pt.get<std::string>("rdpoverride.pcb"));
+                    conf->overrideParams.m_bOverrideRdpPcb = true;
                 }
                 else {
-                    this->overrideParams.m_bOverrideRdpPcb = false;
+                    conf->overrideParams.m_bOverrideRdpPcb = false;
                 }
 
                 if (pt.get_optional<int>("rdpoverride.port")) {
@@ -835,10 +991,10 @@ namespace wsgate{
                     if ((0 > n) || (65536 < n)) {
                         throw tracing::invalid_argument("Invalid port value.");
                     }
-                    this->overrideParams.m_RdpOverrideParams.port = n;
-                    this->overrideParams.m_bOverrideRdpPort = true;
+                    conf->overrideParams.m_RdpOverrideParams.port = n;
+                    conf->overrideParams.m_bOverrideRdpPort = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpPort = false;
+                    conf->overrideParams.m_bOverrideRdpPort = false;
                 }
 
                 if (pt.get_optional<int>("rdpoverride.performance")) {
@@ -846,138 +1002,245 @@ namespace wsgate{
                     if ((0 > n) || (2 < n)) {
                         throw tracing::invalid_argument("Invalid performance value.");
                     }
-                    this->overrideParams.m_RdpOverrideParams.perf = n;
-                    this->overrideParams.m_bOverrideRdpPerf = true;
+                    conf->overrideParams.m_RdpOverrideParams.perf = n;
+                    conf->overrideParams.m_bOverrideRdpPerf = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpPerf = false;
+                    conf->overrideParams.m_bOverrideRdpPerf = false;
                 }
                 if (pt.get_optional<int>("rdpoverride.forcentlm")) {
                     int n = pt.get<int>("rdpoverride.forcentlm");
                     if ((0 > n) || (2 < n)) {
                         throw tracing::invalid_argument("Invalid forcentlm value.");
                     }
-                    this->overrideParams.m_RdpOverrideParams.fntlm = n;
-                    this->overrideParams.m_bOverrideRdpFntlm = true;
+                    conf->overrideParams.m_RdpOverrideParams.fntlm = n;
+                    conf->overrideParams.m_bOverrideRdpFntlm = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpFntlm = false;
+                    conf->overrideParams.m_bOverrideRdpFntlm = false;
                 }
                 if (pt.get_optional<std::string>("rdpoverride.nowallpaper")) {
-                    this->overrideParams.m_RdpOverrideParams.nowallp = str2bint(pt.get<std::string>("rdpoverride.nowallpaper"));
-                    this->overrideParams.m_bOverrideRdpNowallp = true;
+                    conf->overrideParams.m_RdpOverrideParams.nowallp = str2bint(pt.get<std::string>("rdpoverride.nowallpaper"));
+                    conf->overrideParams.m_bOverrideRdpNowallp = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpNowallp = false;
+                    conf->overrideParams.m_bOverrideRdpNowallp = false;
                 }
                 if (pt.get_optional<std::string>("rdpoverride.nofullwindowdrag")) {
-                    this->overrideParams.m_RdpOverrideParams.nowdrag = str2bint(pt.get<std::string>("rdpoverride.nofullwindowdrag"));
-                    this->overrideParams.m_bOverrideRdpNowdrag = true;
+                    conf->overrideParams.m_RdpOverrideParams.nowdrag = str2bint(pt.get<std::string>("rdpoverride.nofullwindowdrag"));
+                    conf->overrideParams.m_bOverrideRdpNowdrag = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpNowdrag = false;
+                    conf->overrideParams.m_bOverrideRdpNowdrag = false;
                 }
                 if (pt.get_optional<std::string>("rdpoverride.nomenuanimation")) {
-                    this->overrideParams.m_RdpOverrideParams.nomani = str2bint(pt.get<std::string>("rdpoverride.nomenuanimation"));
-                    this->overrideParams.m_bOverrideRdpNomani = true;
+                    conf->overrideParams.m_RdpOverrideParams.nomani = str2bint(pt.get<std::string>("rdpoverride.nomenuanimation"));
+                    conf->overrideParams.m_bOverrideRdpNomani = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpNomani = false;
+                    conf->overrideParams.m_bOverrideRdpNomani = false;
                 }
                 if (pt.get_optional<std::string>("rdpoverride.notheming")) {
-                    this->overrideParams.m_RdpOverrideParams.notheme = str2bint(pt.get<std::string>("rdpoverride.notheming"));
-                    this->overrideParams.m_bOverrideRdpNotheme = true;
+                    conf->overrideParams.m_RdpOverrideParams.notheme = str2bint(pt.get<std::string>("rdpoverride.notheming"));
+                    conf->overrideParams.m_bOverrideRdpNotheme = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpNotheme = false;
+                    conf->overrideParams.m_bOverrideRdpNotheme = false;
                 }
                 if (pt.get_optional<std::string>("rdpoverride.notls")) {
-                    this->overrideParams.m_RdpOverrideParams.notls = str2bint(pt.get<std::string>("rdpoverride.notls"));
-                    this->overrideParams.m_bOverrideRdpNotls = true;
+                    conf->overrideParams.m_RdpOverrideParams.notls = str2bint(pt.get<std::string>("rdpoverride.notls"));
+                    conf->overrideParams.m_bOverrideRdpNotls = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpNotls = false;
+                    conf->overrideParams.m_bOverrideRdpNotls = false;
                 }
                 if (pt.get_optional<std::string>("rdpoverride.nonla")) {
-                    this->overrideParams.m_RdpOverrideParams.nonla = str2bint(pt.get<std::string>("rdpoverride.nonla"));
-                    this->overrideParams.m_bOverrideRdpNonla = true;
+                    conf->overrideParams.m_RdpOverrideParams.nonla = str2bint(pt.get<std::string>("rdpoverride.nonla"));
+                    conf->overrideParams.m_bOverrideRdpNonla = true;
                 } else {
-                    this->overrideParams.m_bOverrideRdpNonla = false;
+                    conf->overrideParams.m_bOverrideRdpNonla = false;
                 }
                 if (pt.get_optional<std::string>("global.hostname")) {
-                    m_sHostname.assign(pt.get<std::string>("global.hostname"));
+                    conf->m_sHostname.assign(pt.get<std::string>("global.hostname"));
                 } else {
-                    m_sHostname.clear();
+                    conf->m_sHostname.clear();
                 }
                 if (pt.get_optional<std::string>("openstack.authurl")) {
-                    m_sOpenStackAuthUrl.assign(pt.get<std::string>("openstack.authurl"));
+                    conf->m_sOpenStackAuthUrl.assign(pt.get<std::string>("openstack.authurl"));
                 } else {
-                    m_sOpenStackAuthUrl.clear();
+                    conf->m_sOpenStackAuthUrl.clear();
                 }
                 if (pt.get_optional<std::string>("openstack.username")) {
-                    m_sOpenStackUsername.assign(pt.get<std::string>("openstack.username"));
+                    conf->m_sOpenStackUsername.assign(pt.get<std::string>("openstack.username"));
                 } else {
-                    m_sOpenStackUsername.clear();
+                    conf->m_sOpenStackUsername.clear();
                 }
                 if (pt.get_optional<std::string>("openstack.password")) {
-                    m_sOpenStackPassword.assign(pt.get<std::string>("openstack.password"));
+                    conf->m_sOpenStackPassword.assign(pt.get<std::string>("openstack.password"));
                 } else {
-                    m_sOpenStackPassword.clear();
+                    conf->m_sOpenStackPassword.clear();
                 }
                 if (pt.get_optional<std::string>("openstack.projectname")) {
-                    m_sOpenStackProjectName.assign(pt.get<std::string>("openstack.projectname"));
+                    conf->m_sOpenStackProjectName.assign(pt.get<std::string>("openstack.projectname"));
                 }
                 else if (pt.get_optional<std::string>("openstack.tenantname")) {
-                    m_sOpenStackProjectName.assign(pt.get<std::string>("openstack.tenantname"));
+                    conf->m_sOpenStackProjectName.assign(pt.get<std::string>("openstack.tenantname"));
                 }
                 else {
-                    m_sOpenStackProjectName.clear();
+                    conf->m_sOpenStackProjectName.clear();
                 }
                 if (pt.get_optional<std::string>("openstack.projectid")) {
-                    m_sOpenStackProjectId.assign(pt.get<std::string>("openstack.projectid"));
+                    conf->m_sOpenStackProjectId.assign(pt.get<std::string>("openstack.projectid"));
                 }
                 else {
-                    m_sOpenStackProjectId.clear();
+                    conf->m_sOpenStackProjectId.clear();
                 }
                 if (pt.get_optional<std::string>("openstack.projectdomainname")) {
-                    m_sOpenStackProjectDomainName.assign(pt.get<std::string>("openstack.projectdomainname"));
+                    conf->m_sOpenStackProjectDomainName.assign(pt.get<std::string>("openstack.projectdomainname"));
                 }
                 else {
-                    m_sOpenStackProjectDomainName.assign("default");
+                    conf->m_sOpenStackProjectDomainName.assign("default");
                 }
                 if (pt.get_optional<std::string>("openstack.userdomainname")) {
-                    m_sOpenStackUserDomainName.assign(pt.get<std::string>("openstack.userdomainname"));
+                    conf->m_sOpenStackUserDomainName.assign(pt.get<std::string>("openstack.userdomainname"));
                 }
                 else {
-                    m_sOpenStackUserDomainName.assign("default");
+                    conf->m_sOpenStackUserDomainName.assign("default");
                 }
                 if (pt.get_optional<std::string>("openstack.projectdomainid")) {
-                    m_sOpenStackProjectDomainId.assign(pt.get<std::string>("openstack.projectdomainid"));
+                    conf->m_sOpenStackProjectDomainId.assign(pt.get<std::string>("openstack.projectdomainid"));
                 }
                 else {
-                    m_sOpenStackProjectDomainId.clear();
+                    conf->m_sOpenStackProjectDomainId.clear();
                 }
                 if (pt.get_optional<std::string>("openstack.userdomainid")) {
-                    m_sOpenStackUserDomainId.assign(pt.get<std::string>("openstack.userdomainid"));
+                    conf->m_sOpenStackUserDomainId.assign(pt.get<std::string>("openstack.userdomainid"));
                 }
                 else {
-                    m_sOpenStackUserDomainId.clear();
+                    conf->m_sOpenStackUserDomainId.clear();
                 }
                 if (pt.get_optional<std::string>("openstack.keystoneversion")) {
-                    m_sOpenStackKeystoneVersion.assign(pt.get<std::string>("openstack.keystoneversion"));
+                    conf->m_sOpenStackKeystoneVersion.assign(pt.get<std::string>("openstack.keystoneversion"));
                 }
                 else {
-                    m_sOpenStackKeystoneVersion = KEYSTONE_V2;
+                    conf->m_sOpenStackKeystoneVersion = KEYSTONE_V2;
                 }
                 if (pt.get_optional<std::string>("openstack.region")) {
-                    m_sOpenStackRegion.assign(pt.get<std::string>("openstack.region"));
+                    conf->m_sOpenStackRegion.assign(pt.get<std::string>("openstack.region"));
                 }
                 else {
-                    m_sOpenStackRegion.clear();
+                    conf->m_sOpenStackRegion.clear();
+                }
+                conf->m_nTokenTimeout = pt.get<unsigned long>("openstack.authtimeout", 10);
+                if (0 == conf->m_nTokenTimeout) {
+                    throw tracing::invalid_argument("Invalid openstack authtimeout value.");
                 }
+                conf->m_nMaxPendingTokens = pt.get<unsigned long>("openstack.maxpending", 64);
+                const unsigned long cacheTtl = pt.get<unsigned long>("openstack.cachettl", 30);
+                const unsigned long negativeTtl = pt.get<unsigned long>("openstack.negativettl", 10);
+                // Without a token service or a cache, prefetched results are lost.
+                conf->m_bPrefetchTokens = str2bool(pt.get<std::string>("openstack.prefetch", "true")) &&
+                    !conf->m_sOpenStackAuthUrl.empty() && (0 < cacheTtl);
+
                 if (pt.get_optional<std::string>("hyperv.hostusername")) {
-                    m_sHyperVHostUsername.assign(pt.get<std::string>("hyperv.hostusername"));
+                    conf->m_sHyperVHostUsername.assign(pt.get<std::string>("hyperv.hostusername"));
                 } else {
-                    m_sHyperVHostUsername.clear();
+                    conf->m_sHyperVHostUsername.clear();
                 }
                 if (pt.get_optional<std::string>("hyperv.hostpassword")) {
-                    m_sHyperVHostPassword.assign(pt.get<std::string>("hyperv.hostpassword"));
+                    conf->m_sHyperVHostPassword.assign(pt.get<std::string>("hyperv.hostpassword"));
                 } else {
-                    m_sHyperVHostPassword.clear();
+                    conf->m_sHyperVHostPassword.clear();
+                }
+
+                conf->m_deflateConfig = wspp::permessage_deflate::defaults();
+                conf->m_deflateConfig.enabled = str2bool(pt.get<std::string>("websocket.deflate","false"));
+                if (pt.get_optional<int>("websocket.windowbits")) {
+                    int n = pt.get<int>("websocket.windowbits");
+                    if ((9 > n) || (15 < n)) {
+                        throw tracing::invalid_argument("Invalid windowbits value.");
+                    }
+                    conf->m_deflateConfig.server_max_window_bits = n;
+                    conf->m_deflateConfig.client_max_window_bits = n;
+                }
+                if (!str2bool(pt.get<std::string>("websocket.contexttakeover","true"))) {
+                    conf->m_deflateConfig.server_no_context_takeover = true;
+                    conf->m_deflateConfig.client_no_context_takeover = true;
+                }
+                if (pt.get_optional<unsigned long>("websocket.deflateminsize")) {
+                    conf->m_deflateConfig.min_size = pt.get<unsigned long>("websocket.deflateminsize");
+                }
+                conf->m_nMaxPreAuth = pt.get<unsigned long>("websocket.maxpreauth", 64);
+
+                conf->m_channelParams.names.clear();
+                if (pt.get_optional<std::string>("channels.relay")) {
+                    vector<string> names;
+                    string relay = pt.get<std::string>("channels.relay");
+                    split(names, relay, is_any_of(", "), boost::token_compress_on);
+                    for (vector<string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+                        if (it->empty()) {
+                            continue;
+                        }
+                        if (7 < it->length()) {
+                            throw tracing::invalid_argument("Invalid channel name (max. 7 characters).");
+                        }
+                        conf->m_channelParams.names.push_back(*it);
+                    }
                 }
+                conf->m_channelParams.window = pt.get<unsigned long>("channels.window", 262144);
+                conf->m_channelParams.maxpending = pt.get<unsigned long>("channels.maxpending", 4194304);
+                if ((16384 > conf->m_channelParams.window) || (conf->m_channelParams.window > conf->m_channelParams.maxpending)) {
+                    throw tracing::invalid_argument("Invalid channel window or maxpending value.");
+                }
+                // By default, a relayed channel message (plus its header)
+                // must not be refused before the channel's own limit applies.
+                conf->m_nMaxMessage = pt.get<unsigned long>("websocket.maxmessage",
+                        max(static_cast<unsigned long>(wspp::frame::limits::PAYLOAD_SIZE_MESSAGE),
+                            conf->m_channelParams.maxpending + 4096));
+                if (4096 > conf->m_nMaxMessage) {
+                    throw tracing::invalid_argument("Invalid maxmessage value.");
+                }
+
+                conf->m_engineParams.enabled = str2bool(pt.get<std::string>("engine.enable","false"));
+                conf->m_engineParams.port = pt.get<uint16_t>("engine.port", 8443);
+                conf->m_engineParams.bindaddr = pt.get<std::string>("engine.bindaddr", "0.0.0.0");
+                conf->m_engineParams.tls = str2bool(pt.get<std::string>("engine.tls",
+                            pt.get_optional<uint16_t>("ssl.port") ? "true" : "false"));
+                conf->m_engineParams.certfile = pt.get<std::string>("ssl.certfile", "");
+                conf->m_engineParams.certpass = pt.get<std::string>("ssl.certpass", "");
+                conf->m_engineParams.threads = pt.get<int>("engine.threads", 0);
+                conf->m_engineParams.maxqueue = pt.get<unsigned long>("engine.maxqueue", 33554432);
+                conf->m_engineParams.sessioncache = pt.get<long>("engine.sessioncache", 20480);
+                conf->m_engineParams.sessiontimeout = pt.get<long>("engine.sessiontimeout", 300);
+                conf->m_engineParams.ticketlifetime = pt.get<long>("engine.ticketlifetime", 3600);
+                conf->m_engineParams.ktls = str2bool(pt.get<std::string>("engine.ktls","true"));
+                conf->m_engineParams.workers = pt.get<int>("engine.workers", 0);
+                conf->m_engineParams.draintimeout = pt.get<long>("engine.draintimeout", 3600);
+                if (conf->m_engineParams.enabled) {
+#ifndef HAVE_SYS_EPOLL_H
+                    throw tracing::invalid_argument("The WebSocket engine is not supported on this platform.");
+#endif
+                    if (conf->m_engineParams.tls && conf->m_engineParams.certfile.empty()) {
+                        throw tracing::invalid_argument("The WebSocket engine needs ssl.certfile for TLS.");
+                    }
+                    if ((0 > conf->m_engineParams.threads) || (65536 > conf->m_engineParams.maxqueue)) {
+                        throw tracing::invalid_argument("Invalid engine threads or maxqueue value.");
+                    }
+                    if ((0 > conf->m_engineParams.sessioncache) || (0 >= conf->m_engineParams.sessiontimeout) ||
+                            (0 > conf->m_engineParams.ticketlifetime)) {
+                        throw tracing::invalid_argument("Invalid engine sessioncache, sessiontimeout or ticketlifetime value.");
+                    }
+                    if ((0 > conf->m_engineParams.workers) || (0 > conf->m_engineParams.draintimeout)) {
+                        throw tracing::invalid_argument("Invalid engine workers or draintimeout value.");
+                    }
+                }
+
+                // Valid, now apply the process-wide settings.
+                if (pt.get_optional<std::string>("global.logmask")) {
+                    if (NULL != logger) {
+                        logger->setmaskByName(to_upper_copy(pt.get<std::string>("global.logmask")));
+                    }
+                }
+                if (pt.get_optional<std::string>("global.logfacility")) {
+                    if (NULL != logger) {
+                        logger->setfacilityByName(to_upper_copy(pt.get<std::string>("global.logfacility")));
+                    }
+                }
+                nova_console_token_auth_factory::get_instance()->set_timeout(conf->m_nTokenTimeout);
+                nova_console_token_auth_factory::get_instance()->set_cache_ttl(cacheTtl, negativeTtl);
             } catch (const tracing::invalid_argument & e) {
                 cerr << e.what() << endl;
                 wsgate::log::err << e.what() << endl;
@@ -989,6 +1252,7 @@ namespace wsgate{
             cerr << e.what() << endl;
             return false;
         }
+        m_config.Publish(conf);
         return true;
     }
 
@@ -1058,56 +1322,36 @@ namespace wsgate{
         return (1 == str2bint(s));
     }
 
-    void WsGate::wc2pat(string &wildcards) {
-        boost::replace_all(wildcards, "\\", "\\\\");
-        boost::replace_all(wildcards, "^", "\\^");
-        boost::replace_all(wildcards, ".", "\\.");
-        boost::replace_all(wildcards, "$", "\\$");
-        boost::replace_all(wildcards, "|", "\\|");
-        boost::replace_all(wildcards, "(", "\\(");
-        boost::replace_all(wildcards, ")", "\\)");
-        boost::replace_all(wildcards, "[", "\\[");
-        boost::replace_all(wildcards, "]", "\\]");
-        boost::replace_all(wildcards, "*", "\\*");
-        boost::replace_all(wildcards, "+", "\\+");
-        boost::replace_all(wildcards, "?", "\\?");
-        boost::replace_all(wildcards, "/", "\\/");
-        boost::replace_all(wildcards, "\\?", ".");
-        boost::replace_all(wildcards, "\\*", ".*");
-        wildcards.insert(0, "^").append("$");
-    }
-
-    void WsGate::setHostList(const vector<string> &hosts, vector<boost::regex> &hostlist) {
-        vector<string> tmp(hosts);
-        vector<string>::iterator i;
-        hostlist.clear();
-        for (i = tmp.begin(); i != tmp.end(); ++i) {
-            wc2pat(*i);
-            boost::regex re(*i, boost::regex::icase);
-            hostlist.push_back(re);
+    vector<string> WsGate::aclList(boost::property_tree::ptree const& pt, const string &key) {
+        vector<string> ret;
+        if (pt.get_optional<std::string>(key)) {
+            string list(pt.get<std::string>(key));
+            trim(list);
+            if (!list.empty()) {
+                split(ret, list, is_any_of(", \t"), boost::token_compress_on);
+            }
         }
+        return ret;
     }
 
-    void WsGate::setAclOrder(const string &order) {
+    bool WsGate::isOrderDenyAllow(const string &order) {
         vector<string> parts;
         boost::split(parts, order, is_any_of(","));
         if (2 == parts.size()) {
             trim(parts[0]);
             trim(parts[1]);
             if (iequals(parts[0],"deny") && iequals(parts[1],"allow")) {
-                m_bOrderDenyAllow = true;
-                return;
+                return true;
             }
             if (iequals(parts[0],"allow") && iequals(parts[1],"deny")) {
-                m_bOrderDenyAllow = false;
-                return;
+                return false;
             }
         }
         throw tracing::invalid_argument("Invalid acl order value.");
     }
 
     bool WsGate::GetDaemon() {
-        return m_bDaemon;
+        return config()->m_bDaemon;
     }
 
     void WsGate::SetPidFile(const string &name) {
@@ -1117,16 +1361,97 @@ namespace wsgate{
     void WsGate::RegisterRdpSession(rdp_ptr rdp) {
         ostringstream oss;
         oss << hex << rdp.get();
+        boost::mutex::scoped_lock lock(m_sessionLock);
         m_SessionMap[oss.str()] = rdp;
     }
 
     void WsGate::UnregisterRdpSession(rdp_ptr rdp) {
         ostringstream oss;
         oss << hex << rdp.get();
+        boost::mutex::scoped_lock lock(m_sessionLock);
         m_SessionMap.erase(oss.str());
     }
 
+    void WsGate::StartRdpSession(rdp_ptr r, const string &_host, const string &_pcb,
+            const string &_user, const string &_pass, const WsRdpParams &_params)
+    {
+        string host = _host;
+        string pcb = _pcb;
+        string user = _user;
+        string pass = _pass;
+        WsRdpParams params = _params;
+
+        string username;
+        string domain;
+
+        //do needed overrides
+        config_ptr cfg(config());
+        const WsRdpOverrideParams &op = cfg->overrideParams;
+        if (op.m_bOverrideRdpFntlm) params.fntlm = op.m_RdpOverrideParams.fntlm;
+        if (op.m_bOverrideRdpNomani) params.nomani = op.m_RdpOverrideParams.nomani;
+        if (op.m_bOverrideRdpNonla) params.nonla = op.m_RdpOverrideParams.nonla;
+        if (op.m_bOverrideRdpNotheme) params.notheme = op.m_RdpOverrideParams.notheme;
+        if (op.m_bOverrideRdpNotls) params.notls = op.m_RdpOverrideParams.notls;
+        if (op.m_bOverrideRdpNowallp) params.nowallp = op.m_RdpOverrideParams.nowallp;
+        if (op.m_bOverrideRdpNowdrag) params.nowdrag = op.m_bOverrideRdpNowdrag;
+        if (op.m_bOverrideRdpPerf) params.perf = op.m_RdpOverrideParams.perf;
+        if (op.m_bOverrideRdpPort) params.port = op.m_RdpOverrideParams.port;
+        if (op.m_bOverrideRdpHost) host = op.m_sRdpOverrideHost;
+        if (op.m_bOverrideRdpPass) pass = op.m_sRdpOverridePass;
+        if (op.m_bOverrideRdpPcb) pcb = op.m_sRdpOverridePcb;
+        if (op.m_bOverrideRdpUser) user = op.m_sRdpOverrideUser;
+
+        // Without a token, the host arrives along with the credentials,
+        // so the check at upgrade time did not see it.
+        string address;
+        if (!ConnectionIsAllowed(*cfg, host, address)) {
+            log::info << "RDP Host '" << host << "' denied by access rules" << endl;
+            throw tracing::runtime_error("Denied by access rules");
+        }
+
+        SplitUserDomain(user, username, domain);
+
+        // Connect to the checked address, another lookup might differ.
+        r->Connect(address, pcb, username, domain, pass, params);
+        RegisterRdpSession(r);
+
+        log::debug << "RDP Host:              '" << host << "'" << endl;
+        log::debug << "RDP Pcb:               '" << pcb << "'" << endl;
+        log::debug << "RDP User:              '" << user << "'" << endl;
+        log::info << "RDP Port:               '" << params.port << "'" << endl;
+        log::debug << "RDP Desktop size:       " << params.width << "x" << params.height << endl;
+        log::debug << "RDP Performance:        " << params.perf << endl;
+        log::debug << "RDP No wallpaper:       " << params.nowallp << endl;
+        log::debug << "RDP No full windowdrag: " << params.nowdrag << endl;
+        log::debug << "RDP No menu animation:  " << params.nomani << endl;
+        log::debug << "RDP No theming:         " << params.notheme << endl;
+        log::debug << "RDP Disable TLS:        " << params.notls << endl;
+        log::debug << "RDP Disable NLA:        " << params.nonla << endl;
+        log::debug << "RDP NTLM auth:          " << params.fntlm << endl;
+    }
+
+    string WsGate::GetEngineHost(const string &thisHost) const {
+        return GetEngineHost(*config(), thisHost);
+    }
+
+    string WsGate::GetEngineHost(const Config &cfg, const string &thisHost) const {
+        string host(thisHost);
+        size_t colon = host.rfind(':');
+        if ((string::npos != colon) && (string::npos == host.find(']', colon))) {
+            // Strip the port (but not part of an IPv6 address)
+            if (('[' == host[0]) || (host.find(':') == colon)) {
+                host.erase(colon);
+            }
+        }
+        if (cfg.m_engineParams.port != (cfg.m_engineParams.tls ? 443 : 80)) {
+            ostringstream oss;
+            oss << host << ":" << cfg.m_engineParams.port;
+            host = oss.str();
+        }
+        return host;
+    }
+
     WsRdpOverrideParams WsGate::getOverrideParams(){
-        return this->overrideParams;
+        return config()->overrideParams;
     }
 }
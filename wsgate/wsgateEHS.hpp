@@ -6,6 +6,9 @@
 #endif
 
 #include <ehs/ehs.h>
+#include <atomic>
+#include <functional>
+#include <future>
 #include <vector>
 #include <sstream>
 #include <iostream>
@@ -34,6 +37,12 @@
 #include "logging.hpp"
 #include "wsendpoint.hpp"
 #include "myrawsocket.hpp"
+#include "WsUpgrade.hpp"
+#include "OpStream.hpp"
+#include "CursorCache.hpp"
+#include "HostAcl.hpp"
+#include "Snapshot.hpp"
+#include "WsEngine.hpp"
 #include "nova_token_auth.hpp"
 
 using namespace std;
@@ -59,14 +68,38 @@ namespace wsgate{
             WsGate(EHS *parent = NULL, std::string registerpath = "");
             virtual ~WsGate();
             HttpResponse *HandleThreadException(ehs_threadid_t, HttpRequest *request, exception &ex);
-            void CheckForPredefined(string& rdpHost, string& rdpUser, string& rdpPass);
-            bool ConnectionIsAllowed(string rdphost);
             void LogInfo(std::basic_string<char> remoteAdress, string uri, const char response[]);
             ResponseCode HandleRobotsRequest(HttpRequest *request, HttpResponse *response, string uri, string thisHost);
             ResponseCode HandleCursorRequest(HttpRequest *request, HttpResponse *response, string uri, string thisHost);
             ResponseCode HandleRedirectRequest(HttpRequest *request, HttpResponse *response, string uri, string thisHost);
-            int CheckIfWSocketRequest(HttpRequest *request, HttpResponse *response, string uri, string thisHost);
             ResponseCode HandleWsgateRequest(HttpRequest *request, HttpResponse *response, std::string uri, std::string thisHost);
+            /**
+             * Performs the WebSocket handshake and prepares the RDP session.
+             * Shared by the EHS listener and WsEngine.
+             * @param request The upgrade request.
+             * @param uri The request URI.
+             * @param thisHost The expected value of the Host header.
+             * @param console The resolved OpenStack console token (see
+             *   ResolveConsoleToken). If NULL, a token in the URI is resolved
+             *   here, blocking the calling thread for at most authtimeout.
+             * @return The HTTP response code, 101 on success.
+             */
+            ResponseCode HandleUpgrade(WsUpgrade &request, std::string uri, std::string thisHost,
+                    const nova_console_info *console = NULL);
+            /**
+             * Receives the result of ResolveConsoleToken.
+             * @param ok true, if the token is valid.
+             * @param info The console of the token.
+             */
+            typedef std::function<void (bool ok, const nova_console_info &info)> ConsoleTokenCallback;
+            /**
+             * Starts resolving an OpenStack console token, without waiting
+             * for Keystone and nova.
+             * @param token The console token.
+             * @param done Invoked with the result, usually on another thread.
+             * @return false, if too many lookups are pending already.
+             */
+            bool ResolveConsoleToken(const string &token, const ConsoleTokenCallback &done);
             ResponseCode HandleRequest(HttpRequest *request, HttpResponse *response);
             ResponseCode HandleHTTPRequest(HttpRequest *request, HttpResponse *response, bool tokenAuth = false);
             boost::property_tree::ptree GetConfig();
@@ -78,8 +111,109 @@ namespace wsgate{
             void SetPidFile(const string &name);
             void RegisterRdpSession(rdp_ptr rdp);
             void UnregisterRdpSession(rdp_ptr rdp);
+            /**
+             * Applies the configured overrides and connects an RDP session.
+             * Throws tracing::runtime_error, if the resulting host is
+             * denied by the ACL.
+             * @param rdp The session to connect.
+             * @param host The RDP host to connect to.
+             * @param pcb The preconnection blob.
+             * @param user The user name, optionally prefixed by a domain.
+             * @param pass The password.
+             * @param params Additional RDP parameters.
+             */
+            void StartRdpSession(rdp_ptr rdp, const string &host, const string &pcb,
+                    const string &user, const string &pass, const WsRdpParams &params);
             WsRdpOverrideParams getOverrideParams();
+            /**
+             * Retrieves the maximum number of WebSocket connections,
+             * still waiting for their credentials.
+             * @return The limit, 0 means unlimited.
+             */
+            unsigned long GetMaxPreAuth() const { return config()->m_nMaxPreAuth; }
+            /**
+             * Retrieves the maximum size of messages from the client.
+             * @return The limit in bytes, before and after decompression.
+             */
+            unsigned long GetMaxMessage() const { return config()->m_nMaxMessage; }
+            /**
+             * Retrieves the static virtual channels, relayed to the client.
+             * @return The channel parameters.
+             */
+            WsChannelParams GetChannelParams() const { return config()->m_channelParams; }
+            /**
+             * Retrieves the process-wide cache for cursor images.
+             * @return The cursor cache.
+             */
+            CursorCache *GetCursorCache() { return &m_cursorCache; }
+            /**
+             * Retrieves the parameters of the WebSocket engine.
+             * @return The engine parameters.
+             */
+            WsEngineParams GetEngineParams() const { return config()->m_engineParams; }
+            /**
+             * Retrieves the configured host name.
+             * @return The host name or an empty string, if none is configured.
+             */
+            string GetHostname() const { return config()->m_sHostname; }
+            /**
+             * Determines the host, under which the WebSocket engine
+             * is reachable by the clients.
+             * @param thisHost The host (and optional port) of the web server.
+             * @return The same host with the port of the engine.
+             */
+            string GetEngineHost(const string &thisHost) const;
         private:
+            /**
+             * An immutable snapshot of the configuration.
+             * ReadConfig builds and validates a new one aside and
+             * publishes it as a whole (see SnapshotHolder). So a request
+             * works with a consistent configuration from start to end,
+             * even if the config file is reloaded meanwhile.
+             */
+            class Config {
+                public:
+                    Config();
+
+                    boost::property_tree::ptree m_ptIniConfig;
+                    string m_sHostname;
+                    string m_sDocumentRoot;
+                    bool m_bDebug;
+                    bool m_bEnableCore;
+                    bool m_bDaemon;
+                    bool m_bRedirect;
+                    // Caches its decisions, thread-safe.
+                    mutable HostAcl m_acl;
+                    WsRdpOverrideParams overrideParams;
+                    string m_sOpenStackAuthUrl;
+                    string m_sOpenStackUsername;
+                    string m_sOpenStackPassword;
+                    string m_sOpenStackProjectName;
+                    string m_sOpenStackProjectId;
+                    string m_sOpenStackProjectDomainName;
+                    string m_sOpenStackUserDomainName;
+                    string m_sOpenStackProjectDomainId;
+                    string m_sOpenStackUserDomainId;
+                    string m_sOpenStackKeystoneVersion;
+                    string m_sOpenStackRegion;
+                    string m_sHyperVHostUsername;
+                    string m_sHyperVHostPassword;
+                    wspp::deflate_params m_deflateConfig;
+                    unsigned long m_nMaxPreAuth;
+                    unsigned long m_nMaxMessage;
+                    unsigned long m_nTokenTimeout;
+                    unsigned long m_nMaxPendingTokens;
+                    bool m_bPrefetchTokens;
+                    WsChannelParams m_channelParams;
+                    WsEngineParams m_engineParams;
+
+                private:
+                    // Non-copyable
+                    Config(const Config &);
+                    Config & operator=(const Config &);
+            };
+            typedef SnapshotHolder<Config>::ptr config_ptr;
+
             typedef enum {
                 TEXT,
                 HTML,
@@ -96,47 +230,36 @@ namespace wsgate{
             typedef boost::tuple<time_t, string> cache_entry;
             typedef map<path, cache_entry> StaticCache;
 
-            string m_sHostname;
-            string m_sDocumentRoot;
             string m_sPidFile;
-            bool m_bDebug;
-            bool m_bEnableCore;
             SessionMap m_SessionMap;
-            vector<boost::regex> m_allowedHosts;
-            vector<boost::regex> m_deniedHosts;
-            WsRdpOverrideParams overrideParams;
-            bool m_bOrderDenyAllow;
+            boost::mutex m_sessionLock;
             string m_sConfigFile;
-            boost::property_tree::ptree m_ptIniConfig;
-            bool m_bDaemon;
-            bool m_bRedirect;
+            SnapshotHolder<Config> m_config;
             StaticCache m_StaticCache;
-            string m_sOpenStackAuthUrl;
-            string m_sOpenStackUsername;
-            string m_sOpenStackPassword;
-            string m_sOpenStackProjectName;
-            string m_sOpenStackProjectId;
-            string m_sOpenStackProjectDomainName;
-            string m_sOpenStackUserDomainName;
-            string m_sOpenStackProjectDomainId;
-            string m_sOpenStackUserDomainId;
-            string m_sOpenStackKeystoneVersion;
-            string m_sOpenStackRegion;
-            string m_sHyperVHostUsername;
-            string m_sHyperVHostPassword;
+            std::atomic<unsigned long> m_nPendingTokens;
+            CursorCache m_cursorCache;
 
             // Non-copyable
             WsGate(const WsGate&);
             WsGate & operator=(const WsGate&);
 
+            /**
+             * Retrieves the current configuration.
+             * Lock-free, so it may be used on every request.
+             * @return The snapshot of the configuration.
+             */
+            config_ptr config() const { return m_config.Get(); }
+            void CheckForPredefined(const Config &cfg, string& rdpHost, string& rdpUser, string& rdpPass);
+            bool ConnectionIsAllowed(const Config &cfg, string rdphost, string &address);
+            int CheckIfWSocketRequest(const Config &cfg, WsUpgrade &request, string uri, string thisHost, wspp::deflate_params &deflate, int &protocol);
+            string GetEngineHost(const Config &cfg, const string &thisHost) const;
             MimeType simpleMime(const string & filename);
             template <typename T> std::vector<T> as_vector(boost::property_tree::ptree const& pt, boost::property_tree::ptree::key_type const& key);
             bool notModified(HttpRequest *request, HttpResponse *response, time_t mtime);
             int str2bint(const string &s);
             bool str2bool(const string &s);
-            void wc2pat(string &wildcards);
-            void setHostList(const vector<string> &hosts, vector<boost::regex> &hostlist);
-            void setAclOrder(const string &order);
+            vector<string> aclList(boost::property_tree::ptree const& pt, const string &key);
+            bool isOrderDenyAllow(const string &order);
     };
 }
 
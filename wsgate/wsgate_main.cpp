@@ -23,6 +23,11 @@
 #include "myWsHandler.hpp"
 #include "wsGateService.hpp"
 #include "myBindHelper.hpp"
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/prctl.h>
+# include "Prefork.hpp"
+# include "ListenSockets.hpp"
+#endif
 
 namespace wsgate{
 
@@ -68,10 +73,16 @@ namespace wsgate{
 static bool g_service_background = true;
 #endif
 
+#ifndef _WIN32
+static volatile sig_atomic_t g_terminated = 0;
+#endif
+
 static void terminate(int)
 {
 #ifdef _WIN32
     wsgate::WsGateService::g_signaled = true;
+#else
+    g_terminated = 1;
 #endif
     signal(SIGINT, terminate);
     signal(SIGTERM, terminate);
@@ -80,8 +91,28 @@ static void terminate(int)
 #ifndef _WIN32
 static wsgate::WsGate *g_srv = NULL;
 static wsgate::WsGate *g_psrv = NULL;
+#ifdef HAVE_SYS_EPOLL_H
+static wsgate::Prefork *g_prefork = NULL;
+#endif
+static volatile sig_atomic_t g_reload = 0;
 static void reload(int)
 {
+    g_reload = 1;
+    signal(SIGHUP, reload);
+}
+
+/**
+ * Reloads the config file after a SIGHUP.
+ * Invoked from the main loops, not from the signal handler: ReadConfig
+ * allocates and logs. The new configuration is published atomically,
+ * requests in flight finish with the previous one.
+ */
+static void checkReload()
+{
+    if (!g_reload) {
+        return;
+    }
+    g_reload = 0;
     wsgate::log::info << "Got SIGHUP, reloading config file." << endl;
     if (NULL != g_srv) {
         g_srv->ReadConfig();
@@ -89,7 +120,125 @@ static void reload(int)
     if (NULL != g_psrv) {
         g_psrv->ReadConfig();
     }
+#ifdef HAVE_SYS_EPOLL_H
+    if (NULL != g_prefork) {
+        g_prefork->Reload();
+    }
+#endif
+}
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+static volatile sig_atomic_t g_upgrade = 0;
+static void upgrade(int)
+{
+    g_upgrade = 1;
+    signal(SIGUSR2, upgrade);
+}
+
+/**
+ * Handles SIGUSR2 and follows the handover to the new process.
+ * Invoked from the main loops.
+ * @param successor The pid of the new process, -1 if none.
+ * @return true, if the new process is listening and this one
+ *   has to stop accepting.
+ */
+static bool checkUpgrade(char **argv, pid_t &successor)
+{
+    if (g_upgrade) {
+        g_upgrade = 0;
+        if (-1 == successor) {
+            successor = wsgate::ListenSockets::Handover(argv);
+        }
+    }
+    if (-1 == successor) {
+        return false;
+    }
+    // Keep accepting, until the new process is up.
+    switch (wsgate::ListenSockets::SuccessorState()) {
+        case 0:
+            return false;
+        case -1:
+            waitpid(successor, NULL, WNOHANG);
+            successor = -1;
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Starts an EHS instance. After a restart, the previous process
+ * may still hold the port, if EHS has bound it without the bind
+ * helper. In that case, ask it to release the port and retry for a while.
+ */
+static void startServer(wsgate::WsGate &srv, EHSServerParameters &oSP)
+{
+    for (int i = 0; ; ++i) {
+        try {
+            srv.StartServer(oSP);
+            return;
+        } catch (const exception &) {
+            if ((1000 <= i) || !wsgate::ListenSockets::Inherited()) {
+                throw;
+            }
+            wsgate::ListenSockets::Ready();
+            usleep(10000);
+        }
+    }
+}
+
+/**
+ * Main loop of a worker process (see wsgate::Prefork).
+ * Runs the WebSocket engine only, the web pages are served by
+ * the main process.
+ * On SIGUSR2, the worker drains its connections and terminates.
+ */
+static int runWorker(wsgate::WsGate &srv, int n)
+{
+    // Shared with the other workers, so that they resume each other's TLS sessions.
+    string ticketSecret(wsgate::Prefork::TicketSecret());
+    // Do not outlive the main process.
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (1 == getppid()) {
+        return -1;
+    }
+    g_srv = &srv;
+    signal(SIGPIPE, SIG_IGN);
     signal(SIGHUP, reload);
+    signal(SIGUSR2, upgrade);
+    signal(SIGINT, terminate);
+    signal(SIGTERM, terminate);
+
+    // The route names the main process as well: After a restart, the
+    // workers of the new one reuse the same numbers.
+    pid_t master = getppid();
+    srv.GetCursorCache()->SetRoute(boost::lexical_cast<string>(master) + "/" +
+            boost::lexical_cast<string>(n) + "/");
+    try {
+        wsgate::PreforkChannel channel(&srv, master, n);
+        channel.Start();
+        wsgate::WsEngine engine(&srv, srv.GetEngineParams());
+        engine.SetTicketSecret(ticketSecret);
+        engine.Start();
+        wsgate::log::info << "Worker " << n << " listening on " << srv.GetEngineParams().bindaddr
+            << ":" << srv.GetEngineParams().port << endl;
+        while (!g_terminated) {
+            checkReload();
+            if (g_upgrade) {
+                engine.Drain();
+                if (0 == engine.Connections()) {
+                    break;
+                }
+            }
+            usleep(100000);
+        }
+        wsgate::log::info << "Worker " << n << " terminating" << endl;
+    } catch (exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        wsgate::log::err << e.what() << endl;
+        return -1;
+    }
+    return 0;
 }
 #endif
 
@@ -99,6 +248,9 @@ int _service_main (int argc, char **argv)
 int main (int argc, char **argv)
 #endif
 {
+#ifdef HAVE_SYS_EPOLL_H
+    wsgate::ListenSockets::Init();
+#endif
     wsgate::logger log("wsgate");
 
     // commandline options
@@ -109,7 +261,11 @@ int main (int argc, char **argv)
 #ifndef _WIN32
         ("foreground,f", "Run in foreground.")
 #endif
-        ("config,c", po::value<string>()->default_value(DEFAULTCFG), "Specify config file");
+        ("config,c", po::value<string>()->default_value(DEFAULTCFG), "Specify config file")
+#ifdef HAVE_SYS_EPOLL_H
+        ("worker", po::value<int>(), "Run as worker process (internal)")
+#endif
+        ;
 
     po::variables_map vm;
     try {
@@ -148,6 +304,16 @@ int main (int argc, char **argv)
     if (!srv.ReadConfig(&log)) {
         return -1;
     }
+#ifdef HAVE_SYS_EPOLL_H
+    if (vm.count("worker")) {
+        wsgate::RDP::GlobalInit();
+        int ret = runWorker(srv, vm["worker"].as<int>());
+        wsgate::RDP::GlobalUninit();
+        return ret;
+    }
+    // The workers are started after daemonizing, which changes the cwd.
+    const string workerConfig(boost::filesystem::absolute(srv.GetConfigFile()).string());
+#endif
 
     boost::property_tree::ptree pt = srv.GetConfig();
 
@@ -261,10 +427,15 @@ int main (int argc, char **argv)
     }
 #endif
 
+    wsgate::RDP::GlobalInit();
+
 #ifndef _WIN32
     g_srv = &srv;
     signal(SIGPIPE, SIG_IGN);
     signal(SIGHUP, reload);
+#ifdef HAVE_SYS_EPOLL_H
+    signal(SIGUSR2, upgrade);
+#endif
     if (srv.GetEnableCore()) {
         struct rlimit rlim;
         rlim.rlim_cur = rlim.rlim_max = RLIM_INFINITY;
@@ -277,9 +448,18 @@ int main (int argc, char **argv)
     signal(SIGTERM, terminate);
 
     wsgate::WsGate *psrv = NULL;
+#ifdef HAVE_SYS_EPOLL_H
+    wsgate::WsEngine *engine = NULL;
+    wsgate::Prefork *prefork = NULL;
+    pid_t successor = -1;
+#endif
     try {
         wsgate::log::info << "wsgate v" << VERSION << "." << GITREV << " starting" << endl;
+#ifdef HAVE_SYS_EPOLL_H
+        startServer(srv, oSP);
+#else
         srv.StartServer(oSP);
+#endif
         wsgate::log::info << "Listening on " << oSP["bindaddress"].GetCharString() << ":" << oSP["port"].GetInt() << endl;
 
         if (need2) {
@@ -298,18 +478,48 @@ int main (int argc, char **argv)
             psrv->SetSourceEHS(srv);
             wsgate::MyRawSocketHandler *psh = new wsgate::MyRawSocketHandler(psrv);
             psrv->SetRawSocketHandler(psh);
+#ifdef HAVE_SYS_EPOLL_H
+            startServer(*psrv, oSP);
+#else
             psrv->StartServer(oSP);
+#endif
 #ifndef _WIN32
             g_psrv = psrv;
 #endif
             wsgate::log::info << "Listening on " << oSP["bindaddress"].GetCharString() << ":" << oSP["port"].GetInt() << endl;
         }
+#ifdef HAVE_SYS_EPOLL_H
+        if (srv.GetEngineParams().enabled) {
+            if (0 < srv.GetEngineParams().workers) {
+                prefork = new wsgate::Prefork(workerConfig, srv.GetEngineParams().workers);
+                prefork->Start();
+                g_prefork = prefork;
+            } else {
+                engine = new wsgate::WsEngine(&srv, srv.GetEngineParams());
+                engine->Start();
+            }
+        }
+        // After a restart, the previous process may stop accepting now.
+        wsgate::ListenSockets::CloseUnused();
+        wsgate::ListenSockets::Ready();
+#endif
 
         if (daemon) {
 #ifdef _WIN32
             while (!(srv.ShouldTerminate() || (psrv && psrv->ShouldTerminate()) || wsgate::WsGateService::g_signaled)) {
 #else
             while (!(srv.ShouldTerminate() || (psrv && psrv->ShouldTerminate()))) {
+#endif
+#ifndef _WIN32
+                checkReload();
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+                if (NULL != prefork) {
+                    prefork->Check();
+                }
+                if (checkUpgrade(argv, successor)) {
+                    break;
+                }
 #endif
                 if (sleepInLoop) {
                     usleep(50000);
@@ -329,6 +539,17 @@ int main (int argc, char **argv)
             while (!(srv.ShouldTerminate() || (psrv && psrv->ShouldTerminate()) || kbd.qpressed()))
 #endif
             	{
+#ifndef _WIN32
+                checkReload();
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+                if (NULL != prefork) {
+                    prefork->Check();
+                }
+                if (checkUpgrade(argv, successor)) {
+                    break;
+                }
+#endif
                 if (sleepInLoop)
 					{
 						usleep(1000);
@@ -343,17 +564,63 @@ int main (int argc, char **argv)
 					}
             }
         }
+#ifdef HAVE_SYS_EPOLL_H
+        if (-1 != successor) {
+            // Free the ports for the new process, which also owns the
+            // pid file now. Then serve the remaining connections.
+            srv.SetPidFile("");
+            srv.StopServer();
+            if (NULL != psrv) {
+                psrv->StopServer();
+            }
+            const long timeout = srv.GetEngineParams().draintimeout;
+            const time_t start = time(NULL);
+            if (NULL != engine) {
+                engine->Drain();
+            }
+            if (NULL != prefork) {
+                prefork->Drain();
+            }
+            while (!g_terminated && ((0 == timeout) || (time(NULL) - start < timeout)) &&
+                    (((NULL != engine) && (0 < engine->Connections())) ||
+                     ((NULL != prefork) && prefork->Running()))) {
+                // Reap the new process, if it daemonizes.
+                waitpid(successor, NULL, WNOHANG);
+                usleep(100000);
+            }
+        }
+#endif
         wsgate::log::info << "terminating" << endl;
+#ifdef HAVE_SYS_EPOLL_H
+        g_prefork = NULL;
+        delete prefork;
+        prefork = NULL;
+        delete engine;
+        engine = NULL;
+        if (-1 == successor) {
+            srv.StopServer();
+            if (NULL != psrv) {
+                psrv->StopServer();
+            }
+        }
+#else
         srv.StopServer();
         if (NULL != psrv) {
             psrv->StopServer();
         }
+#endif
     } catch (exception &e) {
         cerr << "ERROR: " << e.what() << endl;
         wsgate::log::err << e.what() << endl;
     }
 
+#ifdef HAVE_SYS_EPOLL_H
+    g_prefork = NULL;
+    delete prefork;
+    delete engine;
+#endif
     delete psrv;
+    wsgate::RDP::GlobalUninit();
     return 0;
 }
 
@@ -7,9 +7,24 @@ namespace wspp{
                 m_endpoint->send(data, frame::opcode::TEXT);
             }
         }
-    void wshandler::send_binary(const std::string & data) {
+    void wshandler::send_binary(const std::string & data, bool compressible) {
         if (m_endpoint) {
-            m_endpoint->send(data, frame::opcode::BINARY);
+            m_endpoint->send(data, frame::opcode::BINARY, compressible);
+        }
+    }
+    void wshandler::send_binary(const buffer_list & slices, bool compressible) {
+        if (m_endpoint) {
+            m_endpoint->send(slices, frame::opcode::BINARY, compressible);
+        }
+    }
+    void wshandler::send_binary(const buffer_slice & slice, bool compressible) {
+        if (m_endpoint) {
+            m_endpoint->send(&slice, 1, frame::opcode::BINARY, compressible);
+        }
+    }
+    void wshandler::send_binary(const buffer_slice * slices, size_t count, bool compressible) {
+        if (m_endpoint) {
+            m_endpoint->send(slices, count, frame::opcode::BINARY, compressible);
         }
     }
 }
\ No newline at end of file
@@ -22,6 +22,8 @@
 
 #include <string>
 #include "wsgate.hpp"
+#include "wsbuffer.hpp"
+#include "wsarena.hpp"
 
 namespace wspp {
     class wsendpoint;
@@ -48,11 +50,48 @@ namespace wspp {
             /**
              * Send a binary message to the remote client.
              * @param data The payload to send.
+             * @param compressible false, if the payload is already compressed
+             *  and should not be deflated again.
              */
-            void send_binary(const std::string & data);
+            void send_binary(const std::string & data, bool compressible = true);
+
+            /**
+             * Send a binary message, assembled from multiple slices.
+             * This avoids concatenating a message header and a large
+             * payload into a temporary buffer before sending.
+             * @param slices The payload slices, forming a single message.
+             * @param compressible false, if the payload is already compressed
+             *  and should not be deflated again.
+             */
+            void send_binary(const buffer_list & slices, bool compressible = true);
+
+            /**
+             * Send a binary message, consisting of a single slice.
+             * @param slice The payload to send.
+             * @param compressible false, if the payload is already compressed
+             *  and should not be deflated again.
+             */
+            void send_binary(const buffer_slice & slice, bool compressible = true);
+
+            /**
+             * Send a binary message, assembled from an array of slices.
+             * @param slices Pointer to the first payload slice.
+             * @param count Number of slices.
+             * @param compressible false, if the payload is already compressed
+             *  and should not be deflated again.
+             */
+            void send_binary(const buffer_slice * slices, size_t count, bool compressible = true);
+
+            /**
+             * Retrieves the arena for serializing outgoing messages.
+             * The arena must only be used from the RDP session thread.
+             * It is reset after each message, sent by OpStream.
+             * @return The per-session arena.
+             */
+            arena & get_arena() { return m_arena; }
 
             /// Constructor
-            wshandler() : m_endpoint(0) {}
+            wshandler() : m_endpoint(0), m_arena() {}
 
             /// Destructor
             virtual ~wshandler() {}
@@ -70,6 +109,7 @@ namespace wspp {
             wshandler& operator=(const wspp::wshandler&);
 
             wsendpoint *m_endpoint;
+            arena m_arena;
             friend class wsendpoint;
     };
 
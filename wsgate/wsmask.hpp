@@ -0,0 +1,129 @@
+/* vim: set et ts=4 sw=4 cindent:
+ *
+ * FreeRDP-WebConnect,
+ * A gateway for seamless access to your RDP-Sessions in any HTML5-compliant browser.
+ *
+ * Copyright 2012 Fritz Elfert <wsgate@fritz-elfert.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WSMASK_H
+#define WSMASK_H
+
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+# define WSPP_MASK_SSE2 1
+# include <emmintrin.h>
+#endif
+
+// With GCC/clang on x86, an AVX2 kernel is compiled via the target attribute
+// and selected at runtime, so the binary still runs on older CPUs.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define WSPP_MASK_AVX2 1
+# include <immintrin.h>
+#endif
+
+namespace wspp {
+    namespace frame {
+        namespace detail {
+
+            inline size_t unmask_scalar(unsigned char *dst, const unsigned char *src,
+                    size_t len, uint32_t key) {
+                uint64_t key64 = (static_cast<uint64_t>(key) << 32) | key;
+                size_t i = 0;
+                for (; i + 8 <= len; i += 8) {
+                    uint64_t v;
+                    memcpy(&v, src + i, 8);
+                    v ^= key64;
+                    memcpy(dst + i, &v, 8);
+                }
+                return i;
+            }
+
+#ifdef WSPP_MASK_SSE2
+            inline size_t unmask_sse2(unsigned char *dst, const unsigned char *src,
+                    size_t len, uint32_t key) {
+                const __m128i k = _mm_set1_epi32(static_cast<int>(key));
+                size_t i = 0;
+                for (; i + 16 <= len; i += 16) {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(v, k));
+                }
+                return i;
+            }
+#endif
+
+#ifdef WSPP_MASK_AVX2
+            __attribute__((target("avx2")))
+            inline size_t unmask_avx2(unsigned char *dst, const unsigned char *src,
+                    size_t len, uint32_t key) {
+                const __m256i k = _mm256_set1_epi32(static_cast<int>(key));
+                size_t i = 0;
+                for (; i + 32 <= len; i += 32) {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_xor_si256(v, k));
+                }
+                return i;
+            }
+
+            inline bool have_avx2() {
+                static const bool ret = __builtin_cpu_supports("avx2");
+                return ret;
+            }
+#endif
+        }
+
+        /**
+         * Copies and unmasks a chunk of a masked payload (RFC6455, 5.3).
+         * The source and destination may be identical (in-place unmasking).
+         * Wide XOR kernels (256bit AVX2, 128bit SSE2, 64bit scalar) are used
+         * for the bulk of the data, the remainder is processed bytewise.
+         * @param dst Destination buffer.
+         * @param src Source buffer.
+         * @param len Number of bytes to process.
+         * @param key The 4 byte masking key from the frame header.
+         * @param offset Position of src[0] within the payload, which
+         *  determines the rotation of the masking key.
+         */
+        inline void unmask_copy(unsigned char *dst, const unsigned char *src,
+                size_t len, const char *key, uint64_t offset) {
+            unsigned char k[4];
+            for (int j = 0; j < 4; ++j) {
+                k[j] = static_cast<unsigned char>(key[(offset + j) % 4]);
+            }
+            uint32_t key32;
+            memcpy(&key32, k, 4);
+            // All kernels process multiples of 4 bytes, so the key stays aligned.
+            size_t i = 0;
+#ifdef WSPP_MASK_AVX2
+            if ((len >= 64) && detail::have_avx2()) {
+                i += detail::unmask_avx2(dst, src, len, key32);
+            }
+#endif
+#ifdef WSPP_MASK_SSE2
+            i += detail::unmask_sse2(dst + i, src + i, len - i, key32);
+#endif
+            i += detail::unmask_scalar(dst + i, src + i, len - i, key32);
+            for (; i < len; ++i) {
+                dst[i] = src[i] ^ k[i % 4];
+            }
+        }
+
+    }
+}
+
+#endif
@@ -10,6 +10,20 @@
 #define UTF8_VALIDATOR_HPP
 
 #include <stdint.h>
+#include <cstring>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+# define UTF8_VALIDATOR_SSE2 1
+# include <emmintrin.h>
+#endif
+
+// The vectorized multibyte check needs SSSE3 (pshufb, palignr). With GCC/clang
+// on x86 it is compiled via the target attribute and selected at runtime.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define UTF8_VALIDATOR_SSSE3 1
+# include <tmmintrin.h>
+#endif
 
 namespace utf8_validator {
 
@@ -99,15 +113,192 @@ class validator {
         uint32_t    m_codepoint;
 };
 
-// convenience function that creates a validator, validates a complete string 
-// and returns the result.
-// TODO: should this be inline?
-inline bool validate(const std::string& s) {
-    validator v;
-    if (!v.decode(s.begin(),s.end())) {
+namespace detail {
+
+    /**
+     * Scalar validation with an ASCII fast path.
+     * Whenever the DFA is in the accepting state, runs of 8 ASCII bytes
+     * are skipped with a single word test. Everything else goes through
+     * the DFA.
+     */
+    inline bool validate_scalar(const unsigned char *p, size_t len, uint32_t &state) {
+        uint32_t codep = 0;
+        size_t i = 0;
+        while (i < len) {
+            if (state == UTF8_ACCEPT) {
+                while (i + 8 <= len) {
+                    uint64_t w;
+                    memcpy(&w, p + i, 8);
+                    if (w & 0x8080808080808080ULL) {
+                        break;
+                    }
+                    i += 8;
+                }
+                if (i == len) {
+                    break;
+                }
+            }
+            if (decode(&state, &codep, p[i++]) == UTF8_REJECT) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+#ifdef UTF8_VALIDATOR_SSSE3
+    /*
+     * Vectorized validation after John Keiser and Daniel Lemire,
+     * "Validating UTF-8 In Less Than One Instruction Per Byte" (2021).
+     * Every byte pair is classified by three table lookups (high nibble
+     * of the previous byte, low nibble of the previous byte, high nibble
+     * of the current byte). The AND of the three lookups is non-zero for
+     * all invalid 2-byte sequences. 3- and 4-byte sequences are verified
+     * by checking, that continuation bytes appear exactly where a lead
+     * byte 2 or 3 positions earlier requires them.
+     */
+    static const uint8_t TOO_SHORT = 1 << 0;
+    static const uint8_t TOO_LONG = 1 << 1;
+    static const uint8_t OVERLONG_3 = 1 << 2;
+    static const uint8_t TOO_LARGE = 1 << 3;
+    static const uint8_t SURROGATE = 1 << 4;
+    static const uint8_t OVERLONG_2 = 1 << 5;
+    static const uint8_t TOO_LARGE_1000 = 1 << 6;
+    static const uint8_t OVERLONG_4 = 1 << 6;
+    static const uint8_t TWO_CONTS = 1 << 7;
+    static const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    __attribute__((target("ssse3")))
+    inline __m128i check_block(__m128i input, __m128i prev) {
+        const __m128i byte_1_high_tbl = _mm_setr_epi8(
+                TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+                TOO_SHORT | OVERLONG_2,
+                TOO_SHORT,
+                TOO_SHORT | OVERLONG_3 | SURROGATE,
+                static_cast<char>(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4));
+        const __m128i byte_1_low_tbl = _mm_setr_epi8(
+                static_cast<char>(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+                static_cast<char>(CARRY | OVERLONG_2),
+                static_cast<char>(CARRY),
+                static_cast<char>(CARRY),
+                static_cast<char>(CARRY | TOO_LARGE),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+                static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000));
+        const __m128i byte_2_high_tbl = _mm_setr_epi8(
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+                static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+                static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+                static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+        const __m128i nibble = _mm_set1_epi8(0x0F);
+
+        __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+        __m128i b1h = _mm_shuffle_epi8(byte_1_high_tbl, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+        __m128i b1l = _mm_shuffle_epi8(byte_1_low_tbl, _mm_and_si128(prev1, nibble));
+        __m128i b2h = _mm_shuffle_epi8(byte_2_high_tbl, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+        __m128i special = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+
+        __m128i prev2 = _mm_alignr_epi8(input, prev, 14);
+        __m128i prev3 = _mm_alignr_epi8(input, prev, 13);
+        // Only 111_____ (prev2) and 1111____ (prev3) end up >= 0x80
+        __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xe0 - 0x80)));
+        __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xf0 - 0x80)));
+        __m128i must23 = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(static_cast<char>(0x80)));
+        return _mm_xor_si128(must23, special);
+    }
+
+    __attribute__((target("ssse3")))
+    inline bool validate_ssse3(const unsigned char *p, size_t len) {
+        // Non-zero in the last 3 lanes, if a multibyte sequence is still open
+        const __m128i max_value = _mm_setr_epi8(
+                -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                static_cast<char>(0xf0 - 1), static_cast<char>(0xe0 - 1), static_cast<char>(0xc0 - 1));
+        __m128i error = _mm_setzero_si128();
+        __m128i prev = _mm_setzero_si128();
+        __m128i prev_incomplete = _mm_setzero_si128();
+        for (size_t i = 0; i <= len; i += 16) {
+            __m128i input;
+            if (i + 16 <= len) {
+                input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+            } else {
+                // Tail (zero padded) and finally an all-zero block, which
+                // flags any sequence left open at the end of the data.
+                unsigned char tail[16];
+                memset(tail, 0, sizeof(tail));
+                if (i < len) {
+                    memcpy(tail, p + i, len - i);
+                }
+                input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tail));
+            }
+            if (0 == _mm_movemask_epi8(input)) {
+                // ASCII fast path: Only check for an open sequence in the previous block.
+                error = _mm_or_si128(error, prev_incomplete);
+                prev = _mm_setzero_si128();
+                prev_incomplete = _mm_setzero_si128();
+            } else {
+                error = _mm_or_si128(error, check_block(input, prev));
+                prev_incomplete = _mm_subs_epu8(input, max_value);
+                prev = input;
+            }
+        }
+        error = _mm_or_si128(error, prev_incomplete);
+        return 0xFFFF == _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128()));
+    }
+
+    inline bool have_ssse3() {
+        static const bool ret = __builtin_cpu_supports("ssse3");
+        return ret;
+    }
+#endif
+
+}
+
+/**
+ * Validate a complete buffer of UTF-8 data.
+ * On x86 CPUs with SSSE3, a vectorized validator is used. Otherwise,
+ * ASCII runs are skipped (16 bytes at a time with SSE2, 8 bytes otherwise)
+ * and the remaining bytes are validated by the DFA.
+ * @param data The data to validate.
+ * @param len The length of the data.
+ * @return true, if the data is valid UTF-8.
+ */
+inline bool validate(const char *data, size_t len) {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+#ifdef UTF8_VALIDATOR_SSSE3
+    if ((len >= 16) && detail::have_ssse3()) {
+        return detail::validate_ssse3(p, len);
+    }
+#endif
+    size_t i = 0;
+#ifdef UTF8_VALIDATOR_SSE2
+    while ((i + 16 <= len) &&
+            (0 == _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i))))) {
+        i += 16;
+    }
+#endif
+    uint32_t state = UTF8_ACCEPT;
+    if (!detail::validate_scalar(p + i, len - i, state)) {
         return false;
     }
-    return v.complete();
+    return state == UTF8_ACCEPT;
+}
+
+// convenience function that validates a complete string 
+// and returns the result.
+inline bool validate(const std::string& s) {
+    return validate(s.data(), s.length());
 }
 
 } // namespace utf8_validator